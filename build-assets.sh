@@ -0,0 +1,197 @@
+#!/bin/bash -e
+
+# 构建网页静态资源：去重、背景图转码、内容指纹、预压缩
+# 用法：./build-assets.sh [源目录] [输出目录]
+# 输出目录只含页面与 assets，由 mk-rootfs.sh 覆盖到 rootfs 的 /www
+#
+# - 内容相同的资源只保留一份，未被页面或样式引用的资源不输出
+# - 背景图按屏幕宽度生成 AVIF/WebP（有 avifenc/cwebp 时），样式中用 image-set 回落到 PNG
+# - assets 下的文件名带内容哈希，lighttpd 对其下发一年且 immutable 的缓存头
+# - html/css/js/svg 生成 .gz 与 .br 同名文件，lighttpd 按 Accept-Encoding 直接发送
+
+SRC_DIR="${1:-overlay/www}"
+OUT_DIR="${2:-build/www}"
+# 背景图的小屏宽度与最大宽度
+BG_SMALL=720
+BG_MAX=1920
+
+if ! command -v brotli >/dev/null; then
+    echo "ERROR: brotli not found. Please install it (apt install brotli) and retry."
+    exit 1
+fi
+HAVE_CWEBP=0
+HAVE_AVIF=0
+command -v cwebp >/dev/null && HAVE_CWEBP=1
+command -v avifenc >/dev/null && command -v convert >/dev/null && HAVE_AVIF=1
+[ $HAVE_CWEBP = 1 ] || echo "Warning: cwebp not found, backgrounds stay PNG only."
+[ $HAVE_AVIF = 1 ] || echo "Warning: avifenc/convert not found, skipping AVIF."
+
+echo -e "\033[36m Building web assets: $SRC_DIR -> $OUT_DIR\033[0m"
+rm -rf "$OUT_DIR"
+mkdir -p "$OUT_DIR/assets"
+cp "$SRC_DIR"/*.html "$OUT_DIR/"
+for f in "$SRC_DIR"/assets/*.css; do
+    cp "$f" "$OUT_DIR/assets/"
+done
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+declare -A NAME_OF     # 资源原名 -> 带指纹的文件名
+declare -A BY_HASH     # 内容哈希 -> 带指纹的文件名
+declare -A IMAGE_SET   # 背景图指纹名 -> image-set 内容（大屏）
+declare -A IMAGE_SET_S # 背景图指纹名 -> image-set 内容（小屏）
+
+# 把资源复制为 名字.哈希.扩展名，内容相同的资源共用一个文件
+fingerprint() {
+    local src="$1" name="$2"
+    local hash base ext out
+    hash=$(sha256sum "$src" | cut -c1-10)
+    base="${name%.*}"
+    ext="${name##*.}"
+    if [ -n "${BY_HASH[$hash.$ext]}" ]; then
+        NAME_OF[$name]="${BY_HASH[$hash.$ext]}"
+        echo "  $name = ${BY_HASH[$hash.$ext]} (duplicate)"
+        return
+    fi
+    out="$base.$hash.$ext"
+    cp "$src" "$OUT_DIR/assets/$out"
+    BY_HASH[$hash.$ext]="$out"
+    NAME_OF[$name]="$out"
+    echo "  $name -> $out"
+}
+
+# 图片宽度 PNG 直接读文件头 其他格式需要 ImageMagick
+image_width() {
+    if command -v identify >/dev/null; then
+        identify -format '%w' "$1"
+    elif [ "$(od -An -c -j1 -N3 "$1" | tr -d ' ')" = "PNG" ]; then
+        od -An -tu1 -j16 -N4 "$1" | awk '{ print $1 * 16777216 + $2 * 65536 + $3 * 256 + $4 }'
+    else
+        echo 0
+    fi
+}
+
+# 为背景图生成各宽度的 AVIF/WebP，并记录 image-set 的写法
+transcode() {
+    local fp="$1" src="$OUT_DIR/assets/$1"
+    local stem="${fp%.*}" ext="${fp##*.}" width w suffix set resize
+    local full="" small=""
+    width=$(image_width "$src")
+    [ "$width" -gt 0 ] || width=$BG_MAX
+    [ "$width" -gt "$BG_MAX" ] && width=$BG_MAX
+    for w in "$width" "$BG_SMALL"; do
+        [ "$w" -gt "$width" ] && continue
+        suffix=""
+        [ "$w" != "$width" ] && suffix="-$w"
+        set=""
+        if [ $HAVE_AVIF = 1 ]; then
+            convert "$src" -resize "${w}x>" "$WORK/bg.png"
+            avifenc --min 20 --max 32 -s 4 "$WORK/bg.png" "$OUT_DIR/assets/$stem$suffix.avif" >/dev/null
+            set="$set url('/assets/$stem$suffix.avif') type('image/avif'),"
+        fi
+        if [ $HAVE_CWEBP = 1 ]; then
+            resize=""
+            [ "$w" != "$(image_width "$src")" ] && resize="-resize $w 0"
+            cwebp -quiet -q 80 $resize "$src" -o "$OUT_DIR/assets/$stem$suffix.webp"
+            set="$set url('/assets/$stem$suffix.webp') type('image/webp'),"
+        fi
+        [ -z "$set" ] && continue
+        set="${set# } url('/assets/$fp') type('image/$ext')"
+        if [ -z "$suffix" ]; then
+            full="$set"
+        else
+            small="$set"
+        fi
+    done
+    IMAGE_SET[$fp]="$full"
+    IMAGE_SET_S[$fp]="$small"
+}
+
+# === 1. 样式引用的背景图：去重并转码 ===
+echo "Backgrounds:"
+for name in $(grep -ho "url([^)]*)" "$OUT_DIR"/assets/*.css | sed -E "s/url\(['\"]?//; s/['\"]?\)$//" | xargs -n1 basename | sort -u); do
+    [ -f "$SRC_DIR/assets/$name" ] || continue
+    [ -n "${NAME_OF[$name]}" ] && continue
+    fingerprint "$SRC_DIR/assets/$name" "$name"
+    fp="${NAME_OF[$name]}"
+    [ -n "${IMAGE_SET[$fp]+x}" ] || transcode "$fp"
+done
+
+# === 2. 改写样式中的 url()：换成指纹名，并追加 image-set 与小屏规则 ===
+for css in "$OUT_DIR"/assets/*.css; do
+    rules=""
+    for name in "${!NAME_OF[@]}"; do
+        rules="$rules$name=${NAME_OF[$name]}=${IMAGE_SET[${NAME_OF[$name]}]}=${IMAGE_SET_S[${NAME_OF[$name]}]}"$'\n'
+    done
+    RULES="$rules" awk '
+        BEGIN {
+            n = split(ENVIRON["RULES"], lines, "\n")
+            for (i = 1; i <= n; i++) {
+                if (split(lines[i], f, "=") < 2) continue
+                fp[f[1]] = f[2]; big[f[1]] = f[3]; small[f[1]] = f[4]
+            }
+        }
+        /\{/ { sel = $0; sub(/[ \t]*\{.*/, "", sel); sub(/^[ \t]*/, "", sel) }
+        {
+            line = $0
+            if (match(line, /url\([^)]*\)/)) {
+                ref = substr(line, RSTART + 4, RLENGTH - 5)
+                gsub(/["\047]/, "", ref)
+                sub(/.*\//, "", ref)
+                if (ref in fp) {
+                    line = substr(line, 1, RSTART - 1) "url(\047/assets/" fp[ref] "\047)" substr(line, RSTART + RLENGTH)
+                    print line
+                    indent = line; sub(/[^ \t].*/, "", indent)
+                    if (big[ref] != "") print indent "background-image: image-set(" big[ref] ");"
+                    if (small[ref] != "") media = media "  " sel " { background-image: image-set(" small[ref] "); }\n"
+                    next
+                }
+            }
+            print line
+        }
+        END { if (media != "") printf "\n@media (max-width: %dpx) {\n%s}\n", '"$BG_SMALL"', media }
+    ' "$css" > "$WORK/out.css"
+    mv "$WORK/out.css" "$css"
+done
+
+# === 3. 样式与图标加指纹 ===
+echo "Stylesheets and icons:"
+REFS=$(grep -ho "/assets/[A-Za-z0-9_.-]*\.\(css\|js\|svg\)" "$OUT_DIR"/*.html | sort -u)
+for ref in $REFS; do
+    name="${ref#/assets/}"
+    if [ -f "$OUT_DIR/assets/$name" ]; then
+        src="$OUT_DIR/assets/$name"
+    elif [ -f "$SRC_DIR/assets/$name" ]; then
+        src="$SRC_DIR/assets/$name"
+    else
+        echo "Warning: $ref referenced but not found."
+        continue
+    fi
+    fingerprint "$src" "$name"
+done
+# 未加指纹的样式原件不再需要
+for css in "$SRC_DIR"/assets/*.css; do
+    rm -f "$OUT_DIR/assets/$(basename "$css")"
+done
+for f in "$SRC_DIR"/assets/*; do
+    name=$(basename "$f")
+    [ -n "${NAME_OF[$name]}" ] || echo "  $name skipped (not referenced)"
+done
+
+# === 4. 改写页面中的资源路径 ===
+for html in "$OUT_DIR"/*.html; do
+    for name in "${!NAME_OF[@]}"; do
+        sed -i "s#/assets/${name//./\\.}\([\"'#? ]\)#/assets/${NAME_OF[$name]}\1#g" "$html"
+    done
+done
+
+# === 5. 文本资源预压缩 ===
+echo "Compressing..."
+find "$OUT_DIR" -type f \( -name '*.html' -o -name '*.css' -o -name '*.js' -o -name '*.svg' \) | while read -r f; do
+    gzip -9 -n -k -f "$f"
+    brotli -q 11 -k -f "$f"
+done
+
+du -sh "$SRC_DIR/assets" "$OUT_DIR/assets" | sed 's/^/  /'
+echo -e "\033[32m Web assets built.\033[0m"
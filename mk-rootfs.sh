@@ -71,6 +71,12 @@ if [ -d overlay ]; then
     echo "Applying overlay..."
     sudo cp -rfp overlay/* "${chroot_dir}/" || true
 fi
+# === 构建网页静态资源（去重、转码、指纹、预压缩），替换原始页面与资源 ===
+echo "Building web assets..."
+./build-assets.sh overlay/www build/www
+sudo rm -rf "${chroot_dir}/www/assets"
+sudo rm -f "${chroot_dir}"/www/*.html
+sudo cp -rf build/www/* "${chroot_dir}/www/"
 # === 允许 nobody 无密码执行 nmcli Wi-Fi 连接 ===
 echo "Configuring sudoers for 'nobody' Wi-Fi access..."
 sudo mkdir -p "${chroot_dir}/etc/sudoers.d"
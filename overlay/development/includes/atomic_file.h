@@ -0,0 +1,24 @@
+#ifndef ATOMIC_FILE_H
+#define ATOMIC_FILE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// 提交时同时 fsync 所在目录，断电后 rename 也不会丢失
+#define ATOMIC_FILE_SYNC_DIR 0x1
+
+struct atomic_file {
+    FILE *fp;
+    int flags;
+    char path[512];
+    char tmp_path[512];
+};
+
+// 写到同目录临时文件 提交时 fsync 后 rename 覆盖目标
+// 读者看到的要么是旧文件 要么是完整的新文件 因此无需加锁
+FILE *atomic_file_open(struct atomic_file *af, const char *path, mode_t mode, int flags);
+int atomic_file_commit(struct atomic_file *af);
+void atomic_file_abort(struct atomic_file *af);
+int atomic_write_file(const char *path, const void *data, size_t len, mode_t mode, int flags);
+#endif
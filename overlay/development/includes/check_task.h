@@ -1,4 +1,4 @@
 #ifndef CHECK_TASK_H
 #define CHECK_TASK_H
-void *check_task_thread(void *arg);
+int check_task_start(void);
 #endif
\ No newline at end of file
@@ -17,10 +17,17 @@
 #define CMD_LEN         (sizeof(CMD) - 1)
 #define BUFFER_SIZE     256
 #define OUTPUT_FILE     "/development/tmp/temperature.json"
-#define INTERVAL_SEC    10
+#define INTERVAL_SEC    10     // JSON 导出间隔与历史原始层分辨率（秒）
+#define TEMP_SAMPLE_MS              10000  // 采样周期（毫秒） 可调到 1000 每秒一次
+#define TEMP_RESPONSE_TIMEOUT_MS    1500   // 等待应答超时
+#define TEMP_RETRY_BASE_MS          250    // 超时后首次重试间隔 之后逐次翻倍
+#define TEMP_RETRY_MAX_MS           8000   // 重试间隔上限
+#define TEMP_REOPEN_FAILURES        5      // 连续失败该次数后重新打开串口
 // voice.h
 #define VOICE_SERIAL_DEVICE    "/dev/voice_module"
 #define VOICE_BAUDRATE         B9600
+#define VOICE_MAX_RETRY        15      // 串口打开最多重试次数
+#define VOICE_RETRY_DELAY_SEC  2       // 重试间隔（秒）
 // zigbee_mq.h
 #define ZIGBEE_CMD_LIGHT_ON     "L1"
 #define ZIGBEE_CMD_LIGHT_OFF    "L0"
@@ -41,4 +48,69 @@
 #define DEVICE_STATE_FILE "/development/tmp/device_state.txt"
 #define MAX_RETRY 10
 #define RETRY_DELAY_SEC 2
+#define ZIGBEE_CMD_GAP_MS 10   // 相邻两条命令写串口的最小间隔
+// ipc_owner.h
+#define IPC_OWNER_USER         "nobody"  // CGI 运行用户 与 lighttpd 的 server.username 一致
+#define IPC_OWNER_MODE         0600
+// session_store.h
+#define SESSION_SHM_NAME       "/web_sessions"
+#define SESSION_KEY_MAX        64
+#define SESSION_USER_MAX       63
+#define SESSION_SECRET_LEN     32      // 令牌 HMAC 密钥长度
+#define SESSION_TABLE_SIZE     256     // 必须为 2 的幂
+#define SESSION_MAX_LIVE       192     // 超过后淘汰最早过期的会话
+#define SESSION_SWEEP_INTERVAL 60
+// session_token.h
+// 令牌格式：16 位随机数 + 8 位到期时间 + 40 位 HMAC 标签（均为十六进制）
+#define TOKEN_NONCE_HEX        16
+#define TOKEN_EXPIRY_HEX       8
+#define TOKEN_TAG_HEX          40
+#define TOKEN_SIGNED_HEX       (TOKEN_NONCE_HEX + TOKEN_EXPIRY_HEX)
+#define TOKEN_LEN              (TOKEN_SIGNED_HEX + TOKEN_TAG_HEX)
+#define TOKEN_MAX_AGE          (7 * 86400)   // 令牌签名内的绝对有效期
+// disk_index.h
+#define DISK_INDEX_ROOT        "/mnt/ssd"
+#define DISK_INDEX_FILE        "/development/tmp/disk.index"
+#define DISK_INDEX_DEBOUNCE_MS 1000    // 事件静默该时长后落盘
+#define DISK_INDEX_MAX_DELAY   5       // 持续有事件时最长落盘间隔（秒）
+#define DISK_INDEX_RETRY       60      // 根目录未挂载时的重试间隔（秒）
+#define DISK_INDEX_RECONCILE   3600    // 全量 nftw 校正累计大小的间隔（秒）
+// disk_jobs.h
+#define DISK_JOBS_SHM_NAME     "/web_disk_jobs"
+#define DISK_JOBS_MQ_NAME      "/disk_jobs"
+#define DISK_JOBS_MQ_MAX       10
+#define DISK_JOBS_MAX          32      // 任务表槽位数
+#define DISK_JOBS_PATH_MAX     1024
+#define DISK_JOBS_ID_LEN       16
+#define DISK_JOBS_MAX_DEPTH    128     // 递归深度上限 防止耗尽文件描述符
+// photo_index.h
+#define PHOTO_INDEX_DIR        "/media/sdcard/photos"
+#define PHOTO_INDEX_FILE       "/development/tmp/photos.index"
+#define PHOTO_INDEX_NOTE_MAX   4096    // 备注超出部分不进索引
+#define PHOTO_INDEX_DEBOUNCE_MS 2000   // 事件静默该时长后重建
+#define PHOTO_INDEX_RESCAN     3600    // 无事件时的全量校验间隔（秒）
+#define PHOTO_INDEX_RETRY      60      // 存储卡未挂载时的重试间隔（秒）
+// events.h
+#define EVENTS_SOCKET          "/tmp/events.sock"
+#define EVENTS_MAX_CLIENTS     32
+#define EVENTS_HEADER_MAX      8192
+#define EVENTS_HEARTBEAT       25      // 心跳与会话复核间隔（秒）
+#define EVENTS_SYSTEM_INTERVAL 10      // 有订阅者时系统指标的采样间隔（秒）
+#define EVENTS_PENDING_MAX     8       // 请求头尚未读完的连接上限
+#define EVENTS_HEADER_TIMEOUT  2       // 读取 SCGI 请求头的时限（秒）
+// state_shm.h
+#define STATE_SHM_NAME         "/web_state"
+#define STATE_EXPORT_JSON      1       // 为 0 时温湿度与天气只写共享内存，不再导出 JSON 文件
+#define STATE_READ_RETRY       1000    // 读者遇到并发写入时的重试上限
+// temp_history.h
+#define TEMP_HISTORY_FILE      "/development/tmp/temperature.history"
+#define TEMP_HISTORY_RAW_DAYS  30      // 原始读数（INTERVAL_SEC 分辨率）保留天数
+#define TEMP_HISTORY_MIN_DAYS  90      // 分钟汇总保留天数
+#define TEMP_HISTORY_HOUR_DAYS 1825    // 小时汇总保留天数
+#define TEMP_HISTORY_MAX_POINTS 5000   // 单次查询最多返回的点数
+#define TEMP_HISTORY_DEFAULT_POINTS 720 // 未指定 step 时按此点数自动选择
+// reactor.h
+#define REACTOR_MAX_EVENTS     16      // 每次 epoll_wait 取回的事件数
+#define REACTOR_WORKERS        2       // 执行阻塞工作的线程数
+#define REACTOR_QUEUE_MAX      32      // 待执行任务上限
 #endif
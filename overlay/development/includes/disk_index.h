@@ -0,0 +1,55 @@
+#ifndef DISK_INDEX_H
+#define DISK_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "define.h"
+
+#define DISK_INDEX_MAGIC   0x58445959u
+#define DISK_INDEX_VERSION 2
+#define DISK_INDEX_DIR     0x1u
+
+// 索引文件头 其后依次为条目数组与路径字符串区
+struct disk_index_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t names_size;
+    int64_t built_at;
+    int64_t root_mtime_ns;
+    uint64_t root_size;
+    uint64_t root_usage;
+    uint64_t root_files;
+};
+
+// 条目按 (父目录, 名字) 字节序排列 同一目录的子项连续存放
+// 目录的 size/usage/files 为整棵子树的累计值 usage 为实际占用的块字节数
+struct disk_index_entry {
+    uint64_t size;
+    uint64_t usage;
+    int64_t mtime_ns;
+    uint32_t path_off;
+    uint16_t path_len;
+    uint16_t parent_len;
+    uint32_t flags;
+    uint32_t files;
+};
+
+typedef struct {
+    void *map;
+    size_t map_size;
+    const struct disk_index_header *hdr;
+    const struct disk_index_entry *entries;
+    const char *names;
+} disk_index_t;
+
+int disk_index_key_cmp(const char *pa, size_t pa_len, const char *na,
+                       const char *pb, size_t pb_len, const char *nb);
+int disk_index_open(disk_index_t *idx, const char *file);
+void disk_index_close(disk_index_t *idx);
+const char *disk_index_path(const disk_index_t *idx, const struct disk_index_entry *e);
+const char *disk_index_name(const disk_index_t *idx, const struct disk_index_entry *e);
+int disk_index_children(const disk_index_t *idx, const char *dir, size_t *first, size_t *count);
+const struct disk_index_entry *disk_index_lookup(const disk_index_t *idx, const char *path);
+int disk_index_dir_mtime(const disk_index_t *idx, const char *dir, int64_t *mtime_ns);
+#endif
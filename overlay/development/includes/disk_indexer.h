@@ -0,0 +1,7 @@
+#ifndef DISK_INDEXER_H
+#define DISK_INDEXER_H
+
+#include "disk_index.h"
+
+void *disk_index_thread(void *arg);
+#endif
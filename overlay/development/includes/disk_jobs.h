@@ -0,0 +1,44 @@
+#ifndef DISK_JOBS_H
+#define DISK_JOBS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "define.h"
+
+enum disk_job_op {
+    DISK_JOB_DELETE = 1,
+    DISK_JOB_MOVE,
+    DISK_JOB_COPY
+};
+
+enum disk_job_state {
+    DISK_JOB_FREE = 0,
+    DISK_JOB_QUEUED,
+    DISK_JOB_RUNNING,
+    DISK_JOB_DONE,
+    DISK_JOB_FAILED
+};
+
+// 路径均相对 DISK_INDEX_ROOT 进度计数由守护进程原子更新
+struct disk_job {
+    char id[DISK_JOBS_ID_LEN + 1];
+    uint32_t op;
+    uint32_t state;
+    int32_t error;
+    char src[DISK_JOBS_PATH_MAX];
+    char dst[DISK_JOBS_PATH_MAX];
+    uint64_t entries;
+    uint64_t bytes;
+    uint64_t total_bytes;
+    int64_t created;
+    int64_t finished;
+};
+
+int disk_job_submit(enum disk_job_op op, const char *src, const char *dst, char *id, size_t id_size);
+int disk_job_get(const char *id, struct disk_job *out);
+const char *disk_job_op_name(uint32_t op);
+const char *disk_job_state_name(uint32_t state);
+struct disk_job *disk_job_begin(int slot);
+void disk_job_finish(struct disk_job *job, int error);
+void disk_job_recover(void);
+#endif
@@ -0,0 +1,5 @@
+#ifndef DISK_WORKER_H
+#define DISK_WORKER_H
+
+void *disk_worker_thread(void *arg);
+#endif
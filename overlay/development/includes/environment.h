@@ -4,5 +4,5 @@ struct MemoryStruct {
     char *memory;
     size_t size;
 };
-void *environment_thread(void *arg);
+int environment_start(void);
 #endif
\ No newline at end of file
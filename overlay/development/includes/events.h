@@ -0,0 +1,20 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <json-c/json.h>
+#include "define.h"
+
+// 推送主题 浏览器通过 /home/events?topics=a,b 订阅
+enum event_topic {
+    EVENT_TEMPERATURE = 0,
+    EVENT_WEATHER,
+    EVENT_DEVICES,
+    EVENT_SYSTEM,
+    EVENT_TOPIC_COUNT
+};
+
+void events_publish(enum event_topic topic, const char *json);
+void events_publish_json(enum event_topic topic, json_object *obj);
+void events_publish_devices(void);
+void *events_thread(void *arg);
+#endif
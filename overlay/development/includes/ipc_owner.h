@@ -0,0 +1,9 @@
+#ifndef IPC_OWNER_H
+#define IPC_OWNER_H
+
+#include <sys/types.h>
+#include "define.h"
+
+int ipc_owner_lookup(uid_t *uid, gid_t *gid);
+int ipc_owner_secure(int fd, mode_t mode);
+#endif
@@ -0,0 +1,56 @@
+#ifndef PHOTO_INDEX_H
+#define PHOTO_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "define.h"
+
+#define PHOTO_INDEX_MAGIC     0x58444950u
+#define PHOTO_INDEX_VERSION   1
+#define PHOTO_INDEX_EXIF_TIME 0x1u     // taken 取自 EXIF 否则为文件修改时间
+
+// 索引文件头 其后依次为条目数组与字符串区
+struct photo_index_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t strings_size;
+    int64_t built_at;
+    int64_t dir_mtime_ns;
+};
+
+// 条目按 (拍摄时间, 名字) 排序 拍摄时间为不带时区的本地时间 按 UTC 换算成秒
+// 宽高已按 EXIF 方向换算为显示尺寸 备注为同名 .txt 文件的内容 没有时长度为 0
+struct photo_index_entry {
+    int64_t taken;
+    int64_t mtime_ns;
+    int64_t note_mtime_ns;
+    uint64_t size;
+    uint32_t name_off;
+    uint32_t name_len;
+    uint32_t note_off;
+    uint32_t note_len;
+    uint32_t width;
+    uint32_t height;
+    uint16_t orientation;
+    uint16_t flags;
+    uint32_t reserved;
+};
+
+typedef struct {
+    void *map;
+    size_t map_size;
+    const struct photo_index_header *hdr;
+    const struct photo_index_entry *entries;
+    const char *strings;
+} photo_index_t;
+
+int photo_index_open(photo_index_t *idx, const char *file);
+void photo_index_close(photo_index_t *idx);
+int photo_index_fresh(const photo_index_t *idx, const char *dir);
+const char *photo_index_name(const photo_index_t *idx, const struct photo_index_entry *e);
+const char *photo_index_note(const photo_index_t *idx, const struct photo_index_entry *e);
+void photo_index_range(const photo_index_t *idx, int64_t from, int64_t to, size_t *first, size_t *last);
+int photo_index_rebuild(const char *dir, const char *file);
+int photo_exif_orientation(const unsigned char *data, size_t len);
+#endif
@@ -0,0 +1,7 @@
+#ifndef PHOTO_SCANNER_H
+#define PHOTO_SCANNER_H
+
+#include "photo_index.h"
+
+void *photo_index_thread(void *arg);
+#endif
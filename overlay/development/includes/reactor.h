@@ -0,0 +1,24 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+#include "define.h"
+
+struct reactor_timer;
+
+typedef void (*reactor_fd_cb)(int fd, uint32_t events, void *arg);
+typedef void (*reactor_timer_cb)(void *arg);
+typedef void (*reactor_job_fn)(void *arg);
+
+// 除 reactor_submit 外 均只能在事件循环线程或 reactor_run 之前调用
+int reactor_init(void);
+int reactor_add_fd(int fd, uint32_t events, reactor_fd_cb cb, void *arg);
+int reactor_mod_fd(int fd, uint32_t events);
+void reactor_del_fd(int fd);
+struct reactor_timer *reactor_timer_new(reactor_timer_cb cb, void *arg);
+void reactor_timer_set(struct reactor_timer *t, int first_ms, int period_ms);
+int reactor_submit(reactor_job_fn fn, void *arg);
+int reactor_spawn(char *const argv[]);
+int reactor_run(void);
+#endif
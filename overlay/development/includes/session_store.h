@@ -0,0 +1,17 @@
+#ifndef SESSION_STORE_H
+#define SESSION_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include "define.h"
+
+int session_store_add(const char *token, const char *user, long ttl_seconds);
+int session_store_touch(const char *token, long ttl_seconds, char *user, size_t user_size);
+int session_store_peek(const char *token, char *user, size_t user_size);
+void session_store_remove(const char *token);
+void session_store_clear(void);
+int session_store_secret(unsigned char *key, size_t len, uint32_t *gen);
+uint32_t session_store_secret_gen(void);
+int session_store_sweep(void);
+#endif
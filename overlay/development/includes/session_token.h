@@ -0,0 +1,8 @@
+#ifndef SESSION_TOKEN_H
+#define SESSION_TOKEN_H
+
+#include "define.h"
+
+int session_token_tag(const char *signed_part, char tag[TOKEN_TAG_HEX]);
+int session_token_verify(const char *token);
+#endif
@@ -0,0 +1,22 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_BLOCK_SIZE 64
+#define SHA256_DIGEST_SIZE 32
+
+typedef struct{
+    uint32_t state[8];
+    uint64_t bits;
+    unsigned char buf[SHA256_BLOCK_SIZE];
+    size_t used;
+}sha256_ctx_t;
+
+void sha256_init(sha256_ctx_t*c);
+void sha256_update(sha256_ctx_t*c,const void*data,size_t len);
+void sha256_final(sha256_ctx_t*c,unsigned char out[SHA256_DIGEST_SIZE]);
+void hmac_sha256(const unsigned char*key,size_t key_len,const void*msg,size_t msg_len,unsigned char out[SHA256_DIGEST_SIZE]);
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef STATE_SHM_H
+#define STATE_SHM_H
+
+#include <stdint.h>
+#include <json-c/json.h>
+#include "define.h"
+#include "weather.h"
+
+struct state_temperature {
+    float temperature;
+    float humidity;
+    int64_t timestamp;
+};
+
+struct state_devices {
+    uint8_t light;
+    uint8_t fan;
+    uint8_t aircon;
+    uint8_t washing;
+    uint8_t door;
+    uint8_t wifi;
+};
+
+// 分区的更新序号与写入时间 用于 ETag 与 Last-Modified
+struct state_meta {
+    uint64_t version;
+    int64_t updated;
+};
+
+// 读取函数返回 0 表示成功 分区尚未写入或共享内存不可用时返回 -1
+int state_shm_write_temperature(const struct state_temperature *t);
+int state_shm_write_weather(const WeatherData *wd);
+int state_shm_write_devices(const struct state_devices *d);
+int state_shm_read_temperature(struct state_temperature *out, struct state_meta *meta);
+int state_shm_read_weather(WeatherData *out, struct state_meta *meta);
+int state_shm_read_devices(struct state_devices *out, struct state_meta *meta);
+json_object *state_temperature_to_json(const struct state_temperature *t);
+#endif
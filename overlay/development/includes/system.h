@@ -1,6 +1,8 @@
 #ifndef SYSTEM_H
 #define SYSTEM_H
 
+#include <json-c/json.h>
+
 typedef struct{
     double load_percent;
     long uptime_minutes;
@@ -15,5 +17,6 @@ typedef struct{
 }system_info_t;
 
 int collect_system_info(system_info_t*info);
+json_object*system_info_to_json(const system_info_t*info);
 
 #endif
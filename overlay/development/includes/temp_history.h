@@ -0,0 +1,39 @@
+#ifndef TEMP_HISTORY_H
+#define TEMP_HISTORY_H
+
+#include <stdint.h>
+#include "define.h"
+
+// 汇总层级 由细到粗
+enum temp_history_tier {
+    TEMP_HISTORY_RAW = 0,
+    TEMP_HISTORY_MINUTE,
+    TEMP_HISTORY_HOUR,
+    TEMP_HISTORY_TIER_COUNT
+};
+
+// 查询结果中的一个点 覆盖 [ts, ts + step)
+struct temp_history_point {
+    int64_t ts;
+    uint32_t count;
+    float temp_min;
+    float temp_avg;
+    float temp_max;
+    float hum_min;
+    float hum_avg;
+    float hum_max;
+};
+
+typedef int (*temp_history_cb)(const struct temp_history_point *p, void *arg);
+
+struct temp_history_range {
+    int64_t from;
+    int64_t to;
+    int64_t step;
+    int64_t resolution;
+};
+
+int temp_history_append(int64_t ts, float temperature, float humidity);
+int temp_history_plan(struct temp_history_range *r);
+int temp_history_query(const struct temp_history_range *r, temp_history_cb cb, void *arg);
+#endif
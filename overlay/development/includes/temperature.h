@@ -1,4 +1,4 @@
 #ifndef TEMPERATURE_H
 #define TEMPERATURE_H
-void* temperature_thread(void *arg);
+int temperature_start(void);
 #endif
\ No newline at end of file
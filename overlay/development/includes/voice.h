@@ -1,4 +1,4 @@
 #ifndef VOICE_H
 #define VOICE_H
-void* voice_thread(void* arg);
+int voice_start(void);
 #endif
\ No newline at end of file
@@ -1,6 +1,8 @@
 #ifndef WEATHER_H
 #define WEATHER_H
 
+#include <json-c/json.h>
+
 typedef struct{
     char code[16];
     char weather[64];
@@ -13,5 +15,6 @@ typedef struct{
 }WeatherData;
 
 int parse_weather_json(const char*json_str,WeatherData*out);
+json_object*weather_data_to_json(const WeatherData*wd);
 
 #endif
@@ -1,16 +1,22 @@
 #ifndef ZIGBEE_MQ_H
 #define ZIGBEE_MQ_H
 
+#include <sys/types.h>
 #include "define.h"
 
 int init_zigbee_mq(void);
 int send_zigbee_command(const char* cmd);
 int cgi_send_zigbee_cmd(const char* cmd);
-void* zigbee_thread(void* arg);
+void zigbee_set_state_saver(void (*fn)(void));
+void zigbee_save_state(void);
 // 状态查询 CGI 使用
 int get_light_state(void);
 int get_fan_state(void);
 int get_aircon_state(void);
 int get_washing_state(void);
 int get_door_state(void);
+void get_device_states(int* light, int* fan, int* aircon, int* washing, int* door, int* wifi);
+// 守护进程从队列取命令转发到串口
+int zigbee_mq_fd(void);
+ssize_t zigbee_mq_receive(char* buf, size_t size);
 #endif
\ No newline at end of file
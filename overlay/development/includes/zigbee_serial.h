@@ -0,0 +1,6 @@
+#ifndef ZIGBEE_SERIAL_H
+#define ZIGBEE_SERIAL_H
+int zigbee_serial_start(void);
+// 设备状态变化通知 守护进程用于推送
+void zigbee_set_state_listener(void (*fn)(void));
+#endif
@@ -0,0 +1,127 @@
+/**********************************************************************
+ * @file atomic_file.c
+ * @brief 缓存文件原子发布实现
+ *
+ * 本文件实现守护进程与 CGI 共用的文件写入辅助函数：内容先写入目标
+ * 同目录下的临时文件，fsync 后 rename 覆盖目标，可选再 fsync 目录。
+ * rename 在同一文件系统内是原子的，读者打开到的总是完整文件。
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ *
+ * @note
+ * - 临时文件名为 .目标名.XXXXXX，多个进程同时写同一目标互不干扰，
+ *   最后一次 rename 生效。
+ * - 目标已存在时沿用其权限位，否则使用调用方给出的权限。
+ * - 失败时删除临时文件，目标保持原样。
+ **********************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include "atomic_file.h"
+
+// 取 path 所在目录
+static void dir_of(const char *path, char *out, size_t size) {
+    char buf[512];
+
+    snprintf(buf, sizeof(buf), "%s", path);
+    snprintf(out, size, "%s", dirname(buf));
+}
+
+// fsync 目录 使 rename 落盘
+static void sync_dir(const char *path) {
+    char dir[512];
+    int fd;
+
+    dir_of(path, dir, sizeof(dir));
+    fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        fsync(fd);
+        close(fd);
+    }
+}
+
+// 打开临时文件 写完后调用 atomic_file_commit 或 atomic_file_abort
+FILE *atomic_file_open(struct atomic_file *af, const char *path, mode_t mode, int flags) {
+    char dir[512];
+    char base[512];
+    struct stat st;
+    int fd;
+
+    af->fp = NULL;
+    af->flags = flags;
+    snprintf(af->path, sizeof(af->path), "%s", path);
+    dir_of(path, dir, sizeof(dir));
+    snprintf(base, sizeof(base), "%s", path);
+    if ((size_t)snprintf(af->tmp_path, sizeof(af->tmp_path), "%s/.%s.XXXXXX", dir, basename(base)) >= sizeof(af->tmp_path)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    fd = mkostemp(af->tmp_path, O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (stat(path, &st) == 0) {
+        mode = st.st_mode & 07777;
+    }
+    fchmod(fd, mode);
+    af->fp = fdopen(fd, "w");
+    if (!af->fp) {
+        close(fd);
+        unlink(af->tmp_path);
+        return NULL;
+    }
+    return af->fp;
+}
+
+// 刷新并 fsync 临时文件 再 rename 到目标
+int atomic_file_commit(struct atomic_file *af) {
+    int ok;
+
+    if (!af->fp) {
+        return -1;
+    }
+    ok = !ferror(af->fp) && fflush(af->fp) == 0 && fsync(fileno(af->fp)) == 0;
+    if (fclose(af->fp) != 0) {
+        ok = 0;
+    }
+    af->fp = NULL;
+    if (!ok || rename(af->tmp_path, af->path) != 0) {
+        unlink(af->tmp_path);
+        return -1;
+    }
+    if (af->flags & ATOMIC_FILE_SYNC_DIR) {
+        sync_dir(af->path);
+    }
+    return 0;
+}
+
+// 放弃写入 删除临时文件
+void atomic_file_abort(struct atomic_file *af) {
+    if (af->fp) {
+        fclose(af->fp);
+        af->fp = NULL;
+        unlink(af->tmp_path);
+    }
+}
+
+// 一次写入整块内容
+int atomic_write_file(const char *path, const void *data, size_t len, mode_t mode, int flags) {
+    struct atomic_file af;
+
+    if (!atomic_file_open(&af, path, mode, flags)) {
+        return -1;
+    }
+    if (len > 0 && fwrite(data, 1, len, af.fp) != len) {
+        atomic_file_abort(&af);
+        return -1;
+    }
+    return atomic_file_commit(&af);
+}
@@ -10,6 +10,9 @@
  *
  * @note
  * - 缓存文件路径为 /development/tmp/weather.json，确保目录存在且可写。
+ * - 由事件循环的定时器按 CHECK_INTERVAL 触发，检查在工作线程中执行，
+ *   上一次尚未结束时跳过本次。
+ * - 推送通知经 reactor_spawn 直接执行 curl，不经过 shell。
  **********************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
@@ -19,6 +22,7 @@
 #include <json-c/json.h>
 #include "check_task.h"
 #include "define.h"
+#include "reactor.h"
 
 // 简单哈希函数
 static unsigned int simple_hash(const char *str) {
@@ -90,18 +94,19 @@ static void mark_task_notified(const char *task_id) {
 }
 // 发送通知
 static void push_notification(const char *sckey, const char *title, const char *desp) {
-    char cmd[1024];
+    char title_arg[256];
+    char desp_arg[600];
+    char url[256];
+    char *argv[] = { "curl", "-k", "-m", "10", "-s", "-o", "/dev/null",
+                     "-d", title_arg, "-d", desp_arg, url, NULL };
 
     if (!sckey || !title || !desp) return;
-    
-    snprintf(cmd, sizeof(cmd),
-        "curl -k -m 10 -s -o /dev/null "
-        "-d 'title=%s' "
-        "-d 'desp=%s' "
-        "'https://sctapi.ftqq.com/%s.send'",
-        title, desp, sckey
-    );
-    system(cmd);
+
+    snprintf(title_arg, sizeof(title_arg), "title=%s", title);
+    snprintf(desp_arg, sizeof(desp_arg), "desp=%s", desp);
+    snprintf(url, sizeof(url), "https://sctapi.ftqq.com/%s.send", sckey);
+    // 经 reactor_spawn 启动 curl 恢复默认信号处理 也不再经过 shell
+    reactor_spawn(argv);
 }
 // 解析日期时间字符串
 static time_t parse_datetime(const char *dt_str) {
@@ -214,16 +219,36 @@ static void check_once() {
     }
     json_object_put(root);
 }
-// 检查任务线程
-void *check_task_thread(void *arg) {
-    printf("check_tasks daemon thread started.\n");
+static int g_checking = 0;   // 上一次检查尚未结束
+
+// 工作线程中检查一次
+static void check_job(void *arg) {
+    (void)arg;
+    check_once();
+    __atomic_store_n(&g_checking, 0, __ATOMIC_RELEASE);
+}
+// 定时提交检查 推送通知要执行外部命令 不在事件循环中执行
+static void check_tick(void *arg) {
+    (void)arg;
+    // 上一次还在推送时跳过本次 不在队列里堆积
+    if (__atomic_exchange_n(&g_checking, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    if (reactor_submit(check_job, NULL) != 0) {
+        __atomic_store_n(&g_checking, 0, __ATOMIC_RELEASE);
+    }
+}
+// 在事件循环上启动任务检查
+int check_task_start(void) {
+    struct reactor_timer *t;
+
     printf("Data file: %s\n", DATA_FILE);
     printf("State file: %s\n", STATE_FILE);
     printf("Checking every %d seconds.\n", CHECK_INTERVAL);
-
-    while (1) {
-        check_once();
-        sleep(CHECK_INTERVAL);
+    t = reactor_timer_new(check_tick, NULL);
+    if (!t) {
+        return -1;
     }
-    return NULL;
+    reactor_timer_set(t, 1, CHECK_INTERVAL * 1000);
+    return 0;
 }
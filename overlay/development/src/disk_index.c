@@ -0,0 +1,191 @@
+/**********************************************************************
+ * @file disk_index.c
+ * @brief 移动硬盘元数据索引读取实现
+ *
+ * 本文件定义 environment 守护进程生成的磁盘索引文件格式，
+ * 并实现 CGI 侧的只读访问：整个文件 mmap 后按目录二分查找子项。
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ *
+ * @note
+ * - 路径均为相对 DISK_INDEX_ROOT 的绝对形式，如 /a/b.txt，根目录记为空串。
+ * - 条目按 (父目录, 名字) 字节序排序，列目录为一次二分加连续区间读取。
+ * - 文件由守护进程写临时文件后 rename 替换，读者无需加锁。
+ **********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "disk_index.h"
+
+// 比较两段字节串 较短者为前缀时排在前面
+static int bytes_cmp(const char *a, size_t a_len, const char *b, size_t b_len) {
+    size_t n = a_len < b_len ? a_len : b_len;
+    int r = memcmp(a, b, n);
+
+    if (r != 0) {
+        return r;
+    }
+    return a_len < b_len ? -1 : (a_len > b_len ? 1 : 0);
+}
+
+// 索引排序键：先父目录 再名字
+int disk_index_key_cmp(const char *pa, size_t pa_len, const char *na,
+                       const char *pb, size_t pb_len, const char *nb) {
+    int r = bytes_cmp(pa, pa_len, pb, pb_len);
+
+    if (r != 0) {
+        return r;
+    }
+    return strcmp(na, nb);
+}
+
+// 映射索引文件并校验头部
+int disk_index_open(disk_index_t *idx, const char *file) {
+    struct stat st;
+    size_t need;
+    void *p;
+    int fd;
+
+    memset(idx, 0, sizeof(*idx));
+    fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct disk_index_header)) {
+        close(fd);
+        return -1;
+    }
+    p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+    idx->map = p;
+    idx->map_size = (size_t)st.st_size;
+    idx->hdr = p;
+    need = sizeof(struct disk_index_header)
+         + (size_t)idx->hdr->count * sizeof(struct disk_index_entry)
+         + idx->hdr->names_size;
+    if (idx->hdr->magic != DISK_INDEX_MAGIC || idx->hdr->version != DISK_INDEX_VERSION
+        || need != idx->map_size) {
+        disk_index_close(idx);
+        return -1;
+    }
+    idx->entries = (const struct disk_index_entry *)(idx->hdr + 1);
+    idx->names = (const char *)(idx->entries + idx->hdr->count);
+    return 0;
+}
+
+// 解除映射
+void disk_index_close(disk_index_t *idx) {
+    if (idx->map) {
+        munmap(idx->map, idx->map_size);
+    }
+    memset(idx, 0, sizeof(*idx));
+}
+
+// 条目完整路径
+const char *disk_index_path(const disk_index_t *idx, const struct disk_index_entry *e) {
+    return idx->names + e->path_off;
+}
+
+// 条目名字
+const char *disk_index_name(const disk_index_t *idx, const struct disk_index_entry *e) {
+    return idx->names + e->path_off + e->parent_len + 1;
+}
+
+// 去掉末尾斜杠 根目录得到长度 0
+static size_t dir_key_len(const char *dir) {
+    size_t len = strlen(dir);
+
+    while (len > 0 && dir[len - 1] == '/') {
+        len--;
+    }
+    return len;
+}
+
+// 查找首个不小于给定键的条目
+static size_t lower_bound(const disk_index_t *idx, const char *parent, size_t parent_len,
+                          const char *name) {
+    size_t lo = 0;
+    size_t hi = idx->hdr->count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const struct disk_index_entry *e = &idx->entries[mid];
+
+        if (disk_index_key_cmp(idx->names + e->path_off, e->parent_len, disk_index_name(idx, e),
+                               parent, parent_len, name) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// 求目录下子项所在区间 目录无子项时 count 为 0
+int disk_index_children(const disk_index_t *idx, const char *dir, size_t *first, size_t *count) {
+    size_t len = dir_key_len(dir);
+    size_t i;
+
+    i = lower_bound(idx, dir, len, "");
+    *first = i;
+    while (i < idx->hdr->count
+           && bytes_cmp(idx->names + idx->entries[i].path_off, idx->entries[i].parent_len, dir, len) == 0) {
+        i++;
+    }
+    *count = i - *first;
+    return 0;
+}
+
+// 按完整路径查找条目
+const struct disk_index_entry *disk_index_lookup(const disk_index_t *idx, const char *path) {
+    size_t len = dir_key_len(path);
+    size_t parent_len = len;
+    char name[256];
+    const struct disk_index_entry *e;
+    size_t i;
+
+    while (parent_len > 0 && path[parent_len - 1] != '/') {
+        parent_len--;
+    }
+    if (parent_len == 0 || len - parent_len >= sizeof(name)) {
+        return NULL;
+    }
+    memcpy(name, path + parent_len, len - parent_len);
+    name[len - parent_len] = '\0';
+    parent_len--;
+    i = lower_bound(idx, path, parent_len, name);
+    if (i >= idx->hdr->count) {
+        return NULL;
+    }
+    e = &idx->entries[i];
+    if (disk_index_key_cmp(idx->names + e->path_off, e->parent_len, disk_index_name(idx, e),
+                           path, parent_len, name) != 0) {
+        return NULL;
+    }
+    return e;
+}
+
+// 取目录在建索引时的修改时间 用于判断索引是否仍反映该目录
+int disk_index_dir_mtime(const disk_index_t *idx, const char *dir, int64_t *mtime_ns) {
+    const struct disk_index_entry *e;
+
+    if (dir_key_len(dir) == 0) {
+        *mtime_ns = idx->hdr->root_mtime_ns;
+        return 0;
+    }
+    e = disk_index_lookup(idx, dir);
+    if (!e || !(e->flags & DISK_INDEX_DIR)) {
+        return -1;
+    }
+    *mtime_ns = e->mtime_ns;
+    return 0;
+}
@@ -0,0 +1,676 @@
+/**********************************************************************
+ * @file disk_indexer.c
+ * @brief 移动硬盘元数据索引维护线程实现
+ *
+ * 本文件启动时遍历 DISK_INDEX_ROOT 建立内存中的有序条目表，
+ * 之后通过 inotify 监视每个目录增量更新，事件静默后整体写出索引文件，
+ * 供 CGI 列目录与搜索时直接读取，避免每次请求都 readdir 加 stat。
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ *
+ * @note
+ * - 内存条目与文件条目同序，落盘为一次顺序写，写临时文件后 rename。
+ * - 事件队列溢出时整体重扫；根目录消失（拔盘）后删除索引并等待重新挂载。
+ * - 不跨越文件系统边界，跳过上传临时文件与 .uploads 目录。
+ * - fanotify 需要 CAP_SYS_ADMIN 且仍须逐目录解析名字，这里只用 inotify。
+ * - 目录的累计大小随每个事件按差值向上传递到各级祖先，
+ *   另每隔 DISK_INDEX_RECONCILE 秒用 nftw 全量重算一次以纠正漏掉的事件。
+ * - 删除文件只二分查找删一项；新目录只排序新扫描到的条目再归并，
+ *   批量复制或删除时不会每个事件都扫描、重排整个条目表。
+ **********************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "disk_indexer.h"
+#include "atomic_file.h"
+
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE \
+                    | IN_ATTRIB | IN_DELETE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+struct idx_node {
+    char *path;
+    uint16_t path_len;
+    uint16_t parent_len;
+    uint32_t flags;
+    uint32_t files;
+    uint64_t size;
+    uint64_t usage;
+    int64_t mtime_ns;
+};
+
+static struct idx_node *g_nodes = NULL;
+static size_t g_count = 0;
+static size_t g_cap = 0;
+static char **g_watches = NULL;
+static int g_watch_cap = 0;
+static int g_ifd = -1;
+static int g_root_wd = -1;
+static int64_t g_root_mtime = 0;
+static uint64_t g_root_size = 0;
+static uint64_t g_root_usage = 0;
+static uint64_t g_root_files = 0;
+static size_t g_root_len = 0;
+static int g_watch_full = 0;
+
+// 上传临时文件与会话目录不入索引
+static int is_internal_name(const char *name) {
+    return strncmp(name, ".upload", 7) == 0;
+}
+
+// 纳秒精度修改时间
+static int64_t stat_mtime_ns(const struct stat *st) {
+    return (int64_t)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+}
+
+// 父目录部分长度 /a/b 为 2 /a 为 0
+static size_t parent_len_of(const char *path, size_t len) {
+    while (len > 0 && path[len - 1] != '/') {
+        len--;
+    }
+    return len > 0 ? len - 1 : 0;
+}
+
+// 条目排序比较
+static int node_cmp(const void *pa, const void *pb) {
+    const struct idx_node *a = pa;
+    const struct idx_node *b = pb;
+
+    return disk_index_key_cmp(a->path, a->parent_len, a->path + a->parent_len + 1,
+                              b->path, b->parent_len, b->path + b->parent_len + 1);
+}
+
+// 二分查找路径 未找到时 *pos 为插入位置
+static int node_find(const char *path, size_t *pos) {
+    size_t len = strlen(path);
+    size_t plen = parent_len_of(path, len);
+    size_t lo = 0;
+    size_t hi = g_count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        struct idx_node *n = &g_nodes[mid];
+        int r = disk_index_key_cmp(n->path, n->parent_len, n->path + n->parent_len + 1,
+                                   path, plen, path + plen + 1);
+        if (r == 0) {
+            *pos = mid;
+            return 1;
+        }
+        if (r < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *pos = lo;
+    return 0;
+}
+
+// 保证数组容量
+static int node_reserve(size_t need) {
+    size_t cap;
+    struct idx_node *p;
+
+    if (need <= g_cap) {
+        return 0;
+    }
+    cap = g_cap ? g_cap * 2 : 4096;
+    while (cap < need) {
+        cap *= 2;
+    }
+    p = realloc(g_nodes, cap * sizeof(*p));
+    if (!p) {
+        return -1;
+    }
+    g_nodes = p;
+    g_cap = cap;
+    return 0;
+}
+
+// 用 stat 结果填充条目元数据 目录的累计值不在这里改动
+static void node_fill(struct idx_node *n, const struct stat *st) {
+    n->flags = S_ISDIR(st->st_mode) ? DISK_INDEX_DIR : 0;
+    n->mtime_ns = stat_mtime_ns(st);
+    if (!(n->flags & DISK_INDEX_DIR)) {
+        n->size = (uint64_t)st->st_size;
+        n->usage = (uint64_t)st->st_blocks * 512;
+        n->files = 1;
+    }
+}
+
+// 把子项的大小变化累加到各级祖先目录与根
+static void propagate(const char *path, int64_t d_size, int64_t d_usage, int64_t d_files) {
+    char buf[PATH_MAX];
+    size_t len = strlen(path);
+    size_t pos;
+
+    if ((d_size == 0 && d_usage == 0 && d_files == 0) || len >= sizeof(buf)) {
+        return;
+    }
+    memcpy(buf, path, len + 1);
+    while ((len = parent_len_of(buf, len)) > 0) {
+        buf[len] = '\0';
+        if (node_find(buf, &pos)) {
+            g_nodes[pos].size += (uint64_t)d_size;
+            g_nodes[pos].usage += (uint64_t)d_usage;
+            g_nodes[pos].files += (uint32_t)d_files;
+        }
+    }
+    g_root_size += (uint64_t)d_size;
+    g_root_usage += (uint64_t)d_usage;
+    g_root_files += (uint64_t)d_files;
+}
+
+// 在数组末尾追加条目 之后需整体排序
+static int node_append(const char *path, const struct stat *st) {
+    size_t len = strlen(path);
+    struct idx_node *n;
+
+    if (len > UINT16_MAX || node_reserve(g_count + 1) != 0) {
+        return -1;
+    }
+    n = &g_nodes[g_count];
+    n->path = strdup(path);
+    if (!n->path) {
+        return -1;
+    }
+    n->path_len = (uint16_t)len;
+    n->parent_len = (uint16_t)parent_len_of(path, len);
+    n->files = 0;
+    n->size = 0;
+    n->usage = 0;
+    node_fill(n, st);
+    g_count++;
+    return 0;
+}
+
+static void node_remove_tree(const char *path);
+
+// 插入或更新单个条目 保持有序 大小变化传递给祖先
+static int node_upsert(const char *path, const struct stat *st) {
+    struct idx_node *n;
+    struct idx_node old;
+    size_t pos;
+
+    if (node_find(path, &pos)) {
+        n = &g_nodes[pos];
+        if (!(n->flags & DISK_INDEX_DIR) == !S_ISDIR(st->st_mode)) {
+            old = *n;
+            node_fill(n, st);
+            propagate(path, (int64_t)(n->size - old.size), (int64_t)(n->usage - old.usage),
+                      (int64_t)n->files - (int64_t)old.files);
+            return 0;
+        }
+        // 同名条目类型改变 按删除后新建处理
+        node_remove_tree(path);
+        node_find(path, &pos);
+    }
+    if (node_append(path, st) != 0) {
+        return -1;
+    }
+    if (pos < g_count - 1) {
+        struct idx_node tmp = g_nodes[g_count - 1];
+        memmove(&g_nodes[pos + 1], &g_nodes[pos], (g_count - 1 - pos) * sizeof(*g_nodes));
+        g_nodes[pos] = tmp;
+    }
+    n = &g_nodes[pos];
+    propagate(path, (int64_t)n->size, (int64_t)n->usage, (int64_t)n->files);
+    return 0;
+}
+
+// 判断 path 是否为 prefix 本身或其下的路径
+static int path_within(const char *path, const char *prefix, size_t prefix_len) {
+    return strncmp(path, prefix, prefix_len) == 0
+        && (path[prefix_len] == '\0' || path[prefix_len] == '/');
+}
+
+// 删除单个非目录条目 并从祖先中扣除 条目为目录时返回 0 交给 node_remove_tree
+static int node_remove_entry(const char *path) {
+    size_t i;
+
+    if (!node_find(path, &i)) {
+        return 1;
+    }
+    if (g_nodes[i].flags & DISK_INDEX_DIR) {
+        return 0;
+    }
+    propagate(path, -(int64_t)g_nodes[i].size, -(int64_t)g_nodes[i].usage,
+              -(int64_t)g_nodes[i].files);
+    free(g_nodes[i].path);
+    memmove(&g_nodes[i], &g_nodes[i + 1], (g_count - i - 1) * sizeof(*g_nodes));
+    g_count--;
+    return 1;
+}
+
+// 删除路径及其整棵子树的条目 并从祖先中扣除
+static void node_remove_tree(const char *path) {
+    size_t len = strlen(path);
+    size_t i;
+    size_t kept = 0;
+
+    // 文件只需删一项 不必扫描整个数组
+    if (node_remove_entry(path)) {
+        return;
+    }
+    node_find(path, &i);
+    propagate(path, -(int64_t)g_nodes[i].size, -(int64_t)g_nodes[i].usage,
+              -(int64_t)g_nodes[i].files);
+
+    for (i = 0; i < g_count; i++) {
+        if (path_within(g_nodes[i].path, path, len)) {
+            free(g_nodes[i].path);
+            continue;
+        }
+        g_nodes[kept++] = g_nodes[i];
+    }
+    g_count = kept;
+}
+
+// 清空全部条目
+static void node_clear(void) {
+    size_t i;
+
+    for (i = 0; i < g_count; i++) {
+        free(g_nodes[i].path);
+    }
+    g_count = 0;
+    g_root_size = 0;
+    g_root_usage = 0;
+    g_root_files = 0;
+}
+
+// 为目录添加监视并记录 wd 对应的相对路径
+static void watch_add(const char *abs_path, const char *rel) {
+    int wd = inotify_add_watch(g_ifd, abs_path, WATCH_MASK);
+    char **p;
+    int cap;
+
+    if (wd < 0) {
+        if (errno == ENOSPC && !g_watch_full) {
+            fprintf(stderr, "disk index: inotify watch limit reached, some directories are not watched\n");
+            g_watch_full = 1;
+        }
+        return;
+    }
+    if (wd >= g_watch_cap) {
+        cap = g_watch_cap ? g_watch_cap : 1024;
+        while (cap <= wd) {
+            cap *= 2;
+        }
+        p = realloc(g_watches, (size_t)cap * sizeof(*p));
+        if (!p) {
+            inotify_rm_watch(g_ifd, wd);
+            return;
+        }
+        memset(p + g_watch_cap, 0, (size_t)(cap - g_watch_cap) * sizeof(*p));
+        g_watches = p;
+        g_watch_cap = cap;
+    }
+    free(g_watches[wd]);
+    g_watches[wd] = strdup(rel);
+    if (rel[0] == '\0') {
+        g_root_wd = wd;
+    }
+}
+
+// 移除子树下所有目录的监视
+static void watch_remove_tree(const char *rel) {
+    size_t len = strlen(rel);
+    int wd;
+
+    for (wd = 0; wd < g_watch_cap; wd++) {
+        if (g_watches[wd] && path_within(g_watches[wd], rel, len)) {
+            inotify_rm_watch(g_ifd, wd);
+            free(g_watches[wd]);
+            g_watches[wd] = NULL;
+        }
+    }
+}
+
+// 遍历回调 追加条目并监视目录
+static int scan_cb(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf) {
+    const char *rel = fpath + g_root_len;
+
+    if (is_internal_name(fpath + ftwbuf->base)) {
+        return typeflag == FTW_D ? FTW_SKIP_SUBTREE : FTW_CONTINUE;
+    }
+    if (typeflag == FTW_D) {
+        watch_add(fpath, rel);
+    }
+    if (rel[0] == '\0') {
+        g_root_mtime = stat_mtime_ns(sb);
+        return FTW_CONTINUE;
+    }
+    if (typeflag == FTW_NS) {
+        return FTW_CONTINUE;
+    }
+    node_append(rel, sb);
+    return FTW_CONTINUE;
+}
+
+// 新条目累加到各级祖先 新加入的目录累计值为零 由子树中的文件逐个向上累加
+static void propagate_new(const struct idx_node *nodes, size_t count) {
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        if (!(nodes[i].flags & DISK_INDEX_DIR)) {
+            propagate(nodes[i].path, (int64_t)nodes[i].size, (int64_t)nodes[i].usage, 1);
+        }
+    }
+}
+
+// 把已排序的末段 [old_count, g_count) 从后往前归并进有序前段
+static struct idx_node *merge_tail(size_t old_count) {
+    size_t m = g_count - old_count;
+    struct idx_node *tail;
+    size_t i = old_count;
+    size_t j = m;
+    size_t k = g_count;
+
+    tail = malloc(m * sizeof(*tail));
+    if (!tail) {
+        return NULL;
+    }
+    memcpy(tail, &g_nodes[old_count], m * sizeof(*tail));
+    while (j > 0) {
+        if (i > 0 && node_cmp(&g_nodes[i - 1], &tail[j - 1]) > 0) {
+            g_nodes[--k] = g_nodes[--i];
+        } else {
+            g_nodes[--k] = tail[--j];
+        }
+    }
+    return tail;
+}
+
+// 扫描一棵子树加入索引 rel 为空串时扫描整个根目录
+static void scan_tree(const char *rel) {
+    char abs_path[PATH_MAX];
+    struct idx_node *tail;
+    size_t len = strlen(rel);
+    size_t old_count;
+    size_t i;
+
+    snprintf(abs_path, sizeof(abs_path), "%s%s", DISK_INDEX_ROOT, rel);
+    if (rel[0] == '\0') {
+        node_clear();
+    } else {
+        node_remove_tree(rel);
+    }
+    old_count = g_count;
+    nftw(abs_path, scan_cb, 32, FTW_PHYS | FTW_MOUNT | FTW_ACTIONRETVAL);
+    // 只排序新扫描到的部分 再与原有条目归并 不重排整个数组
+    qsort(&g_nodes[old_count], g_count - old_count, sizeof(*g_nodes), node_cmp);
+    if (old_count == 0 || old_count == g_count) {
+        propagate_new(&g_nodes[old_count], g_count - old_count);
+        return;
+    }
+    tail = merge_tail(old_count);
+    if (!tail) {
+        // 内存不足时退回整体排序 按路径找出子树中的文件累加
+        qsort(g_nodes, g_count, sizeof(*g_nodes), node_cmp);
+        for (i = 0; i < g_count; i++) {
+            if (path_within(g_nodes[i].path, rel, len)) {
+                propagate_new(&g_nodes[i], 1);
+            }
+        }
+        return;
+    }
+    // 归并后祖先目录都已就位 按新条目的副本累加
+    propagate_new(tail, g_count - old_count);
+    free(tail);
+}
+
+// 按当前文件系统状态刷新单个路径
+static void refresh_path(const char *rel) {
+    char abs_path[PATH_MAX];
+    struct stat st;
+
+    snprintf(abs_path, sizeof(abs_path), "%s%s", DISK_INDEX_ROOT, rel);
+    if (lstat(abs_path, &st) != 0) {
+        node_remove_tree(rel);
+        return;
+    }
+    if (rel[0] == '\0') {
+        g_root_mtime = stat_mtime_ns(&st);
+        return;
+    }
+    node_upsert(rel, &st);
+}
+
+// 写出索引文件 先写临时文件再原子替换
+static int write_index(void) {
+    struct atomic_file af;
+    struct disk_index_header hdr;
+    struct disk_index_entry e;
+    uint32_t off = 0;
+    size_t names_size = 0;
+    size_t i;
+    FILE *fp;
+    int ok;
+
+    for (i = 0; i < g_count; i++) {
+        names_size += (size_t)g_nodes[i].path_len + 1;
+    }
+    if (names_size > UINT32_MAX || g_count > UINT32_MAX) {
+        return -1;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = DISK_INDEX_MAGIC;
+    hdr.version = DISK_INDEX_VERSION;
+    hdr.count = (uint32_t)g_count;
+    hdr.names_size = (uint32_t)names_size;
+    hdr.built_at = (int64_t)time(NULL);
+    hdr.root_mtime_ns = g_root_mtime;
+    hdr.root_size = g_root_size;
+    hdr.root_usage = g_root_usage;
+    hdr.root_files = g_root_files;
+
+    fp = atomic_file_open(&af, DISK_INDEX_FILE, 0644, 0);
+    if (!fp) {
+        perror("disk index: open temp file");
+        return -1;
+    }
+    ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+    for (i = 0; ok && i < g_count; i++) {
+        memset(&e, 0, sizeof(e));
+        e.size = g_nodes[i].size;
+        e.usage = g_nodes[i].usage;
+        e.files = g_nodes[i].files;
+        e.mtime_ns = g_nodes[i].mtime_ns;
+        e.path_off = off;
+        e.path_len = g_nodes[i].path_len;
+        e.parent_len = g_nodes[i].parent_len;
+        e.flags = g_nodes[i].flags;
+        off += (uint32_t)g_nodes[i].path_len + 1;
+        ok = fwrite(&e, sizeof(e), 1, fp) == 1;
+    }
+    for (i = 0; ok && i < g_count; i++) {
+        ok = fwrite(g_nodes[i].path, (size_t)g_nodes[i].path_len + 1, 1, fp) == 1;
+    }
+    if (!ok) {
+        atomic_file_abort(&af);
+    }
+    if (!ok || atomic_file_commit(&af) != 0) {
+        perror("disk index: write");
+        return -1;
+    }
+    return 0;
+}
+
+// 处理一条 inotify 事件 返回 1 表示根目录已失效
+static int handle_event(const struct inotify_event *ev) {
+    char rel[PATH_MAX];
+    const char *dir;
+
+    if (ev->mask & IN_Q_OVERFLOW) {
+        scan_tree("");
+        return 0;
+    }
+    if (ev->wd < 0 || ev->wd >= g_watch_cap || !g_watches[ev->wd]) {
+        return 0;
+    }
+    dir = g_watches[ev->wd];
+    if (ev->mask & (IN_IGNORED | IN_DELETE_SELF | IN_UNMOUNT)) {
+        if (ev->wd == g_root_wd) {
+            return 1;
+        }
+        if (ev->mask & IN_IGNORED) {
+            free(g_watches[ev->wd]);
+            g_watches[ev->wd] = NULL;
+        }
+        return 0;
+    }
+    if (ev->len == 0 || is_internal_name(ev->name)) {
+        return 0;
+    }
+    snprintf(rel, sizeof(rel), "%s/%s", dir, ev->name);
+    if (ev->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        if (ev->mask & IN_ISDIR) {
+            node_remove_tree(rel);
+            watch_remove_tree(rel);
+        } else {
+            node_remove_entry(rel);
+        }
+    } else if ((ev->mask & (IN_CREATE | IN_MOVED_TO)) && (ev->mask & IN_ISDIR)) {
+        scan_tree(rel);
+    } else {
+        refresh_path(rel);
+    }
+    // 增删改名都会更新所在目录的 mtime CGI 据此判断索引是否过期
+    refresh_path(dir);
+    return 0;
+}
+
+// 单调时钟毫秒数
+static long long now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 全量重扫校正累计值 与增量结果不一致时记录偏差
+static void reconcile(void) {
+    uint64_t size = g_root_size;
+    uint64_t files = g_root_files;
+
+    scan_tree("");
+    if (size != g_root_size || files != g_root_files) {
+        fprintf(stderr, "disk index: reconcile corrected totals from %llu bytes/%llu files to %llu/%llu\n",
+                (unsigned long long)size, (unsigned long long)files,
+                (unsigned long long)g_root_size, (unsigned long long)g_root_files);
+    }
+    write_index();
+}
+
+// 监视并维护索引 根目录失效时返回
+static void index_run(void) {
+    char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfd = { .fd = g_ifd, .events = POLLIN };
+    long long next_reconcile = now_ms() + DISK_INDEX_RECONCILE * 1000LL;
+    long long dirty_since = 0;
+    long long wait;
+    int timeout;
+    ssize_t n;
+    char *p;
+    int rc;
+
+    for (;;) {
+        wait = next_reconcile - now_ms();
+        if (wait < 0) {
+            wait = 0;
+        }
+        timeout = dirty_since && wait > DISK_INDEX_DEBOUNCE_MS ? DISK_INDEX_DEBOUNCE_MS : (int)wait;
+        rc = poll(&pfd, 1, timeout);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("disk index: poll");
+            return;
+        }
+        if (rc == 0) {
+            if (now_ms() >= next_reconcile) {
+                reconcile();
+                next_reconcile = now_ms() + DISK_INDEX_RECONCILE * 1000LL;
+            } else {
+                write_index();
+            }
+            dirty_since = 0;
+            continue;
+        }
+        n = read(g_ifd, buf, sizeof(buf));
+        if (n <= 0) {
+            if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+                continue;
+            }
+            return;
+        }
+        for (p = buf; p < buf + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+            if (handle_event((const struct inotify_event *)p)) {
+                return;
+            }
+        }
+        if (!dirty_since) {
+            dirty_since = now_ms();
+        } else if (now_ms() - dirty_since >= DISK_INDEX_MAX_DELAY * 1000LL) {
+            write_index();
+            dirty_since = 0;
+        }
+    }
+}
+
+// 释放监视与条目
+static void index_stop(void) {
+    int wd;
+
+    for (wd = 0; wd < g_watch_cap; wd++) {
+        free(g_watches[wd]);
+        g_watches[wd] = NULL;
+    }
+    if (g_ifd >= 0) {
+        close(g_ifd);
+        g_ifd = -1;
+    }
+    g_root_wd = -1;
+    g_watch_full = 0;
+    node_clear();
+    unlink(DISK_INDEX_FILE);
+}
+
+// 磁盘索引线程
+void *disk_index_thread(void *arg) {
+    struct stat st;
+
+    (void)arg;
+    g_root_len = strlen(DISK_INDEX_ROOT);
+    for (;;) {
+        if (stat(DISK_INDEX_ROOT, &st) != 0 || !S_ISDIR(st.st_mode)) {
+            sleep(DISK_INDEX_RETRY);
+            continue;
+        }
+        g_ifd = inotify_init1(IN_CLOEXEC);
+        if (g_ifd < 0) {
+            perror("disk index: inotify_init1");
+            sleep(DISK_INDEX_RETRY);
+            continue;
+        }
+        scan_tree("");
+        write_index();
+        index_run();
+        index_stop();
+        sleep(1);
+    }
+    return NULL;
+}
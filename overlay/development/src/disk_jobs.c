@@ -0,0 +1,311 @@
+/**********************************************************************
+ * @file disk_jobs.c
+ * @brief 磁盘后台任务表实现
+ *
+ * 本文件实现 CGI 与 environment 守护进程共享的磁盘任务表。
+ * CGI 在共享内存中登记删除、移动、复制任务后立即返回任务 ID，
+ * 再经 POSIX 消息队列通知守护进程，由后台线程执行并更新进度。
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ *
+ * @note
+ * - 共享内存名为 /web_disk_jobs，消息队列名为 /disk_jobs，均归 CGI 用户
+ *   所有、权限 0600，其他本地用户不能伪造任务或篡改进度。
+ * - 槽位用尽时复用最早结束的任务，排队或执行中的任务不会被覆盖。
+ * - 互斥锁为进程间共享的健壮锁，进度计数不加锁，用原子读写。
+ **********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <mqueue.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+#include "disk_jobs.h"
+#include "ipc_owner.h"
+
+#define DISK_JOBS_MAGIC   0x4a4f4253u
+#define DISK_JOBS_VERSION 1
+
+struct disk_job_table {
+    uint32_t magic;
+    uint32_t version;
+    pthread_mutex_t lock;
+    struct disk_job jobs[DISK_JOBS_MAX];
+};
+
+static struct disk_job_table *g_jobs = NULL;
+
+// 初始化新建的任务表
+static void init_table(struct disk_job_table *t) {
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&t->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    t->version = DISK_JOBS_VERSION;
+    __atomic_store_n(&t->magic, DISK_JOBS_MAGIC, __ATOMIC_RELEASE);
+}
+
+// 映射共享内存任务表，不存在则创建
+static struct disk_job_table *attach_table(void) {
+    int fd;
+    int created = 0;
+    int i;
+    mode_t old_mask;
+    struct stat st;
+    void *p;
+    struct disk_job_table *t;
+
+    if (g_jobs) {
+        return g_jobs;
+    }
+    old_mask = umask(0);
+    fd = shm_open(DISK_JOBS_SHM_NAME, O_RDWR | O_CREAT | O_EXCL, IPC_OWNER_MODE);
+    if (fd >= 0) {
+        created = 1;
+    } else if (errno == EEXIST) {
+        // 创建者可能还没把属主改为 CGI 用户
+        for (i = 0; i < 100; i++) {
+            fd = shm_open(DISK_JOBS_SHM_NAME, O_RDWR, IPC_OWNER_MODE);
+            if (fd >= 0 || errno != EACCES) {
+                break;
+            }
+            usleep(10000);
+        }
+    }
+    umask(old_mask);
+    if (fd < 0) {
+        perror("shm_open disk jobs");
+        return NULL;
+    }
+    if (ipc_owner_secure(fd, IPC_OWNER_MODE) != 0) {
+        close(fd);
+        if (created) {
+            shm_unlink(DISK_JOBS_SHM_NAME);
+        }
+        return NULL;
+    }
+    if (created) {
+        if (ftruncate(fd, sizeof(struct disk_job_table)) != 0) {
+            perror("ftruncate disk jobs");
+            close(fd);
+            shm_unlink(DISK_JOBS_SHM_NAME);
+            return NULL;
+        }
+    } else {
+        for (i = 0; i < 100; i++) {
+            if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(struct disk_job_table)) {
+                break;
+            }
+            usleep(10000);
+        }
+        if (i == 100) {
+            close(fd);
+            return NULL;
+        }
+    }
+    p = mmap(NULL, sizeof(struct disk_job_table), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap disk jobs");
+        return NULL;
+    }
+    t = (struct disk_job_table *)p;
+    if (created) {
+        init_table(t);
+    } else {
+        for (i = 0; i < 100; i++) {
+            if (__atomic_load_n(&t->magic, __ATOMIC_ACQUIRE) == DISK_JOBS_MAGIC) {
+                break;
+            }
+            usleep(10000);
+        }
+        if (t->magic != DISK_JOBS_MAGIC || t->version != DISK_JOBS_VERSION) {
+            fprintf(stderr, "disk job table %s has unexpected layout\n", DISK_JOBS_SHM_NAME);
+            munmap(p, sizeof(struct disk_job_table));
+            return NULL;
+        }
+    }
+    g_jobs = t;
+    return t;
+}
+
+// 加锁，持锁进程崩溃时恢复锁状态
+static int lock_table(struct disk_job_table *t) {
+    int rc = pthread_mutex_lock(&t->lock);
+
+    if (rc == EOWNERDEAD) {
+        pthread_mutex_consistent(&t->lock);
+        rc = 0;
+    }
+    return rc;
+}
+
+// 生成十六进制任务 ID
+static int make_job_id(char *id, size_t size) {
+    unsigned char raw[DISK_JOBS_ID_LEN / 2];
+    size_t i;
+
+    if (size < DISK_JOBS_ID_LEN + 1 || getrandom(raw, sizeof(raw), 0) != (ssize_t)sizeof(raw)) {
+        return -1;
+    }
+    for (i = 0; i < sizeof(raw); i++) {
+        snprintf(id + i * 2, 3, "%02x", raw[i]);
+    }
+    return 0;
+}
+
+// 登记任务并通知守护进程 返回 0 成功 -1 参数错误 -2 任务表已满 -3 守护进程不可用
+int disk_job_submit(enum disk_job_op op, const char *src, const char *dst, char *id, size_t id_size) {
+    struct disk_job_table *t;
+    struct disk_job *job = NULL;
+    char msg[16];
+    mqd_t mq;
+    int slot = -1;
+    int i;
+
+    if (!src || strlen(src) >= DISK_JOBS_PATH_MAX || (dst && strlen(dst) >= DISK_JOBS_PATH_MAX)
+        || make_job_id(id, id_size) != 0) {
+        return -1;
+    }
+    t = attach_table();
+    if (!t || lock_table(t) != 0) {
+        return -3;
+    }
+    for (i = 0; i < DISK_JOBS_MAX; i++) {
+        uint32_t state = t->jobs[i].state;
+        if (state == DISK_JOB_FREE) {
+            slot = i;
+            break;
+        }
+        if ((state == DISK_JOB_DONE || state == DISK_JOB_FAILED)
+            && (slot < 0 || t->jobs[i].finished < t->jobs[slot].finished)) {
+            slot = i;
+        }
+    }
+    if (slot < 0) {
+        pthread_mutex_unlock(&t->lock);
+        return -2;
+    }
+    job = &t->jobs[slot];
+    memset(job, 0, sizeof(*job));
+    memcpy(job->id, id, DISK_JOBS_ID_LEN + 1);
+    job->op = (uint32_t)op;
+    snprintf(job->src, sizeof(job->src), "%s", src);
+    snprintf(job->dst, sizeof(job->dst), "%s", dst ? dst : "");
+    job->created = (int64_t)time(NULL);
+    job->state = DISK_JOB_QUEUED;
+    pthread_mutex_unlock(&t->lock);
+
+    snprintf(msg, sizeof(msg), "%d", slot);
+    mq = mq_open(DISK_JOBS_MQ_NAME, O_WRONLY | O_NONBLOCK);
+    if (mq == (mqd_t)-1 || mq_send(mq, msg, strlen(msg), 0) == -1) {
+        if (mq != (mqd_t)-1) {
+            mq_close(mq);
+        }
+        disk_job_finish(job, EAGAIN);
+        return -3;
+    }
+    mq_close(mq);
+    return 0;
+}
+
+// 按 ID 取任务快照 未找到返回 -1
+int disk_job_get(const char *id, struct disk_job *out) {
+    struct disk_job_table *t = attach_table();
+    int found = -1;
+    int i;
+
+    if (!t || !id || lock_table(t) != 0) {
+        return -1;
+    }
+    for (i = 0; i < DISK_JOBS_MAX; i++) {
+        if (t->jobs[i].state != DISK_JOB_FREE && strcmp(t->jobs[i].id, id) == 0) {
+            *out = t->jobs[i];
+            out->entries = __atomic_load_n(&t->jobs[i].entries, __ATOMIC_RELAXED);
+            out->bytes = __atomic_load_n(&t->jobs[i].bytes, __ATOMIC_RELAXED);
+            found = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&t->lock);
+    return found;
+}
+
+// 操作类型名
+const char *disk_job_op_name(uint32_t op) {
+    switch (op) {
+        case DISK_JOB_DELETE: return "delete";
+        case DISK_JOB_MOVE: return "move";
+        case DISK_JOB_COPY: return "copy";
+        default: return "unknown";
+    }
+}
+
+// 任务状态名
+const char *disk_job_state_name(uint32_t state) {
+    switch (state) {
+        case DISK_JOB_QUEUED: return "queued";
+        case DISK_JOB_RUNNING: return "running";
+        case DISK_JOB_DONE: return "done";
+        case DISK_JOB_FAILED: return "failed";
+        default: return "free";
+    }
+}
+
+// 守护进程取出排队中的任务并标记为执行中 槽位状态不符时返回 NULL
+struct disk_job *disk_job_begin(int slot) {
+    struct disk_job_table *t = attach_table();
+    struct disk_job *job = NULL;
+
+    if (!t || slot < 0 || slot >= DISK_JOBS_MAX || lock_table(t) != 0) {
+        return NULL;
+    }
+    if (t->jobs[slot].state == DISK_JOB_QUEUED) {
+        job = &t->jobs[slot];
+        job->state = DISK_JOB_RUNNING;
+    }
+    pthread_mutex_unlock(&t->lock);
+    return job;
+}
+
+// 结束任务 error 为 0 表示成功 否则为 errno
+void disk_job_finish(struct disk_job *job, int error) {
+    struct disk_job_table *t = attach_table();
+
+    if (!t || lock_table(t) != 0) {
+        return;
+    }
+    job->error = error;
+    job->finished = (int64_t)time(NULL);
+    job->state = error ? DISK_JOB_FAILED : DISK_JOB_DONE;
+    pthread_mutex_unlock(&t->lock);
+}
+
+// 守护进程启动时把上次中断的任务标记为失败
+void disk_job_recover(void) {
+    struct disk_job_table *t = attach_table();
+    int i;
+
+    if (!t || lock_table(t) != 0) {
+        return;
+    }
+    for (i = 0; i < DISK_JOBS_MAX; i++) {
+        if (t->jobs[i].state == DISK_JOB_RUNNING) {
+            t->jobs[i].error = EINTR;
+            t->jobs[i].finished = (int64_t)time(NULL);
+            t->jobs[i].state = DISK_JOB_FAILED;
+        }
+    }
+    pthread_mutex_unlock(&t->lock);
+}
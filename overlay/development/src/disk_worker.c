@@ -0,0 +1,413 @@
+/**********************************************************************
+ * @file disk_worker.c
+ * @brief 磁盘后台任务执行线程实现
+ *
+ * 本文件从 /disk_jobs 消息队列取出 CGI 登记的任务槽位，
+ * 在守护进程中执行递归删除、移动与复制，并实时更新任务进度，
+ * 使耗时的目录操作不再占用 lighttpd 的 CGI 连接。
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ *
+ * @note
+ * - 删除、移动与复制均基于目录 fd 的 *at 系列调用，不跟随符号链接。
+ * - 任务路径来自共享内存，执行前校验长度与 .. 分量，打开的父目录
+ *   须确实位于 DISK_INDEX_ROOT 之下，经符号链接逃出的任务直接失败。
+ * - 消息队列归 CGI 用户所有、权限 0600。
+ * - 移动优先 rename，跨文件系统时退化为复制后删除。
+ * - 目标已存在时任务失败，不覆盖已有文件。
+ * - 总字节数取自磁盘索引中的子树累计值，索引不可用时为 0。
+ **********************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <mqueue.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "disk_worker.h"
+#include "disk_jobs.h"
+#include "disk_index.h"
+#include "ipc_owner.h"
+
+#define COPY_CHUNK (1 << 20)
+
+// 累加进度计数 CGI 无锁读取
+static void add_progress(struct disk_job *job, uint64_t entries, uint64_t bytes) {
+    __atomic_add_fetch(&job->entries, entries, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&job->bytes, bytes, __ATOMIC_RELAXED);
+}
+
+// 校验相对路径并拼出绝对路径 拒绝根目录本身与 .. 分量
+static int resolve_path(const char *rel, char *abs_path, size_t size) {
+    const char *p = rel;
+
+    // 共享内存中的字段不一定以 0 结尾
+    if (strnlen(rel, DISK_JOBS_PATH_MAX) == DISK_JOBS_PATH_MAX || rel[0] != '/' || rel[1] == '\0') {
+        return -1;
+    }
+    while ((p = strstr(p, "..")) != NULL) {
+        if (p[-1] == '/' && (p[2] == '/' || p[2] == '\0')) {
+            return -1;
+        }
+        p += 2;
+    }
+    if ((size_t)snprintf(abs_path, size, "%s%s", DISK_INDEX_ROOT, rel) >= size) {
+        return -1;
+    }
+    while (strlen(abs_path) > 1 && abs_path[strlen(abs_path) - 1] == '/') {
+        abs_path[strlen(abs_path) - 1] = '\0';
+    }
+    return 0;
+}
+
+// 目录描述符的实际位置是否在 DISK_INDEX_ROOT 之下
+static int dir_under_root(int fd) {
+    char link[64];
+    char real[PATH_MAX];
+    char root[PATH_MAX];
+    ssize_t n;
+    size_t len;
+
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    n = readlink(link, real, sizeof(real) - 1);
+    if (n < 0 || !realpath(DISK_INDEX_ROOT, root)) {
+        return 0;
+    }
+    real[n] = '\0';
+    len = strlen(root);
+    return strncmp(real, root, len) == 0 && (real[len] == '/' || real[len] == '\0');
+}
+
+// 打开路径的父目录 *name 指向最后一段 父目录经符号链接逃出根目录时失败
+static int open_parent(char *abs_path, const char **name) {
+    char *slash = strrchr(abs_path, '/');
+    int fd;
+
+    *slash = '\0';
+    fd = open(abs_path[0] ? abs_path : "/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    *slash = '/';
+    *name = slash + 1;
+    if (fd >= 0 && !dir_under_root(fd)) {
+        close(fd);
+        errno = EACCES;
+        return -1;
+    }
+    return fd;
+}
+
+// 递归删除 parent_fd 下名为 name 的条目 返回 0 或 errno
+static int remove_at(int parent_fd, const char *name, struct disk_job *job, int depth) {
+    struct stat st;
+    struct dirent *ent;
+    DIR *dir;
+    int fd;
+    int rc = 0;
+
+    if (fstatat(parent_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        return errno == ENOENT ? 0 : errno;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        if (unlinkat(parent_fd, name, 0) != 0) {
+            return errno == ENOENT ? 0 : errno;
+        }
+        add_progress(job, 1, (uint64_t)st.st_size);
+        return 0;
+    }
+    if (depth >= DISK_JOBS_MAX_DEPTH) {
+        return ELOOP;
+    }
+    fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) {
+        return errno;
+    }
+    dir = fdopendir(fd);
+    if (!dir) {
+        rc = errno;
+        close(fd);
+        return rc;
+    }
+    while (rc == 0 && (ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        rc = remove_at(dirfd(dir), ent->d_name, job, depth + 1);
+    }
+    closedir(dir);
+    if (rc == 0 && unlinkat(parent_fd, name, AT_REMOVEDIR) != 0 && errno != ENOENT) {
+        rc = errno;
+    }
+    if (rc == 0) {
+        add_progress(job, 1, 0);
+    }
+    return rc;
+}
+
+// 复制普通文件内容 优先 copy_file_range 在内核内完成
+static int copy_file_data(int in_fd, int out_fd, struct disk_job *job) {
+    static char buf[COPY_CHUNK];
+    ssize_t n;
+    ssize_t w;
+    ssize_t off;
+    int use_range = 1;
+
+    for (;;) {
+        if (use_range) {
+            n = copy_file_range(in_fd, NULL, out_fd, NULL, COPY_CHUNK, 0);
+            if (n < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+                use_range = 0;
+                continue;
+            }
+        } else {
+            n = read(in_fd, buf, sizeof(buf));
+            for (off = 0; n > 0 && off < n; off += w) {
+                w = write(out_fd, buf + off, (size_t)(n - off));
+                if (w < 0) {
+                    if (errno == EINTR) {
+                        w = 0;
+                        continue;
+                    }
+                    return errno;
+                }
+            }
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        if (n == 0) {
+            return 0;
+        }
+        add_progress(job, 0, (uint64_t)n);
+    }
+}
+
+// 递归复制 src_parent 下的 src_name 到 dst_parent 下的 dst_name 返回 0 或 errno
+static int copy_at(int src_parent, const char *src_name, int dst_parent, const char *dst_name,
+                   struct disk_job *job, int depth) {
+    struct stat st;
+    struct timespec times[2];
+    struct dirent *ent;
+    char target[PATH_MAX];
+    DIR *dir;
+    ssize_t len;
+    int in_fd;
+    int out_fd;
+    int rc = 0;
+
+    if (fstatat(src_parent, src_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+        return errno;
+    }
+    times[0] = st.st_atim;
+    times[1] = st.st_mtim;
+    if (S_ISLNK(st.st_mode)) {
+        len = readlinkat(src_parent, src_name, target, sizeof(target) - 1);
+        if (len < 0) {
+            return errno;
+        }
+        target[len] = '\0';
+        if (symlinkat(target, dst_parent, dst_name) != 0) {
+            return errno;
+        }
+        add_progress(job, 1, (uint64_t)st.st_size);
+        return 0;
+    }
+    if (S_ISREG(st.st_mode)) {
+        in_fd = openat(src_parent, src_name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (in_fd < 0) {
+            return errno;
+        }
+        out_fd = openat(dst_parent, dst_name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, st.st_mode & 07777);
+        if (out_fd < 0) {
+            rc = errno;
+            close(in_fd);
+            return rc;
+        }
+        rc = copy_file_data(in_fd, out_fd, job);
+        if (rc == 0) {
+            futimens(out_fd, times);
+        }
+        close(in_fd);
+        if (close(out_fd) != 0 && rc == 0) {
+            rc = errno;
+        }
+        if (rc == 0) {
+            add_progress(job, 1, 0);
+        }
+        return rc;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        // 设备与管道等特殊文件不复制
+        return 0;
+    }
+    if (depth >= DISK_JOBS_MAX_DEPTH) {
+        return ELOOP;
+    }
+    if (mkdirat(dst_parent, dst_name, (st.st_mode & 07777) | S_IRWXU) != 0) {
+        return errno;
+    }
+    in_fd = openat(src_parent, src_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    out_fd = openat(dst_parent, dst_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (in_fd < 0 || out_fd < 0) {
+        rc = errno;
+        if (in_fd >= 0) {
+            close(in_fd);
+        }
+        if (out_fd >= 0) {
+            close(out_fd);
+        }
+        return rc;
+    }
+    dir = fdopendir(in_fd);
+    if (!dir) {
+        rc = errno;
+        close(in_fd);
+        close(out_fd);
+        return rc;
+    }
+    while (rc == 0 && (ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        rc = copy_at(dirfd(dir), ent->d_name, out_fd, ent->d_name, job, depth + 1);
+    }
+    closedir(dir);
+    if (rc == 0) {
+        fchmod(out_fd, st.st_mode & 07777);
+        futimens(out_fd, times);
+        add_progress(job, 1, 0);
+    }
+    close(out_fd);
+    return rc;
+}
+
+// 从磁盘索引取源路径的总字节数
+static uint64_t lookup_total_bytes(const char *rel) {
+    disk_index_t idx;
+    const struct disk_index_entry *e;
+    uint64_t total = 0;
+
+    if (disk_index_open(&idx, DISK_INDEX_FILE) != 0) {
+        return 0;
+    }
+    e = disk_index_lookup(&idx, rel);
+    if (e) {
+        total = e->size;
+    }
+    disk_index_close(&idx);
+    return total;
+}
+
+// 执行一个任务 返回 0 或 errno
+static int run_job(struct disk_job *job) {
+    char src[PATH_MAX];
+    char dst[PATH_MAX];
+    const char *src_name;
+    const char *dst_name;
+    struct stat st;
+    int src_parent;
+    int dst_parent = -1;
+    int rc;
+
+    if (resolve_path(job->src, src, sizeof(src)) != 0) {
+        return EINVAL;
+    }
+    if (job->op != DISK_JOB_DELETE) {
+        if (resolve_path(job->dst, dst, sizeof(dst)) != 0) {
+            return EINVAL;
+        }
+        // 不能把目录复制或移动到它自己的子树里
+        if (strncmp(dst, src, strlen(src)) == 0 && (dst[strlen(src)] == '/' || dst[strlen(src)] == '\0')) {
+            return EINVAL;
+        }
+    }
+
+    src_parent = open_parent(src, &src_name);
+    if (src_parent < 0) {
+        return errno;
+    }
+    if (job->op == DISK_JOB_DELETE) {
+        job->total_bytes = lookup_total_bytes(job->src);
+        rc = remove_at(src_parent, src_name, job, 0);
+        close(src_parent);
+        return rc;
+    }
+    dst_parent = open_parent(dst, &dst_name);
+    if (dst_parent < 0) {
+        rc = errno;
+        close(src_parent);
+        return rc;
+    }
+    if (fstatat(dst_parent, dst_name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+        rc = EEXIST;
+    } else {
+        job->total_bytes = lookup_total_bytes(job->src);
+        if (job->op == DISK_JOB_MOVE && renameat(src_parent, src_name, dst_parent, dst_name) == 0) {
+            add_progress(job, 1, job->total_bytes);
+            rc = 0;
+        } else if (job->op == DISK_JOB_MOVE && errno != EXDEV) {
+            rc = errno;
+        } else {
+            rc = copy_at(src_parent, src_name, dst_parent, dst_name, job, 0);
+            // 跨文件系统移动 复制完成后删除源 进度改为统计删除前的复制量
+            if (rc == 0 && job->op == DISK_JOB_MOVE) {
+                struct disk_job scratch = *job;
+                rc = remove_at(src_parent, src_name, &scratch, 0);
+            }
+        }
+    }
+    close(src_parent);
+    close(dst_parent);
+    return rc;
+}
+
+// 磁盘任务线程
+void *disk_worker_thread(void *arg) {
+    struct mq_attr attr;
+    struct disk_job *job;
+    char msg[16];
+    mode_t old_mask;
+    mqd_t mq;
+    ssize_t n;
+
+    (void)arg;
+    memset(&attr, 0, sizeof(attr));
+    attr.mq_maxmsg = DISK_JOBS_MQ_MAX;
+    attr.mq_msgsize = sizeof(msg);
+    old_mask = umask(0);
+    mq = mq_open(DISK_JOBS_MQ_NAME, O_CREAT | O_RDONLY | O_CLOEXEC, IPC_OWNER_MODE, &attr);
+    umask(old_mask);
+    if (mq == (mqd_t)-1) {
+        perror("mq_open disk jobs");
+        return NULL;
+    }
+    // Linux 上 mqd_t 即描述符 旧版本以 0666 创建的队列在这里收紧
+    if (ipc_owner_secure((int)mq, IPC_OWNER_MODE) != 0) {
+        mq_close(mq);
+        return NULL;
+    }
+    disk_job_recover();
+    for (;;) {
+        n = mq_receive(mq, msg, sizeof(msg), NULL);
+        if (n < 0) {
+            if (errno != EINTR) {
+                perror("mq_receive disk jobs");
+                sleep(1);
+            }
+            continue;
+        }
+        msg[n < (ssize_t)sizeof(msg) ? n : (ssize_t)sizeof(msg) - 1] = '\0';
+        job = disk_job_begin(atoi(msg));
+        if (!job) {
+            continue;
+        }
+        disk_job_finish(job, run_job(job));
+    }
+    return NULL;
+}
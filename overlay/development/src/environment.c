@@ -3,9 +3,9 @@
  * @brief 天气数据采集线程实现
  *
  * 本文件实现了通过和风天气 API 定期获取当前天气信息，
- * 并将 JSON 响应缓存到本地文件的后台守护线程。
+ * 并将 JSON 响应缓存到本地文件的后台任务。
  * 使用 libcurl 发起 HTTPS 请求，使用 gzip 自动解压，
- * 并通过文件锁确保多进程/线程环境下的写入安全。
+ * 缓存文件以临时文件加 rename 的方式原子替换。
  *
  * @author 杨翊
  * @date 2026-01-23
@@ -14,6 +14,8 @@
  * @note
  * - API 密钥和城市 ID 已硬编码，根据实际情况修改。
  * - 缓存文件路径为 /development/tmp/weather.json。
+ * - 解析结果同时写入共享内存快照，STATE_EXPORT_JSON 为 0 时不再写文件。
+ * - 由事件循环的定时器按 WEATHER_INTERVAL 触发，请求在工作线程中执行。
  **********************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
@@ -21,10 +23,14 @@
 #include <unistd.h>
 #include <time.h>
 #include <fcntl.h>
-#include <sys/file.h>
 #include <curl/curl.h>
 #include "environment.h"
 #include "define.h"
+#include "events.h"
+#include "weather.h"
+#include "state_shm.h"
+#include "atomic_file.h"
+#include "reactor.h"
 
 //回调函数 固定签名要求
 static size_t WriteMemoryCallback(void *contents, size_t size, size_t nmemb, void *userp) {
@@ -87,38 +93,51 @@ static int fetch_weather_to_file() {
         free(chunk.memory);
         return -1;
     }
-    int fd = open(WEATHER_CACHE_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd < 0) {
-        fprintf(stderr, "Failed to open weather cache file for writing\n");
-    } 
-    else {
-        // 加文件锁确保写入安全
-        if (flock(fd, LOCK_EX) != 0) {
-            perror("flock failed");
-        } else {
-            ssize_t written = write(fd, chunk.memory, chunk.size);
-            if (written < 0) {
-                perror("write failed");
-            }
-            flock(fd, LOCK_UN);
-        }
-        close(fd);
+#if STATE_EXPORT_JSON
+    // 原子替换缓存文件 读者不会读到空文件或半截内容
+    if (atomic_write_file(WEATHER_CACHE_FILE, chunk.memory, chunk.size, 0644, 0) != 0) {
+        perror("Failed to write weather cache file");
+    }
+#endif
+    // 解析后写入共享内存快照，并推送给已打开页面的浏览器
+    WeatherData wd;
+    if (parse_weather_json(chunk.memory, &wd) == 0) {
+        state_shm_write_weather(&wd);
+        json_object *obj = weather_data_to_json(&wd);
+        events_publish_json(EVENT_WEATHER, obj);
+        json_object_put(obj);
     }
     curl_easy_cleanup(curl);// 清理curl
     free(chunk.memory);
     return 0;
 }
-// 环境数据采集线程
-void *environment_thread(void *arg) {
-    printf("environment daemon thread started.\n");
+// 工作线程中获取一次天气
+static void fetch_job(void *arg) {
+    char timebuf[64];
+
+    (void)arg;
+    get_current_time_str(timebuf, sizeof(timebuf));
+    printf("[%s] Fetching weather...\n", timebuf);
+    fetch_weather_to_file();
+}
+// 定时提交天气获取 请求可能阻塞数秒 不在事件循环中执行
+static void weather_tick(void *arg) {
+    (void)arg;
+    if (reactor_submit(fetch_job, NULL) != 0) {
+        fprintf(stderr, "Weather fetch skipped: worker queue full\n");
+    }
+}
+// 在事件循环上启动天气采集
+int environment_start(void) {
+    struct reactor_timer *t;
+
     printf("Weather cache file: %s\n", WEATHER_CACHE_FILE);
     printf("Checking weather every %d seconds.\n", WEATHER_INTERVAL);
-    while (1) {
-        char timebuf[64];
-        get_current_time_str(timebuf, sizeof(timebuf));
-        printf("[%s] Fetching weather...\n", timebuf);
-        fetch_weather_to_file();
-        sleep(WEATHER_INTERVAL);
+    t = reactor_timer_new(weather_tick, NULL);
+    if (!t) {
+        return -1;
     }
-    return NULL;
-}
\ No newline at end of file
+    // 启动后立即获取一次
+    reactor_timer_set(t, 1, WEATHER_INTERVAL * 1000);
+    return 0;
+}
@@ -0,0 +1,660 @@
+/**********************************************************************
+ * @file events.c
+ * @brief 服务器推送事件（SSE）线程实现
+ *
+ * 本文件实现 /home/events 推送通道：lighttpd 以 SCGI 方式把请求转到
+ * 守护进程的 unix 套接字，各采集线程产生新数据时调用 events_publish，
+ * 本线程把变化的主题推给订阅了该主题的浏览器，页面无需轮询。
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ *
+ * @note
+ * - 每个主题只保存最新一份 JSON 与版本号，内容未变化的发布直接忽略
+ * - 每个连接记录各主题已发送的版本，发送缓冲区清空后才取最新版本，
+ *   慢速客户端只会错过中间值，不会积压
+ * - 新连接先收到所订阅主题的当前值，断线重连即可恢复完整状态
+ * - 系统指标只在有订阅者时按间隔采样，无人查看时不产生任何开销
+ * - 单线程 poll 处理全部连接，心跳时复核会话，注销后连接随即关闭
+ * - 连接与 CGI 使用同一套令牌校验（签名、签名内到期时间、会话表），
+ *   只查询会话不续期，推送连接不会让会话永不过期
+ * - SCGI 请求头在 poll 循环内非阻塞读取，超时未读完的连接直接关闭，
+ *   迟迟不发请求的客户端不会卡住其他连接的推送
+ * - 套接字权限为 0600，属主为 lighttpd 运行用户
+ **********************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "events.h"
+#include "ipc_owner.h"
+#include "session_store.h"
+#include "session_token.h"
+#include "state_shm.h"
+#include "system.h"
+#include "weather.h"
+#include "zigbee_mq.h"
+
+#define EVENTS_TOKEN_MAX 128
+#define EVENTS_FRAME_MAX 8192
+
+struct topic_state {
+    char *json;
+    unsigned long version;
+};
+
+// 已接受但请求头尚未读完的连接
+struct pending_conn {
+    int fd;
+    time_t deadline;
+    size_t got;
+    char buf[EVENTS_HEADER_MAX];
+};
+
+struct event_client {
+    int fd;
+    unsigned topics;
+    unsigned long sent[EVENT_TOPIC_COUNT];
+    char token[EVENTS_TOKEN_MAX];
+    char *out;
+    size_t out_len;
+    size_t out_off;
+};
+
+static const char *topic_names[EVENT_TOPIC_COUNT] = {
+    "temperature", "weather", "devices", "system"
+};
+
+static struct topic_state g_topics[EVENT_TOPIC_COUNT];
+static pthread_mutex_t g_topics_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t g_wake_once = PTHREAD_ONCE_INIT;
+static int g_wake_fd = -1;
+static struct event_client g_clients[EVENTS_MAX_CLIENTS];
+static int g_client_count = 0;
+static struct pending_conn g_pending[EVENTS_PENDING_MAX];
+static int g_pending_count = 0;
+
+// 创建唤醒推送线程用的 eventfd
+static void create_wake_fd(void) {
+    g_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+// 发布主题的最新值 json 须为单行
+void events_publish(enum event_topic topic, const char *json) {
+    uint64_t one = 1;
+    char *copy;
+    char *p;
+
+    if ((unsigned)topic >= EVENT_TOPIC_COUNT || !json) {
+        return;
+    }
+    pthread_once(&g_wake_once, create_wake_fd);
+    pthread_mutex_lock(&g_topics_lock);
+    if (g_topics[topic].json && strcmp(g_topics[topic].json, json) == 0) {
+        pthread_mutex_unlock(&g_topics_lock);
+        return;
+    }
+    copy = strdup(json);
+    if (!copy) {
+        pthread_mutex_unlock(&g_topics_lock);
+        return;
+    }
+    // SSE 的 data 行不能含换行
+    for (p = copy; *p; p++) {
+        if (*p == '\n' || *p == '\r') {
+            *p = ' ';
+        }
+    }
+    free(g_topics[topic].json);
+    g_topics[topic].json = copy;
+    g_topics[topic].version++;
+    pthread_mutex_unlock(&g_topics_lock);
+    if (g_wake_fd >= 0 && write(g_wake_fd, &one, sizeof(one)) < 0) {
+        // 计数器已满时推送线程本来就会被唤醒
+    }
+}
+
+// 发布 JSON 对象
+void events_publish_json(enum event_topic topic, json_object *obj) {
+    if (obj) {
+        events_publish(topic, json_object_to_json_string_ext(obj, JSON_C_TO_STRING_PLAIN));
+    }
+}
+
+// 发布设备开关状态 字段名与 /home/control/{device} 的设备名一致
+void events_publish_devices(void) {
+    int light, fan, aircon, washing, door, wifi;
+    char json[160];
+
+    get_device_states(&light, &fan, &aircon, &washing, &door, &wifi);
+    snprintf(json, sizeof(json),
+             "{\"light\":%d,\"aircon\":%d,\"washing_machine\":%d,\"fan\":%d,\"door\":%d,\"wifi\":%d}",
+             light, aircon, washing, fan, door, wifi);
+    events_publish(EVENT_DEVICES, json);
+}
+
+// 读取整个小文件 调用方释放
+static char *read_small_file(const char *path) {
+    FILE *f = fopen(path, "r");
+    char *buf;
+    long size;
+
+    if (!f) {
+        return NULL;
+    }
+    if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) <= 0 || size > 65536) {
+        fclose(f);
+        return NULL;
+    }
+    rewind(f);
+    buf = malloc((size_t)size + 1);
+    if (buf && fread(buf, 1, (size_t)size, f) != (size_t)size) {
+        free(buf);
+        buf = NULL;
+    }
+    if (buf) {
+        buf[size] = '\0';
+    }
+    fclose(f);
+    return buf;
+}
+
+// 启动时用状态快照填充各主题 快照为空时读缓存文件 采集线程之后会推送新值
+static void seed_topics(void) {
+    struct state_temperature t;
+    char *text;
+    json_object *obj;
+    WeatherData wd;
+
+    if (state_shm_read_temperature(&t, NULL) == 0) {
+        obj = state_temperature_to_json(&t);
+        events_publish_json(EVENT_TEMPERATURE, obj);
+        json_object_put(obj);
+    } else if ((text = read_small_file(OUTPUT_FILE)) != NULL) {
+        obj = json_tokener_parse(text);
+        events_publish_json(EVENT_TEMPERATURE, obj);
+        json_object_put(obj);
+        free(text);
+    }
+    if (state_shm_read_weather(&wd, NULL) == 0) {
+        obj = weather_data_to_json(&wd);
+        events_publish_json(EVENT_WEATHER, obj);
+        json_object_put(obj);
+    } else if ((text = read_small_file(WEATHER_CACHE_FILE)) != NULL) {
+        if (parse_weather_json(text, &wd) == 0) {
+            obj = weather_data_to_json(&wd);
+            events_publish_json(EVENT_WEATHER, obj);
+            json_object_put(obj);
+        }
+        free(text);
+    }
+    events_publish_devices();
+}
+
+// 采集一次系统指标
+static void sample_system(void) {
+    system_info_t info;
+    json_object *obj;
+
+    if (collect_system_info(&info)) {
+        obj = system_info_to_json(&info);
+        events_publish_json(EVENT_SYSTEM, obj);
+        json_object_put(obj);
+    }
+}
+
+// 创建监听套接字 仅 lighttpd 运行用户可连接
+static int open_listen_socket(void) {
+    struct sockaddr_un addr;
+    mode_t old_mask;
+    uid_t uid;
+    gid_t gid;
+    int fd;
+    int rc;
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (fd < 0) {
+        perror("events socket");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", EVENTS_SOCKET);
+    unlink(EVENTS_SOCKET);
+    // 创建时即为 0600 不留可被其他用户连接的窗口
+    old_mask = umask(0177);
+    rc = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+    if (rc != 0 || listen(fd, 16) != 0) {
+        perror("events bind");
+        close(fd);
+        return -1;
+    }
+    if (geteuid() == 0) {
+        if (ipc_owner_lookup(&uid, &gid) != 0 || chown(EVENTS_SOCKET, uid, gid) != 0) {
+            perror("events chown");
+            close(fd);
+            unlink(EVENTS_SOCKET);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+// 在 SCGI 头中查找变量
+static const char *scgi_header(const char *buf, size_t len, const char *key) {
+    const char *p = buf;
+    const char *end = buf + len;
+    const char *val;
+
+    while (p < end) {
+        val = memchr(p, '\0', (size_t)(end - p));
+        if (!val || val + 1 >= end) {
+            return NULL;
+        }
+        val++;
+        if (strcmp(p, key) == 0) {
+            return val;
+        }
+        p = memchr(val, '\0', (size_t)(end - val));
+        if (!p) {
+            return NULL;
+        }
+        p++;
+    }
+    return NULL;
+}
+
+// 解析已读到的 SCGI 请求头 完整返回 1 需继续读返回 0 格式错误返回 -1
+static int parse_scgi_request(const char *buf, size_t got, size_t *start, size_t *len) {
+    const char *colon;
+    size_t head;
+    size_t need;
+
+    colon = memchr(buf, ':', got);
+    if (!colon) {
+        return got > 8 ? -1 : 0;
+    }
+    head = (size_t)(colon - buf) + 1;
+    need = head + strtoul(buf, NULL, 10) + 1;
+    if (need > EVENTS_HEADER_MAX || need <= head + 1) {
+        return -1;
+    }
+    if (got < need) {
+        return 0;
+    }
+    if (buf[need - 1] != ',') {
+        return -1;
+    }
+    *start = head;
+    *len = need - head - 1;
+    return 1;
+}
+
+// 从 Cookie 中取 token
+static int cookie_token(const char *cookie, char *token, size_t size) {
+    const char *p = cookie;
+    size_t n;
+
+    while (p && (p = strstr(p, "token=")) != NULL) {
+        if (p == cookie || p[-1] == ' ' || p[-1] == ';') {
+            p += 6;
+            n = strcspn(p, ";");
+            if (n == 0 || n >= size) {
+                return -1;
+            }
+            memcpy(token, p, n);
+            token[n] = '\0';
+            return 0;
+        }
+        p += 6;
+    }
+    return -1;
+}
+
+// 解析 topics=a,b 参数 未指定时订阅全部
+static unsigned parse_topics(const char *query) {
+    char list[256];
+    char *tok;
+    char *save = NULL;
+    const char *p;
+    unsigned mask = 0;
+    int i;
+
+    p = query ? strstr(query, "topics=") : NULL;
+    if (!p || (p != query && p[-1] != '&')) {
+        return (1u << EVENT_TOPIC_COUNT) - 1;
+    }
+    snprintf(list, sizeof(list), "%s", p + 7);
+    list[strcspn(list, "&")] = '\0';
+    for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        for (i = 0; i < EVENT_TOPIC_COUNT; i++) {
+            if (strcmp(tok, topic_names[i]) == 0) {
+                mask |= 1u << i;
+            }
+        }
+    }
+    return mask;
+}
+
+// 直接回写一段短响应并关闭连接
+static void reject(int fd, const char *status, const char *body) {
+    char resp[256];
+    int n;
+
+    n = snprintf(resp, sizeof(resp), "Status: %s\r\nContent-Type: application/json\r\n\r\n%s\n", status, body);
+    if (write(fd, resp, (size_t)n) < 0) {
+        // 连接已断开
+    }
+    close(fd);
+}
+
+// 追加待发送数据
+static int client_append(struct event_client *c, const char *data, size_t len) {
+    char *p;
+
+    p = realloc(c->out, c->out_len + len);
+    if (!p) {
+        return -1;
+    }
+    memcpy(p + c->out_len, data, len);
+    c->out = p;
+    c->out_len += len;
+    return 0;
+}
+
+// 尽量写出缓冲区 返回 -1 表示连接已断开
+static int client_flush(struct event_client *c) {
+    ssize_t n;
+
+    while (c->out_off < c->out_len) {
+        n = write(c->fd, c->out + c->out_off, c->out_len - c->out_off);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 0;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        c->out_off += (size_t)n;
+    }
+    free(c->out);
+    c->out = NULL;
+    c->out_len = 0;
+    c->out_off = 0;
+    return 0;
+}
+
+// 缓冲区已清空时 取各订阅主题的最新版本组帧
+static void client_fill(struct event_client *c) {
+    char frame[EVENTS_FRAME_MAX];
+    int i;
+    int n;
+
+    if (c->out_len > 0) {
+        return;
+    }
+    pthread_mutex_lock(&g_topics_lock);
+    for (i = 0; i < EVENT_TOPIC_COUNT; i++) {
+        if (!(c->topics & (1u << i)) || !g_topics[i].json || c->sent[i] == g_topics[i].version) {
+            continue;
+        }
+        n = snprintf(frame, sizeof(frame), "event: %s\ndata: %s\n\n", topic_names[i], g_topics[i].json);
+        if (n > 0 && (size_t)n < sizeof(frame) && client_append(c, frame, (size_t)n) == 0) {
+            c->sent[i] = g_topics[i].version;
+        }
+    }
+    pthread_mutex_unlock(&g_topics_lock);
+}
+
+// 关闭并移除连接
+static void client_drop(int i) {
+    close(g_clients[i].fd);
+    free(g_clients[i].out);
+    g_clients[i] = g_clients[--g_client_count];
+}
+
+// 令牌签名有效且会话仍在 只查询不续期
+static int token_valid(const char *token) {
+    return session_token_verify(token) && session_store_peek(token, NULL, 0);
+}
+
+// 请求头读完 校验会话后发送响应头与当前值
+static void start_client(int fd, const char *req, size_t len) {
+    const char *header =
+        "Status: 200 OK\r\n"
+        "Content-Type: text/event-stream\r\n"
+        "Cache-Control: no-cache\r\n"
+        "X-Accel-Buffering: no\r\n\r\n"
+        "retry: 5000\n\n";
+    struct event_client *c;
+    char token[EVENTS_TOKEN_MAX];
+    const char *cookie;
+
+    cookie = scgi_header(req, len, "HTTP_COOKIE");
+    if (!cookie || cookie_token(cookie, token, sizeof(token)) != 0 || !token_valid(token)) {
+        reject(fd, "401 Unauthorized", "{\"error\":\"Unauthorized\",\"redirect\":\"/login.html\"}");
+        return;
+    }
+    if (g_client_count >= EVENTS_MAX_CLIENTS) {
+        reject(fd, "503 Service Unavailable", "{\"error\":\"Too many event streams\"}");
+        return;
+    }
+    c = &g_clients[g_client_count++];
+    memset(c, 0, sizeof(*c));
+    c->fd = fd;
+    c->topics = parse_topics(scgi_header(req, len, "QUERY_STRING"));
+    snprintf(c->token, sizeof(c->token), "%s", token);
+    client_append(c, header, strlen(header));
+    client_fill(c);
+    if (client_flush(c) != 0) {
+        client_drop(g_client_count - 1);
+    }
+}
+
+// 关闭并移除未完成请求头的连接
+static void pending_drop(int i) {
+    close(g_pending[i].fd);
+    g_pending[i] = g_pending[--g_pending_count];
+}
+
+// 接受所有排队的连接 请求头留到可读时再读
+static void accept_pending(int listen_fd) {
+    int fd;
+
+    while ((fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)) >= 0) {
+        if (g_pending_count >= EVENTS_PENDING_MAX) {
+            close(fd);
+            continue;
+        }
+        g_pending[g_pending_count].fd = fd;
+        g_pending[g_pending_count].got = 0;
+        g_pending[g_pending_count].deadline = time(NULL) + EVENTS_HEADER_TIMEOUT;
+        g_pending_count++;
+    }
+}
+
+// 读取请求头的可用部分 读完后转为推送连接
+static void pending_read(int i) {
+    struct pending_conn *p = &g_pending[i];
+    size_t start;
+    size_t len;
+    ssize_t n;
+    int fd;
+    int rc;
+
+    n = read(p->fd, p->buf + p->got, sizeof(p->buf) - p->got);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return;
+    }
+    if (n <= 0) {
+        pending_drop(i);
+        return;
+    }
+    p->got += (size_t)n;
+    rc = parse_scgi_request(p->buf, p->got, &start, &len);
+    if (rc == 0 && p->got < sizeof(p->buf)) {
+        return;
+    }
+    if (rc <= 0) {
+        pending_drop(i);
+        return;
+    }
+    // 先移出等待表 start_client 可能关闭描述符
+    fd = p->fd;
+    p->fd = -1;
+    start_client(fd, p->buf + start, len);
+    g_pending[i] = g_pending[--g_pending_count];
+}
+
+// 心跳：复核会话 空闲连接发注释行保活并及时发现断开
+static void heartbeat(void) {
+    static const char ping[] = ": ping\n\n";
+    int i;
+
+    for (i = g_client_count - 1; i >= 0; i--) {
+        if (!token_valid(g_clients[i].token)) {
+            client_drop(i);
+            continue;
+        }
+        if (g_clients[i].out_len == 0) {
+            client_append(&g_clients[i], ping, sizeof(ping) - 1);
+        }
+    }
+}
+
+// 是否有连接订阅了系统指标
+static int system_wanted(void) {
+    int i;
+
+    for (i = 0; i < g_client_count; i++) {
+        if (g_clients[i].topics & (1u << EVENT_SYSTEM)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// 推送线程
+void *events_thread(void *arg) {
+    struct pollfd fds[EVENTS_MAX_CLIENTS + EVENTS_PENDING_MAX + 2];
+    struct pollfd *pfds;
+    struct pollfd *cfds;
+    char drain[256];
+    uint64_t count;
+    time_t now;
+    time_t next_beat;
+    time_t next_system = 0;
+    time_t wake;
+    int listen_fd;
+    int timeout;
+    int i;
+    int n;
+
+    (void)arg;
+    pthread_once(&g_wake_once, create_wake_fd);
+    listen_fd = open_listen_socket();
+    if (listen_fd < 0 || g_wake_fd < 0) {
+        fprintf(stderr, "Events init failed, events thread exiting.\n");
+        return NULL;
+    }
+    seed_topics();
+    printf("Events thread started, listening on %s\n", EVENTS_SOCKET);
+    next_beat = time(NULL) + EVENTS_HEARTBEAT;
+
+    while (1) {
+        now = time(NULL);
+        if (system_wanted() && now >= next_system) {
+            sample_system();
+            next_system = now + EVENTS_SYSTEM_INTERVAL;
+        }
+        if (now >= next_beat) {
+            heartbeat();
+            next_beat = now + EVENTS_HEARTBEAT;
+        }
+        // 请求头超时未读完的连接直接关闭
+        for (i = g_pending_count - 1; i >= 0; i--) {
+            if (now >= g_pending[i].deadline) {
+                pending_drop(i);
+            }
+        }
+        for (i = g_client_count - 1; i >= 0; i--) {
+            client_fill(&g_clients[i]);
+            if (client_flush(&g_clients[i]) != 0) {
+                client_drop(i);
+            }
+        }
+
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = g_wake_fd;
+        fds[1].events = POLLIN;
+        pfds = fds + 2;
+        for (i = 0; i < g_pending_count; i++) {
+            pfds[i].fd = g_pending[i].fd;
+            pfds[i].events = POLLIN;
+        }
+        cfds = pfds + g_pending_count;
+        for (i = 0; i < g_client_count; i++) {
+            cfds[i].fd = g_clients[i].fd;
+            cfds[i].events = POLLIN | (g_clients[i].out_len > 0 ? POLLOUT : 0);
+        }
+        wake = next_beat;
+        if (system_wanted() && next_system < wake) {
+            wake = next_system;
+        }
+        for (i = 0; i < g_pending_count; i++) {
+            if (g_pending[i].deadline < wake) {
+                wake = g_pending[i].deadline;
+            }
+        }
+        timeout = wake > now ? (int)(wake - now) * 1000 : 0;
+        n = poll(fds, (nfds_t)(g_pending_count + g_client_count + 2), timeout);
+        if (n < 0) {
+            if (errno != EINTR) {
+                perror("events poll");
+                sleep(1);
+            }
+            continue;
+        }
+        if (fds[1].revents & POLLIN) {
+            if (read(g_wake_fd, &count, sizeof(count)) < 0) {
+                // 已被读空
+            }
+        }
+        // 浏览器关闭页面后 lighttpd 关闭连接 这里读到 EOF
+        for (i = g_client_count - 1; i >= 0; i--) {
+            if (cfds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                client_drop(i);
+            } else if ((cfds[i].revents & POLLIN) && read(g_clients[i].fd, drain, sizeof(drain)) <= 0) {
+                client_drop(i);
+            }
+        }
+        // 读完请求头的连接追加到推送连接末尾 不影响上面按下标处理的结果
+        for (i = g_pending_count - 1; i >= 0; i--) {
+            if (pfds[i].revents & POLLIN) {
+                pending_read(i);
+            } else if (pfds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+                pending_drop(i);
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            accept_pending(listen_fd);
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,78 @@
+/**********************************************************************
+ * @file ipc_owner.c
+ * @brief 共享内存与消息队列的属主和权限
+ *
+ * 守护进程以 root 运行，CGI 以 lighttpd 的 nobody 运行，两者共用的
+ * 共享内存、消息队列与套接字归 CGI 用户所有、权限 0600：root 不受
+ * 权限位限制，其他本地用户无法读写会话密钥、伪造状态或注入任务。
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ *
+ * @note
+ * - 以 root 打开时把对象改为 CGI 用户所有，旧版本以 0666 创建的对象
+ *   随之收紧，不必重启。
+ * - 对象属主既不是 root 也不是 CGI 用户，或权限位比要求宽，视为被
+ *   其他用户抢先创建，调用方应拒绝使用。
+ **********************************************************************/
+#include <stdio.h>
+#include <unistd.h>
+#include <pwd.h>
+#include <sys/stat.h>
+#include "ipc_owner.h"
+
+// 查询 CGI 用户的 uid/gid 结果缓存
+int ipc_owner_lookup(uid_t *uid, gid_t *gid) {
+    static int looked_up = 0;
+    static uid_t cached_uid;
+    static gid_t cached_gid;
+    struct passwd pw;
+    struct passwd *res = NULL;
+    char buf[1024];
+
+    if (!__atomic_load_n(&looked_up, __ATOMIC_ACQUIRE)) {
+        if (getpwnam_r(IPC_OWNER_USER, &pw, buf, sizeof(buf), &res) != 0 || !res) {
+            fprintf(stderr, "ipc owner: user %s not found\n", IPC_OWNER_USER);
+            return -1;
+        }
+        cached_uid = pw.pw_uid;
+        cached_gid = pw.pw_gid;
+        __atomic_store_n(&looked_up, 1, __ATOMIC_RELEASE);
+    }
+    *uid = cached_uid;
+    *gid = cached_gid;
+    return 0;
+}
+
+// 校验属主后调整属主与权限 不可信时返回 -1
+int ipc_owner_secure(int fd, mode_t mode) {
+    struct stat st;
+    uid_t uid;
+    gid_t gid;
+    int have_owner;
+
+    have_owner = ipc_owner_lookup(&uid, &gid) == 0;
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+    // 先看属主 其他用户创建的对象不能接手
+    if (st.st_uid != 0 && st.st_uid != geteuid() && !(have_owner && st.st_uid == uid)) {
+        fprintf(stderr, "ipc owner: object owned by unexpected uid %u\n", (unsigned)st.st_uid);
+        return -1;
+    }
+    if (geteuid() == 0 && have_owner && st.st_uid != uid && fchown(fd, uid, gid) != 0) {
+        perror("ipc owner: fchown");
+    }
+    if ((st.st_mode & 07777) != mode && (geteuid() == 0 || st.st_uid == geteuid())) {
+        fchmod(fd, mode);
+    }
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+    if (st.st_mode & ~mode & 0777) {
+        fprintf(stderr, "ipc owner: object mode %o is too permissive\n", (unsigned)(st.st_mode & 0777));
+        return -1;
+    }
+    return 0;
+}
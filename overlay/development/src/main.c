@@ -8,7 +8,8 @@
  * @version 1.0
  *
  * @note
- *
+ * - 串口、消息队列与周期任务由主线程的 epoll 事件循环统一处理，
+ *   阻塞的网络请求交给事件循环的工作线程。
  **********************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,42 +18,72 @@
 #include "check_task.h"
 #include "temperature.h"
 #include "zigbee_mq.h"
+#include "zigbee_serial.h"
 #include "voice.h"
+#include "session_store.h"
+#include "disk_indexer.h"
+#include "disk_worker.h"
+#include "photo_scanner.h"
+#include "events.h"
+#include "reactor.h"
+
+// 清扫过期会话 只是一次共享内存遍历 直接在事件循环中执行
+static void session_sweep(void *arg) {
+    int removed;
+
+    (void)arg;
+    removed = session_store_sweep();
+    if (removed > 0) {
+        printf("[Session] Swept %d expired sessions\n", removed);
+    }
+}
 
 int main() {
-    pthread_t env_thread, task_thread, temp_thread, zig_thread, vo_thread;
+    pthread_t disk_thread, job_thread, photo_thread, ev_thread;
+    struct reactor_timer *sweep_timer;
+    // 先初始化事件循环 屏蔽的信号由之后创建的线程继承
+    if (reactor_init() != 0) {
+        fprintf(stderr, "Failed to init reactor\n");
+        return 1;
+    }
     //初始化 Zigbee 消息队列
     if (init_zigbee_mq() != 0) {
         fprintf(stderr, "Failed to init MQ\n");
         return 1;
     }
-    //创建各个线程
-    if (pthread_create(&env_thread, NULL, environment_thread, NULL) != 0) {
-        perror("Failed to create environment thread");
+    // 设备状态变化时推送给浏览器
+    zigbee_set_state_listener(events_publish_devices);
+    // 串口、消息队列与周期任务挂到事件循环上
+    if (environment_start() != 0 || check_task_start() != 0 || temperature_start() != 0 ||
+        zigbee_serial_start() != 0 || voice_start() != 0) {
+        fprintf(stderr, "Failed to register event handlers\n");
         return EXIT_FAILURE;
     }
-    if (pthread_create(&task_thread, NULL, check_task_thread, NULL) != 0) {
-        perror("Failed to create check_task thread");
+    sweep_timer = reactor_timer_new(session_sweep, NULL);
+    if (!sweep_timer) {
         return EXIT_FAILURE;
     }
-    if (pthread_create(&temp_thread, NULL, temperature_thread, NULL) != 0) {
-        perror("Failed to create temperature thread");
+    reactor_timer_set(sweep_timer, SESSION_SWEEP_INTERVAL * 1000, SESSION_SWEEP_INTERVAL * 1000);
+    // 遍历目录的索引线程与推送服务仍各自一个线程
+    if (pthread_create(&disk_thread, NULL, disk_index_thread, NULL) != 0) {
+        perror("Failed to create disk index thread");
         return EXIT_FAILURE;
     }
-    if (pthread_create(&zig_thread, NULL, zigbee_thread, NULL) != 0) {
-        perror("Failed to create zigbee thread");
+    if (pthread_create(&job_thread, NULL, disk_worker_thread, NULL) != 0) {
+        perror("Failed to create disk job thread");
         return EXIT_FAILURE;
     }
-    if (pthread_create(&vo_thread, NULL, voice_thread, NULL) != 0) {
-        perror("Failed to create voice thread");
+    if (pthread_create(&photo_thread, NULL, photo_index_thread, NULL) != 0) {
+        perror("Failed to create photo index thread");
+        return EXIT_FAILURE;
+    }
+    if (pthread_create(&ev_thread, NULL, events_thread, NULL) != 0) {
+        perror("Failed to create events thread");
+        return EXIT_FAILURE;
+    }
+    // 主线程运行事件循环 收到 SIGINT/SIGTERM 后退出
+    if (reactor_run() != 0) {
         return EXIT_FAILURE;
     }
-
-    pthread_join(env_thread, NULL);
-    pthread_join(task_thread, NULL);
-    pthread_join(temp_thread, NULL);
-    pthread_join(zig_thread, NULL);
-    pthread_join(vo_thread, NULL);
-
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
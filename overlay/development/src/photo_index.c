@@ -0,0 +1,656 @@
+/**********************************************************************
+ * @file photo_index.c
+ * @brief 照片目录索引实现
+ *
+ * 本文件定义照片索引文件格式，提供 CGI 侧的只读访问，
+ * 并实现 CGI 与 environment 守护进程共用的增量重建：
+ * 只解析新增或改动照片的文件头与 EXIF，其余条目沿用旧索引。
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ *
+ * @note
+ * - 条目按 (拍摄时间, 名字) 排序，按日期区间查询为两次二分。
+ * - 拍摄时间取 EXIF DateTimeOriginal，其次 DateTime，都没有时用文件修改时间。
+ * - 备注文件 <照片名>.txt 的内容一并存入字符串区，列表无需逐个打开。
+ * - 重建时对照片目录加 flock 排他锁，守护进程与 CGI 不会同时写；
+ *   写临时文件后 rename 替换，读者无需加锁。
+ **********************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "photo_index.h"
+#include "atomic_file.h"
+
+// 重建时的照片条目 字符串在写出时才放进字符串区
+struct scan_item {
+    char *name;
+    char *note;
+    struct photo_index_entry e;
+};
+
+// 备注文件名与修改时间
+struct scan_note {
+    char *name;
+    int64_t mtime_ns;
+};
+
+// EXIF 解析结果
+struct exif_info {
+    int orientation;
+    int64_t taken;
+    int has_taken;
+};
+
+// 映射索引文件并校验头部
+int photo_index_open(photo_index_t *idx, const char *file) {
+    struct stat st;
+    size_t need;
+    void *p;
+    int fd;
+
+    memset(idx, 0, sizeof(*idx));
+    fd = open(file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct photo_index_header)) {
+        close(fd);
+        return -1;
+    }
+    p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        return -1;
+    }
+    idx->map = p;
+    idx->map_size = (size_t)st.st_size;
+    idx->hdr = p;
+    need = sizeof(struct photo_index_header)
+         + (size_t)idx->hdr->count * sizeof(struct photo_index_entry)
+         + idx->hdr->strings_size;
+    if (idx->hdr->magic != PHOTO_INDEX_MAGIC || idx->hdr->version != PHOTO_INDEX_VERSION
+        || need != idx->map_size) {
+        photo_index_close(idx);
+        return -1;
+    }
+    idx->entries = (const struct photo_index_entry *)(idx->hdr + 1);
+    idx->strings = (const char *)(idx->entries + idx->hdr->count);
+    return 0;
+}
+
+// 解除映射
+void photo_index_close(photo_index_t *idx) {
+    if (idx->map) {
+        munmap(idx->map, idx->map_size);
+    }
+    memset(idx, 0, sizeof(*idx));
+}
+
+// 照片目录的修改时间与建索引时一致则认为索引是新的
+int photo_index_fresh(const photo_index_t *idx, const char *dir) {
+    struct stat st;
+
+    if (stat(dir, &st) != 0) {
+        return 0;
+    }
+    return (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec == idx->hdr->dir_mtime_ns;
+}
+
+// 照片文件名
+const char *photo_index_name(const photo_index_t *idx, const struct photo_index_entry *e) {
+    return idx->strings + e->name_off;
+}
+
+// 备注内容 没有备注时为空串
+const char *photo_index_note(const photo_index_t *idx, const struct photo_index_entry *e) {
+    return idx->strings + e->note_off;
+}
+
+// 求拍摄时间落在 [from, to] 内的条目区间 [first, last)
+void photo_index_range(const photo_index_t *idx, int64_t from, int64_t to, size_t *first, size_t *last) {
+    size_t lo = 0;
+    size_t hi = idx->hdr->count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (idx->entries[mid].taken < from) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *first = lo;
+    hi = idx->hdr->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (idx->entries[mid].taken <= to) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *last = lo;
+}
+
+// 按 TIFF 字节序读取整数
+static uint32_t tiff16(const unsigned char *p, int le) {
+    return le ? (uint32_t)(p[0] | p[1] << 8) : (uint32_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t tiff32(const unsigned char *p, int le) {
+    return le ? (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24
+              : (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+// 在一个 IFD 中查找标签 返回条目位置 未找到返回 NULL
+static const unsigned char *tiff_find(const unsigned char *d, size_t len, int le, uint32_t ifd, uint32_t tag) {
+    uint32_t count;
+    uint32_t i;
+
+    if (ifd > len || len - ifd < 2) {
+        return NULL;
+    }
+    count = tiff16(d + ifd, le);
+    for (i = 0; i < count && ifd + 2 + (i + 1) * 12 <= len; i++) {
+        const unsigned char *e = d + ifd + 2 + i * 12;
+        if (tiff16(e, le) == tag) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+// 解析 "YYYY:MM:DD HH:MM:SS" 形式的 EXIF 时间
+static int tiff_datetime(const unsigned char *d, size_t len, int le, const unsigned char *e, int64_t *out) {
+    char buf[20];
+    uint32_t off;
+    struct tm tm;
+
+    if (!e || tiff16(e + 2, le) != 2 || tiff32(e + 4, le) < 19) {
+        return -1;
+    }
+    off = tiff32(e + 8, le);
+    if (off > len || len - off < 19) {
+        return -1;
+    }
+    memcpy(buf, d + off, 19);
+    buf[19] = '\0';
+    memset(&tm, 0, sizeof(tm));
+    if (sscanf(buf, "%4d:%2d:%2d %2d:%2d:%2d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+               &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6 || tm.tm_year < 1900 || tm.tm_mon < 1) {
+        return -1;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    *out = (int64_t)timegm(&tm);
+    return 0;
+}
+
+// 解析 APP1 段 data 从 "Exif\0\0" 开始
+static void exif_parse(const unsigned char *data, size_t len, struct exif_info *info) {
+    const unsigned char *d;
+    const unsigned char *e;
+    uint32_t ifd0;
+    int le;
+
+    info->orientation = 1;
+    info->has_taken = 0;
+    if (len < 14 || memcmp(data, "Exif\0\0", 6) != 0) {
+        return;
+    }
+    d = data + 6;
+    len -= 6;
+    le = d[0] == 'I';
+    ifd0 = tiff32(d + 4, le);
+    e = tiff_find(d, len, le, ifd0, 0x0112);
+    if (e) {
+        uint32_t v = tiff16(e + 8, le);
+        info->orientation = v >= 1 && v <= 8 ? (int)v : 1;
+    }
+    // DateTimeOriginal 在 Exif 子 IFD 中 其次用 IFD0 的 DateTime
+    e = tiff_find(d, len, le, ifd0, 0x8769);
+    if (e) {
+        uint32_t sub = tiff32(e + 8, le);
+        if (tiff_datetime(d, len, le, tiff_find(d, len, le, sub, 0x9003), &info->taken) == 0) {
+            info->has_taken = 1;
+            return;
+        }
+    }
+    if (tiff_datetime(d, len, le, tiff_find(d, len, le, ifd0, 0x0132), &info->taken) == 0) {
+        info->has_taken = 1;
+    }
+}
+
+// 取 EXIF 方向标记 默认为 1
+int photo_exif_orientation(const unsigned char *data, size_t len) {
+    struct exif_info info;
+
+    exif_parse(data, len, &info);
+    return info.orientation;
+}
+
+// 读取大端 16 位整数
+static unsigned int be16(const unsigned char *p) {
+    return (unsigned int)p[0] << 8 | p[1];
+}
+
+// 扫描 JPEG 段 取 SOF 中的尺寸与 APP1 中的 EXIF
+static int probe_jpeg(FILE *fp, struct photo_index_entry *e, struct exif_info *exif) {
+    unsigned char hdr[4];
+    unsigned char sof[5];
+    unsigned char *app1;
+    int seen_exif = 0;
+
+    for (;;) {
+        unsigned int len;
+        int marker;
+
+        if (fread(hdr, 1, 2, fp) != 2 || hdr[0] != 0xff) {
+            return -1;
+        }
+        marker = hdr[1];
+        // 填充字节
+        if (marker == 0xff) {
+            fseek(fp, -1, SEEK_CUR);
+            continue;
+        }
+        if (marker == 0xd8 || (marker >= 0xd0 && marker <= 0xd7) || marker == 0x01) {
+            continue;
+        }
+        if (marker == 0xd9 || marker == 0xda) {
+            return -1;
+        }
+        if (fread(hdr + 2, 1, 2, fp) != 2) {
+            return -1;
+        }
+        len = be16(hdr + 2);
+        if (len < 2) {
+            return -1;
+        }
+        len -= 2;
+        if (marker == 0xe1 && !seen_exif && len >= 14) {
+            app1 = malloc(len);
+            if (!app1 || fread(app1, 1, len, fp) != len) {
+                free(app1);
+                return -1;
+            }
+            if (memcmp(app1, "Exif\0\0", 6) == 0) {
+                exif_parse(app1, len, exif);
+                seen_exif = 1;
+            }
+            free(app1);
+            continue;
+        }
+        // SOF0 至 SOF15 除去 DHT、JPG 与 DAC
+        if (marker >= 0xc0 && marker <= 0xcf && marker != 0xc4 && marker != 0xc8 && marker != 0xcc) {
+            if (len < 5 || fread(sof, 1, 5, fp) != 5) {
+                return -1;
+            }
+            e->height = be16(sof + 1);
+            e->width = be16(sof + 3);
+            return 0;
+        }
+        if (fseek(fp, (long)len, SEEK_CUR) != 0) {
+            return -1;
+        }
+    }
+}
+
+// 只读文件头取尺寸、方向与拍摄时间 支持 JPEG、PNG 与 GIF
+static void probe_photo(int dirfd, const char *name, struct photo_index_entry *e) {
+    unsigned char head[24];
+    struct exif_info exif;
+    struct tm tm;
+    time_t mtime = (time_t)(e->mtime_ns / 1000000000LL);
+    FILE *fp;
+    size_t n;
+    int fd;
+
+    exif.orientation = 1;
+    exif.has_taken = 0;
+    e->width = 0;
+    e->height = 0;
+    fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+    fp = fd >= 0 ? fdopen(fd, "rb") : NULL;
+    if (fp) {
+        n = fread(head, 1, sizeof(head), fp);
+        if (n >= 3 && head[0] == 0xff && head[1] == 0xd8 && head[2] == 0xff) {
+            fseek(fp, 2, SEEK_SET);
+            probe_jpeg(fp, e, &exif);
+        } else if (n >= 24 && memcmp(head, "\x89PNG\r\n\x1a\n", 8) == 0 && memcmp(head + 12, "IHDR", 4) == 0) {
+            e->width = (uint32_t)head[16] << 24 | (uint32_t)head[17] << 16 | (uint32_t)head[18] << 8 | head[19];
+            e->height = (uint32_t)head[20] << 24 | (uint32_t)head[21] << 16 | (uint32_t)head[22] << 8 | head[23];
+        } else if (n >= 10 && (memcmp(head, "GIF87a", 6) == 0 || memcmp(head, "GIF89a", 6) == 0)) {
+            e->width = (uint32_t)(head[6] | head[7] << 8);
+            e->height = (uint32_t)(head[8] | head[9] << 8);
+        }
+        fclose(fp);
+    } else if (fd >= 0) {
+        close(fd);
+    }
+    e->orientation = (uint16_t)exif.orientation;
+    if (exif.orientation >= 5) {
+        uint32_t t = e->width;
+        e->width = e->height;
+        e->height = t;
+    }
+    if (exif.has_taken) {
+        e->taken = exif.taken;
+        e->flags |= PHOTO_INDEX_EXIF_TIME;
+    } else {
+        // 与 EXIF 一致 用本地时间的各字段按 UTC 换算
+        localtime_r(&mtime, &tm);
+        e->taken = (int64_t)timegm(&tm);
+    }
+}
+
+// 是否为索引收录的照片文件
+static int is_photo_name(const char *name) {
+    const char *ext = strrchr(name, '.');
+    const char *p;
+
+    if (name[0] == '.' || !ext || ext == name) {
+        return 0;
+    }
+    for (p = name; *p; p++) {
+        if ((unsigned char)*p < 0x20) {
+            return 0;
+        }
+    }
+    ext++;
+    return strcasecmp(ext, "jpg") == 0 || strcasecmp(ext, "jpeg") == 0
+        || strcasecmp(ext, "png") == 0 || strcasecmp(ext, "gif") == 0;
+}
+
+// 读取备注文件 超长部分截断
+static char *read_note(int dirfd, const char *name) {
+    char *buf;
+    ssize_t n;
+    int fd;
+
+    fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    buf = malloc(PHOTO_INDEX_NOTE_MAX + 1);
+    if (!buf) {
+        close(fd);
+        return NULL;
+    }
+    n = read(fd, buf, PHOTO_INDEX_NOTE_MAX);
+    close(fd);
+    if (n < 0) {
+        free(buf);
+        return NULL;
+    }
+    buf[n] = '\0';
+    return buf;
+}
+
+// 按名字比较旧索引条目
+static int old_name_cmp(const void *a, const void *b, void *arg) {
+    const photo_index_t *idx = arg;
+
+    return strcmp(photo_index_name(idx, *(const struct photo_index_entry *const *)a),
+                  photo_index_name(idx, *(const struct photo_index_entry *const *)b));
+}
+
+// 在按名字排序的旧索引条目中查找
+static const struct photo_index_entry *old_find(const photo_index_t *idx, const struct photo_index_entry **sorted,
+                                                const char *name) {
+    size_t lo = 0;
+    size_t hi = idx->map ? idx->hdr->count : 0;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int r = strcmp(photo_index_name(idx, sorted[mid]), name);
+        if (r == 0) {
+            return sorted[mid];
+        }
+        if (r < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+static int note_cmp(const void *a, const void *b) {
+    return strcmp(((const struct scan_note *)a)->name, ((const struct scan_note *)b)->name);
+}
+
+// 按 (拍摄时间, 名字) 排序
+static int item_cmp(const void *a, const void *b) {
+    const struct scan_item *x = a;
+    const struct scan_item *y = b;
+
+    if (x->e.taken != y->e.taken) {
+        return x->e.taken < y->e.taken ? -1 : 1;
+    }
+    return strcmp(x->name, y->name);
+}
+
+// 写出索引文件 先写临时文件再原子替换
+static int write_index(const char *file, struct scan_item *items, size_t count, int64_t dir_mtime_ns) {
+    struct atomic_file af;
+    struct photo_index_header hdr;
+    size_t strings_size = 1;
+    uint32_t off = 1;
+    size_t i;
+    FILE *fp;
+    int ok;
+
+    for (i = 0; i < count; i++) {
+        strings_size += strlen(items[i].name) + 1;
+        if (items[i].note && items[i].note[0]) {
+            strings_size += strlen(items[i].note) + 1;
+        }
+    }
+    if (strings_size > UINT32_MAX || count > UINT32_MAX) {
+        return -1;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = PHOTO_INDEX_MAGIC;
+    hdr.version = PHOTO_INDEX_VERSION;
+    hdr.count = (uint32_t)count;
+    hdr.strings_size = (uint32_t)strings_size;
+    hdr.built_at = (int64_t)time(NULL);
+    hdr.dir_mtime_ns = dir_mtime_ns;
+
+    fp = atomic_file_open(&af, file, 0644, 0);
+    if (!fp) {
+        perror("photo index: create temp file");
+        return -1;
+    }
+    ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+    // 字符串区首字节为空串 没有备注的条目指向这里
+    for (i = 0; ok && i < count; i++) {
+        struct photo_index_entry *e = &items[i].e;
+        e->name_len = (uint32_t)strlen(items[i].name);
+        e->name_off = off;
+        off += e->name_len + 1;
+        e->note_len = items[i].note ? (uint32_t)strlen(items[i].note) : 0;
+        e->note_off = 0;
+        if (e->note_len) {
+            e->note_off = off;
+            off += e->note_len + 1;
+        }
+        ok = fwrite(e, sizeof(*e), 1, fp) == 1;
+    }
+    ok = ok && fputc('\0', fp) != EOF;
+    for (i = 0; ok && i < count; i++) {
+        ok = fwrite(items[i].name, items[i].e.name_len + 1, 1, fp) == 1;
+        if (ok && items[i].e.note_len) {
+            ok = fwrite(items[i].note, items[i].e.note_len + 1, 1, fp) == 1;
+        }
+    }
+    if (!ok) {
+        atomic_file_abort(&af);
+    }
+    if (!ok || atomic_file_commit(&af) != 0) {
+        perror("photo index: write");
+        return -1;
+    }
+    return 0;
+}
+
+// 增量重建照片索引 未改动的照片沿用旧条目 不再打开文件
+int photo_index_rebuild(const char *dir, const char *file) {
+    photo_index_t old;
+    const struct photo_index_entry **old_sorted = NULL;
+    struct scan_item *items = NULL;
+    struct scan_note *notes = NULL;
+    size_t item_count = 0;
+    size_t item_cap = 0;
+    size_t note_count = 0;
+    size_t note_cap = 0;
+    struct dirent *ent;
+    struct stat st;
+    DIR *d;
+    size_t i;
+    int dfd;
+    int rc = -1;
+
+    dfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd < 0) {
+        return -1;
+    }
+    if (flock(dfd, LOCK_EX) != 0 || fstat(dfd, &st) != 0) {
+        close(dfd);
+        return -1;
+    }
+    int64_t dir_mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+
+    if (photo_index_open(&old, file) == 0) {
+        old_sorted = malloc(sizeof(*old_sorted) * (old.hdr->count ? old.hdr->count : 1));
+        if (!old_sorted) {
+            photo_index_close(&old);
+        } else {
+            for (i = 0; i < old.hdr->count; i++) {
+                old_sorted[i] = &old.entries[i];
+            }
+            qsort_r(old_sorted, old.hdr->count, sizeof(*old_sorted), old_name_cmp, &old);
+        }
+    }
+
+    d = fdopendir(dup(dfd));
+    if (!d) {
+        goto out;
+    }
+    while ((ent = readdir(d)) != NULL) {
+        size_t len = strlen(ent->d_name);
+        int is_note = len > 4 && strcmp(ent->d_name + len - 4, ".txt") == 0;
+
+        if (ent->d_type != DT_REG && ent->d_type != DT_UNKNOWN) {
+            continue;
+        }
+        if (!is_note && !is_photo_name(ent->d_name)) {
+            continue;
+        }
+        if (fstatat(dfd, ent->d_name, &st, 0) != 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if (is_note) {
+            if (note_count == note_cap) {
+                struct scan_note *p;
+                note_cap = note_cap ? note_cap * 2 : 64;
+                p = realloc(notes, note_cap * sizeof(*notes));
+                if (!p) {
+                    closedir(d);
+                    goto out;
+                }
+                notes = p;
+            }
+            notes[note_count].name = strdup(ent->d_name);
+            notes[note_count].mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+            if (notes[note_count].name) {
+                note_count++;
+            }
+            continue;
+        }
+        if (item_count == item_cap) {
+            struct scan_item *p;
+            item_cap = item_cap ? item_cap * 2 : 256;
+            p = realloc(items, item_cap * sizeof(*items));
+            if (!p) {
+                closedir(d);
+                goto out;
+            }
+            items = p;
+        }
+        memset(&items[item_count], 0, sizeof(items[0]));
+        items[item_count].name = strdup(ent->d_name);
+        if (!items[item_count].name) {
+            closedir(d);
+            goto out;
+        }
+        items[item_count].e.mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        items[item_count].e.size = (uint64_t)st.st_size;
+        item_count++;
+    }
+    closedir(d);
+    qsort(notes, note_count, sizeof(*notes), note_cmp);
+
+    for (i = 0; i < item_count; i++) {
+        struct scan_item *it = &items[i];
+        const struct photo_index_entry *prev = old_sorted ? old_find(&old, old_sorted, it->name) : NULL;
+        struct scan_note key;
+        struct scan_note *note;
+        char note_name[NAME_MAX + 8];
+
+        if (prev && prev->mtime_ns == it->e.mtime_ns && prev->size == it->e.size) {
+            it->e.taken = prev->taken;
+            it->e.width = prev->width;
+            it->e.height = prev->height;
+            it->e.orientation = prev->orientation;
+            it->e.flags = prev->flags;
+        } else {
+            probe_photo(dfd, it->name, &it->e);
+        }
+        snprintf(note_name, sizeof(note_name), "%s.txt", it->name);
+        key.name = note_name;
+        note = bsearch(&key, notes, note_count, sizeof(*notes), note_cmp);
+        if (!note) {
+            continue;
+        }
+        it->e.note_mtime_ns = note->mtime_ns;
+        if (prev && prev->note_mtime_ns == note->mtime_ns) {
+            it->note = strdup(photo_index_note(&old, prev));
+        } else {
+            it->note = read_note(dfd, note_name);
+        }
+    }
+    qsort(items, item_count, sizeof(*items), item_cmp);
+    rc = write_index(file, items, item_count, dir_mtime_ns);
+
+out:
+    for (i = 0; i < item_count; i++) {
+        free(items[i].name);
+        free(items[i].note);
+    }
+    for (i = 0; i < note_count; i++) {
+        free(notes[i].name);
+    }
+    free(items);
+    free(notes);
+    free(old_sorted);
+    if (old.map) {
+        photo_index_close(&old);
+    }
+    close(dfd);
+    return rc;
+}
@@ -0,0 +1,122 @@
+/**********************************************************************
+ * @file photo_scanner.c
+ * @brief 照片索引后台维护线程实现
+ *
+ * 本文件用 inotify 监视照片目录，照片或备注变化且静默一段时间后
+ * 增量重建照片索引，另定期全量校验一次，使相册列表请求只读索引。
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ *
+ * @note
+ * - 以点开头的名字（缩略图目录、上传临时文件）不触发重建。
+ * - 目录被删除或存储卡卸载后关闭监视，等待重新挂载。
+ **********************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include "photo_scanner.h"
+
+#define PHOTO_WATCH_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE \
+                          | IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT)
+
+// 单调时钟毫秒数
+static long long now_ms(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// 重建索引 失败时记录日志
+static void rebuild(void) {
+    if (photo_index_rebuild(PHOTO_INDEX_DIR, PHOTO_INDEX_FILE) != 0) {
+        fprintf(stderr, "photo index: rebuild of %s failed\n", PHOTO_INDEX_DIR);
+    }
+}
+
+// 监视并维护索引 目录失效时返回
+static void scanner_run(int ifd) {
+    char buf[8192] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfd = { .fd = ifd, .events = POLLIN };
+    long long next_rescan = now_ms() + PHOTO_INDEX_RESCAN * 1000LL;
+    long long dirty_at = 0;
+    long long wait;
+    ssize_t n;
+    char *p;
+    int rc;
+
+    for (;;) {
+        wait = (dirty_at ? dirty_at + PHOTO_INDEX_DEBOUNCE_MS : next_rescan) - now_ms();
+        rc = poll(&pfd, 1, wait < 0 ? 0 : (int)wait);
+        if (rc < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("photo index: poll");
+            return;
+        }
+        if (rc == 0) {
+            rebuild();
+            dirty_at = 0;
+            next_rescan = now_ms() + PHOTO_INDEX_RESCAN * 1000LL;
+            continue;
+        }
+        n = read(ifd, buf, sizeof(buf));
+        if (n <= 0) {
+            if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+                continue;
+            }
+            return;
+        }
+        for (p = buf; p < buf + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+
+            if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT | IN_IGNORED)) {
+                return;
+            }
+            if (ev->mask & IN_Q_OVERFLOW || (ev->len && ev->name[0] != '.')) {
+                // 每个新事件都重新计时 批量导入结束后只重建一次
+                dirty_at = now_ms();
+            }
+        }
+    }
+}
+
+// 照片索引线程
+void *photo_index_thread(void *arg) {
+    struct stat st;
+    int ifd;
+
+    (void)arg;
+    for (;;) {
+        if (stat(PHOTO_INDEX_DIR, &st) != 0 || !S_ISDIR(st.st_mode)) {
+            sleep(PHOTO_INDEX_RETRY);
+            continue;
+        }
+        ifd = inotify_init1(IN_CLOEXEC);
+        if (ifd < 0) {
+            perror("photo index: inotify_init1");
+            sleep(PHOTO_INDEX_RETRY);
+            continue;
+        }
+        if (inotify_add_watch(ifd, PHOTO_INDEX_DIR, PHOTO_WATCH_MASK) < 0) {
+            perror("photo index: inotify_add_watch");
+            close(ifd);
+            sleep(PHOTO_INDEX_RETRY);
+            continue;
+        }
+        rebuild();
+        scanner_run(ifd);
+        close(ifd);
+        sleep(1);
+    }
+    return NULL;
+}
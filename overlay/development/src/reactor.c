@@ -0,0 +1,355 @@
+/**********************************************************************
+ * @file reactor.c
+ * @brief 守护进程事件循环实现
+ *
+ * 本文件实现基于 epoll 的单线程事件循环：串口、消息队列等描述符，
+ * timerfd 定时器与 signalfd 信号都挂在同一个 epoll 上，空闲时线程
+ * 只睡在 epoll_wait 里，没有轮询和固定间隔的唤醒。联网、执行外部
+ * 命令等可能阻塞数秒的工作交给小型工作线程池，不拖慢事件循环。
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ *
+ * @note
+ * - 回调在事件循环线程中执行，不得阻塞；描述符与定时器的注册、修改、
+ *   删除只能在该线程或 reactor_run 之前进行，reactor_submit 可在任意线程调用。
+ * - 同一批事件中被删除的描述符延迟到本批处理完后释放，不会回调已删除的处理器。
+ * - reactor_init 屏蔽 SIGINT/SIGTERM，之后创建的线程继承该屏蔽，
+ *   信号统一由 signalfd 接收，reactor_run 收到后返回。
+ * - 忽略 SIGPIPE，对端断开时写操作返回 EPIPE 而不是结束进程。
+ * - 屏蔽与忽略的信号会被子进程继承，外部命令须经 reactor_spawn 启动，
+ *   子进程恢复默认的信号屏蔽与处理方式，能被 SIGTERM/SIGPIPE 正常结束。
+ * - 任务队列满时 reactor_submit 返回 -1，周期任务下个周期再提交即可。
+ **********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include "reactor.h"
+
+struct handler {
+    int fd;
+    int dead;
+    reactor_fd_cb cb;
+    void *arg;
+    struct handler *next;
+};
+
+struct reactor_timer {
+    int fd;
+    reactor_timer_cb cb;
+    void *arg;
+};
+
+struct job {
+    reactor_job_fn fn;
+    void *arg;
+    struct job *next;
+};
+
+static int g_epoll_fd = -1;
+static int g_stop = 0;
+static struct handler *g_handlers = NULL;   // 已注册的处理器
+static struct handler *g_dead = NULL;       // 本批事件处理完后释放
+// 工作线程任务队列
+static pthread_mutex_t g_job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_job_cond = PTHREAD_COND_INITIALIZER;
+static struct job *g_job_head = NULL;
+static struct job *g_job_tail = NULL;
+static int g_job_count = 0;
+
+// 工作线程 依次取出任务执行
+static void *worker_thread(void *arg) {
+    struct job *j;
+
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&g_job_lock);
+        while (!g_job_head) {
+            pthread_cond_wait(&g_job_cond, &g_job_lock);
+        }
+        j = g_job_head;
+        g_job_head = j->next;
+        if (!g_job_head) {
+            g_job_tail = NULL;
+        }
+        g_job_count--;
+        pthread_mutex_unlock(&g_job_lock);
+        j->fn(j->arg);
+        free(j);
+    }
+    return NULL;
+}
+
+// 读取 signalfd 收到退出信号后结束事件循环
+static void signal_ready(int fd, uint32_t events, void *arg) {
+    struct signalfd_siginfo si;
+
+    (void)events;
+    (void)arg;
+    while (read(fd, &si, sizeof(si)) == sizeof(si)) {
+        printf("[Reactor] Caught signal %u, exiting.\n", si.ssi_signo);
+        g_stop = 1;
+    }
+}
+
+// 定时器到期 读空计数后回调
+static void timer_ready(int fd, uint32_t events, void *arg) {
+    struct reactor_timer *t = arg;
+    uint64_t expirations;
+
+    (void)events;
+    // 同一批事件中已被重新设置或停止的定时器读不到计数 不回调
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;
+    }
+    t->cb(t->arg);
+}
+
+// 创建 epoll 实例、信号描述符与工作线程
+int reactor_init(void) {
+    sigset_t mask;
+    pthread_t tid;
+    int sig_fd;
+    int i;
+
+    signal(SIGPIPE, SIG_IGN);
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if (pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0) {
+        perror("pthread_sigmask");
+        return -1;
+    }
+    g_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (g_epoll_fd < 0) {
+        perror("epoll_create1");
+        return -1;
+    }
+    sig_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (sig_fd < 0 || reactor_add_fd(sig_fd, EPOLLIN, signal_ready, NULL) != 0) {
+        perror("signalfd");
+        return -1;
+    }
+    for (i = 0; i < REACTOR_WORKERS; i++) {
+        if (pthread_create(&tid, NULL, worker_thread, NULL) != 0) {
+            perror("Failed to create reactor worker");
+            return -1;
+        }
+        pthread_detach(tid);
+    }
+    return 0;
+}
+
+// 注册描述符 events 为 EPOLLIN 等标志 水平触发
+int reactor_add_fd(int fd, uint32_t events, reactor_fd_cb cb, void *arg) {
+    struct epoll_event ev;
+    struct handler *h;
+
+    h = calloc(1, sizeof(*h));
+    if (!h) {
+        return -1;
+    }
+    h->fd = fd;
+    h->cb = cb;
+    h->arg = arg;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = h;
+    if (epoll_ctl(g_epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        perror("epoll_ctl add");
+        free(h);
+        return -1;
+    }
+    h->next = g_handlers;
+    g_handlers = h;
+    return 0;
+}
+
+// 按描述符查找处理器
+static struct handler *find_handler(int fd) {
+    struct handler *h;
+
+    for (h = g_handlers; h; h = h->next) {
+        if (h->fd == fd) {
+            return h;
+        }
+    }
+    return NULL;
+}
+
+// 修改关注的事件 传 0 暂停接收该描述符的事件
+int reactor_mod_fd(int fd, uint32_t events) {
+    struct epoll_event ev;
+    struct handler *h = find_handler(fd);
+
+    if (!h) {
+        return -1;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = h;
+    return epoll_ctl(g_epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+// 注销描述符 须在 close 之前调用
+void reactor_del_fd(int fd) {
+    struct handler **pp;
+    struct handler *h;
+
+    for (pp = &g_handlers; *pp; pp = &(*pp)->next) {
+        if ((*pp)->fd == fd) {
+            h = *pp;
+            *pp = h->next;
+            epoll_ctl(g_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+            h->dead = 1;
+            h->next = g_dead;
+            g_dead = h;
+            return;
+        }
+    }
+}
+
+// 创建定时器 初始为停止状态
+struct reactor_timer *reactor_timer_new(reactor_timer_cb cb, void *arg) {
+    struct reactor_timer *t;
+
+    t = calloc(1, sizeof(*t));
+    if (!t) {
+        return NULL;
+    }
+    t->cb = cb;
+    t->arg = arg;
+    t->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (t->fd < 0) {
+        perror("timerfd_create");
+        free(t);
+        return NULL;
+    }
+    if (reactor_add_fd(t->fd, EPOLLIN, timer_ready, t) != 0) {
+        close(t->fd);
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+// 设置定时器 first_ms 后首次触发 之后每 period_ms 触发 两者都为 0 时停止
+void reactor_timer_set(struct reactor_timer *t, int first_ms, int period_ms) {
+    struct itimerspec its;
+
+    if (first_ms <= 0) {
+        first_ms = period_ms;
+    }
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = first_ms / 1000;
+    its.it_value.tv_nsec = (long)(first_ms % 1000) * 1000000L;
+    its.it_interval.tv_sec = period_ms / 1000;
+    its.it_interval.tv_nsec = (long)(period_ms % 1000) * 1000000L;
+    if (timerfd_settime(t->fd, 0, &its, NULL) != 0) {
+        perror("timerfd_settime");
+    }
+}
+
+// 把可能阻塞的工作交给工作线程
+int reactor_submit(reactor_job_fn fn, void *arg) {
+    struct job *j;
+
+    j = malloc(sizeof(*j));
+    if (!j) {
+        return -1;
+    }
+    j->fn = fn;
+    j->arg = arg;
+    j->next = NULL;
+    pthread_mutex_lock(&g_job_lock);
+    if (g_job_count >= REACTOR_QUEUE_MAX) {
+        pthread_mutex_unlock(&g_job_lock);
+        free(j);
+        return -1;
+    }
+    if (g_job_tail) {
+        g_job_tail->next = j;
+    } else {
+        g_job_head = j;
+    }
+    g_job_tail = j;
+    g_job_count++;
+    pthread_cond_signal(&g_job_cond);
+    pthread_mutex_unlock(&g_job_lock);
+    return 0;
+}
+
+// 执行外部命令并等待结束 返回退出码 只能在工作线程中调用
+int reactor_spawn(char *const argv[]) {
+    extern char **environ;
+    posix_spawnattr_t attr;
+    sigset_t mask;
+    sigset_t defaults;
+    pid_t pid;
+    int status;
+    int rc;
+
+    // 子进程不继承事件循环的信号屏蔽和对 SIGPIPE 的忽略
+    sigemptyset(&mask);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGTERM);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    rc = posix_spawnp(&pid, argv[0], NULL, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    if (rc != 0) {
+        fprintf(stderr, "[Reactor] spawn %s: %s\n", argv[0], strerror(rc));
+        return -1;
+    }
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// 事件循环 收到 SIGINT/SIGTERM 后返回
+int reactor_run(void) {
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    struct handler *h;
+    int n;
+    int i;
+
+    while (!g_stop) {
+        n = epoll_wait(g_epoll_fd, events, REACTOR_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            return -1;
+        }
+        for (i = 0; i < n; i++) {
+            h = events[i].data.ptr;
+            if (!h->dead) {
+                h->cb(h->fd, events[i].events, h->arg);
+            }
+        }
+        while (g_dead) {
+            h = g_dead;
+            g_dead = h->next;
+            free(h);
+        }
+    }
+    return 0;
+}
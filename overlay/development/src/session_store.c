@@ -0,0 +1,466 @@
+/**********************************************************************
+ * @file session_store.c
+ * @brief 共享内存会话表实现
+ *
+ * 本文件实现基于 POSIX 共享内存的登录会话哈希表，
+ * CGI 进程写入与校验令牌，environment 守护进程负责定期清扫过期会话。
+ * 查找为开放寻址 O(1)，每次校验成功滑动续期，表容量固定。
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ *
+ * @note
+ * - 共享内存名为 /web_sessions，权限 0600 归 CGI 用户所有，root 不受限，
+ *   其他本地用户读不到签名密钥。
+ * - 取不到足够的随机数时密钥标记为无效，既不签发也不校验令牌。
+ * - 互斥锁为进程间共享的健壮锁，持锁进程崩溃后可恢复。
+ * - 会话只存于内存，重启后需重新登录。
+ * - 表头保存令牌签名密钥，清空会话时一并轮换，旧令牌签名随之失效；
+ *   密钥代号可不加锁读取，进程缓存密钥后只在代号变化时重新加锁读取。
+ **********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+#include "session_store.h"
+#include "ipc_owner.h"
+
+#define SESSION_MAGIC   0x53455353u
+#define SESSION_VERSION 5
+#define SESSION_MASK    (SESSION_TABLE_SIZE - 1)
+
+struct session_entry {
+    char token[SESSION_KEY_MAX + 1];
+    char user[SESSION_USER_MAX + 1];
+    unsigned char used;
+    time_t expires_at;
+};
+
+struct session_table {
+    uint32_t magic;
+    uint32_t version;
+    pthread_mutex_t lock;
+    uint32_t live;
+    uint32_t secret_ok;         // 密钥生成失败时为 0
+    uint32_t secret_gen;        // 密钥每轮换一次加 1 进程据此判断缓存是否过期
+    unsigned char secret[SESSION_SECRET_LEN];
+    struct session_entry slots[SESSION_TABLE_SIZE];
+};
+
+static struct session_table *g_table = NULL;
+
+// 令牌哈希（FNV-1a）
+static uint32_t token_hash(const char *token) {
+    uint32_t h = 2166136261u;
+
+    while (*token) {
+        h ^= (unsigned char)*token++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// 生成新的签名密钥 随机数不足时返回 -1
+static int fill_secret(unsigned char *key, size_t len) {
+    size_t got = 0;
+    ssize_t n;
+    int fd;
+
+    while (got < len) {
+        n = getrandom(key + got, len - got, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        got += (size_t)n;
+    }
+    if (got == len) {
+        return 0;
+    }
+    // 内核不支持 getrandom 时退回 /dev/urandom
+    fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror("open /dev/urandom");
+        memset(key, 0, len);
+        return -1;
+    }
+    while (got < len) {
+        n = read(fd, key + got, len - got);
+        if (n <= 0) {
+            break;
+        }
+        got += (size_t)n;
+    }
+    close(fd);
+    if (got != len) {
+        fprintf(stderr, "session secret: not enough entropy\n");
+        memset(key, 0, len);
+        return -1;
+    }
+    return 0;
+}
+
+// 初始化新建的会话表
+static void init_table(struct session_table *t) {
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&t->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    t->live = 0;
+    t->secret_ok = fill_secret(t->secret, sizeof(t->secret)) == 0;
+    t->secret_gen = 1;
+    t->version = SESSION_VERSION;
+    // 最后写 magic，其他进程看到 magic 即表示初始化完成
+    __atomic_store_n(&t->magic, SESSION_MAGIC, __ATOMIC_RELEASE);
+}
+
+// 映射共享内存会话表，不存在则创建
+static struct session_table *attach_table(void) {
+    int fd;
+    int created = 0;
+    int i;
+    mode_t old_mask;
+    struct stat st;
+    void *p;
+    struct session_table *t;
+
+    if (g_table) {
+        return g_table;
+    }
+    old_mask = umask(0);
+    fd = shm_open(SESSION_SHM_NAME, O_RDWR | O_CREAT | O_EXCL, IPC_OWNER_MODE);
+    if (fd >= 0) {
+        created = 1;
+    } else if (errno == EEXIST) {
+        // 创建者可能还没把属主改为 CGI 用户
+        for (i = 0; i < 100; i++) {
+            fd = shm_open(SESSION_SHM_NAME, O_RDWR, IPC_OWNER_MODE);
+            if (fd >= 0 || errno != EACCES) {
+                break;
+            }
+            usleep(10000);
+        }
+    }
+    umask(old_mask);
+    if (fd < 0) {
+        perror("shm_open sessions");
+        return NULL;
+    }
+    if (ipc_owner_secure(fd, IPC_OWNER_MODE) != 0) {
+        close(fd);
+        if (created) {
+            shm_unlink(SESSION_SHM_NAME);
+        }
+        return NULL;
+    }
+    if (created) {
+        if (ftruncate(fd, sizeof(struct session_table)) != 0) {
+            perror("ftruncate sessions");
+            close(fd);
+            shm_unlink(SESSION_SHM_NAME);
+            return NULL;
+        }
+    } else {
+        // 等待创建者完成 ftruncate
+        for (i = 0; i < 100; i++) {
+            if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(struct session_table)) {
+                break;
+            }
+            usleep(10000);
+        }
+        if (i == 100) {
+            close(fd);
+            return NULL;
+        }
+    }
+    p = mmap(NULL, sizeof(struct session_table), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap sessions");
+        return NULL;
+    }
+    t = (struct session_table *)p;
+    if (created) {
+        init_table(t);
+    } else {
+        for (i = 0; i < 100; i++) {
+            if (__atomic_load_n(&t->magic, __ATOMIC_ACQUIRE) == SESSION_MAGIC) {
+                break;
+            }
+            usleep(10000);
+        }
+        if (t->magic != SESSION_MAGIC || t->version != SESSION_VERSION) {
+            fprintf(stderr, "session table %s has unexpected layout\n", SESSION_SHM_NAME);
+            munmap(p, sizeof(struct session_table));
+            return NULL;
+        }
+    }
+    g_table = t;
+    return t;
+}
+
+// 加锁，持锁进程崩溃时恢复锁状态
+static int lock_table(struct session_table *t) {
+    int rc = pthread_mutex_lock(&t->lock);
+
+    if (rc == EOWNERDEAD) {
+        pthread_mutex_consistent(&t->lock);
+        rc = 0;
+    }
+    return rc;
+}
+
+// 查找令牌所在槽位，未找到返回 -1
+static int find_slot(struct session_table *t, const char *token) {
+    uint32_t idx = token_hash(token) & SESSION_MASK;
+    uint32_t i;
+
+    for (i = 0; i < SESSION_TABLE_SIZE; i++) {
+        if (!t->slots[idx].used) {
+            return -1;
+        }
+        if (strcmp(t->slots[idx].token, token) == 0) {
+            return (int)idx;
+        }
+        idx = (idx + 1) & SESSION_MASK;
+    }
+    return -1;
+}
+
+// 删除槽位并回移后续项，保持线性探测链连续
+static void delete_slot(struct session_table *t, uint32_t idx) {
+    uint32_t next;
+    uint32_t home;
+
+    t->slots[idx].used = 0;
+    t->live--;
+    next = (idx + 1) & SESSION_MASK;
+    while (t->slots[next].used) {
+        home = token_hash(t->slots[next].token) & SESSION_MASK;
+        // 空位落在该项的探测路径上才能前移
+        if (((next - home) & SESSION_MASK) >= ((next - idx) & SESSION_MASK)) {
+            t->slots[idx] = t->slots[next];
+            t->slots[next].used = 0;
+            idx = next;
+        }
+        next = (next + 1) & SESSION_MASK;
+    }
+}
+
+// 清扫过期会话（需已持锁）
+static int sweep_locked(struct session_table *t, time_t now) {
+    uint32_t idx = 0;
+    int removed = 0;
+
+    while (idx < SESSION_TABLE_SIZE) {
+        if (t->slots[idx].used && t->slots[idx].expires_at <= now) {
+            delete_slot(t, idx);
+            removed++;
+            continue; // 回移后当前槽位可能换了新项
+        }
+        idx++;
+    }
+    return removed;
+}
+
+// 淘汰最早过期的会话（需已持锁）
+static void evict_oldest_locked(struct session_table *t) {
+    uint32_t idx;
+    int oldest = -1;
+
+    for (idx = 0; idx < SESSION_TABLE_SIZE; idx++) {
+        if (t->slots[idx].used &&
+            (oldest < 0 || t->slots[idx].expires_at < t->slots[oldest].expires_at)) {
+            oldest = (int)idx;
+        }
+    }
+    if (oldest >= 0) {
+        delete_slot(t, (uint32_t)oldest);
+    }
+}
+
+// 复制会话所属用户名
+static void copy_user(char *dst, size_t size, const char *user) {
+    if (!dst || size == 0) {
+        return;
+    }
+    snprintf(dst, size, "%s", user ? user : "");
+}
+
+// 添加会话
+int session_store_add(const char *token, const char *user, long ttl_seconds) {
+    struct session_table *t;
+    time_t now;
+    uint32_t idx;
+    int slot;
+
+    if (!token || !*token || strlen(token) > SESSION_KEY_MAX) {
+        return 0;
+    }
+    t = attach_table();
+    if (!t || lock_table(t) != 0) {
+        return 0;
+    }
+    if (!t->secret_ok) {
+        pthread_mutex_unlock(&t->lock);
+        return 0;
+    }
+    now = time(NULL);
+    slot = find_slot(t, token);
+    if (slot >= 0) {
+        copy_user(t->slots[slot].user, sizeof(t->slots[slot].user), user);
+        t->slots[slot].expires_at = now + ttl_seconds;
+        pthread_mutex_unlock(&t->lock);
+        return 1;
+    }
+    if (t->live >= SESSION_MAX_LIVE) {
+        sweep_locked(t, now);
+    }
+    if (t->live >= SESSION_MAX_LIVE) {
+        evict_oldest_locked(t);
+    }
+    idx = token_hash(token) & SESSION_MASK;
+    while (t->slots[idx].used) {
+        idx = (idx + 1) & SESSION_MASK;
+    }
+    strcpy(t->slots[idx].token, token);
+    copy_user(t->slots[idx].user, sizeof(t->slots[idx].user), user);
+    t->slots[idx].expires_at = now + ttl_seconds;
+    t->slots[idx].used = 1;
+    t->live++;
+    pthread_mutex_unlock(&t->lock);
+    return 1;
+}
+
+// 校验会话，ttl_seconds 大于 0 时滑动续期，user 非空时带回会话所属用户名
+int session_store_touch(const char *token, long ttl_seconds, char *user, size_t user_size) {
+    struct session_table *t;
+    time_t now;
+    int slot;
+    int valid = 0;
+
+    if (!token || !*token || strlen(token) > SESSION_KEY_MAX) {
+        return 0;
+    }
+    t = attach_table();
+    if (!t || lock_table(t) != 0) {
+        return 0;
+    }
+    now = time(NULL);
+    slot = find_slot(t, token);
+    if (slot >= 0) {
+        if (t->slots[slot].expires_at <= now) {
+            delete_slot(t, (uint32_t)slot);
+        } else {
+            if (ttl_seconds > 0) {
+                t->slots[slot].expires_at = now + ttl_seconds;
+            }
+            copy_user(user, user_size, t->slots[slot].user);
+            valid = 1;
+        }
+    }
+    pthread_mutex_unlock(&t->lock);
+    return valid;
+}
+
+// 查询会话是否有效 不续期
+int session_store_peek(const char *token, char *user, size_t user_size) {
+    return session_store_touch(token, 0, user, user_size);
+}
+
+// 删除会话
+void session_store_remove(const char *token) {
+    struct session_table *t;
+    int slot;
+
+    if (!token || strlen(token) > SESSION_KEY_MAX) {
+        return;
+    }
+    t = attach_table();
+    if (!t || lock_table(t) != 0) {
+        return;
+    }
+    slot = find_slot(t, token);
+    if (slot >= 0) {
+        delete_slot(t, (uint32_t)slot);
+    }
+    pthread_mutex_unlock(&t->lock);
+}
+
+// 清空所有会话
+void session_store_clear(void) {
+    struct session_table *t = attach_table();
+
+    if (!t || lock_table(t) != 0) {
+        return;
+    }
+    memset(t->slots, 0, sizeof(t->slots));
+    t->live = 0;
+    __atomic_store_n(&t->secret_ok, fill_secret(t->secret, sizeof(t->secret)) == 0, __ATOMIC_RELEASE);
+    if (++t->secret_gen == 0) {
+        t->secret_gen = 1;
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    pthread_mutex_unlock(&t->lock);
+}
+
+// 读取令牌签名密钥及其代号
+int session_store_secret(unsigned char *key, size_t len, uint32_t *gen) {
+    struct session_table *t;
+
+    if (!key || len != SESSION_SECRET_LEN) {
+        return 0;
+    }
+    t = attach_table();
+    if (!t || lock_table(t) != 0) {
+        return 0;
+    }
+    if (!t->secret_ok) {
+        // 密钥不可用时拒绝签发与校验
+        pthread_mutex_unlock(&t->lock);
+        return 0;
+    }
+    memcpy(key, t->secret, len);
+    if (gen) {
+        *gen = t->secret_gen;
+    }
+    pthread_mutex_unlock(&t->lock);
+    return 1;
+}
+
+// 当前密钥代号 不加锁 密钥不可用时返回 0
+uint32_t session_store_secret_gen(void) {
+    struct session_table *t = attach_table();
+
+    if (!t || !__atomic_load_n(&t->secret_ok, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    return __atomic_load_n(&t->secret_gen, __ATOMIC_ACQUIRE);
+}
+
+// 清扫过期会话，返回清除数量
+int session_store_sweep(void) {
+    struct session_table *t = attach_table();
+    int removed;
+
+    if (!t || lock_table(t) != 0) {
+        return -1;
+    }
+    removed = sweep_locked(t, time(NULL));
+    pthread_mutex_unlock(&t->lock);
+    return removed;
+}
@@ -0,0 +1,97 @@
+/**********************************************************************
+ * @file session_token.c
+ * @brief 会话令牌签名与校验
+ *
+ * 本文件实现令牌 HMAC 标签的计算与校验，CGI 签发与校验令牌、
+ * 守护进程校验推送连接都使用这里的实现，两边规则一致。
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ *
+ * @note
+ * - 签名密钥按代号缓存在线程内，校验只做一次无锁读取代号，
+ *   伪造令牌不会争用会话表锁；密钥轮换后代号变化才重新加锁读取。
+ * - 校验只看格式、签名与签名内的到期时间，不访问会话槽位，
+ *   会话是否仍有效由调用方再查会话表。
+ **********************************************************************/
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "session_token.h"
+#include "session_store.h"
+#include "sha256.h"
+
+// 签名密钥缓存 代号为 0 表示未缓存
+static __thread unsigned char g_key[SESSION_SECRET_LEN];
+static __thread uint32_t g_key_gen = 0;
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// 取签名密钥 代号未变时用缓存
+static const unsigned char *token_key(void) {
+    uint32_t gen = session_store_secret_gen();
+
+    if (gen == 0) {
+        // 密钥不可用 丢弃缓存
+        memset(g_key, 0, sizeof(g_key));
+        g_key_gen = 0;
+        return NULL;
+    }
+    if (gen != g_key_gen && !session_store_secret(g_key, sizeof(g_key), &g_key_gen)) {
+        memset(g_key, 0, sizeof(g_key));
+        g_key_gen = 0;
+        return NULL;
+    }
+    return g_key;
+}
+
+// 计算令牌前缀的签名标签
+int session_token_tag(const char *signed_part, char tag[TOKEN_TAG_HEX]) {
+    const unsigned char *key = token_key();
+    unsigned char mac[SHA256_DIGEST_SIZE];
+    int i;
+
+    if (!key) {
+        return -1;
+    }
+    hmac_sha256(key, SESSION_SECRET_LEN, signed_part, TOKEN_SIGNED_HEX, mac);
+    for (i = 0; i < TOKEN_TAG_HEX / 2; i++) {
+        tag[i * 2] = hex_digits[mac[i] >> 4];
+        tag[i * 2 + 1] = hex_digits[mac[i] & 0x0F];
+    }
+    return 0;
+}
+
+// 校验格式、签名与到期时间 有效返回 1
+int session_token_verify(const char *token) {
+    char tag[TOKEN_TAG_HEX];
+    unsigned char diff = 0;
+    unsigned long expires = 0;
+    int i;
+
+    if (!token || strlen(token) != (size_t)TOKEN_LEN) {
+        return 0;
+    }
+    for (i = 0; i < TOKEN_LEN; i++) {
+        char ch = token[i];
+        if (!((ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f'))) {
+            return 0;
+        }
+    }
+    for (i = TOKEN_NONCE_HEX; i < TOKEN_SIGNED_HEX; i++) {
+        char ch = token[i];
+        expires = (expires << 4) | (unsigned long)(ch <= '9' ? ch - '0' : ch - 'a' + 10);
+    }
+    if ((time_t)expires <= time(NULL)) {
+        return 0;
+    }
+    if (session_token_tag(token, tag) != 0) {
+        return 0;
+    }
+    // 定长比较 避免按字节提前返回泄露时序
+    for (i = 0; i < TOKEN_TAG_HEX; i++) {
+        diff |= (unsigned char)(tag[i] ^ token[TOKEN_SIGNED_HEX + i]);
+    }
+    return diff == 0;
+}
@@ -0,0 +1,334 @@
+/**********************************************************************
+ * @file state_shm.c
+ * @brief 传感器与设备状态共享内存快照实现
+ *
+ * 本文件实现守护进程与 CGI 共用的状态快照：温湿度、天气与设备开关
+ * 各占共享内存中的一个定长分区，写者在顺序锁（seqlock）保护下更新，
+ * 读者只做内存拷贝并比较序号，不加锁、不打开文件、不解析 JSON。
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ *
+ * @note
+ * - 共享内存名为 /web_state，归 CGI 用户所有、权限 0600，root 与 nobody 共用。
+ * - 表头记录布局版本与结构大小，两个程序版本不一致时拒绝映射并退回读文件。
+ * - 序号为奇数表示正在写入，读者重试；写者之间用进程间共享的健壮锁互斥，
+ *   同一时刻只有一个写者改动序号与数据。
+ * - 写者中途退出时序号停在奇数，下一个写者取得锁后整块覆盖该分区
+ *   再改回偶数，读者重试有上限，不会因此卡死或读到拼接的数据。
+ * - 每次写入序号加 2，序号的一半即分区版本，可直接用作 ETag。
+ **********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "ipc_owner.h"
+#include "state_shm.h"
+
+#define STATE_MAGIC       0x53544154u
+#define STATE_VERSION     2
+
+struct seq_header {
+    uint32_t seq;
+    uint32_t valid;
+    int64_t updated;
+};
+
+struct state_block {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t reserved;
+    pthread_mutex_t write_lock;
+    struct seq_header temp_hdr;
+    struct state_temperature temp;
+    struct seq_header weather_hdr;
+    WeatherData weather;
+    struct seq_header dev_hdr;
+    struct state_devices devices;
+};
+
+static struct state_block *g_state = NULL;
+
+// 初始化新建的状态块
+static void init_block(struct state_block *b) {
+    pthread_mutexattr_t attr;
+
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&b->write_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    b->version = STATE_VERSION;
+    b->size = sizeof(struct state_block);
+    // 最后写 magic，其他进程看到 magic 即表示初始化完成
+    __atomic_store_n(&b->magic, STATE_MAGIC, __ATOMIC_RELEASE);
+}
+
+// 映射共享内存状态块，不存在则创建
+static struct state_block *attach_block(void) {
+    static int failed = 0;
+    int fd;
+    int created = 0;
+    int i;
+    mode_t old_mask;
+    struct stat st;
+    void *p;
+    struct state_block *b;
+
+    if (g_state || failed) {
+        return g_state;
+    }
+    old_mask = umask(0);
+    fd = shm_open(STATE_SHM_NAME, O_RDWR | O_CREAT | O_EXCL, IPC_OWNER_MODE);
+    if (fd >= 0) {
+        created = 1;
+    } else if (errno == EEXIST) {
+        // 创建者可能还没把属主改为 CGI 用户
+        for (i = 0; i < 100; i++) {
+            fd = shm_open(STATE_SHM_NAME, O_RDWR, IPC_OWNER_MODE);
+            if (fd >= 0 || errno != EACCES) {
+                break;
+            }
+            usleep(10000);
+        }
+    }
+    umask(old_mask);
+    if (fd < 0) {
+        perror("shm_open state");
+        failed = 1;
+        return NULL;
+    }
+    if (ipc_owner_secure(fd, IPC_OWNER_MODE) != 0) {
+        close(fd);
+        if (created) {
+            shm_unlink(STATE_SHM_NAME);
+        }
+        failed = 1;
+        return NULL;
+    }
+    if (created) {
+        // 新建的共享内存全为 0，各分区 valid 为 0 即未写入
+        if (ftruncate(fd, sizeof(struct state_block)) != 0) {
+            perror("ftruncate state");
+            close(fd);
+            shm_unlink(STATE_SHM_NAME);
+            failed = 1;
+            return NULL;
+        }
+    } else {
+        // 等待创建者完成 ftruncate
+        for (i = 0; i < 100; i++) {
+            if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(struct state_block)) {
+                break;
+            }
+            usleep(10000);
+        }
+        if (i == 100) {
+            close(fd);
+            failed = 1;
+            return NULL;
+        }
+    }
+    p = mmap(NULL, sizeof(struct state_block), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap state");
+        failed = 1;
+        return NULL;
+    }
+    b = (struct state_block *)p;
+    if (created) {
+        init_block(b);
+    } else {
+        for (i = 0; i < 100; i++) {
+            if (__atomic_load_n(&b->magic, __ATOMIC_ACQUIRE) == STATE_MAGIC) {
+                break;
+            }
+            usleep(10000);
+        }
+        if (b->magic != STATE_MAGIC || b->version != STATE_VERSION || b->size != sizeof(struct state_block)) {
+            fprintf(stderr, "state block %s has unexpected layout\n", STATE_SHM_NAME);
+            munmap(p, sizeof(struct state_block));
+            failed = 1;
+            return NULL;
+        }
+    }
+    g_state = b;
+    return b;
+}
+
+// 加写锁，持锁进程崩溃时恢复锁状态
+static int lock_writer(struct state_block *b) {
+    int rc = pthread_mutex_lock(&b->write_lock);
+
+    if (rc == EOWNERDEAD) {
+        pthread_mutex_consistent(&b->write_lock);
+        rc = 0;
+    }
+    return rc;
+}
+
+// 开始写入：把序号从偶数改为奇数 须持有写锁
+static uint32_t seq_write_begin(struct seq_header *h) {
+    uint32_t s = __atomic_load_n(&h->seq, __ATOMIC_RELAXED);
+
+    // 上一个写者中途退出时序号已是奇数 本次整块覆盖后再改回偶数
+    if (!(s & 1)) {
+        s++;
+        __atomic_store_n(&h->seq, s, __ATOMIC_RELAXED);
+    }
+    // 保证奇数序号先于数据可见
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return s;
+}
+
+// 结束写入：序号改回偶数
+static void seq_write_end(struct seq_header *h, uint32_t s) {
+    h->valid = 1;
+    h->updated = (int64_t)time(NULL);
+    __atomic_store_n(&h->seq, s + 1, __ATOMIC_RELEASE);
+}
+
+// 在写锁内覆盖一个分区
+static int seq_write(struct state_block *b, struct seq_header *h, void *dst, const void *src, size_t len) {
+    uint32_t s;
+
+    if (lock_writer(b) != 0) {
+        return -1;
+    }
+    s = seq_write_begin(h);
+    memcpy(dst, src, len);
+    seq_write_end(h, s);
+    pthread_mutex_unlock(&b->write_lock);
+    return 0;
+}
+
+// 无锁读取一个分区，序号前后一致才算读到完整数据
+static int seq_read(struct seq_header *h, const void *src, void *dst, size_t len, struct state_meta *meta) {
+    uint32_t s1;
+    uint32_t s2;
+    uint32_t valid;
+    int64_t updated;
+    int i;
+
+    for (i = 0; i < STATE_READ_RETRY; i++) {
+        s1 = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+        if (s1 & 1) {
+            sched_yield();
+            continue;
+        }
+        memcpy(dst, src, len);
+        valid = h->valid;
+        updated = h->updated;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        s2 = __atomic_load_n(&h->seq, __ATOMIC_RELAXED);
+        if (s1 != s2) {
+            continue;
+        }
+        if (!valid) {
+            return -1;
+        }
+        if (meta) {
+            meta->version = s1 / 2;
+            meta->updated = updated;
+        }
+        return 0;
+    }
+    return -1;
+}
+
+// 写入温湿度
+int state_shm_write_temperature(const struct state_temperature *t) {
+    struct state_block *b = attach_block();
+
+    if (!b || !t) {
+        return -1;
+    }
+    return seq_write(b, &b->temp_hdr, &b->temp, t, sizeof(*t));
+}
+
+// 写入天气
+int state_shm_write_weather(const WeatherData *wd) {
+    struct state_block *b = attach_block();
+
+    if (!b || !wd) {
+        return -1;
+    }
+    return seq_write(b, &b->weather_hdr, &b->weather, wd, sizeof(*wd));
+}
+
+// 写入设备开关状态
+int state_shm_write_devices(const struct state_devices *d) {
+    struct state_block *b = attach_block();
+
+    if (!b || !d) {
+        return -1;
+    }
+    return seq_write(b, &b->dev_hdr, &b->devices, d, sizeof(*d));
+}
+
+// 读取温湿度
+int state_shm_read_temperature(struct state_temperature *out, struct state_meta *meta) {
+    struct state_block *b = attach_block();
+
+    if (!b || !out) {
+        return -1;
+    }
+    return seq_read(&b->temp_hdr, &b->temp, out, sizeof(*out), meta);
+}
+
+// 读取天气
+int state_shm_read_weather(WeatherData *out, struct state_meta *meta) {
+    struct state_block *b = attach_block();
+
+    if (!b || !out) {
+        return -1;
+    }
+    if (seq_read(&b->weather_hdr, &b->weather, out, sizeof(*out), meta) != 0) {
+        return -1;
+    }
+    // 字符串字段来自共享内存 防御性补结尾
+    out->code[sizeof(out->code) - 1] = '\0';
+    out->weather[sizeof(out->weather) - 1] = '\0';
+    out->temperature[sizeof(out->temperature) - 1] = '\0';
+    out->feels_like[sizeof(out->feels_like) - 1] = '\0';
+    out->humidity[sizeof(out->humidity) - 1] = '\0';
+    out->wind_dir[sizeof(out->wind_dir) - 1] = '\0';
+    out->wind_scale[sizeof(out->wind_scale) - 1] = '\0';
+    return 0;
+}
+
+// 读取设备开关状态
+int state_shm_read_devices(struct state_devices *out, struct state_meta *meta) {
+    struct state_block *b = attach_block();
+
+    if (!b || !out) {
+        return -1;
+    }
+    return seq_read(&b->dev_hdr, &b->devices, out, sizeof(*out), meta);
+}
+
+// 温湿度转为 JSON 保留一位小数
+json_object *state_temperature_to_json(const struct state_temperature *t) {
+    json_object *root;
+    char hum_str[32];
+    char temp_str[32];
+
+    snprintf(hum_str, sizeof(hum_str), "%.1f", t->humidity);
+    snprintf(temp_str, sizeof(temp_str), "%.1f", t->temperature);
+    root = json_object_new_object();
+    json_object_object_add(root, "humidity", json_object_new_double_s(t->humidity, hum_str));
+    json_object_object_add(root, "temperature", json_object_new_double_s(t->temperature, temp_str));
+    json_object_object_add(root, "timestamp", json_object_new_int64(t->timestamp));
+    return root;
+}
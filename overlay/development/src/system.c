@@ -4,6 +4,7 @@
  *
  * 本文件实现负载内存磁盘网络等系统信息采集
  * 供 CGI 处理函数返回系统状态数据
+ * 与 environment 守护进程共用 事件推送与接口输出同样的 JSON
  *
  * @author 杨翊
  * @date 2026-02-02
@@ -244,3 +245,22 @@ int collect_system_info(system_info_t*info){
     }
     return 1;
 }
+
+// 转为接口返回的 JSON 对象
+json_object*system_info_to_json(const system_info_t*info){
+    json_object*root=json_object_new_object();
+
+    json_object_object_add(root,"load_percent",json_object_new_double(info->load_percent));
+    json_object_object_add(root,"uptime_minutes",json_object_new_int64(info->uptime_minutes));
+    json_object_object_add(root,"memory_total_mb",json_object_new_int64(info->memory_total_mb));
+    json_object_object_add(root,"memory_used_mb",json_object_new_int64(info->memory_used_mb));
+    json_object_object_add(root,"memory_percent",json_object_new_double(info->memory_percent));
+    json_object_object_add(root,"ip",json_object_new_string(info->ip));
+    if(info->cpu_temp_c>=0){
+        json_object_object_add(root,"cpu_temp_c",json_object_new_double(info->cpu_temp_c));
+    }
+    json_object_object_add(root,"disk_total_gb",json_object_new_int64(info->disk_total_gb));
+    json_object_object_add(root,"disk_used_gb",json_object_new_int64(info->disk_used_gb));
+    json_object_object_add(root,"disk_percent",json_object_new_double(info->disk_percent));
+    return root;
+}
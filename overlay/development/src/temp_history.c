@@ -0,0 +1,384 @@
+/**********************************************************************
+ * @file temp_history.c
+ * @brief 温湿度历史环形存储实现
+ *
+ * 本文件实现温湿度读数的定长记录环形文件：温度线程每次读数后写入
+ * 原始层，并增量更新分钟与小时两级汇总（最小、最大、平均）。
+ * CGI 只读映射同一文件，按时间直接算出记录偏移回答区间查询。
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ *
+ * @note
+ * - 文件路径为 /development/tmp/temperature.history，创建时按全部容量
+ *   ftruncate（稀疏文件），之后大小不变。
+ * - 记录位置为 (时间 / 分辨率) % 容量，记录内保存所属时间段的起点，
+ *   与查询时间段不符即为空洞或已被覆盖的旧数据，无需扫描。
+ * - 写入时先把记录时间清零再改数据，最后写回时间；读者前后两次读到
+ *   相同时间才采用，读写双方都不加锁。
+ * - 表头记录各层分辨率、容量与偏移，保留天数改动后守护进程重建文件。
+ **********************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "temp_history.h"
+
+#define TEMP_HISTORY_MAGIC   0x54484953u
+#define TEMP_HISTORY_VERSION 1
+
+struct tier_info {
+    uint32_t resolution;
+    uint32_t capacity;
+    uint32_t record_size;
+    uint32_t reserved;
+    uint64_t offset;
+};
+
+struct history_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t tier_count;
+    uint32_t reserved;
+    int64_t created;
+    struct tier_info tiers[TEMP_HISTORY_TIER_COUNT];
+};
+
+// 原始读数 ts 为所属时间段起点 0 表示空
+struct raw_record {
+    int64_t ts;
+    float temperature;
+    float humidity;
+};
+
+// 汇总记录
+struct rollup_record {
+    int64_t ts;
+    uint32_t count;
+    float temp_min;
+    float temp_max;
+    float hum_min;
+    float hum_max;
+    uint32_t reserved;
+    double temp_sum;
+    double hum_sum;
+};
+
+struct history_map {
+    unsigned char *base;
+    size_t size;
+    const struct history_header *hdr;
+};
+
+static struct history_map g_writer;
+
+// 按当前配置填写表头
+static void layout(struct history_header *h) {
+    static const uint32_t res[TEMP_HISTORY_TIER_COUNT] = { INTERVAL_SEC, 60, 3600 };
+    static const uint32_t days[TEMP_HISTORY_TIER_COUNT] = {
+        TEMP_HISTORY_RAW_DAYS, TEMP_HISTORY_MIN_DAYS, TEMP_HISTORY_HOUR_DAYS
+    };
+    uint64_t off = sizeof(struct history_header);
+    int i;
+
+    memset(h, 0, sizeof(*h));
+    h->magic = TEMP_HISTORY_MAGIC;
+    h->version = TEMP_HISTORY_VERSION;
+    h->tier_count = TEMP_HISTORY_TIER_COUNT;
+    for (i = 0; i < TEMP_HISTORY_TIER_COUNT; i++) {
+        h->tiers[i].resolution = res[i];
+        h->tiers[i].capacity = (uint32_t)((uint64_t)days[i] * 86400 / res[i]);
+        h->tiers[i].record_size = i == TEMP_HISTORY_RAW ? sizeof(struct raw_record) : sizeof(struct rollup_record);
+        h->tiers[i].offset = off;
+        off += (uint64_t)h->tiers[i].capacity * h->tiers[i].record_size;
+    }
+}
+
+// 文件总大小
+static size_t layout_size(const struct history_header *h) {
+    const struct tier_info *t = &h->tiers[TEMP_HISTORY_TIER_COUNT - 1];
+
+    return (size_t)(t->offset + (uint64_t)t->capacity * t->record_size);
+}
+
+// 校验已映射文件的表头
+static int header_valid(const struct history_header *h, size_t size) {
+    int i;
+
+    if (size < sizeof(*h) || h->magic != TEMP_HISTORY_MAGIC || h->version != TEMP_HISTORY_VERSION ||
+        h->tier_count != TEMP_HISTORY_TIER_COUNT) {
+        return 0;
+    }
+    for (i = 0; i < TEMP_HISTORY_TIER_COUNT; i++) {
+        if (h->tiers[i].resolution == 0 || h->tiers[i].capacity == 0 ||
+            h->tiers[i].record_size != (i == TEMP_HISTORY_RAW ? sizeof(struct raw_record) : sizeof(struct rollup_record)) ||
+            h->tiers[i].offset + (uint64_t)h->tiers[i].capacity * h->tiers[i].record_size > size) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// 时间段 bucket 在某层中的记录地址
+static void *record_at(const struct history_map *m, int tier, int64_t bucket) {
+    const struct tier_info *t = &m->hdr->tiers[tier];
+
+    return m->base + t->offset + (uint64_t)(bucket % t->capacity) * t->record_size;
+}
+
+// 写者映射文件 不存在或布局与配置不符时重建
+static int writer_attach(void) {
+    struct history_header want;
+    struct stat st;
+    void *p;
+    int fd;
+
+    if (g_writer.base) {
+        return 0;
+    }
+    layout(&want);
+    fd = open(TEMP_HISTORY_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("temp history: open");
+        return -1;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    if ((size_t)st.st_size != layout_size(&want)) {
+        st.st_size = 0;
+    }
+    if (st.st_size > 0) {
+        struct history_header cur;
+
+        if (pread(fd, &cur, sizeof(cur), 0) != (ssize_t)sizeof(cur) ||
+            memcmp(cur.tiers, want.tiers, sizeof(want.tiers)) != 0 || !header_valid(&cur, (size_t)st.st_size)) {
+            st.st_size = 0;
+        }
+    }
+    if (st.st_size == 0) {
+        // 新建或布局变化：清空后按全部容量扩展 未写过的记录全为 0
+        fprintf(stderr, "temp history: creating %s\n", TEMP_HISTORY_FILE);
+        want.created = (int64_t)time(NULL);
+        if (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t)layout_size(&want)) != 0 ||
+            pwrite(fd, &want, sizeof(want), 0) != (ssize_t)sizeof(want)) {
+            perror("temp history: create");
+            close(fd);
+            return -1;
+        }
+    }
+    p = mmap(NULL, layout_size(&want), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("temp history: mmap");
+        return -1;
+    }
+    g_writer.base = p;
+    g_writer.size = layout_size(&want);
+    g_writer.hdr = (const struct history_header *)p;
+    return 0;
+}
+
+// 增量更新一条汇总记录
+static void rollup_add(struct rollup_record *r, int64_t bucket_ts, float temperature, float humidity) {
+    int fresh = __atomic_load_n(&r->ts, __ATOMIC_RELAXED) != bucket_ts;
+
+    __atomic_store_n(&r->ts, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    if (fresh) {
+        r->count = 0;
+        r->temp_min = r->temp_max = temperature;
+        r->hum_min = r->hum_max = humidity;
+        r->temp_sum = 0;
+        r->hum_sum = 0;
+    }
+    r->count++;
+    if (temperature < r->temp_min) r->temp_min = temperature;
+    if (temperature > r->temp_max) r->temp_max = temperature;
+    if (humidity < r->hum_min) r->hum_min = humidity;
+    if (humidity > r->hum_max) r->hum_max = humidity;
+    r->temp_sum += temperature;
+    r->hum_sum += humidity;
+    __atomic_store_n(&r->ts, bucket_ts, __ATOMIC_RELEASE);
+}
+
+// 追加一次读数 同时更新各级汇总
+int temp_history_append(int64_t ts, float temperature, float humidity) {
+    struct raw_record *raw;
+    int64_t res;
+    int64_t bucket;
+    int i;
+
+    if (ts <= 0 || writer_attach() != 0) {
+        return -1;
+    }
+    res = g_writer.hdr->tiers[TEMP_HISTORY_RAW].resolution;
+    bucket = ts / res;
+    raw = record_at(&g_writer, TEMP_HISTORY_RAW, bucket);
+    __atomic_store_n(&raw->ts, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    raw->temperature = temperature;
+    raw->humidity = humidity;
+    __atomic_store_n(&raw->ts, bucket * res, __ATOMIC_RELEASE);
+
+    for (i = TEMP_HISTORY_MINUTE; i < TEMP_HISTORY_TIER_COUNT; i++) {
+        res = g_writer.hdr->tiers[i].resolution;
+        bucket = ts / res;
+        rollup_add(record_at(&g_writer, i, bucket), bucket * res, temperature, humidity);
+    }
+    return 0;
+}
+
+// 规范化查询区间并选择汇总层级
+// from/to/step 为 0 表示未指定 返回 -1 参数非法 -2 点数超限
+int temp_history_plan(struct temp_history_range *r) {
+    struct history_header h;
+    int64_t now = (int64_t)time(NULL);
+    int64_t res;
+    int64_t points;
+    int tier;
+
+    layout(&h);
+    if (r->to <= 0 || r->to > now) {
+        r->to = now;
+    }
+    if (r->from <= 0) {
+        r->from = r->to - 86400;
+    }
+    if (r->from >= r->to || r->step < 0) {
+        return -1;
+    }
+    if (r->step == 0) {
+        r->step = (r->to - r->from + TEMP_HISTORY_DEFAULT_POINTS - 1) / TEMP_HISTORY_DEFAULT_POINTS;
+    }
+    // 取分辨率不超过 step 的最粗层级 其保留期覆盖不到 from 时再换更粗的层级
+    for (tier = TEMP_HISTORY_TIER_COUNT - 1; tier > 0; tier--) {
+        if ((int64_t)h.tiers[tier].resolution <= r->step) {
+            break;
+        }
+    }
+    while (tier < TEMP_HISTORY_TIER_COUNT - 1 &&
+           r->from < now - (int64_t)h.tiers[tier].resolution * h.tiers[tier].capacity) {
+        tier++;
+    }
+    res = h.tiers[tier].resolution;
+    r->resolution = res;
+    r->step = (r->step + res - 1) / res * res;
+    r->from -= r->from % r->step;
+    points = (r->to - r->from + r->step - 1) / r->step;
+    if (points > TEMP_HISTORY_MAX_POINTS) {
+        return -2;
+    }
+    return 0;
+}
+
+// 读出一条记录并折算为汇总 记录为空或正被改写时返回 0
+static int read_record(const struct history_map *m, int tier, int64_t bucket, struct rollup_record *out) {
+    const void *rec = record_at(m, tier, bucket);
+    int64_t want = bucket * m->hdr->tiers[tier].resolution;
+    int64_t ts1;
+    int64_t ts2;
+
+    ts1 = __atomic_load_n((const int64_t *)rec, __ATOMIC_ACQUIRE);
+    if (ts1 != want) {
+        return 0;
+    }
+    if (tier == TEMP_HISTORY_RAW) {
+        const struct raw_record *raw = rec;
+
+        out->count = 1;
+        out->temp_min = out->temp_max = raw->temperature;
+        out->hum_min = out->hum_max = raw->humidity;
+        out->temp_sum = raw->temperature;
+        out->hum_sum = raw->humidity;
+    } else {
+        memcpy(out, rec, sizeof(*out));
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    ts2 = __atomic_load_n((const int64_t *)rec, __ATOMIC_RELAXED);
+    return ts2 == want && out->count > 0;
+}
+
+// 按规划好的区间逐点输出 每点只访问其覆盖的记录 返回输出点数
+int temp_history_query(const struct temp_history_range *r, temp_history_cb cb, void *arg) {
+    struct history_header want;
+    struct history_map m;
+    struct temp_history_point p;
+    struct rollup_record rec;
+    struct stat st;
+    double temp_sum;
+    double hum_sum;
+    int64_t t;
+    int64_t b;
+    int64_t res;
+    int tier;
+    int count = 0;
+    int fd;
+
+    layout(&want);
+    for (tier = 0; tier < TEMP_HISTORY_TIER_COUNT; tier++) {
+        if ((int64_t)want.tiers[tier].resolution == r->resolution) {
+            break;
+        }
+    }
+    if (tier == TEMP_HISTORY_TIER_COUNT || r->step < r->resolution) {
+        return -1;
+    }
+    fd = open(TEMP_HISTORY_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != layout_size(&want)) {
+        close(fd);
+        return -1;
+    }
+    m.size = (size_t)st.st_size;
+    m.base = mmap(NULL, m.size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m.base == MAP_FAILED) {
+        return -1;
+    }
+    m.hdr = (const struct history_header *)m.base;
+    if (!header_valid(m.hdr, m.size) || memcmp(m.hdr->tiers, want.tiers, sizeof(want.tiers)) != 0) {
+        munmap(m.base, m.size);
+        return -1;
+    }
+    res = r->resolution;
+    for (t = r->from; t < r->to; t += r->step) {
+        memset(&p, 0, sizeof(p));
+        temp_sum = 0;
+        hum_sum = 0;
+        for (b = t / res; b < (t + r->step) / res; b++) {
+            if (!read_record(&m, tier, b, &rec)) {
+                continue;
+            }
+            if (p.count == 0 || rec.temp_min < p.temp_min) p.temp_min = rec.temp_min;
+            if (p.count == 0 || rec.temp_max > p.temp_max) p.temp_max = rec.temp_max;
+            if (p.count == 0 || rec.hum_min < p.hum_min) p.hum_min = rec.hum_min;
+            if (p.count == 0 || rec.hum_max > p.hum_max) p.hum_max = rec.hum_max;
+            p.count += rec.count;
+            temp_sum += rec.temp_sum;
+            hum_sum += rec.hum_sum;
+        }
+        if (p.count == 0) {
+            continue;
+        }
+        p.ts = t;
+        p.temp_avg = (float)(temp_sum / p.count);
+        p.hum_avg = (float)(hum_sum / p.count);
+        count++;
+        if (cb(&p, arg) != 0) {
+            break;
+        }
+    }
+    munmap(m.base, m.size);
+    return count;
+}
@@ -10,6 +10,15 @@
  *
  * @note
  * - 缓存文件路径为 /development/tmp/temperature.json，确保目录存在且可写。
+ * - 读数同时写入共享内存快照，STATE_EXPORT_JSON 为 0 时不再写文件。
+ * - JSON 导出要 fsync，交给工作线程按快照中的最新读数写入，
+ *   上一次导出还在排队时不再提交，事件循环不等待 SD 卡。
+ * - 每次读数追加到历史环形文件，供 /temperature/history 查询趋势。
+ * - 串口非阻塞打开，挂在守护进程的事件循环上：周期定时器按
+ *   TEMP_SAMPLE_MS 发请求，单次定时器负责应答超时与退避重试。
+ * - 应答按行拼接，收到 \r\n 才解析，分多次到达的数据不会被丢弃。
+ * - 超时后按 TEMP_RETRY_BASE_MS 起指数退避重发，连续失败
+ *   TEMP_REOPEN_FAILURES 次重新打开串口，串口打不开时同样退避重试。
  **********************************************************************/
 #include <stdio.h>
 #include <stdlib.h>
@@ -17,7 +26,6 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
-#include <sys/file.h>
 #include <sys/stat.h>
 #include <termios.h>
 #include <time.h>
@@ -25,13 +33,41 @@
 #include <json-c/json.h>
 #include "temperature.h"
 #include "define.h"
+#include "events.h"
+#include "state_shm.h"
+#include "atomic_file.h"
+#include "temp_history.h"
+#include "reactor.h"
+
+enum temp_link_state {
+    TEMP_LINK_IDLE,      // 空闲 等待下一个采样周期
+    TEMP_LINK_WAIT,      // 已发出请求 等待应答
+    TEMP_LINK_BACKOFF    // 超时后退避 到期重发
+};
+
+struct temp_link {
+    enum temp_link_state state;
+    int failures;               // 连续失败次数
+    size_t len;                 // buf 中未成行的字节数
+    char buf[BUFFER_SIZE];
+};
+
+static int g_serial_fd = -1;
+static int g_open_failures = 0;
+static struct temp_link g_link;
+static struct reactor_timer *g_tick_timer = NULL;    // 采样周期
+static struct reactor_timer *g_wait_timer = NULL;    // 应答超时与退避
+static struct reactor_timer *g_open_timer = NULL;    // 串口打开重试
+
+static void serial_ready(int fd, uint32_t events, void *arg);
 
 // 初始化串口  
 static int init_serial(const char *port) {
     int fd;
     struct termios options;
 
-    fd = open(port, O_RDWR | O_NOCTTY | O_NDELAY);// 打开串口
+    // 非阻塞打开 由 poll 等待数据到达
+    fd = open(port, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
     if (fd < 0) {
         perror("Failed to open serial port");
         return -1;
@@ -42,6 +78,10 @@ static int init_serial(const char *port) {
         return -1;
     }// 设置串口为原始模式
     cfmakeraw(&options);
+    options.c_cflag |= CLOCAL | CREAD;
+    // read 有多少取多少 不在内核里等待 超时由定时器负责
+    options.c_cc[VMIN] = 0;
+    options.c_cc[VTIME] = 0;
     cfsetspeed(&options, BAUD_RATE);// 设置波特率
     if (tcsetattr(fd, TCSANOW, &options) < 0) {
         perror("tcsetattr failed");
@@ -60,84 +100,240 @@ static int parse_response(const char *buf, float *humidity, float *temperature)
     }
     return -1;
 }
-// 写入 JSON 文件（带 flock 锁）
-static int write_json_to_file(float humidity, float temperature) {
-    int fd;
-    char hum_str[32];
-    char temp_str[32];
-    json_object *root;
+#if STATE_EXPORT_JSON
+// 原子写入 JSON 文件 读者不会读到截断的内容
+static int write_json_to_file(json_object *root) {
     const char *json_str;
-    ssize_t written;
 
     mkdir("/development/tmp", 0755);
-    fd = open(OUTPUT_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (fd < 0) {
-        perror("Failed to open output file");
+    json_str = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PRETTY);
+    if (atomic_write_file(OUTPUT_FILE, json_str, strlen(json_str), 0644, 0) != 0) {
+        perror("Failed to write output file");
         return -1;
     }
-    if (flock(fd, LOCK_EX) != 0) {
-        perror("flock failed");
-        close(fd);
-        return -1;
+    return 0;
+}
+static int g_export_queued = 0;   // 导出任务已提交尚未执行
+
+// 工作线程中导出快照里的最新读数
+static void export_job(void *arg) {
+    struct state_temperature t;
+    json_object *root;
+
+    (void)arg;
+    __atomic_store_n(&g_export_queued, 0, __ATOMIC_RELEASE);
+    if (state_shm_read_temperature(&t, NULL) != 0) {
+        return;
     }
-    // 格式化为一位小数的字符串
-    snprintf(hum_str, sizeof(hum_str), "%.1f", humidity);
-    snprintf(temp_str, sizeof(temp_str), "%.1f", temperature);
-    // 构建 JSON
-    root = json_object_new_object();
-    json_object_object_add(root, "humidity", json_object_new_double_s(humidity, hum_str));
-    json_object_object_add(root, "temperature", json_object_new_double_s(temperature, temp_str));
-    json_object_object_add(root, "timestamp", json_object_new_int64(time(NULL)));
-    json_str = json_object_to_json_string_ext(root, JSON_C_TO_STRING_PRETTY);
-    written = write(fd, json_str, strlen(json_str));
-    if (written < 0) {
-        perror("write failed");
+    root = state_temperature_to_json(&t);
+    if (write_json_to_file(root) != 0) {
+        fprintf(stderr, "Failed to write JSON file\n");
     }
-    flock(fd, LOCK_UN);
-    close(fd);
     json_object_put(root);
-    return (written >= 0) ? 0 : -1;
 }
-// 温度采集线程主函数
-void* temperature_thread(void *arg) {
-    int serial_fd;
-    char buffer[BUFFER_SIZE];
+// 提交导出任务 已在排队时跳过
+static void queue_export(void) {
+    if (__atomic_exchange_n(&g_export_queued, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    if (reactor_submit(export_job, NULL) != 0) {
+        __atomic_store_n(&g_export_queued, 0, __ATOMIC_RELEASE);
+    }
+}
+#endif
+// 发布一次读数：共享内存供 CGI 读取 JSON 文件为可选导出
+static void publish_reading(float humidity, float temperature) {
+#if STATE_EXPORT_JSON
+    static int64_t last_export = 0;
+#endif
+    struct state_temperature t;
+    json_object *root;
+
+    t.humidity = humidity;
+    t.temperature = temperature;
+    t.timestamp = (int64_t)time(NULL);
+    if (state_shm_write_temperature(&t) != 0) {
+        fprintf(stderr, "Failed to update state snapshot\n");
+    }
+    if (temp_history_append(t.timestamp, temperature, humidity) != 0) {
+        fprintf(stderr, "Failed to append temperature history\n");
+    }
+    root = state_temperature_to_json(&t);
+#if STATE_EXPORT_JSON
+    // 采样可能快于导出间隔 文件每 INTERVAL_SEC 最多写一次
+    if (t.timestamp - last_export >= INTERVAL_SEC) {
+        last_export = t.timestamp;
+        queue_export();
+    }
+#endif
+    events_publish_json(EVENT_TEMPERATURE, root);
+    json_object_put(root);
+}
+// 第 failures 次失败后的重试间隔 指数增长并封顶
+static int retry_delay_ms(int failures) {
+    int delay = TEMP_RETRY_BASE_MS;
+
+    while (--failures > 0 && delay < TEMP_RETRY_MAX_MS) {
+        delay *= 2;
+    }
+    return delay < TEMP_RETRY_MAX_MS ? delay : TEMP_RETRY_MAX_MS;
+}
+// 发送一次读取命令 丢弃上一轮残留的输入
+static int send_request(int serial_fd, struct temp_link *link) {
+    tcflush(serial_fd, TCIFLUSH);
+    link->len = 0;
+    if (write(serial_fd, CMD, CMD_LEN) != (ssize_t)CMD_LEN) {
+        perror("Failed to send command");
+        return -1;
+    }
+    return 0;
+}
+// 读取串口数据并按行切分 每解析出一条读数返回 1
+static int read_lines(int serial_fd, struct temp_link *link) {
     ssize_t n;
+    char *start;
+    char *nl;
     float humidity;
     float temperature;
+    int got = 0;
 
-    serial_fd = init_serial(SERIAL_PORT);
-    if (serial_fd < 0) {
-        fprintf(stderr, "Serial init failed, temperature thread exiting.\n");
-        return NULL;
-    }
-    while (1) {
-        // 发送命令
-        if (write(serial_fd, CMD, CMD_LEN) != CMD_LEN) {
-            perror("Failed to send command");
-            sleep(INTERVAL_SEC);
-            continue;
+    n = read(serial_fd, link->buf + link->len, sizeof(link->buf) - 1 - link->len);
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+    if (n == 0) {
+        return 0;
+    }
+    link->len += (size_t)n;
+    link->buf[link->len] = '\0';
+    start = link->buf;
+    // 响应以 \r\n 结尾 不完整的行留到下次继续拼接
+    while ((nl = strchr(start, '\n')) != NULL) {
+        *nl = '\0';
+        if (nl > start && nl[-1] == '\r') {
+            nl[-1] = '\0';
+        }
+        if (*start == '\0') {
+            // 空行
+        } else if (parse_response(start, &humidity, &temperature) == 0) {
+            publish_reading(humidity, temperature);
+            got = 1;
+        } else {
+            fprintf(stderr, "[TEMP] Unrecognized response: '%s'\n", start);
         }
-        // 读取响应（最多等待 2 秒）
-        memset(buffer, 0, sizeof(buffer));
-        n = read(serial_fd, buffer, sizeof(buffer) - 1);
-        if (n > 0) {
-            buffer[n] = '\0';
-            if (parse_response(buffer, &humidity, &temperature) == 0) {
-                printf("[TEMP] Got H=%.1f%%, T=%.1f°C\n", humidity, temperature);
-                if (write_json_to_file(humidity, temperature) != 0) {
-                    fprintf(stderr, "Failed to write JSON file\n");
-                }
-            } 
-            else {
-                fprintf(stderr, "[TEMP] Unrecognized response: '%s'\n", buffer);
-            }
-        } 
-        else {
-            fprintf(stderr, "[TEMP] No response from sensor\n");
+        start = nl + 1;
+    }
+    link->len -= (size_t)(start - link->buf);
+    memmove(link->buf, start, link->len);
+    if (link->len >= sizeof(link->buf) - 1) {
+        fprintf(stderr, "[TEMP] Line too long, discarded\n");
+        link->len = 0;
+    }
+    return got;
+}
+// 关闭串口 放弃进行中的请求
+static void close_serial(void) {
+    if (g_serial_fd >= 0) {
+        reactor_del_fd(g_serial_fd);
+        close(g_serial_fd);
+        g_serial_fd = -1;
+    }
+    g_link.len = 0;
+    g_link.state = TEMP_LINK_IDLE;
+    reactor_timer_set(g_wait_timer, 0, 0);
+}
+// 尝试打开串口 失败则按退避间隔重试
+static void try_open(void *arg) {
+    (void)arg;
+    g_serial_fd = init_serial(SERIAL_PORT);
+    if (g_serial_fd >= 0 && reactor_add_fd(g_serial_fd, EPOLLIN, serial_ready, NULL) == 0) {
+        g_open_failures = 0;
+        return;
+    }
+    if (g_serial_fd >= 0) {
+        close(g_serial_fd);
+        g_serial_fd = -1;
+    }
+    g_open_failures++;
+    reactor_timer_set(g_open_timer, retry_delay_ms(g_open_failures), 0);
+}
+// 重新打开串口
+static void reopen_serial(void) {
+    close_serial();
+    try_open(NULL);
+}
+// 请求失败或超时 进入退避 等待后重发
+static void enter_backoff(void) {
+    g_link.failures++;
+    fprintf(stderr, "[TEMP] No response from sensor (%d)\n", g_link.failures);
+    if (g_link.failures % TEMP_REOPEN_FAILURES == 0) {
+        // 连续失败多次 重新打开串口
+        reopen_serial();
+        if (g_serial_fd < 0) {
+            return;
         }
-        sleep(INTERVAL_SEC);
     }
-    close(serial_fd);
-    return NULL;
+    g_link.state = TEMP_LINK_BACKOFF;
+    reactor_timer_set(g_wait_timer, retry_delay_ms(g_link.failures), 0);
+}
+// 发出请求并开始计时等待应答
+static void start_request(void) {
+    if (g_serial_fd < 0) {
+        // 串口尚未打开 由打开定时器负责恢复
+        g_link.state = TEMP_LINK_IDLE;
+        return;
+    }
+    if (send_request(g_serial_fd, &g_link) != 0) {
+        enter_backoff();
+        return;
+    }
+    g_link.state = TEMP_LINK_WAIT;
+    reactor_timer_set(g_wait_timer, TEMP_RESPONSE_TIMEOUT_MS, 0);
+}
+// 串口可读
+static void serial_ready(int fd, uint32_t events, void *arg) {
+    int got;
+
+    (void)arg;
+    got = read_lines(fd, &g_link);
+    if (got > 0) {
+        // 收到读数 取消超时 恢复正常周期
+        g_link.state = TEMP_LINK_IDLE;
+        g_link.failures = 0;
+        reactor_timer_set(g_wait_timer, 0, 0);
+    } else if (got < 0 || (events & (EPOLLERR | EPOLLHUP))) {
+        perror("[TEMP] Serial read failed, reopening");
+        reopen_serial();
+    }
+}
+// 采样周期到 上一次请求还在等待或退避中时跳过 不堆积请求
+static void sample_tick(void *arg) {
+    (void)arg;
+    if (g_link.state == TEMP_LINK_IDLE) {
+        start_request();
+    }
+}
+// 应答超时或退避结束
+static void wait_expired(void *arg) {
+    (void)arg;
+    if (g_link.state == TEMP_LINK_WAIT) {
+        enter_backoff();
+    } else if (g_link.state == TEMP_LINK_BACKOFF) {
+        start_request();
+    }
+}
+// 在事件循环上启动温湿度采集
+int temperature_start(void) {
+    g_tick_timer = reactor_timer_new(sample_tick, NULL);
+    g_wait_timer = reactor_timer_new(wait_expired, NULL);
+    g_open_timer = reactor_timer_new(try_open, NULL);
+    if (!g_tick_timer || !g_wait_timer || !g_open_timer) {
+        return -1;
+    }
+    memset(&g_link, 0, sizeof(g_link));
+    g_link.state = TEMP_LINK_IDLE;
+    try_open(NULL);
+    // 立即采第一次 之后按采样周期
+    reactor_timer_set(g_tick_timer, 1, TEMP_SAMPLE_MS);
+    return 0;
 }
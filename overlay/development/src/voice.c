@@ -11,6 +11,8 @@
  *
  * @note
  * - 注意约定好的数据
+ * - 串口挂在守护进程的事件循环上，有数据到达才被唤醒，一次读出全部字节。
+ * - 串口打不开或中途断开时由定时器每 2 秒重试，最多 15 次。
  **********************************************************************/
 #include "zigbee_mq.h" 
 #include <stdio.h>
@@ -25,10 +27,11 @@
 #include <errno.h>
 #include <termios.h>
 #include <stdint.h>
-#include <sys/file.h>
 #include <json-c/json.h> 
 #include "voice.h"
 #include "define.h"
+#include "state_shm.h"
+#include "reactor.h"
 
 // 读取温度传感器数据
 static int read_temperature_data(float* temperature, float* humidity) {
@@ -39,21 +42,22 @@ static int read_temperature_data(float* temperature, float* humidity) {
     json_object* root;
     json_object* temp_obj = NULL;
     json_object* hum_obj = NULL;
+    struct state_temperature t;
 
+    // 优先读共享内存快照
+    if (state_shm_read_temperature(&t, NULL) == 0) {
+        *temperature = t.temperature;
+        *humidity = t.humidity;
+        return 0;
+    }
     fp = fopen(filepath, "r");
     if (!fp) {
         return -1;
     }
-    // 加共享锁
-    if (flock(fileno(fp), LOCK_SH) != 0) {
-        fclose(fp);
-        return -2;
-    }
     // 获取文件大小
     fseek(fp, 0, SEEK_END);
     len = ftell(fp);
     if (len <= 0 || len > 4096) {
-        flock(fileno(fp), LOCK_UN);
         fclose(fp);
         return -3;
     }
@@ -61,18 +65,15 @@ static int read_temperature_data(float* temperature, float* humidity) {
     // 读取文件内容
     json_str = malloc(len + 1);
     if (!json_str) {
-        flock(fileno(fp), LOCK_UN);
         fclose(fp);
         return -4;
     }
     if (fread(json_str, 1, len, fp) != (size_t)len) {
         free(json_str);
-        flock(fileno(fp), LOCK_UN);
         fclose(fp);
         return -5;
     }
     json_str[len] = '\0';
-    flock(fileno(fp), LOCK_UN);
     fclose(fp);
     // 解析 JSON
     root = json_tokener_parse(json_str);
@@ -234,49 +235,33 @@ static uint8_t weather_text_to_code(const char* text) {
     if (strcmp(text, "霾") == 0) return 0x10;
     return 0x00; // 未知
 }
-// 读取并编码天气数据
-static int encode_weather_data(uint8_t* outbuf, size_t outlen) {
+// 从天气缓存文件读取 快照不可用时使用
+static int read_weather_file(uint8_t* weather_code, int* temp, int* hum) {
     FILE* f;
-    int fd;
     long sz;
     char* buf;
     struct json_object* root;
     struct json_object* now = NULL;
     struct json_object *jtext, *jtemp, *jhum;
-    const char* text;
-    int temp;
-    int hum;
-    uint8_t weather_code;
 
-    if (outlen < 14) {
-        return -1;
-    }
     f = fopen(WEATHER_CACHE_FILE, "r");
     if (!f) {
         return -2;
     }
-    fd = fileno(f);
-    if (flock(fd, LOCK_SH) != 0) { 
-        fclose(f); 
-        return -3; 
-    }
     fseek(f, 0, SEEK_END);
     sz = ftell(f);
     fseek(f, 0, SEEK_SET);
     if (sz <= 0 || sz > 4096) { 
-        flock(fd, LOCK_UN); 
         fclose(f); 
         return -4;
     }
     buf = malloc(sz+1);
     if (!buf) { 
-        flock(fd, LOCK_UN); 
         fclose(f); 
         return -5; 
     }
     fread(buf, 1, sz, f); 
     buf[sz] = 0;
-    flock(fd, LOCK_UN); 
     fclose(f);
     root = json_tokener_parse(buf);
     free(buf);
@@ -292,10 +277,30 @@ static int encode_weather_data(uint8_t* outbuf, size_t outlen) {
         !json_object_object_get_ex(now, "humidity", &jhum)) {
         json_object_put(root); return -8;
     }
-    text = json_object_get_string(jtext);
-    temp = atoi(json_object_get_string(jtemp));
-    hum = atoi(json_object_get_string(jhum));
-    weather_code = weather_text_to_code(text);
+    *weather_code = weather_text_to_code(json_object_get_string(jtext));
+    *temp = atoi(json_object_get_string(jtemp));
+    *hum = atoi(json_object_get_string(jhum));
+    json_object_put(root);
+    return 0;
+}
+// 读取并编码天气数据
+static int encode_weather_data(uint8_t* outbuf, size_t outlen) {
+    WeatherData wd;
+    int temp;
+    int hum;
+    uint8_t weather_code;
+    int ret;
+
+    if (outlen < 14) {
+        return -1;
+    }
+    if (state_shm_read_weather(&wd, NULL) == 0) {
+        weather_code = weather_text_to_code(wd.weather);
+        temp = atoi(wd.temperature);
+        hum = atoi(wd.humidity);
+    } else if ((ret = read_weather_file(&weather_code, &temp, &hum)) != 0) {
+        return ret;
+    }
     // 编码
     memset(outbuf, 0, 14);
     outbuf[0] = 0xAA; outbuf[1] = 0x55; outbuf[2] = 0x01;
@@ -311,128 +316,155 @@ static int encode_weather_data(uint8_t* outbuf, size_t outlen) {
     outbuf[10] = (uint8_t)((hum >> 16) & 0xFF);
     outbuf[11] = (uint8_t)((hum >> 24) & 0xFF);
     outbuf[12] = 0x55; outbuf[13] = 0xAA;
-    json_object_put(root);
     return 0;
 }
+static int g_voice_fd = -1;
+static int g_open_attempts = 0;
+static int g_have_prefix = 0;      // 已收到命令前缀 0x11 等待命令码
+static struct reactor_timer *g_open_timer = NULL;
+
+// 打开并配置语音模块串口
 static int open_voice_port(void) {
-    int fd = -1;
-    int retry = 0;
-    const int max_retry = 15;      // 最多重试 15 次
-    const int retry_delay_sec = 2; // 每次间隔 2 秒
+    int fd;
     struct termios tty;
 
-    while (retry < max_retry) {
-        fd = open(VOICE_SERIAL_DEVICE, O_RDWR | O_NOCTTY);
-        if (fd >= 0) {
-            // 成功打开，配置串口
-            if (tcgetattr(fd, &tty) != 0) {
-                perror("[Voice] tcgetattr failed");
-                close(fd);
-                return -1;
-            }
-            cfmakeraw(&tty);// 原始模式
-            cfsetspeed(&tty, VOICE_BAUDRATE);// 设置波特率
-            if (tcsetattr(fd, TCSANOW, &tty) != 0) {
-                perror("[Voice] tcsetattr failed");
-                close(fd);
-                return -1;
-            }
-            tcflush(fd, TCIOFLUSH);// 清空接收缓冲区
-            printf("[Voice] Serial port opened: %s\n", VOICE_SERIAL_DEVICE);
-            return fd;
-        }
-        // 打开失败
-        fprintf(stderr, "[Voice] Failed to open %s (attempt %d/%d): %s\n",
-                VOICE_SERIAL_DEVICE, retry + 1, max_retry, strerror(errno));
-        retry++;
-        if (retry < max_retry) {
-            sleep(retry_delay_sec);
-        }
+    fd = open(VOICE_SERIAL_DEVICE, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    if (tcgetattr(fd, &tty) != 0) {
+        perror("[Voice] tcgetattr failed");
+        close(fd);
+        return -1;
+    }
+    cfmakeraw(&tty);// 原始模式
+    cfsetspeed(&tty, VOICE_BAUDRATE);// 设置波特率
+    if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+        perror("[Voice] tcsetattr failed");
+        close(fd);
+        return -1;
     }
-    fprintf(stderr, "[Voice] Giving up after %d attempts. Voice control disabled.\n", max_retry);
-    return -1;
+    tcflush(fd, TCIOFLUSH);// 清空接收缓冲区
+    return fd;
 }
-// 语音线程
-void* voice_thread(void* arg) {
-    int fd;
-    uint8_t byte;
-    ssize_t n;
-    uint8_t cmd_code;
+// 处理一条 11 XX 命令
+static void handle_command(int fd, uint8_t cmd_code) {
     uint8_t buf[14];
     const char* zigbee_cmd = NULL;
 
-    fd = open_voice_port();  // Use the new function
-    if (fd < 0) {
-        fprintf(stderr, "[Voice] Failed to open %s: %s\n", VOICE_SERIAL_DEVICE, strerror(errno));
-        return NULL;
-    }
-    printf("[Voice] Listening on %s @ %d bps\n", VOICE_SERIAL_DEVICE,
-           (VOICE_BAUDRATE == B9600) ? 9600 :
-           (VOICE_BAUDRATE == B115200) ? 115200 : 0);
-    while (1) {
-        n = read(fd, &byte, 1);
-        if (n <= 0) {
-            usleep(5000);
-            continue;
+    if (cmd_code == 0xFF) {
+        // 处理天气查询命令
+        if (encode_weather_data(buf, sizeof(buf)) == 0) {
+            write(fd, buf, 14);
+            printf("[Voice] 11 FF: send weather to serial\n");
+        } else {
+            printf("[Voice] 11 FF: weather encode/send failed\n");
+        }
+    }
+    else if (cmd_code == 0x03){
+        if (send_temperature_data(fd) == 0) {
+            printf("[Voice] 11 03: send temperature to serial\n");
+        } else {
+            printf("[Voice] 11 03: temperature read/send failed\n");
+        }
+    }
+    else if (cmd_code == 0x04) {
+        // 处理湿度查询命令
+        if (send_humidity_data(fd) == 0) {
+            printf("[Voice] 11 04: send humidity to serial\n");
+        } else {
+            printf("[Voice] 11 04: humidity read/send failed\n");
+        }
+    }
+    else if (cmd_code == 0x11) {
+        // 处理IP地址查询命令
+        if (send_ip_address_data(fd) == 0) {
+            printf("[Voice] 11 11: send IP address to serial\n");
+        } else {
+            printf("[Voice] 11 11: IP address read/send failed\n");
         }
-        if (byte == 0x11) {
-            if (read(fd, &cmd_code, 1) == 1) {
-                if (cmd_code == 0xFF) {
-                    // 处理天气查询命令
-                    if (encode_weather_data(buf, sizeof(buf)) == 0) {
-                        write(fd, buf, 14);
-                        printf("[Voice] 11 FF: send weather to serial\n");
-                    } else {
-                        printf("[Voice] 11 FF: weather encode/send failed\n");
-                    }
-                }
-                else if (cmd_code == 0x03){
-                    if (send_temperature_data(fd) == 0) {
-                        printf("[Voice] 11 03: send temperature to serial\n");
-                    } else {
-                        printf("[Voice] 11 03: temperature read/send failed\n");
-                    }
-                }
-                else if (cmd_code == 0x04) {
-                    // 处理湿度查询命令
-                    if (send_humidity_data(fd) == 0) {
-                        printf("[Voice] 11 04: send humidity to serial\n");
-                    } else {
-                        printf("[Voice] 11 04: humidity read/send failed\n");
-                    }
-                }
-                else if (cmd_code == 0x11) {
-                    // 处理IP地址查询命令
-                    if (send_ip_address_data(fd) == 0) {
-                        printf("[Voice] 11 11: send IP address to serial\n");
-                    } else {
-                        printf("[Voice] 11 11: IP address read/send failed\n");
-                    }
-                }
-                else {
-                    zigbee_cmd = NULL;
-                    switch (cmd_code) {
-                        case 0x01: zigbee_cmd = ZIGBEE_CMD_LIGHT_ON; break;
-                        case 0x02: zigbee_cmd = ZIGBEE_CMD_LIGHT_OFF; break;
-                        case 0x05: zigbee_cmd = ZIGBEE_CMD_FAN_ON; break;
-                        case 0x06: zigbee_cmd = ZIGBEE_CMD_FAN_OFF; break;
-                        case 0x07: zigbee_cmd = ZIGBEE_CMD_AIRCON_ON; break;
-                        case 0x08: zigbee_cmd = ZIGBEE_CMD_AIRCON_OFF; break;
-                        case 0x09: zigbee_cmd = ZIGBEE_CMD_DOOR_OPEN; break;
-                        case 0x10: zigbee_cmd = ZIGBEE_CMD_DOOR_CLOSE; break;
-                        case 0x12: zigbee_cmd = ZIGBEE_CMD_WASHING_ON; break;
-                        case 0x13: zigbee_cmd = ZIGBEE_CMD_WASHING_OFF; break;
-                        default:
-                            continue; // 忽略查询命令
-                    }
-                    if (zigbee_cmd) {
-                        printf("[Voice] Rx: 11 %02X → %s\n", cmd_code, zigbee_cmd);
-                        send_zigbee_command(zigbee_cmd);
-                    }
-                }
-            }
+    }
+    else {
+        switch (cmd_code) {
+            case 0x01: zigbee_cmd = ZIGBEE_CMD_LIGHT_ON; break;
+            case 0x02: zigbee_cmd = ZIGBEE_CMD_LIGHT_OFF; break;
+            case 0x05: zigbee_cmd = ZIGBEE_CMD_FAN_ON; break;
+            case 0x06: zigbee_cmd = ZIGBEE_CMD_FAN_OFF; break;
+            case 0x07: zigbee_cmd = ZIGBEE_CMD_AIRCON_ON; break;
+            case 0x08: zigbee_cmd = ZIGBEE_CMD_AIRCON_OFF; break;
+            case 0x09: zigbee_cmd = ZIGBEE_CMD_DOOR_OPEN; break;
+            case 0x10: zigbee_cmd = ZIGBEE_CMD_DOOR_CLOSE; break;
+            case 0x12: zigbee_cmd = ZIGBEE_CMD_WASHING_ON; break;
+            case 0x13: zigbee_cmd = ZIGBEE_CMD_WASHING_OFF; break;
+            default:
+                return; // 忽略查询命令
+        }
+        printf("[Voice] Rx: 11 %02X → %s\n", cmd_code, zigbee_cmd);
+        send_zigbee_command(zigbee_cmd);
+    }
+}
+static void try_open(void *arg);
+// 串口可读 一次取出已到达的全部字节
+// 命令可能分两次到达 前缀状态跨回调保留
+static void voice_ready(int fd, uint32_t events, void *arg) {
+    uint8_t data[64];
+    ssize_t n;
+    ssize_t i;
+
+    (void)arg;
+    n = read(fd, data, sizeof(data));
+    if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+        return;
+    }
+    if (n <= 0 || (events & (EPOLLERR | EPOLLHUP))) {
+        // 设备出错或被拔出 关闭后重新打开
+        fprintf(stderr, "[Voice] Serial port lost, reopening\n");
+        reactor_del_fd(fd);
+        close(fd);
+        g_voice_fd = -1;
+        g_have_prefix = 0;
+        g_open_attempts = 0;
+        reactor_timer_set(g_open_timer, VOICE_RETRY_DELAY_SEC * 1000, 0);
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        if (g_have_prefix) {
+            g_have_prefix = 0;
+            handle_command(fd, data[i]);
+        } else if (data[i] == 0x11) {
+            g_have_prefix = 1;
         }
     }
-    close(fd);
-    return NULL;
+}
+// 尝试打开串口 失败时由定时器重试
+static void try_open(void *arg) {
+    (void)arg;
+    g_voice_fd = open_voice_port();
+    if (g_voice_fd >= 0 && reactor_add_fd(g_voice_fd, EPOLLIN, voice_ready, NULL) == 0) {
+        printf("[Voice] Listening on %s @ %d bps\n", VOICE_SERIAL_DEVICE,
+               (VOICE_BAUDRATE == B9600) ? 9600 :
+               (VOICE_BAUDRATE == B115200) ? 115200 : 0);
+        return;
+    }
+    if (g_voice_fd >= 0) {
+        close(g_voice_fd);
+        g_voice_fd = -1;
+    }
+    g_open_attempts++;
+    fprintf(stderr, "[Voice] Failed to open %s (attempt %d/%d): %s\n",
+            VOICE_SERIAL_DEVICE, g_open_attempts, VOICE_MAX_RETRY, strerror(errno));
+    if (g_open_attempts < VOICE_MAX_RETRY) {
+        reactor_timer_set(g_open_timer, VOICE_RETRY_DELAY_SEC * 1000, 0);
+    } else {
+        fprintf(stderr, "[Voice] Giving up after %d attempts. Voice control disabled.\n", VOICE_MAX_RETRY);
+    }
+}
+// 在事件循环上启动语音模块
+int voice_start(void) {
+    g_open_timer = reactor_timer_new(try_open, NULL);
+    if (!g_open_timer) {
+        return -1;
+    }
+    try_open(NULL);
+    return 0;
 }
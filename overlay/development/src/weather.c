@@ -4,6 +4,7 @@
  *
  * 本文件实现天气 JSON 响应的解析
  * 供 CGI 接口读取缓存并生成结构化天气数据
+ * 与 environment 守护进程共用 事件推送与接口输出同样的 JSON
  *
  * @author 杨翊
  * @date 2026-02-02
@@ -93,3 +94,21 @@ int parse_weather_json(const char*json_str,WeatherData*out){
     json_object_put(root);
     return 0;
 }
+
+// 转为接口返回的 JSON 对象
+json_object*weather_data_to_json(const WeatherData*wd){
+    json_object*obj=json_object_new_object();
+
+    json_object_object_add(obj,"code",json_object_new_string(wd->code));
+    if(wd->valid){
+        json_object_object_add(obj,"weather",json_object_new_string(wd->weather));
+        json_object_object_add(obj,"temperature",json_object_new_string(wd->temperature));
+        json_object_object_add(obj,"feels_like",json_object_new_string(wd->feels_like));
+        json_object_object_add(obj,"humidity",json_object_new_string(wd->humidity));
+        json_object_object_add(obj,"wind_dir",json_object_new_string(wd->wind_dir));
+        json_object_object_add(obj,"wind_scale",json_object_new_string(wd->wind_scale));
+    }else{
+        json_object_object_add(obj,"error",json_object_new_string("Weather data invalid"));
+    }
+    return obj;
+}
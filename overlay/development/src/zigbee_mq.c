@@ -2,7 +2,7 @@
  * @file zigbee_mq.c
  * @brief Zigbee 线程实现
  *
- * 本文件实现了通过 MQ 接收 Zigbee 命令。
+ * 本文件实现了 Zigbee 命令的消息队列与设备状态。
  *
  * @author 杨翊
  * @date 2026-01-23
@@ -10,24 +10,29 @@
  *
  * @note
  * - MQ 路径为 /development/zigbee_mq。
+ * - 设备状态文件用于重启后恢复，日常读取走共享内存快照，不再加锁读文件。
+ * - 本文件同时编入 CGI，串口转发在守护进程专用的 zigbee_serial.c 中。
+ * - 状态文件要 fsync，守护进程经 zigbee_set_state_saver 交给工作线程写，
+ *   事件循环只更新共享内存快照；CGI 未设置时仍当场写入。
  **********************************************************************/
 #include <stdio.h>
-#include <sys/file.h>
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <pthread.h>
-#include <termios.h>
 #include <errno.h>
 #include <mqueue.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include "zigbee_mq.h"
+#include "state_shm.h"
+#include "atomic_file.h"
 
 static mqd_t g_mq_fd = (mqd_t)-1;
-static int g_serial_fd = -1;
+// 状态文件的保存方式 为空时当场写入
+static void (*g_state_saver)(void) = NULL;
 
 // 写锁
 pthread_mutex_t g_mq_write_mutex = PTHREAD_MUTEX_INITIALIZER;
@@ -67,12 +72,7 @@ static void load_state_from_file(int* light, int* fan, int* aircon, int* washing
         *light = *fan = *aircon = *washing = *door = *wifi = 0;
         return;
     }
-    if (flock(fileno(f), LOCK_SH) != 0) {
-        perror("flock SH");
-        fclose(f);
-        *light = *fan = *aircon = *washing = *door = *wifi = 0;
-        return;
-    }
+    // 写者原子替换文件 读取无需加锁
     n = fscanf(f, "%d %d %d %d %d %d", &l, &f_val, &a, &w, &d, &wi);
     if (n == 5 || n == 6) {
         *light = l;
@@ -85,67 +85,47 @@ static void load_state_from_file(int* light, int* fan, int* aircon, int* washing
         // 格式错误，重置为默认
         *light = *fan = *aircon = *washing = *door = *wifi = 0;
     }
-    flock(fileno(f), LOCK_UN);
     fclose(f);
 }
-// 将状态写入文件
+// 将状态写入文件 原子替换并同步目录 断电后也能恢复
 static void save_state_to_file(int light, int fan, int aircon, int washing, int door, int wifi) {
-    FILE* f;
+    char buf[64];
+    int len;
 
     // 确保目录存在
     create_state_dir();
-    f = fopen(DEVICE_STATE_FILE, "w");
-    if (!f) {
-        perror("fopen state file for writing");
-        return;
-    }
-    if (flock(fileno(f), LOCK_EX) != 0) {
-        perror("flock EX");
-        fclose(f);
-        return;
+    len = snprintf(buf, sizeof(buf), "%d %d %d %d %d %d\n", light, fan, aircon, washing, door, wifi);
+    if (atomic_write_file(DEVICE_STATE_FILE, buf, (size_t)len, 0666, ATOMIC_FILE_SYNC_DIR) != 0) {
+        perror("write state file");
     }
-    fprintf(f, "%d %d %d %d %d %d\n", light, fan, aircon, washing, door, wifi);
-    fflush(f); // 确保写入磁盘
-    flock(fileno(f), LOCK_UN);
-    fclose(f);
 }
 
-// 打开 Zigbee 串口
-static int open_serial_port(void) {
-    int fd = -1;
-    int retry = 0;
-    struct termios tty;
+// 写入共享内存快照
+static void publish_state(int light, int fan, int aircon, int washing, int door, int wifi) {
+    struct state_devices d;
 
-    while (retry < MAX_RETRY) {
-        fd = open(SERIAL_DEVICE, O_RDWR | O_NOCTTY);
-        if (fd >= 0) {
-            // 成功打开，配置串口
-            if (tcgetattr(fd, &tty) != 0) {
-                perror("tcgetattr failed");
-                close(fd);
-                return -1;
-            }
-            cfmakeraw(&tty);
-            cfsetspeed(&tty, B115200);
-            if (tcsetattr(fd, TCSANOW, &tty) != 0) {
-                perror("tcsetattr failed");
-                close(fd);
-                return -1;
-            }
-            tcflush(fd, TCIOFLUSH);
-            printf("[Zigbee] Serial port opened successfully: %s\n", SERIAL_DEVICE);
-            return fd;
-        }
-        // 打开失败
-        fprintf(stderr, "[Zigbee] Failed to open %s (attempt %d/%d): %s\n",
-                SERIAL_DEVICE, retry + 1, MAX_RETRY, strerror(errno));
-        retry++;
-        if (retry < MAX_RETRY) {
-            sleep(RETRY_DELAY_SEC);
-        }
+    d.light = (uint8_t)light;
+    d.fan = (uint8_t)fan;
+    d.aircon = (uint8_t)aircon;
+    d.washing = (uint8_t)washing;
+    d.door = (uint8_t)door;
+    d.wifi = (uint8_t)wifi;
+    state_shm_write_devices(&d);
+}
+// 读取当前状态 优先共享内存 快照不可用时读文件
+static void load_state(int* light, int* fan, int* aircon, int* washing, int* door, int* wifi) {
+    struct state_devices d;
+
+    if (state_shm_read_devices(&d, NULL) == 0) {
+        *light = d.light;
+        *fan = d.fan;
+        *aircon = d.aircon;
+        *washing = d.washing;
+        *door = d.door;
+        *wifi = d.wifi;
+        return;
     }
-    fprintf(stderr, "[Zigbee] Giving up after %d attempts.\n", MAX_RETRY);
-    return -1;
+    load_state_from_file(light, fan, aircon, washing, door, wifi);
 }
 
 // 验证命令（内部函数）
@@ -168,19 +148,24 @@ int init_zigbee_mq(void) {
     attr.mq_msgsize = MAX_CMD_LEN;
     attr.mq_curmsgs = 0;
     old_mask = umask(0);
-    g_mq_fd = mq_open(MQ_NAME, O_CREAT | O_RDWR, 0666, &attr);
+    // 非阻塞 接收方是事件循环 队列满时发送方不能阻塞等待
+    g_mq_fd = mq_open(MQ_NAME, O_CREAT | O_RDWR | O_NONBLOCK, 0666, &attr);
     umask(old_mask);
     if (g_mq_fd == (mqd_t)-1) {
         perror("mq_open");
         return -1;
     }
+    // 用状态文件初始化快照
+    int light, fan, aircon, washing, door, wifi;
+    load_state_from_file(&light, &fan, &aircon, &washing, &door, &wifi);
+    publish_state(light, fan, aircon, washing, door, wifi);
     return 0;
 }
 // 根据命令更新状态并保存到文件
 static void update_and_save_state(const char* cmd) {
     // 先读取当前状态
     int light, fan, aircon, washing, door, wifi;
-    load_state_from_file(&light, &fan, &aircon, &washing, &door, &wifi);
+    load_state(&light, &fan, &aircon, &washing, &door, &wifi);
     if (strcmp(cmd, ZIGBEE_CMD_LIGHT_ON) == 0) {
         light = 1;
     } else if (strcmp(cmd, ZIGBEE_CMD_LIGHT_OFF) == 0) {
@@ -206,7 +191,23 @@ static void update_and_save_state(const char* cmd) {
     } else if (strcmp(cmd, ZIGBEE_CMD_WIFI_OFF) == 0) {
         wifi = 0;
     }
-    // 保存回文件
+    // 更新快照并保存回文件
+    publish_state(light, fan, aircon, washing, door, wifi);
+    if (g_state_saver) {
+        g_state_saver();
+    } else {
+        save_state_to_file(light, fan, aircon, washing, door, wifi);
+    }
+}
+// 设置状态文件的保存方式 守护进程用于把写盘交给工作线程
+void zigbee_set_state_saver(void (*fn)(void)) {
+    g_state_saver = fn;
+}
+// 把当前状态写入状态文件 会 fsync 不要在事件循环中调用
+void zigbee_save_state(void) {
+    int light, fan, aircon, washing, door, wifi;
+
+    load_state(&light, &fan, &aircon, &washing, &door, &wifi);
     save_state_to_file(light, fan, aircon, washing, door, wifi);
 }
 // 发送命令
@@ -257,60 +258,57 @@ int cgi_send_zigbee_cmd(const char* cmd) {
 // 从文件读取状态 供 cgi 调用
 int get_light_state(void) {
     int light, fan, aircon, washing, door, wifi;
-    load_state_from_file(&light, &fan, &aircon, &washing, &door, &wifi);
+    load_state(&light, &fan, &aircon, &washing, &door, &wifi);
     return light;
 }
 // 获取风扇状态
 int get_fan_state(void) {
     int light, fan, aircon, washing, door, wifi;
-    load_state_from_file(&light, &fan, &aircon, &washing, &door, &wifi);
+    load_state(&light, &fan, &aircon, &washing, &door, &wifi);
     return fan;
 }
 // 获取空调状态
 int get_aircon_state(void) {
     int light, fan, aircon, washing, door, wifi;
-    load_state_from_file(&light, &fan, &aircon, &washing, &door, &wifi);
+    load_state(&light, &fan, &aircon, &washing, &door, &wifi);
     return aircon;
 }
 // 获取洗衣机状态
 int get_washing_state(void) {
     int light, fan, aircon, washing, door, wifi;
-    load_state_from_file(&light, &fan, &aircon, &washing, &door, &wifi);
+    load_state(&light, &fan, &aircon, &washing, &door, &wifi);
     return washing;
 }
 // 获取门状态
 int get_door_state(void) {
     int light, fan, aircon, washing, door, wifi;
-    load_state_from_file(&light, &fan, &aircon, &washing, &door, &wifi);
+    load_state(&light, &fan, &aircon, &washing, &door, &wifi);
     return door;
 }
+// 一次读取全部设备状态
+void get_device_states(int* light, int* fan, int* aircon, int* washing, int* door, int* wifi) {
+    load_state(light, fan, aircon, washing, door, wifi);
+}
+// 消息队列描述符 Linux 上可直接交给 epoll
+int zigbee_mq_fd(void) {
+    return (int)g_mq_fd;
+}
+// 非阻塞取出一条合法命令 返回长度 队列为空返回 -1
+// buf 至少 MAX_CMD_LEN + 1 字节
+ssize_t zigbee_mq_receive(char* buf, size_t size) {
+    ssize_t n;
 
-// Zigbee 线程
-void* zigbee_thread(void* arg) {
-    (void)arg;
-    char buffer[MAX_CMD_LEN];
-    ssize_t bytes_read;
-
-    g_serial_fd = open_serial_port();
-    if (g_serial_fd < 0) {
-        perror("Failed to open serial");
-        return NULL;
-    }
-    printf("Zigbee thread started, reading from MQ %s\n", MQ_NAME);
     while (1) {
-        bytes_read = mq_receive(g_mq_fd, buffer, MAX_CMD_LEN, NULL);
-        if (bytes_read <= 0) 
-            continue;
-        buffer[bytes_read] = '\0';
-        if (!is_valid_command(buffer)) {
+        n = mq_receive(g_mq_fd, buf, size - 1, NULL);
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
             continue;
         }
-        if (write(g_serial_fd, buffer, bytes_read) != bytes_read) {
-            perror("write to serial failed");
+        buf[n] = '\0';
+        if (is_valid_command(buf)) {
+            return n;
         }
-        printf("[Zigbee] Sent: %.*s\n", (int)bytes_read, buffer);
-        usleep(10000); // 10ms
     }
-    close(g_serial_fd);
-    return NULL;
 }
@@ -0,0 +1,159 @@
+/**********************************************************************
+ * @file zigbee_serial.c
+ * @brief Zigbee 串口转发实现
+ *
+ * 本文件把消息队列中的 Zigbee 命令转发到 Zigbee 模块串口。
+ * 消息队列描述符挂在守护进程的事件循环上，有命令时才被唤醒。
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ *
+ * @note
+ * - 串口打不开时由定时器按 RETRY_DELAY_SEC 重试，最多 MAX_RETRY 次，
+ *   打开之前不取队列中的命令。
+ * - 设备状态文件由工作线程写入，连续变化只排队一次，写入时取最新状态，
+ *   事件循环不等待 SD 卡 fsync。
+ * - 写串口失败时关闭串口、停止取命令，按同样的间隔重新打开，
+ *   失败的那条命令丢弃，设备拔插后可自动恢复。
+ * - 每写出一条命令暂停接收 ZIGBEE_CMD_GAP_MS，给模块留出处理时间，
+ *   间隔由定时器计时，不占用事件循环。
+ **********************************************************************/
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <pthread.h>
+#include "zigbee_serial.h"
+#include "zigbee_mq.h"
+#include "reactor.h"
+
+static int g_serial_fd = -1;
+static int g_open_attempts = 0;
+static struct reactor_timer *g_open_timer = NULL;
+static struct reactor_timer *g_gap_timer = NULL;
+// 设备状态变化回调 由守护进程设置
+static void (*g_state_listener)(void) = NULL;
+// 状态文件写入互斥与排队标记
+static pthread_mutex_t g_save_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_save_queued = 0;
+
+// 打开并配置 Zigbee 串口
+static int open_serial_port(void) {
+    int fd;
+    struct termios tty;
+
+    fd = open(SERIAL_DEVICE, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    if (tcgetattr(fd, &tty) != 0) {
+        perror("tcgetattr failed");
+        close(fd);
+        return -1;
+    }
+    cfmakeraw(&tty);
+    cfsetspeed(&tty, B115200);
+    if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+        perror("tcsetattr failed");
+        close(fd);
+        return -1;
+    }
+    tcflush(fd, TCIOFLUSH);
+    return fd;
+}
+// 关闭串口并停止取命令 稍后重新打开
+static void reopen_serial(void) {
+    reactor_del_fd(zigbee_mq_fd());
+    reactor_timer_set(g_gap_timer, 0, 0);
+    close(g_serial_fd);
+    g_serial_fd = -1;
+    g_open_attempts = 0;
+    reactor_timer_set(g_open_timer, RETRY_DELAY_SEC * 1000, 0);
+}
+// 队列中有命令 取一条写到串口
+static void mq_ready(int fd, uint32_t events, void *arg) {
+    char buffer[MAX_CMD_LEN + 1];
+    ssize_t n;
+
+    (void)events;
+    (void)arg;
+    n = zigbee_mq_receive(buffer, sizeof(buffer));
+    if (n < 0) {
+        return;
+    }
+    // 状态文件已由发送方更新
+    if (g_state_listener) {
+        g_state_listener();
+    }
+    if (write(g_serial_fd, buffer, (size_t)n) != n) {
+        perror("[Zigbee] Write to serial failed, reopening");
+        reopen_serial();
+        return;
+    }
+    printf("[Zigbee] Sent: %.*s\n", (int)n, buffer);
+    // 暂停取命令 间隔到期后恢复
+    reactor_mod_fd(fd, 0);
+    reactor_timer_set(g_gap_timer, ZIGBEE_CMD_GAP_MS, 0);
+}
+// 命令间隔结束 恢复接收
+static void gap_done(void *arg) {
+    (void)arg;
+    reactor_mod_fd(zigbee_mq_fd(), EPOLLIN);
+}
+// 尝试打开串口 成功后开始接收队列中的命令
+static void try_open(void *arg) {
+    (void)arg;
+    g_serial_fd = open_serial_port();
+    if (g_serial_fd >= 0) {
+        printf("[Zigbee] Serial port opened successfully: %s\n", SERIAL_DEVICE);
+        if (reactor_add_fd(zigbee_mq_fd(), EPOLLIN, mq_ready, NULL) == 0) {
+            printf("Zigbee forwarding started, reading from MQ %s\n", MQ_NAME);
+        }
+        return;
+    }
+    g_open_attempts++;
+    fprintf(stderr, "[Zigbee] Failed to open %s (attempt %d/%d): %s\n",
+            SERIAL_DEVICE, g_open_attempts, MAX_RETRY, strerror(errno));
+    if (g_open_attempts < MAX_RETRY) {
+        reactor_timer_set(g_open_timer, RETRY_DELAY_SEC * 1000, 0);
+    } else {
+        fprintf(stderr, "[Zigbee] Giving up after %d attempts.\n", MAX_RETRY);
+    }
+}
+// 工作线程中写状态文件 两个任务不会交错写入旧状态
+static void save_job(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&g_save_lock);
+    // 先清标记再读状态 写入期间的新变化会再排一次
+    __atomic_store_n(&g_save_queued, 0, __ATOMIC_RELEASE);
+    zigbee_save_state();
+    pthread_mutex_unlock(&g_save_lock);
+}
+// 排队写状态文件 已在排队时不重复提交
+static void queue_save(void) {
+    if (__atomic_exchange_n(&g_save_queued, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    if (reactor_submit(save_job, NULL) != 0) {
+        __atomic_store_n(&g_save_queued, 0, __ATOMIC_RELEASE);
+        fprintf(stderr, "[Zigbee] Worker queue full, state file will be saved on next change\n");
+    }
+}
+// 在事件循环上启动 Zigbee 转发
+int zigbee_serial_start(void) {
+    zigbee_set_state_saver(queue_save);
+    g_open_timer = reactor_timer_new(try_open, NULL);
+    g_gap_timer = reactor_timer_new(gap_done, NULL);
+    if (!g_open_timer || !g_gap_timer) {
+        return -1;
+    }
+    try_open(NULL);
+    return 0;
+}
+// 设置设备状态变化回调
+void zigbee_set_state_listener(void (*fn)(void)) {
+    g_state_listener = fn;
+}
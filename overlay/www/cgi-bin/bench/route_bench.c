@@ -0,0 +1,98 @@
+/**********************************************************************
+ * @file route_bench.c
+ * @brief 路由分发微基准
+ *
+ * 对整张路由表循环查找 比较哈希查找与原线性 strcmp 扫描的耗时
+ * 用法：make bench
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ **********************************************************************/
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "routes.h"
+
+#define BENCH_ROUNDS 200000
+#define MAX_PATHS 128
+
+static const char*methods[]={"GET","POST","PUT","DELETE"};
+
+// 原实现：线性扫描路由表并逐个比较方法字符串
+static route_handler_t linear_dispatch(const char*method,const char*path){
+    int i;
+
+    for(i=0;routes[i].path;i++){
+        if(strcmp(routes[i].path,path)==0){
+            if(strcmp(method,"GET")==0)return routes[i].get;
+            if(strcmp(method,"POST")==0)return routes[i].post;
+            if(strcmp(method,"PUT")==0)return routes[i].put;
+            if(strcmp(method,"PATCH")==0)return routes[i].patch;
+            if(strcmp(method,"DELETE")==0)return routes[i].delete;
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+// 新实现：哈希查找加方法枚举
+static route_handler_t hash_dispatch(const char*method,const char*path){
+    return route_get_handler(route_lookup(path),http_method_from_string(method));
+}
+
+static double now_ns(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (double)ts.tv_sec*1e9+(double)ts.tv_nsec;
+}
+
+static double run(route_handler_t(*fn)(const char*,const char*),const char**paths,int n,unsigned long*hits){
+    double t0;
+    int r;
+    int i;
+
+    *hits=0;
+    t0=now_ns();
+    for(r=0;r<BENCH_ROUNDS;r++){
+        for(i=0;i<n;i++){
+            if(fn(methods[(r+i)&3],paths[i])){
+                (*hits)++;
+            }
+        }
+    }
+    return (now_ns()-t0)/((double)BENCH_ROUNDS*n);
+}
+
+int main(void){
+    static char param_paths[MAX_PATHS][128];
+    const char*paths[MAX_PATHS];
+    unsigned long hits;
+    double t;
+    int n;
+    int i;
+    char*brace;
+
+    routes_init();
+    n=0;
+    for(i=0;routes[i].path&&n<MAX_PATHS-1;i++){
+        brace=strchr(routes[i].path,'{');
+        if(brace){
+            // 参数路由用一个具体值实例化
+            snprintf(param_paths[n],sizeof(param_paths[n]),"%.*slight",(int)(brace-routes[i].path),routes[i].path);
+            paths[n]=param_paths[n];
+        }else{
+            paths[n]=routes[i].path;
+        }
+        n++;
+    }
+    paths[n++]="/no/such/route";
+
+    t=run(linear_dispatch,paths,n,&hits);
+    printf("linear strcmp: %6.1f ns/dispatch (%lu hits)\n",t,hits);
+    t=run(hash_dispatch,paths,n,&hits);
+    printf("hash lookup:   %6.1f ns/dispatch (%lu hits)\n",t,hits);
+    return 0;
+}
@@ -1,9 +1,16 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <stdio.h>
 #include <json-c/json.h>
 
+// 当前请求的输出流与请求体输入
+extern FILE*g_resp;
+extern int g_req_fd;
+
 void send_json_headers(void);
 void send_json_object_response(json_object*obj);
+void json_write_string(FILE*out,const char*s);
+void json_write_stringn(FILE*out,const char*s,size_t len);
 
 #endif
@@ -1,6 +1,14 @@
 #ifndef CONTROL_H
 #define CONTROL_H
 
+typedef struct{
+    const char*name;
+    int(*get_state)(void);
+    const char*cmd_on;
+    const char*cmd_off;
+}control_device_t;
+
 int parse_state_from_json(const char*json_body);
+const control_device_t*find_control_device(const char*name);
 
 #endif
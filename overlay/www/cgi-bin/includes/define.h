@@ -13,15 +13,26 @@
 #define WEB_TUNNEL_URL_FILE "/development/web_tunnel/public_url.txt"
 
 #define PHOTOS_DIR "/media/sdcard/photos"
+#define THUMB_DIR PHOTOS_DIR "/.thumbs"
+// 照片内容哈希到文件名的索引 用于上传去重
+#define PHOTO_HASHES_FILE PHOTOS_DIR "/.hashes"
+#define PHOTOS_UPLOAD_MAX (512L*1024*1024)
+#define PHOTOS_DELETE_MAX 1000
 #define FAMILY_DATA_PATH "/development/tmp/members.json"
 
 #define MAX_FILENAME 512
 #define MAX_PATH 1024
 
 #define DISK_ROOT "/mnt/ssd"
-
-#define SESSION_DIR "/tmp/sessions"
-#define EXPIRE_SECONDS 1800
-#define TOKEN_LEN 32
+// 目录列表分页 默认与单页上限条数
+#define DISK_LIST_DEFAULT_LIMIT 200
+#define DISK_LIST_MAX_LIMIT 1000
+// 占用统计默认与最多返回的子项数
+#define DISK_USAGE_DEFAULT_TOP 10
+#define DISK_USAGE_MAX_TOP 100
+
+// 会话空闲超时 每次校验成功滑动续期
+#define EXPIRE_SECONDS 86400
+// 令牌格式与签名内的有效期见 session_token.h
 
 #endif
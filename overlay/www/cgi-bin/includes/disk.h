@@ -3,17 +3,43 @@
 
 #include <sys/types.h>
 #include <time.h>
+#include "disk_index.h"
 
+// 目录项 名字存于列表的字符串区 按偏移引用
 typedef struct{
-    char name[256];
+    size_t name_off;
     off_t size;
-    int is_dir;
     time_t mtime;
-}disk_file_t;
+    unsigned char is_dir;
+    unsigned char stat_state;
+}disk_entry_t;
+
+typedef struct{
+    int dirfd;
+    disk_entry_t*items;
+    size_t count;
+    size_t cap;
+    char*names;
+    size_t names_len;
+    size_t names_cap;
+    char*rel_path;
+    disk_index_t index;
+    int has_index;
+    int indexed;
+}disk_listing_t;
+
+enum disk_sort{
+    DISK_SORT_NAME=0,
+    DISK_SORT_SIZE,
+    DISK_SORT_MTIME
+};
 
 void url_decode(const char*src,char*dst);
-int list_files_in_dir(const char*dir_path,disk_file_t*files,int max_files);
-int delete_path_recursive(const char*path);
+int disk_listing_open(disk_listing_t*l,const char*rel_path,enum disk_sort sort,int descending);
+int disk_listing_stat(disk_listing_t*l,size_t i);
+const char*disk_listing_name(const disk_listing_t*l,size_t i);
+void disk_listing_close(disk_listing_t*l);
+int disk_name_matches(const char*name,const char*needle);
 extern int safe_filename(const char*name);
 
 #endif
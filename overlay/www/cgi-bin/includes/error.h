@@ -8,6 +8,7 @@ void send_error_403(const char*message);
 void send_error_404(const char*message);
 void send_error_405(const char*message);
 void send_error_500(const char*message);
+void send_error_503(const char*message);
 void _send_json_error(int status_code,const char*status_text,const char*message);
 
 #endif
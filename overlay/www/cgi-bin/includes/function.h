@@ -1,47 +1,53 @@
 #ifndef FUNCTION_H
 #define FUNCTION_H
 
-void check_auth_get(const char*path,const char*body);
-void weather_get(const char*path,const char*body);
-void temperature_get(const char*path,const char*body);
-void picture_get(const char*path,const char*body);
-void notice_get(const char*path,const char*body);
-void system_get(const char*path,const char*body);
-void disk_download_get(const char*path,const char*body);
-void disk_list_get(const char*path,const char*body);
-void photos_list_get(const char*path,const char*body);
-void photos_photo_get(const char*path,const char*body);
-void family_members_get(const char*path,const char*body);
-void photo_note_get(const char*path,const char*body);
-void family_my_tasks_get(const char*path,const char*body);
-void control_light_get(const char*path,const char*body);
-void control_aircon_get(const char*path,const char*body);
-void control_washing_machine_get(const char*path,const char*body);
-void control_fan_get(const char*path,const char*body);
-void control_door_get(const char*path,const char*body);
-void settings_change_password_get(const char*path,const char*body);
-void settings_public_get(const char*path,const char*body);
-void settings_wifi_get(const char*path,const char*body);
+#include "request.h"
 
-void control_light_put(const char*path,const char*body);
-void control_aircon_put(const char*path,const char*body);
-void control_washing_machine_put(const char*path,const char*body);
-void control_fan_put(const char*path,const char*body);
-void control_door_put(const char*path,const char*body);
-void settings_public_put(const char*path,const char*body);
-void settings_wifi_put(const char*path,const char*body);
+void check_auth_get(const struct request_ctx*ctx);
+void weather_get(const struct request_ctx*ctx);
+void temperature_get(const struct request_ctx*ctx);
+void temperature_history_get(const struct request_ctx*ctx);
+void picture_get(const struct request_ctx*ctx);
+void notice_get(const struct request_ctx*ctx);
+void system_get(const struct request_ctx*ctx);
+void disk_download_get(const struct request_ctx*ctx);
+void disk_list_get(const struct request_ctx*ctx);
+void disk_search_get(const struct request_ctx*ctx);
+void disk_usage_get(const struct request_ctx*ctx);
+void photos_list_get(const struct request_ctx*ctx);
+void photos_photo_get(const struct request_ctx*ctx);
+void photos_dedupe_get(const struct request_ctx*ctx);
+void family_members_get(const struct request_ctx*ctx);
+void photo_note_get(const struct request_ctx*ctx);
+void family_my_tasks_get(const struct request_ctx*ctx);
+void control_device_get(const struct request_ctx*ctx);
+void settings_change_password_get(const struct request_ctx*ctx);
+void settings_public_get(const struct request_ctx*ctx);
+void settings_wifi_get(const struct request_ctx*ctx);
+void disk_upload_status_get(const struct request_ctx*ctx);
+void disk_job_get_handler(const struct request_ctx*ctx);
 
-void login_post(const char*path,const char*body);
-void disk_upload_post(const char*path,const char*body);
-void disk_mkdir_post(const char*path,const char*body);
-void disk_rename_post(const char*path,const char*body);
-void photos_upload(const char*path,const char*body);
-void photo_note_post(const char*path,const char*body);
-void family_members_post(const char*path,const char*body);
-void family_task_post(const char*path,const char*body);
-void settings_change_password_post(const char*path,const char*body);
+void control_device_put(const struct request_ctx*ctx);
+void settings_public_put(const struct request_ctx*ctx);
+void settings_wifi_put(const struct request_ctx*ctx);
+void disk_upload_chunk_put(const struct request_ctx*ctx);
 
-void disk_delete_handler(const char*path,const char*body);
-void photos_delete(const char*path,const char*body);
+void login_post(const struct request_ctx*ctx);
+void disk_upload_post(const struct request_ctx*ctx);
+void disk_mkdir_post(const struct request_ctx*ctx);
+void disk_rename_post(const struct request_ctx*ctx);
+void photos_upload(const struct request_ctx*ctx);
+void photos_dedupe_post(const struct request_ctx*ctx);
+void photo_note_post(const struct request_ctx*ctx);
+void family_members_post(const struct request_ctx*ctx);
+void family_task_post(const struct request_ctx*ctx);
+void settings_change_password_post(const struct request_ctx*ctx);
+void disk_upload_init_post(const struct request_ctx*ctx);
+void disk_upload_finalize_post(const struct request_ctx*ctx);
+void disk_jobs_post(const struct request_ctx*ctx);
+
+void disk_delete_handler(const struct request_ctx*ctx);
+void photos_delete(const struct request_ctx*ctx);
+void disk_upload_abort_delete(const struct request_ctx*ctx);
 
 #endif
@@ -0,0 +1,37 @@
+#ifndef MULTIPART_H
+#define MULTIPART_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MULTIPART_BUF_SIZE 65536
+#define MULTIPART_HEADER_MAX 8192
+
+// 单个文件的处理结果
+// result 为 0 成功 1 与已有文件重复未写入 -1 空文件 -2 文件名不安全或被拒收 -3 写入失败
+// 成功时 path 为最终路径 重复时 existing 为已有文件名 hash 仅在设置了 find_duplicate 时有效
+struct multipart_item{
+    const char*filename;
+    const char*path;
+    const char*existing;
+    int result;
+    long size;
+    uint64_t hash;
+};
+
+// 批量上传的逐项处理 均可为空
+// accept 返回 0 表示拒收该文件
+// find_duplicate 在临时文件改名前调用 找到内容相同的已有文件时把文件名写入 existing 并返回 1
+// on_item 在每个文件处理完后调用
+struct multipart_handler{
+    int(*accept)(const char*filename);
+    int(*find_duplicate)(const char*tmp_path,uint64_t hash,long size,char*existing,size_t existing_size,void*arg);
+    void(*on_item)(const struct multipart_item*item,void*arg);
+    void*arg;
+};
+
+int multipart_boundary(const char*content_type,char*boundary,size_t size);
+int multipart_stream_save(int fd,long content_length,const char*boundary,const char*target_dir,
+                          const struct multipart_handler*h);
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef PHOTO_DEDUPE_H
+#define PHOTO_DEDUPE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "photo_index.h"
+
+// 哈希索引的一项 按文件名唯一
+struct photo_hash{
+    uint64_t hash;
+    long long size;
+    long long mtime_ns;
+    char*name;
+};
+
+// 请求内的索引快照 改动过的文件名记入 touched 提交时与磁盘上的最新内容合并
+// photos 为本次请求首次查重时打开的照片索引 index_state 0 未打开 1 已打开 -1 打开失败
+typedef struct{
+    struct photo_hash*items;
+    size_t count;
+    size_t cap;
+    char**touched;
+    size_t touched_count;
+    size_t touched_cap;
+    int replace_all;
+    photo_index_t photos;
+    int index_state;
+}photo_hashes_t;
+
+// 一组内容相同的照片 keep 为保留的那张
+struct photo_dup_group{
+    char*keep;
+    char**dups;
+    size_t dup_count;
+    long long size;
+    long long wasted;
+};
+
+struct photo_dedupe_report{
+    struct photo_dup_group*groups;
+    size_t group_count;
+    size_t scanned;
+    size_t hashed;
+    size_t linked;
+    size_t link_failed;
+    long long wasted;
+    long long reclaimed;
+};
+
+int photo_hash_file(const char*path,uint64_t*hash);
+int photo_hashes_load(photo_hashes_t*h);
+const char*photo_hashes_find_dup(photo_hashes_t*h,uint64_t hash,long long size,const char*path);
+void photo_hashes_put(photo_hashes_t*h,const char*name,uint64_t hash,long long size,long long mtime_ns);
+void photo_hashes_remove(photo_hashes_t*h,const char*name);
+int photo_hashes_commit(photo_hashes_t*h);
+void photo_hashes_free(photo_hashes_t*h);
+int photo_dedupe_scan(int do_link,struct photo_dedupe_report*rep);
+void photo_dedupe_report_free(struct photo_dedupe_report*rep);
+
+#endif
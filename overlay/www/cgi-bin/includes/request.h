@@ -0,0 +1,34 @@
+#ifndef REQUEST_H
+#define REQUEST_H
+
+#include "define.h"
+#include "session_token.h"
+#include "routes.h"
+
+#define REQUEST_BODY_MAX 16384
+#define REQUEST_USER_MAX 64
+
+// 单个请求的上下文 由 main 构建一次后传给处理函数
+struct request_ctx{
+    enum http_method method;
+    const char*method_name;
+    const char*path;
+    const char*query;
+    const char*cookies;
+    const char*content_type;
+    const char*range;
+    const char*if_range;
+    const char*if_none_match;
+    const char*if_modified_since;
+    long content_length;
+    char*body;
+    int authenticated;
+    char token[TOKEN_LEN+1];
+    char user[REQUEST_USER_MAX];
+};
+
+int request_init(struct request_ctx*ctx);
+int request_authenticate(struct request_ctx*ctx);
+void request_free(struct request_ctx*ctx);
+
+#endif
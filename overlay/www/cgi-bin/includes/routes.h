@@ -1,7 +1,15 @@
 #ifndef ROUTES_H
 #define ROUTES_H
 
-typedef void(*route_handler_t)(const char*path,const char*body);
+struct request_ctx;
+
+typedef void(*route_handler_t)(const struct request_ctx*ctx);
+
+// 路由认证策略 缺省为需要登录
+enum route_auth{
+    ROUTE_AUTH_REQUIRED=0,
+    ROUTE_AUTH_NONE
+};
 
 struct route{
     const char*path;
@@ -10,8 +18,24 @@ struct route{
     route_handler_t put;
     route_handler_t patch;
     route_handler_t delete;
+    enum route_auth auth;
+};
+
+enum http_method{
+    HTTP_GET=0,
+    HTTP_POST,
+    HTTP_PUT,
+    HTTP_PATCH,
+    HTTP_DELETE,
+    HTTP_METHOD_UNKNOWN
 };
 
 extern struct route routes[];
 
+int routes_init(void);
+const struct route*route_lookup(const char*path);
+route_handler_t route_get_handler(const struct route*r,enum http_method method);
+enum http_method http_method_from_string(const char*method);
+const char*route_param(const char*path);
+
 #endif
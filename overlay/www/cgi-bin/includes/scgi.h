@@ -0,0 +1,9 @@
+#ifndef SCGI_H
+#define SCGI_H
+
+typedef int(*scgi_request_fn)(void);
+
+int scgi_is_listen_socket(int fd);
+int scgi_serve(int listen_fd,scgi_request_fn handle);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "request.h"
+
+#define SERVE_MAX_RANGES 16
+#define SERVE_BUF_SIZE 65536
+
+// 由文件元数据生成的缓存校验器
+struct cache_validator{
+    char etag[64];
+    char last_modified[40];
+    time_t mtime;
+};
+
+void cache_validator_init(struct cache_validator*v,const struct stat*st);
+void cache_validator_init_version(struct cache_validator*v,uint64_t version,time_t mtime);
+int request_not_modified(const struct request_ctx*ctx,const struct cache_validator*v);
+void send_validator_headers(const struct cache_validator*v,const char*cache_control);
+void send_not_modified(const struct cache_validator*v,const char*cache_control);
+int serve_file(const struct request_ctx*ctx,const char*path,const char*mime,const char*disposition,const char*filename,const char*cache_control);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef THUMB_H
+#define THUMB_H
+
+#include <stddef.h>
+
+#define THUMB_SMALL_EDGE 320
+#define THUMB_MEDIUM_EDGE 1280
+#define THUMB_QUALITY 80
+// 解码前按像素数拒绝过大的图片 防止耗尽内存
+#define THUMB_MAX_PIXELS (40L*1000*1000)
+
+enum thumb_size{
+    THUMB_SIZE_SMALL=0,
+    THUMB_SIZE_MEDIUM
+};
+
+int thumb_parse_size(const char*name,enum thumb_size*out);
+int thumb_get(const char*photo_path,const char*name,enum thumb_size size,char*out,size_t out_size);
+void thumb_remove_all(const char*name);
+void thumb_on_upload(const char*path);
+
+#endif
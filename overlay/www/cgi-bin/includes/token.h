@@ -3,11 +3,12 @@
 
 #include <stddef.h>
 #include "define.h"
+#include "session_token.h"
 
 void generate_token(char*token,size_t len);
-int add_token(const char*token);
-int is_valid_token(const char*token);
-char*get_token_from_cookie(void);
+int add_token(const char*token,const char*user);
+int is_valid_token(const char*token,char*user,size_t user_size);
+int get_token_from_cookie(const char*cookie,char*token,size_t size);
 void clear_all_tokens(void);
 
 #endif
@@ -0,0 +1,34 @@
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include <json-c/json.h>
+#include "define.h"
+#include "sha256.h"
+
+#define UPLOAD_DIR DISK_ROOT "/.uploads"
+#define UPLOAD_ID_LEN 16
+#define UPLOAD_CHUNK_SIZE (4L*1024*1024)
+#define UPLOAD_CHUNK_MAX (16L*1024*1024)
+#define UPLOAD_MAX_RANGES 256
+#define UPLOAD_STALE_SECONDS (7*86400)
+
+// 分块上传会话 记录于 .uploads/<id>.meta
+typedef struct{
+    char id[UPLOAD_ID_LEN+1];
+    char path[512];
+    char name[MAX_FILENAME];
+    long long size;
+    int range_count;
+    long long ranges[UPLOAD_MAX_RANGES][2];
+}upload_state_t;
+
+int upload_init(const char*path,const char*name,long long size,upload_state_t*st);
+int upload_load(const char*id,upload_state_t*st);
+int upload_write_chunk(const char*id,long long offset,long length,int in_fd,upload_state_t*st);
+int upload_finalize(const char*id,const char*sha256_hex,char out_hex[SHA256_DIGEST_SIZE*2+1]);
+int upload_abort(const char*id);
+long long upload_received_bytes(const upload_state_t*st);
+json_object*upload_state_to_json(const upload_state_t*st);
+void send_upload_error(int rc);
+
+#endif
@@ -6,7 +6,6 @@
 #include <json-c/json.h>
 #include "define.h"
 
-int parse_multipart_and_save(const char*body,long content_length,const char*boundary,const char*target_dir);
 int make_parent_writable(const char*dirpath);
 int mkpath(const char*dir,mode_t mode);
 int extract_filename_from_header(const char*header,char*out_filename,size_t out_size);
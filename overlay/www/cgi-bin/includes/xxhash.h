@@ -0,0 +1,19 @@
+#ifndef XXHASH_H
+#define XXHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// XXH64 流式状态
+typedef struct{
+    uint64_t total_len;
+    uint64_t v[4];
+    unsigned char mem[32];
+    size_t memsize;
+}xxh64_state_t;
+
+void xxh64_init(xxh64_state_t*s,uint64_t seed);
+void xxh64_update(xxh64_state_t*s,const void*data,size_t len);
+uint64_t xxh64_digest(const xxh64_state_t*s);
+
+#endif
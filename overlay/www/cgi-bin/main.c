@@ -3,101 +3,71 @@
 #include <string.h>
 #include <unistd.h>
 #include "routes.h"
+#include "request.h"
 #include "error.h"
-#include "token.h"
+#include "common.h"
+#include "scgi.h"
 
-char*read_stdin_body(void);
-int authenticate_request(const char*path_info);
-int dispatch_route(const char*method,const char*path_info,const char*body);
+int authenticate_request(struct request_ctx*ctx,const struct route*r);
+int dispatch_route(const struct request_ctx*ctx,const struct route*r);
+int handle_request(void);
 
-char*read_stdin_body(void){
-    char*clen=getenv("CONTENT_LENGTH");
-    if(!clen)return NULL;
-    long len=atol(clen);
-    if(len<=0||len>16384)return NULL;
-
-    char*buf=malloc(len+1);
-    if(!buf)return NULL;
-    if(fread(buf,1,len,stdin)!=(size_t)len){
-        free(buf);
-        return NULL;
-    }
-    buf[len]='\0';
-    return buf;
-}
-
-int authenticate_request(const char*path_info){
-    if(strcmp(path_info,"/login")==0){
+// 按路由认证策略校验请求 令牌只在此解析校验一次
+int authenticate_request(struct request_ctx*ctx,const struct route*r){
+    if(r&&r->auth==ROUTE_AUTH_NONE){
         return 1;
     }
-
-    char*token=get_token_from_cookie();
-    int valid=is_valid_token(token);
-    free(token);
-
-    if(!valid){
-        printf("Status: 401 Unauthorized\r\n");
-        printf("Content-Type: application/json\r\n\r\n");
-        printf("{\"error\":\"Unauthorized\",\"redirect\":\"/login.html\"}\n");
+    if(!request_authenticate(ctx)){
+        fprintf(g_resp,"Status: 401 Unauthorized\r\n");
+        fprintf(g_resp,"Content-Type: application/json\r\n\r\n");
+        fprintf(g_resp,"{\"error\":\"Unauthorized\",\"redirect\":\"/login.html\"}\n");
         return 0;
     }
     return 1;
 }
 
-int dispatch_route(const char*method,const char*path_info,const char*body){
-    int i;
-    for(i=0;routes[i].path;i++){
-        if(strcmp(routes[i].path,path_info)==0){
-            void(*handler)(const char*,const char*)=NULL;
+int dispatch_route(const struct request_ctx*ctx,const struct route*r){
+    if(!r)return 0;
 
-            if(strcmp(method,"GET")==0){
-                handler=routes[i].get;
-            }else if(strcmp(method,"POST")==0){
-                handler=routes[i].post;
-            }else if(strcmp(method,"PUT")==0){
-                handler=routes[i].put;
-            }else if(strcmp(method,"PATCH")==0){
-                handler=routes[i].patch;
-            }else if(strcmp(method,"DELETE")==0){
-                handler=routes[i].delete;
-            }
-
-            if(handler){
-                handler(path_info,body);
-                fflush(stdout);
-                return 1;
-            }else{
-                send_error_405("Only GET and POST are allowed");
-                fflush(stdout);
-                return 0;
-            }
-        }
+    route_handler_t handler=route_get_handler(r,ctx->method);
+    if(handler){
+        handler(ctx);
+    }else{
+        send_error_405("Only GET and POST are allowed");
     }
-    return 0;
+    fflush(g_resp);
+    return 1;
 }
 
-int main(void){
-    char*method=getenv("REQUEST_METHOD");
-    char*path_info=getenv("PATH_INFO");
-    if(!method)method="GET";
-    if(!path_info)path_info="/";
-
-    char*body=NULL;
-    if(strcmp(method,"GET")!=0&&strcmp(method,"HEAD")!=0){
-        body=read_stdin_body();
-    }
+int handle_request(void){
+    struct request_ctx ctx;
+    request_init(&ctx);
 
-    if(!authenticate_request(path_info)){
-        if(body)free(body);
+    const struct route*r=route_lookup(ctx.path);
+    if(!authenticate_request(&ctx,r)){
+        request_free(&ctx);
         return EXIT_FAILURE;
     }
 
-    if(!dispatch_route(method,path_info,body)){
+    if(!dispatch_route(&ctx,r)){
         send_error_404("YY tell you 404 error");
-        fflush(stdout);
+        fflush(g_resp);
     }
 
-    if(body)free(body);
+    request_free(&ctx);
     return EXIT_SUCCESS;
 }
 
+int main(void){
+    // 由 lighttpd 以 SCGI 方式拉起时 fd 0 为监听套接字
+    if(scgi_is_listen_socket(STDIN_FILENO)){
+        routes_init();
+        return scgi_serve(STDIN_FILENO,handle_request);
+    }
+
+    g_resp=stdout;
+    g_req_fd=STDIN_FILENO;
+    int ret=handle_request();
+    fflush(g_resp);
+    return ret;
+}
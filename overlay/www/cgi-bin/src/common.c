@@ -11,25 +11,66 @@
  *
  * @note
  * - 输出内容类型与缓存控制相关头字段
+ * - 所有输出写入 g_resp 以便常驻模式下按连接切换
  **********************************************************************/
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #include "common.h"
 
+// CGI 模式下即标准输出与标准输入 SCGI 模式下为当前连接
+FILE*g_resp=NULL;
+int g_req_fd=STDIN_FILENO;
+
 // 输出 JSON 响应头
 void send_json_headers(void){
-    printf("Content-Type: application/json; charset=utf-8\r\n");
-    printf("Cache-Control: no-cache\r\n");
-    printf("\r\n");
+    fprintf(g_resp,"Content-Type: application/json; charset=utf-8\r\n");
+    fprintf(g_resp,"Cache-Control: no-cache\r\n");
+    fprintf(g_resp,"\r\n");
 }
 
 // 输出 JSON 对象响应
 void send_json_object_response(json_object*obj){
     if(!obj){
         send_json_headers();
-        printf("{}\n");
+        fprintf(g_resp,"{}\n");
         return;
     }
     send_json_headers();
-    printf("%s\n",json_object_to_json_string_ext(obj,JSON_C_TO_STRING_PLAIN));
+    fprintf(g_resp,"%s\n",json_object_to_json_string_ext(obj,JSON_C_TO_STRING_PLAIN));
     json_object_put(obj);
 }
+
+// 以 JSON 字符串形式输出定长字节串 转义引号、反斜杠与控制字符 UTF-8 原样输出
+void json_write_stringn(FILE*out,const char*s,size_t len){
+    const unsigned char*p=(const unsigned char*)s;
+    const unsigned char*end=p+len;
+    const unsigned char*run=p;
+
+    fputc('"',out);
+    for(;p<end;p++){
+        if(*p>=0x20&&*p!='"'&&*p!='\\'){
+            continue;
+        }
+        fwrite(run,1,(size_t)(p-run),out);
+        switch(*p){
+            case '"':fputs("\\\"",out);break;
+            case '\\':fputs("\\\\",out);break;
+            case '\n':fputs("\\n",out);break;
+            case '\r':fputs("\\r",out);break;
+            case '\t':fputs("\\t",out);break;
+            default:fprintf(out,"\\u%04x",*p);break;
+        }
+        run=p+1;
+    }
+    fwrite(run,1,(size_t)(p-run),out);
+    fputc('"',out);
+}
+
+// 以 JSON 字符串形式输出
+void json_write_string(FILE*out,const char*s){
+    if(!s){
+        s="";
+    }
+    json_write_stringn(out,s,strlen(s));
+}
@@ -11,6 +11,7 @@
  *
  * @note
  * - 主要提供对 JSON 请求体的解析能力
+ * - 设备表把 /control/{device} 的设备名映射到状态查询与 Zigbee 命令
  **********************************************************************/
 #include "control.h"
 #include <stdio.h>
@@ -18,6 +19,17 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <json-c/json.h>
+#include "zigbee_mq.h"
+
+// 可控设备表
+static const control_device_t control_devices[]={
+    {"light",get_light_state,ZIGBEE_CMD_LIGHT_ON,ZIGBEE_CMD_LIGHT_OFF},
+    {"aircon",get_aircon_state,ZIGBEE_CMD_AIRCON_ON,ZIGBEE_CMD_AIRCON_OFF},
+    {"washing_machine",get_washing_state,ZIGBEE_CMD_WASHING_ON,ZIGBEE_CMD_WASHING_OFF},
+    {"fan",get_fan_state,ZIGBEE_CMD_FAN_ON,ZIGBEE_CMD_FAN_OFF},
+    {"door",get_door_state,ZIGBEE_CMD_DOOR_OPEN,ZIGBEE_CMD_DOOR_CLOSE},
+};
+#define CONTROL_DEVICE_COUNT (sizeof(control_devices)/sizeof(control_devices[0]))
 
 // 从 JSON 请求体解析 state 字段
 int parse_state_from_json(const char*json_body){
@@ -50,3 +62,18 @@ int parse_state_from_json(const char*json_body){
     json_object_put(root);
     return state;
 }
+
+// 按名称查找设备
+const control_device_t*find_control_device(const char*name){
+    size_t i;
+
+    if(!name){
+        return NULL;
+    }
+    for(i=0;i<CONTROL_DEVICE_COUNT;i++){
+        if(strcmp(control_devices[i].name,name)==0){
+            return &control_devices[i];
+        }
+    }
+    return NULL;
+}
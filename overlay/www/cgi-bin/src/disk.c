@@ -2,7 +2,7 @@
  * @file disk.c
  * @brief 磁盘文件操作模块实现
  *
- * 本文件实现磁盘目录遍历与文件删除等辅助能力
+ * 本文件实现磁盘目录遍历与列表排序等辅助能力
  * 供 CGI 处理函数完成上传下载与目录管理
  *
  * @author 杨翊
@@ -11,18 +11,24 @@
  *
  * @note
  * - 访问路径需校验避免越权访问
+ * - 目录列表用 getdents64 读取 元数据经 fstatat 相对目录 fd 获取
+ * - 守护进程维护的索引与目录 mtime 一致时直接用索引 不再逐项 stat
  **********************************************************************/
 #define _GNU_SOURCE
-#include <ftw.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <strings.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <dirent.h>
 #include <ctype.h>
 #include "disk.h"
 #include "define.h"
+#include "disk_index.h"
 
 // 获取磁盘根目录
 const char*get_disk_root(void){
@@ -54,51 +60,245 @@ void url_decode(const char*src,char*dst){
     *dst='\0';
 }
 
-// 列出目录文件
-int list_files_in_dir(const char*dir_path,disk_file_t*files,int max_files){
-    DIR*dir;
-    struct dirent*entry;
-    int count;
+#define DISK_DENTS_BUF 32768
+
+// getdents64 返回的目录项布局
+struct linux_dirent64{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// 上传临时文件与会话目录不对外展示
+static int is_internal_name(const char*name){
+    return strncmp(name,".upload",7)==0;
+}
+
+// 追加一个目录项
+static int listing_add(disk_listing_t*l,const char*name,unsigned char d_type){
+    size_t len=strlen(name)+1;
+
+    if(l->count==l->cap){
+        size_t cap=l->cap?l->cap*2:256;
+        disk_entry_t*items=realloc(l->items,cap*sizeof(*items));
+        if(!items)return -1;
+        l->items=items;
+        l->cap=cap;
+    }
+    if(l->names_len+len>l->names_cap){
+        size_t cap=l->names_cap?l->names_cap*2:8192;
+        char*names;
+        while(cap<l->names_len+len)cap*=2;
+        names=realloc(l->names,cap);
+        if(!names)return -1;
+        l->names=names;
+        l->names_cap=cap;
+    }
+    memcpy(l->names+l->names_len,name,len);
+    memset(&l->items[l->count],0,sizeof(l->items[0]));
+    l->items[l->count].name_off=l->names_len;
+    l->items[l->count].is_dir=d_type==DT_DIR;
+    // d_type 未知时只能靠 stat 判断类型
+    l->items[l->count].stat_state=d_type==DT_UNKNOWN?0:2;
+    l->names_len+=len;
+    l->count++;
+    return 0;
+}
+
+// 对目录项补充大小与修改时间 失败返回 -1
+int disk_listing_stat(disk_listing_t*l,size_t i){
+    disk_entry_t*e;
     struct stat st;
-    char full_path[1024];
 
-    if(!dir_path||!files||max_files<=0){
+    if(!l||i>=l->count){
+        return -1;
+    }
+    e=&l->items[i];
+    if(e->stat_state==1){
+        return 0;
+    }
+    if(e->stat_state==3){
         return -1;
     }
-    dir=opendir(dir_path);
-    if(!dir){
+    if(fstatat(l->dirfd,l->names+e->name_off,&st,0)!=0){
+        e->stat_state=3;
         return -1;
     }
+    e->is_dir=S_ISDIR(st.st_mode)?1:0;
+    e->size=e->is_dir?0:st.st_size;
+    e->mtime=st.st_mtime;
+    e->stat_state=1;
+    // 目录大小取索引中的子树累计值
+    if(e->is_dir&&l->has_index){
+        char path[MAX_PATH];
+        const struct disk_index_entry*ie;
+        snprintf(path,sizeof(path),"%s/%s",l->rel_path,l->names+e->name_off);
+        ie=disk_index_lookup(&l->index,path);
+        if(ie&&(ie->flags&DISK_INDEX_DIR)){
+            e->size=(off_t)ie->size;
+        }
+    }
+    return 0;
+}
 
-    count=0;
-    while((entry=readdir(dir))!=NULL&&count<max_files){
-        if(strcmp(entry->d_name,".")==0||strcmp(entry->d_name,"..")==0){
-            continue;
+// 取目录项名字
+const char*disk_listing_name(const disk_listing_t*l,size_t i){
+    return l->names+l->items[i].name_off;
+}
+
+struct listing_sort{
+    const disk_listing_t*l;
+    enum disk_sort sort;
+    int descending;
+};
+
+// 目录在前 再按指定字段比较
+static int listing_cmp(const void*pa,const void*pb,void*arg){
+    const struct listing_sort*ctx=arg;
+    const disk_entry_t*a=pa;
+    const disk_entry_t*b=pb;
+    int r=0;
+
+    if(a->is_dir!=b->is_dir){
+        return a->is_dir?-1:1;
+    }
+    if(ctx->sort==DISK_SORT_SIZE&&a->size!=b->size){
+        r=a->size<b->size?-1:1;
+    }else if(ctx->sort==DISK_SORT_MTIME&&a->mtime!=b->mtime){
+        r=a->mtime<b->mtime?-1:1;
+    }
+    if(r==0){
+        r=strcmp(ctx->l->names+a->name_off,ctx->l->names+b->name_off);
+    }
+    return ctx->descending?-r:r;
+}
+
+// 用 getdents64 读取目录项
+static int listing_from_dents(disk_listing_t*l){
+    static char buf[DISK_DENTS_BUF];
+    long n;
+    long pos;
+
+    while((n=syscall(SYS_getdents64,l->dirfd,buf,sizeof(buf)))>0){
+        for(pos=0;pos<n;){
+            struct linux_dirent64*d=(struct linux_dirent64*)(buf+pos);
+            pos+=d->d_reclen;
+            if(strcmp(d->d_name,".")==0||strcmp(d->d_name,"..")==0||is_internal_name(d->d_name)){
+                continue;
+            }
+            if(listing_add(l,d->d_name,d->d_type)!=0){
+                return -1;
+            }
         }
-        snprintf(full_path,sizeof(full_path),"%s/%s",dir_path,entry->d_name);
-        if(stat(full_path,&st)!=0){
-            continue;
+    }
+    return n<0?-1:0;
+}
+
+// 从守护进程维护的索引取目录项 目录 mtime 与索引记录不一致时视为过期
+static int listing_from_index(disk_listing_t*l,const struct stat*dir_st){
+    const disk_index_t*idx=&l->index;
+    int64_t mtime_ns;
+    size_t first;
+    size_t count;
+    size_t i;
+
+    if(!l->has_index){
+        return -1;
+    }
+    if(disk_index_dir_mtime(idx,l->rel_path,&mtime_ns)!=0
+       ||mtime_ns!=(int64_t)dir_st->st_mtim.tv_sec*1000000000LL+dir_st->st_mtim.tv_nsec){
+        return -1;
+    }
+    disk_index_children(idx,l->rel_path,&first,&count);
+    for(i=first;i<first+count;i++){
+        const struct disk_index_entry*e=&idx->entries[i];
+        disk_entry_t*item;
+        if(listing_add(l,disk_index_name(idx,e),DT_UNKNOWN)!=0){
+            l->count=0;
+            l->names_len=0;
+            return -1;
+        }
+        item=&l->items[l->count-1];
+        item->is_dir=(e->flags&DISK_INDEX_DIR)?1:0;
+        item->size=(off_t)e->size;
+        item->mtime=(time_t)(e->mtime_ns/1000000000LL);
+        item->stat_state=1;
+    }
+    l->indexed=1;
+    return 0;
+}
+
+// 读取 DISK_ROOT 下的目录并排序 优先使用索引 按名字排序时只有当前页才需要 stat
+int disk_listing_open(disk_listing_t*l,const char*rel_path,enum disk_sort sort,int descending){
+    char dir_path[MAX_PATH];
+    struct listing_sort ctx;
+    struct stat st;
+    size_t i;
+
+    size_t len=strlen(rel_path);
+
+    memset(l,0,sizeof(*l));
+    snprintf(dir_path,sizeof(dir_path),"%s%s",DISK_ROOT,rel_path);
+    l->dirfd=open(dir_path,O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if(l->dirfd<0){
+        return -1;
+    }
+    // 去掉末尾斜杠 根目录记为空串 与索引中的路径形式一致
+    while(len>0&&rel_path[len-1]=='/'){
+        len--;
+    }
+    l->rel_path=strndup(rel_path,len);
+    if(!l->rel_path){
+        disk_listing_close(l);
+        return -1;
+    }
+    l->has_index=disk_index_open(&l->index,DISK_INDEX_FILE)==0;
+    if(fstat(l->dirfd,&st)!=0||listing_from_index(l,&st)!=0){
+        if(listing_from_dents(l)!=0){
+            disk_listing_close(l);
+            return -1;
+        }
+    }
+
+    // 排序字段需要元数据时一次 fstatat 全部 否则只补齐类型未知的项
+    for(i=0;i<l->count;i++){
+        if(sort!=DISK_SORT_NAME||l->items[i].stat_state==0){
+            disk_listing_stat(l,i);
         }
-        strncpy(files[count].name,entry->d_name,sizeof(files[count].name)-1);
-        files[count].name[sizeof(files[count].name)-1]='\0';
-        files[count].size=S_ISDIR(st.st_mode)?0:st.st_size;
-        files[count].is_dir=S_ISDIR(st.st_mode)?1:0;
-        files[count].mtime=st.st_mtime;
-        count++;
-    }
-    closedir(dir);
-    return count;
+    }
+    ctx.l=l;
+    ctx.sort=sort;
+    ctx.descending=descending;
+    qsort_r(l->items,l->count,sizeof(l->items[0]),listing_cmp,&ctx);
+    return 0;
 }
 
-// 递归删除回调
-static int unlink_cb(const char*fpath,const struct stat*sb,int typeflag,struct FTW*ftwbuf){
-    (void)sb;
-    (void)typeflag;
-    (void)ftwbuf;
-    return remove(fpath);
+// 名字是否包含关键字 ASCII 字母不区分大小写
+int disk_name_matches(const char*name,const char*needle){
+    size_t n=strlen(needle);
+
+    for(;*name;name++){
+        if(strncasecmp(name,needle,n)==0){
+            return 1;
+        }
+    }
+    return n==0;
 }
 
-// 递归删除路径
-int delete_path_recursive(const char*path){
-    return nftw(path,unlink_cb,64,FTW_DEPTH|FTW_PHYS);
+// 释放目录列表
+void disk_listing_close(disk_listing_t*l){
+    if(l->dirfd>=0){
+        close(l->dirfd);
+    }
+    if(l->has_index){
+        disk_index_close(&l->index);
+    }
+    free(l->rel_path);
+    free(l->items);
+    free(l->names);
+    memset(l,0,sizeof(*l));
+    l->dirfd=-1;
 }
+
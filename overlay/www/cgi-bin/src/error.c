@@ -16,6 +16,7 @@
 #include <string.h>
 #include <json-c/json.h>
 #include "error.h"
+#include "common.h"
 
 // 输出成功响应
 void json_success(const char*msg){
@@ -23,8 +24,8 @@ void json_success(const char*msg){
 
     obj=json_object_new_object();
     json_object_object_add(obj,"message",json_object_new_string(msg?msg:""));
-    printf("Content-Type: application/json\r\n\r\n");
-    printf("%s\n",json_object_to_json_string_ext(obj,JSON_C_TO_STRING_PLAIN));
+    fprintf(g_resp,"Content-Type: application/json\r\n\r\n");
+    fprintf(g_resp,"%s\n",json_object_to_json_string_ext(obj,JSON_C_TO_STRING_PLAIN));
     json_object_put(obj);
 }
 
@@ -34,17 +35,17 @@ void _send_json_error(int status_code,const char*status_text,const char*message)
     const char*json_str;
 
     if(status_code!=200){
-        fprintf(stdout,"Status: %d %s\r\n",status_code,status_text);
+        fprintf(g_resp,"Status: %d %s\r\n",status_code,status_text);
     }
-    fputs("Content-Type: application/json\r\n\r\n",stdout);
+    fputs("Content-Type: application/json\r\n\r\n",g_resp);
     obj=json_object_new_object();
     json_object_object_add(obj,"error",json_object_new_string(message?message:""));
     json_object_object_add(obj,"code",json_object_new_int(status_code));
     json_str=json_object_to_json_string_ext(obj,JSON_C_TO_STRING_PLAIN);
-    fputs(json_str,stdout);
-    fputc('\n',stdout);
+    fputs(json_str,g_resp);
+    fputc('\n',g_resp);
     json_object_put(obj);
-    fflush(stdout);
+    fflush(g_resp);
 }
 
 // 输出 400
@@ -76,3 +77,8 @@ void send_error_405(const char*message){
 void send_error_500(const char*message){
     _send_json_error(500,"Internal Server Error",message?message:"Internal error occurred");
 }
+
+// 输出 503
+void send_error_503(const char*message){
+    _send_json_error(503,"Service Unavailable",message?message:"Service unavailable");
+}
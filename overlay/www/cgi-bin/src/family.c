@@ -19,6 +19,7 @@
 #include <time.h>
 #include <json-c/json.h>
 #include "family.h"
+#include "atomic_file.h"
 
 // 从 Cookie 中提取用户名
 char*get_username_from_cookie(void){
@@ -121,21 +122,19 @@ json_object*load_family_data(void){
 
 // 保存家庭数据
 int save_family_data(json_object*root){
-    FILE*fp;
+    struct atomic_file af;
     const char*str;
-    int ok;
 
-    fp=fopen(FAMILY_DATA_PATH,"w");
-    if(!fp){
+    // 原子替换 check_task 线程不会读到写了一半的文件
+    if(!atomic_file_open(&af,FAMILY_DATA_PATH,0666,ATOMIC_FILE_SYNC_DIR)){
         return -1;
     }
     str=json_object_to_json_string_ext(root,JSON_C_TO_STRING_PRETTY);
-    ok=(fprintf(fp,"%s\n",str)>0);
-    fclose(fp);
-    if(ok){
-        return 0;
+    if(fprintf(af.fp,"%s\n",str)<0){
+        atomic_file_abort(&af);
+        return -1;
     }
-    return -1;
+    return atomic_file_commit(&af);
 }
 
 // 解析截止时间字符串
@@ -12,6 +12,7 @@
  * @note
  * - 处理函数输出 HTTP 头与 JSON 响应体
  **********************************************************************/
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
@@ -19,8 +20,9 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/stat.h> 
-#include <sys/file.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
 #include <json-c/json.h>
 
 #include "define.h"
@@ -30,7 +32,12 @@
 #include "error.h"
 #include "system.h"
 #include "disk.h"
+#include "disk_index.h"
+#include "disk_jobs.h"
 #include "weather.h"
+#include "state_shm.h"
+#include "atomic_file.h"
+#include "temp_history.h"
 #include "photos.h"
 #include "family.h"
 #include "control.h"
@@ -38,19 +45,178 @@
 #include "wifi.h"
 #include "zigbee_mq.h"
 #include "token.h"
+#include "serve.h"
+#include "multipart.h"
+#include "thumb.h"
+#include "photo_dedupe.h"
+#include "upload.h"
+#include "routes.h"
 
 extern const char* get_disk_root(void);
 //#define VALID_USERNAME "root"
 //#define VALID_PASSWORD "root"
 
+// 输出任务状态 JSON
+static json_object *disk_job_to_json(const struct disk_job *job) {
+    json_object *obj = json_object_new_object();
+    json_object_object_add(obj, "id", json_object_new_string(job->id));
+    json_object_object_add(obj, "op", json_object_new_string(disk_job_op_name(job->op)));
+    json_object_object_add(obj, "state", json_object_new_string(disk_job_state_name(job->state)));
+    json_object_object_add(obj, "from", json_object_new_string(job->src));
+    if (job->dst[0]) {
+        json_object_object_add(obj, "to", json_object_new_string(job->dst));
+    }
+    json_object_object_add(obj, "entries", json_object_new_int64((int64_t)job->entries));
+    json_object_object_add(obj, "bytes", json_object_new_int64((int64_t)job->bytes));
+    json_object_object_add(obj, "total_bytes", json_object_new_int64((int64_t)job->total_bytes));
+    json_object_object_add(obj, "created", json_object_new_int64(job->created));
+    if (job->state == DISK_JOB_DONE || job->state == DISK_JOB_FAILED) {
+        json_object_object_add(obj, "finished", json_object_new_int64(job->finished));
+    }
+    if (job->error) {
+        json_object_object_add(obj, "error", json_object_new_string(strerror(job->error)));
+    }
+    return obj;
+}
+
+// 登记后台磁盘任务 成功时返回 202 与任务状态
+static void submit_disk_job(enum disk_job_op op, const char *src, const char *dst) {
+    char id[DISK_JOBS_ID_LEN + 1];
+    struct disk_job job;
+
+    int rc = disk_job_submit(op, src, dst, id, sizeof(id));
+    if (rc == -1) {
+        send_error_400("Invalid job parameters");
+        return;
+    }
+    if (rc == -2) {
+        send_error_503("Too many disk jobs in progress");
+        return;
+    }
+    if (rc != 0 || disk_job_get(id, &job) != 0) {
+        send_error_503("Disk job service unavailable");
+        return;
+    }
+    fprintf(g_resp, "Status: 202 Accepted\r\n");
+    send_json_object_response(disk_job_to_json(&job));
+}
+// 批量照片操作的逐项结果 hashes 为上传去重与删除时维护的内容哈希索引
+struct photo_batch {
+    json_object *results;
+    int ok;
+    int failed;
+    int duplicates;
+    photo_hashes_t hashes;
+};
+
+// 记录一项结果 error 为空表示成功
+static void photo_batch_add(struct photo_batch *batch, const char *name, const char *error) {
+    json_object *item = json_object_new_object();
+
+    json_object_object_add(item, "name", json_object_new_string(name));
+    json_object_object_add(item, "ok", json_object_new_boolean(error == NULL));
+    if (error) {
+        json_object_object_add(item, "error", json_object_new_string(error));
+        batch->failed++;
+    } else {
+        batch->ok++;
+    }
+    json_object_array_add(batch->results, item);
+}
+
+// 上传文件改名前查重 重复时返回已有文件名
+static int photo_find_duplicate(const char *tmp_path, uint64_t hash, long size, char *existing, size_t existing_size, void *arg) {
+    struct photo_batch *batch = arg;
+    const char *name = photo_hashes_find_dup(&batch->hashes, hash, size, tmp_path);
+
+    if (!name) {
+        return 0;
+    }
+    snprintf(existing, existing_size, "%s", name);
+    return 1;
+}
+
+// 批量上传中每个文件处理完后的回调
+static void photo_upload_item(const struct multipart_item *item, void *arg) {
+    struct photo_batch *batch = arg;
+    json_object *obj;
+    struct stat st;
+
+    switch (item->result) {
+        case 0:
+            thumb_on_upload(item->path);
+            if (stat(item->path, &st) == 0) {
+                photo_hashes_put(&batch->hashes, item->filename, item->hash, item->size,
+                                 (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec);
+            }
+            photo_batch_add(batch, item->filename, NULL);
+            break;
+        case 1:
+            // 内容已存在 不写第二份 告知已有的文件名
+            obj = json_object_new_object();
+            json_object_object_add(obj, "name", json_object_new_string(item->filename));
+            json_object_object_add(obj, "ok", json_object_new_boolean(1));
+            json_object_object_add(obj, "duplicate_of", json_object_new_string(item->existing));
+            json_object_array_add(batch->results, obj);
+            batch->duplicates++;
+            break;
+        case -1:
+            photo_batch_add(batch, item->filename, "Empty file");
+            break;
+        case -2:
+            photo_batch_add(batch, item->filename, "Unsupported or unsafe filename");
+            break;
+        default:
+            photo_batch_add(batch, item->filename, "Failed to write file");
+            break;
+    }
+}
+// 扫描重复照片并输出报告 link 为真时把重复文件改为硬链接
+static void send_photo_dedupe_report(int link) {
+    struct photo_dedupe_report rep;
+
+    if (photo_dedupe_scan(link, &rep) != 0) {
+        send_error_500("Failed to scan photos");
+        return;
+    }
+    if (rep.linked > 0) {
+        photos_sync_dir();
+        photos_refresh_index();
+    }
+
+    json_object *obj = json_object_new_object();
+    json_object *groups = json_object_new_array();
+    for (size_t i = 0; i < rep.group_count; i++) {
+        const struct photo_dup_group *g = &rep.groups[i];
+        json_object *group = json_object_new_object();
+        json_object *dups = json_object_new_array();
+
+        for (size_t k = 0; k < g->dup_count; k++) {
+            json_object_array_add(dups, json_object_new_string(g->dups[k]));
+        }
+        json_object_object_add(group, "keep", json_object_new_string(g->keep));
+        json_object_object_add(group, "duplicates", dups);
+        json_object_object_add(group, "size", json_object_new_int64(g->size));
+        json_object_object_add(group, "wasted_bytes", json_object_new_int64(g->wasted));
+        json_object_array_add(groups, group);
+    }
+    json_object_object_add(obj, "scanned", json_object_new_int64((int64_t)rep.scanned));
+    json_object_object_add(obj, "hashed", json_object_new_int64((int64_t)rep.hashed));
+    json_object_object_add(obj, "wasted_bytes", json_object_new_int64(rep.wasted));
+    if (link) {
+        json_object_object_add(obj, "linked", json_object_new_int64((int64_t)rep.linked));
+        json_object_object_add(obj, "link_failed", json_object_new_int64((int64_t)rep.link_failed));
+        json_object_object_add(obj, "reclaimed_bytes", json_object_new_int64(rep.reclaimed));
+    }
+    json_object_object_add(obj, "groups", groups);
+    photo_dedupe_report_free(&rep);
+    send_json_object_response(obj);
+}
 //==============================
 // GET
 //==============================
 // 获取天气
-void weather_get(const char *path, const char *body) {
-    (void)path;
-    (void)body;
-    
+void weather_get(const struct request_ctx *ctx) {
     int fd;
     off_t fsize;
     char *buffer = NULL;
@@ -58,23 +224,46 @@ void weather_get(const char *path, const char *body) {
     WeatherData wd;
     json_object *resp = NULL;
     const char *output;
+    struct stat st;
+    struct cache_validator v;
+    struct state_meta meta;
+
+    // 守护进程发布的快照 只做一次内存拷贝
+    if (state_shm_read_weather(&wd, &meta) == 0) {
+        cache_validator_init_version(&v, meta.version, (time_t)meta.updated);
+        if (request_not_modified(ctx, &v)) {
+            send_not_modified(&v, "no-cache");
+            return;
+        }
+        resp = weather_data_to_json(&wd);
+        send_validator_headers(&v, NULL);
+        send_json_headers();
+        fprintf(g_resp, "%s\n", json_object_to_json_string_ext(resp, JSON_C_TO_STRING_PLAIN));
+        json_object_put(resp);
+        return;
+    }
+    // 快照不可用时读缓存文件，缓存未变化时直接 304，不打开也不解析文件
+    if (stat(WEATHER, &st) != 0) {
+        send_error_404("Weather cache not found");
+        return;
+    }
+    cache_validator_init(&v, &st);
+    if (request_not_modified(ctx, &v)) {
+        send_not_modified(&v, "no-cache");
+        return;
+    }
 
-    send_json_headers();
     fd = open(WEATHER, O_RDONLY);
     if (fd < 0) {
         send_error_404("Weather cache not found");
         return;
     }
-    //加读锁并读取文件内容
-    if (flock(fd, LOCK_SH) != 0) {
-        close(fd);
-        send_error_500("Failed to acquire read lock");
-        return;
+    if (fstat(fd, &st) == 0) {
+        cache_validator_init(&v, &st);
     }
-    //读取整个文件
+    //读取整个文件 写者原子替换 无需加锁
     fsize = lseek(fd, 0, SEEK_END);
     if (fsize <= 0) {
-        flock(fd, LOCK_UN);
         close(fd);
         send_error_404("Weather file is empty");
         return;
@@ -82,13 +271,11 @@ void weather_get(const char *path, const char *body) {
     lseek(fd, 0, SEEK_SET);
     buffer = malloc(fsize + 1);
     if (!buffer) {
-        flock(fd, LOCK_UN);
         close(fd);
         send_error_500("Memory error");
         return;
     }
     bytes_read = read(fd, buffer, fsize);
-    flock(fd, LOCK_UN);
     close(fd);
     if (bytes_read != fsize) {
         free(buffer);
@@ -103,28 +290,47 @@ void weather_get(const char *path, const char *body) {
         return;
     }
     free(buffer);
-    //构建响应 JSON
-    resp = json_object_new_object();
-    json_object_object_add(resp, "code", json_object_new_string(wd.code));
-    if (wd.valid) {
-        json_object_object_add(resp, "weather",      json_object_new_string(wd.weather));
-        json_object_object_add(resp, "temperature",  json_object_new_string(wd.temperature));
-        json_object_object_add(resp, "feels_like",   json_object_new_string(wd.feels_like));
-        json_object_object_add(resp, "humidity",     json_object_new_string(wd.humidity));
-        json_object_object_add(resp, "wind_dir",     json_object_new_string(wd.wind_dir));
-        json_object_object_add(resp, "wind_scale",   json_object_new_string(wd.wind_scale));
-    } else {
-        json_object_object_add(resp, "error", json_object_new_string("Weather data invalid"));
-    }
+    //构建响应 JSON 与事件推送的格式一致
+    resp = weather_data_to_json(&wd);
     //只输出JSON
+    send_validator_headers(&v, NULL);
+    send_json_headers();
     output = json_object_to_json_string_ext(resp, JSON_C_TO_STRING_PLAIN);
-    printf("%s\n", output);
+    fprintf(g_resp, "%s\n", output);
     json_object_put(resp);
 }
 // 获取温湿度
-void temperature_get(const char *path, const char *body) {
-    (void)path;
-    (void)body;
+void temperature_get(const struct request_ctx *ctx) {
+    struct stat st;
+    struct cache_validator v;
+    int have_validator = 0;
+    struct state_temperature t;
+    struct state_meta meta;
+
+    // 守护进程发布的快照 只做一次内存拷贝
+    if (state_shm_read_temperature(&t, &meta) == 0) {
+        cache_validator_init_version(&v, meta.version, (time_t)meta.updated);
+        if (request_not_modified(ctx, &v)) {
+            send_not_modified(&v, "no-cache");
+            return;
+        }
+        json_object *snapshot = state_temperature_to_json(&t);
+        json_object_object_add(snapshot, "success", json_object_new_boolean(true));
+        send_validator_headers(&v, NULL);
+        send_json_headers();
+        fprintf(g_resp, "%s\n", json_object_to_json_string_ext(snapshot, JSON_C_TO_STRING_PRETTY));
+        json_object_put(snapshot);
+        return;
+    }
+
+    // 快照不可用时读缓存文件，缓存未变化时直接 304，不打开也不解析文件
+    if (stat(TEMP_JSON_PATH, &st) == 0) {
+        cache_validator_init(&v, &st);
+        if (request_not_modified(ctx, &v)) {
+            send_not_modified(&v, "no-cache");
+            return;
+        }
+    }
 
     // 打开文件
     int fd = open(TEMP_JSON_PATH, O_RDONLY);
@@ -134,36 +340,27 @@ void temperature_get(const char *path, const char *body) {
         json_object_object_add(resp, "error", json_object_new_string("Temperature data not available"));
         json_object_object_add(resp, "code", json_object_new_int(404));
         
-        printf("Content-Type: application/json\r\n\r\n");
-        printf("%s\n", json_object_to_json_string(resp));
+        fprintf(g_resp, "Content-Type: application/json\r\n\r\n");
+        fprintf(g_resp, "%s\n", json_object_to_json_string(resp));
         json_object_put(resp);
         return;
     }
 
-    // 加读锁
-    if (flock(fd, LOCK_SH) != 0) {
-        close(fd);
-        json_object *resp = json_object_new_object();
-        json_object_object_add(resp, "error", json_object_new_string("Failed to acquire read lock"));
-        json_object_object_add(resp, "code", json_object_new_int(500));
-        
-        printf("Content-Type: application/json\r\n\r\n");
-        printf("%s\n", json_object_to_json_string(resp));
-        json_object_put(resp);
-        return;
+    if (fstat(fd, &st) == 0) {
+        cache_validator_init(&v, &st);
+        have_validator = 1;
     }
 
-    // 读取整个文件
+    // 读取整个文件 写者原子替换 无需加锁
     off_t size = lseek(fd, 0, SEEK_END);
     if (size <= 0) {
-        flock(fd, LOCK_UN);
         close(fd);
         json_object *resp = json_object_new_object();
         json_object_object_add(resp, "error", json_object_new_string("Temperature file is empty"));
         json_object_object_add(resp, "code", json_object_new_int(404));
         
-        printf("Content-Type: application/json\r\n\r\n");
-        printf("%s\n", json_object_to_json_string(resp));
+        fprintf(g_resp, "Content-Type: application/json\r\n\r\n");
+        fprintf(g_resp, "%s\n", json_object_to_json_string(resp));
         json_object_put(resp);
         return;
     }
@@ -171,20 +368,18 @@ void temperature_get(const char *path, const char *body) {
 
     char *buffer = malloc(size + 1);
     if (!buffer) {
-        flock(fd, LOCK_UN);
         close(fd);
         json_object *resp = json_object_new_object();
         json_object_object_add(resp, "error", json_object_new_string("Memory allocation failed"));
         json_object_object_add(resp, "code", json_object_new_int(500));
         
-        printf("Content-Type: application/json\r\n\r\n");
-        printf("%s\n", json_object_to_json_string(resp));
+        fprintf(g_resp, "Content-Type: application/json\r\n\r\n");
+        fprintf(g_resp, "%s\n", json_object_to_json_string(resp));
         json_object_put(resp);
         return;
     }
 
     ssize_t bytes_read = read(fd, buffer, size);
-    flock(fd, LOCK_UN);
     close(fd);
 
     if (bytes_read != size) {
@@ -193,8 +388,8 @@ void temperature_get(const char *path, const char *body) {
         json_object_object_add(resp, "error", json_object_new_string("Incomplete file read"));
         json_object_object_add(resp, "code", json_object_new_int(500));
         
-        printf("Content-Type: application/json\r\n\r\n");
-        printf("%s\n", json_object_to_json_string(resp));
+        fprintf(g_resp, "Content-Type: application/json\r\n\r\n");
+        fprintf(g_resp, "%s\n", json_object_to_json_string(resp));
         json_object_put(resp);
         return;
     }
@@ -246,82 +441,106 @@ void temperature_get(const char *path, const char *body) {
     }
 
     // 输出最终响应
+    if (have_validator) {
+        send_validator_headers(&v, NULL);
+    }
     send_json_headers();
-    printf("%s\n", json_object_to_json_string_ext(response, JSON_C_TO_STRING_PRETTY));
+    fprintf(g_resp, "%s\n", json_object_to_json_string_ext(response, JSON_C_TO_STRING_PRETTY));
     json_object_put(response);
 }
+// 解析时间类查询参数 未提供时为 0 非法时已输出 400 并返回 -1
+static int parse_time_param(const struct request_ctx *ctx, const char *key, int64_t *out) {
+    char value[32];
+    char msg[64];
+    char *end = NULL;
+
+    *out = 0;
+    if (parse_query_string(ctx->query, key, value, sizeof(value)) != 0 || value[0] == '\0') {
+        return 0;
+    }
+    *out = strtoll(value, &end, 10);
+    if (!end || *end != '\0' || *out < 0) {
+        snprintf(msg, sizeof(msg), "Invalid '%s' parameter", key);
+        send_error_400(msg);
+        return -1;
+    }
+    return 0;
+}
+// 输出一个历史点 [时间, 读数次数, 温度最小/平均/最大, 湿度最小/平均/最大]
+static int write_history_point(const struct temp_history_point *p, void *arg) {
+    int *first = arg;
+
+    fprintf(g_resp, "%s[%lld,%u,%.1f,%.2f,%.1f,%.1f,%.2f,%.1f]", *first ? "" : ",",
+            (long long)p->ts, p->count, p->temp_min, p->temp_avg, p->temp_max,
+            p->hum_min, p->hum_avg, p->hum_max);
+    *first = 0;
+    return ferror(g_resp) ? -1 : 0;
+}
+// 获取温湿度历史 ?from=&to=&step= 均为秒 按 step 选择原始/分钟/小时层级
+void temperature_history_get(const struct request_ctx *ctx) {
+    struct temp_history_range r;
+    int first = 1;
+    int rc;
+
+    memset(&r, 0, sizeof(r));
+    if (parse_time_param(ctx, "from", &r.from) != 0 || parse_time_param(ctx, "to", &r.to) != 0 ||
+        parse_time_param(ctx, "step", &r.step) != 0) {
+        return;
+    }
+    rc = temp_history_plan(&r);
+    if (rc == -2) {
+        send_error_400("Too many points, increase 'step'");
+        return;
+    }
+    if (rc != 0) {
+        send_error_400("Invalid time range");
+        return;
+    }
+    send_json_headers();
+    fprintf(g_resp, "{\"from\":%lld,\"to\":%lld,\"step\":%lld,\"resolution\":%lld,"
+            "\"fields\":[\"t\",\"count\",\"temp_min\",\"temp_avg\",\"temp_max\",\"hum_min\",\"hum_avg\",\"hum_max\"],"
+            "\"points\":[",
+            (long long)r.from, (long long)r.to, (long long)r.step, (long long)r.resolution);
+    // 历史文件尚未创建时返回空数组
+    temp_history_query(&r, write_history_point, &first);
+    fprintf(g_resp, "]}\n");
+}
 // 获取图片
-void picture_get(const char *path, const char *body){
-    (void)path;
-    (void)body;
+void picture_get(const struct request_ctx *ctx) {
+    (void)ctx;
 }
 // 获取通知
-void notice_get(const char *path, const char *body){
-    (void)path;
-    (void)body;
+void notice_get(const struct request_ctx *ctx) {
+    (void)ctx;
 }
 
 // 获取系统信息
-void system_get(const char *path, const char *body) {
-    (void)path;
-    (void)body;
-    // 验证登录状态
-    char *token = get_token_from_cookie();
-    if (!token || !is_valid_token(token)) {
-        free(token);
-        // 直接输出 401 错误
-        printf("Status: 401 Unauthorized\r\n");
-        printf("Content-Type: application/json\r\n\r\n");
-        printf("{\"error\":\"Unauthorized\"}\n");
-        return;
-    }
-    free(token);
+void system_get(const struct request_ctx *ctx) {
+    (void)ctx;
 
     // 采集系统信息
     system_info_t info;
     if (!collect_system_info(&info)) {
         // 直接输出 500 错误
-        printf("Status: 500 Internal Server Error\r\n");
-        printf("Content-Type: application/json\r\n\r\n");
-        printf("{\"error\":\"Failed to collect system data\"}\n");
+        fprintf(g_resp, "Status: 500 Internal Server Error\r\n");
+        fprintf(g_resp, "Content-Type: application/json\r\n\r\n");
+        fprintf(g_resp, "{\"error\":\"Failed to collect system data\"}\n");
         return;
     }
 
-    // 构建 JSON 响应
+    // 构建 JSON 响应 与事件推送的格式一致
     send_json_headers();
-    struct json_object *root = json_object_new_object();
-    json_object_object_add(root, "load_percent",     json_object_new_double(info.load_percent));
-    json_object_object_add(root, "uptime_minutes",   json_object_new_int64(info.uptime_minutes));
-    json_object_object_add(root, "memory_total_mb",  json_object_new_int64(info.memory_total_mb));
-    json_object_object_add(root, "memory_used_mb",   json_object_new_int64(info.memory_used_mb));
-    json_object_object_add(root, "memory_percent",   json_object_new_double(info.memory_percent));
-    json_object_object_add(root, "ip",               json_object_new_string(info.ip));
-    if (info.cpu_temp_c >= 0) {
-        json_object_object_add(root, "cpu_temp_c",   json_object_new_double(info.cpu_temp_c));
-    }
-    json_object_object_add(root, "disk_total_gb",    json_object_new_int64(info.disk_total_gb));
-    json_object_object_add(root, "disk_used_gb",     json_object_new_int64(info.disk_used_gb));
-    json_object_object_add(root, "disk_percent",     json_object_new_double(info.disk_percent));
-    printf("%s\n", json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN));
+    struct json_object *root = system_info_to_json(&info);
+    fprintf(g_resp, "%s\n", json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN));
     json_object_put(root);
 }
 
 
 
 // 下载文件
-void disk_download_get(const char *path, const char *body) {
-    (void)path;
-    (void)body;
-    char *token = get_token_from_cookie();
-    if (!token || !is_valid_token(token)) {
-        free(token);
-        send_error_401("Unauthorized");
-        return;
-    }
-    free(token);
-
+void disk_download_get(const struct request_ctx *ctx) {
     char requested_path[512] = "";
-    const char *qs = getenv("QUERY_STRING");
+    const char *qs = ctx->query;
     if (!qs || !strstr(qs, "path=")) {
         send_error_400("Missing 'path' parameter");
         return;
@@ -397,118 +616,470 @@ void disk_download_get(const char *path, const char *body) {
         // 其他格式保持 attachment（如 .doc, .docx, .zip, .exe）
     }
 
-    FILE *fp = fopen(real_path, "rb");
-    if (!fp) {
-        send_error_500("Cannot open file");
+    char *basename = strrchr(real_path, '/') ? strrchr(real_path, '/') + 1 : real_path;
+    serve_file(ctx, real_path, mime, disposition, basename, "private, no-cache");
+}
+// 解析分页参数 offset 与 limit 非法时已输出 400 并返回 -1
+static int parse_page_params(const struct request_ctx *ctx, long *offset, long *limit) {
+    char value[32];
+
+    *offset = 0;
+    *limit = DISK_LIST_DEFAULT_LIMIT;
+    if (parse_query_string(ctx->query, "offset", value, sizeof(value)) == 0) {
+        char *end = NULL;
+        *offset = strtol(value, &end, 10);
+        if (!end || *end != '\0' || *offset < 0) {
+            send_error_400("Invalid 'offset' parameter");
+            return -1;
+        }
+    }
+    if (parse_query_string(ctx->query, "limit", value, sizeof(value)) == 0) {
+        char *end = NULL;
+        *limit = strtol(value, &end, 10);
+        if (!end || *end != '\0' || *limit <= 0) {
+            send_error_400("Invalid 'limit' parameter");
+            return -1;
+        }
+        if (*limit > DISK_LIST_MAX_LIMIT) {
+            *limit = DISK_LIST_MAX_LIMIT;
+        }
+    }
+    return 0;
+}
+// 列出目录
+void disk_list_get(const struct request_ctx *ctx) {
+    char requested_path[512] = "/";
+    char value[32];
+    long offset;
+    long limit;
+    enum disk_sort sort = DISK_SORT_NAME;
+    int descending = 0;
+
+    parse_query_string(ctx->query, "path", requested_path, sizeof(requested_path));
+    if (!is_safe_relative_path(requested_path)) {
+        send_error_403("Invalid path");
+        return;
+    }
+    if (parse_page_params(ctx, &offset, &limit) != 0) {
         return;
     }
+    if (parse_query_string(ctx->query, "sort", value, sizeof(value)) == 0) {
+        if (strcmp(value, "size") == 0) {
+            sort = DISK_SORT_SIZE;
+        } else if (strcmp(value, "mtime") == 0) {
+            sort = DISK_SORT_MTIME;
+        } else if (strcmp(value, "name") != 0) {
+            send_error_400("Invalid 'sort' parameter");
+            return;
+        }
+    }
+    if (parse_query_string(ctx->query, "order", value, sizeof(value)) == 0) {
+        if (strcmp(value, "desc") == 0) {
+            descending = 1;
+        } else if (strcmp(value, "asc") != 0) {
+            send_error_400("Invalid 'order' parameter");
+            return;
+        }
+    }
 
-    // 输出 HTTP 头
-    printf("Content-Type: %s\r\n", mime);
-    printf("Content-Length: %ld\r\n", st.st_size);
+    disk_listing_t listing;
+    if (disk_listing_open(&listing, requested_path, sort, descending) != 0) {
+        send_error_500("Failed to read directory");
+        return;
+    }
 
-    char *basename = strrchr(real_path, '/') ? strrchr(real_path, '/') + 1 : real_path;
-    printf("Content-Disposition: %s; filename=\"%s\"\r\n", disposition, basename);
-    printf("\r\n"); // 空行结束头
+    size_t total = listing.count;
+    size_t begin = (size_t)offset < total ? (size_t)offset : total;
+    size_t end = total - begin > (size_t)limit ? begin + (size_t)limit : total;
+    static const char *const sort_names[] = { "name", "size", "mtime" };
 
-    // 发送文件内容
-    char buf[8192];
-    size_t n;
-    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
-        fwrite(buf, 1, n, stdout);
-    }
-    fclose(fp);
+    // 逐项写出 不在内存中构建整个 JSON 数组
+    send_json_headers();
+    fputs("{\"path\":", g_resp);
+    json_write_string(g_resp, requested_path);
+    fprintf(g_resp, ",\"total\":%zu,\"offset\":%ld,\"limit\":%ld,\"sort\":\"%s\",\"order\":\"%s\",\"indexed\":%s,\"next_offset\":",
+            total, offset, limit, sort_names[sort], descending ? "desc" : "asc", listing.indexed ? "true" : "false");
+    if (end < total) {
+        fprintf(g_resp, "%zu", end);
+    } else {
+        fputs("null", g_resp);
+    }
+    fputs(",\"files\":[", g_resp);
+    int first = 1;
+    for (size_t i = begin; i < end; i++) {
+        // 条目在读取目录后被删除时跳过
+        if (disk_listing_stat(&listing, i) != 0) {
+            continue;
+        }
+        const disk_entry_t *e = &listing.items[i];
+        if (!first) {
+            fputc(',', g_resp);
+        }
+        first = 0;
+        fputs("{\"name\":", g_resp);
+        json_write_string(g_resp, disk_listing_name(&listing, i));
+        fprintf(g_resp, ",\"size\":%lld,\"is_dir\":%s,\"mtime\":%lld}",
+                (long long)e->size, e->is_dir ? "true" : "false", (long long)e->mtime);
+    }
+    fputs("]}\n", g_resp);
+    disk_listing_close(&listing);
 }
-// 列出目录
-void disk_list_get(const char *path, const char *body) {
-    (void)path;
-    (void)body;
-    char *token = get_token_from_cookie();
-    if (!token || !is_valid_token(token)) {
-        free(token);
-        send_error_401("Unauthorized");
+// 在磁盘索引中按名字搜索 结果逐项写出
+void disk_search_get(const struct request_ctx *ctx) {
+    char q[256] = {0};
+    char scope[512] = "/";
+    long offset;
+    long limit;
+
+    if (parse_query_string(ctx->query, "q", q, sizeof(q)) != 0 || q[0] == '\0') {
+        send_error_400("Missing 'q' parameter");
+        return;
+    }
+    parse_query_string(ctx->query, "path", scope, sizeof(scope));
+    if (!is_safe_relative_path(scope)) {
+        send_error_403("Invalid path");
+        return;
+    }
+    if (parse_page_params(ctx, &offset, &limit) != 0) {
         return;
     }
-    free(token);
 
-    char requested_path[512] = "/";
-    const char *qs = getenv("QUERY_STRING");
-    if (qs && strstr(qs, "path=")) {
-        sscanf(qs, "path=%511[^&\r\n]", requested_path);
-        url_decode(requested_path, requested_path);
+    disk_index_t idx;
+    if (disk_index_open(&idx, DISK_INDEX_FILE) != 0) {
+        send_error_503("Search index unavailable");
+        return;
+    }
+
+    size_t scope_len = strlen(scope);
+    while (scope_len > 0 && scope[scope_len - 1] == '/') {
+        scope_len--;
+    }
+    long matched = 0;
+    int first = 1;
+
+    send_json_headers();
+    fputs("{\"q\":", g_resp);
+    json_write_string(g_resp, q);
+    fputs(",\"path\":", g_resp);
+    json_write_string(g_resp, scope);
+    fprintf(g_resp, ",\"offset\":%ld,\"limit\":%ld,\"built_at\":%lld,\"files\":[",
+            offset, limit, (long long)idx.hdr->built_at);
+    for (uint32_t i = 0; i < idx.hdr->count; i++) {
+        const struct disk_index_entry *e = &idx.entries[i];
+        const char *path = disk_index_path(&idx, e);
+        if (scope_len > 0 && (strncmp(path, scope, scope_len) != 0 || path[scope_len] != '/')) {
+            continue;
+        }
+        if (!disk_name_matches(disk_index_name(&idx, e), q)) {
+            continue;
+        }
+        if (matched++ < offset || matched > offset + limit) {
+            continue;
+        }
+        if (!first) {
+            fputc(',', g_resp);
+        }
+        first = 0;
+        fputs("{\"path\":", g_resp);
+        // 父目录为空串时即根目录
+        if (e->parent_len == 0) {
+            fputs("\"/\"", g_resp);
+        } else {
+            json_write_stringn(g_resp, path, e->parent_len);
+        }
+        fputs(",\"name\":", g_resp);
+        json_write_string(g_resp, disk_index_name(&idx, e));
+        fprintf(g_resp, ",\"size\":%llu,\"is_dir\":%s,\"mtime\":%lld}",
+                (unsigned long long)e->size, (e->flags & DISK_INDEX_DIR) ? "true" : "false",
+                (long long)(e->mtime_ns / 1000000000LL));
+    }
+    fprintf(g_resp, "],\"total\":%ld,\"next_offset\":", matched);
+    if (offset + limit < matched) {
+        fprintf(g_resp, "%ld", offset + limit);
+    } else {
+        fputs("null", g_resp);
     }
+    fputs("}\n", g_resp);
+    disk_index_close(&idx);
+}
+// 目录占用统计 返回子树累计值与占用最大的 N 个子项
+void disk_usage_get(const struct request_ctx *ctx) {
+    char requested_path[512] = "/";
+    char value[32];
+    long top = DISK_USAGE_DEFAULT_TOP;
 
+    parse_query_string(ctx->query, "path", requested_path, sizeof(requested_path));
     if (!is_safe_relative_path(requested_path)) {
         send_error_403("Invalid path");
         return;
     }
+    if (parse_query_string(ctx->query, "top", value, sizeof(value)) == 0) {
+        char *end = NULL;
+        top = strtol(value, &end, 10);
+        if (!end || *end != '\0' || top <= 0) {
+            send_error_400("Invalid 'top' parameter");
+            return;
+        }
+        if (top > DISK_USAGE_MAX_TOP) {
+            top = DISK_USAGE_MAX_TOP;
+        }
+    }
 
-    char real_path[1024];
-    snprintf(real_path, sizeof(real_path), "%s%s", get_disk_root(), requested_path);
-
-    disk_file_t files[100];
-    int count = list_files_in_dir(real_path, files, 100);
-    if (count < 0) {
-        send_error_500("Failed to read directory");
+    disk_index_t idx;
+    if (disk_index_open(&idx, DISK_INDEX_FILE) != 0) {
+        send_error_503("Disk index unavailable");
         return;
     }
 
-    struct json_object *root = json_object_new_object();
-    struct json_object *arr = json_object_new_array();
-
-    for (int i = 0; i < count; i++) {
-        struct json_object *item = json_object_new_object();
-        json_object_object_add(item, "name", json_object_new_string(files[i].name));
-        json_object_object_add(item, "size", json_object_new_int64(files[i].size));
-        json_object_object_add(item, "is_dir", json_object_new_boolean(files[i].is_dir));
-        json_object_object_add(item, "mtime", json_object_new_int64((int64_t)files[i].mtime));
-        json_object_array_add(arr, item);
+    uint64_t size, usage, files;
+    size_t len = strlen(requested_path);
+    while (len > 0 && requested_path[len - 1] == '/') {
+        requested_path[--len] = '\0';
+    }
+    if (len == 0) {
+        size = idx.hdr->root_size;
+        usage = idx.hdr->root_usage;
+        files = idx.hdr->root_files;
+    } else {
+        const struct disk_index_entry *dir = disk_index_lookup(&idx, requested_path);
+        if (!dir || !(dir->flags & DISK_INDEX_DIR)) {
+            disk_index_close(&idx);
+            send_error_404("Directory not found");
+            return;
+        }
+        size = dir->size;
+        usage = dir->usage;
+        files = dir->files;
+    }
+
+    // 子项区间内按占用做插入选择 只保留前 top 个
+    const struct disk_index_entry *best[DISK_USAGE_MAX_TOP];
+    size_t first, count, kept = 0;
+    disk_index_children(&idx, requested_path, &first, &count);
+    for (size_t i = first; i < first + count; i++) {
+        const struct disk_index_entry *e = &idx.entries[i];
+        size_t pos = kept;
+        if (kept == (size_t)top && e->usage <= best[kept - 1]->usage) {
+            continue;
+        }
+        if (kept < (size_t)top) {
+            kept++;
+        } else {
+            pos = kept - 1;
+        }
+        while (pos > 0 && best[pos - 1]->usage < e->usage) {
+            best[pos] = best[pos - 1];
+            pos--;
+        }
+        best[pos] = e;
     }
 
-    json_object_object_add(root, "files", arr);
-    send_json_object_response(root);
+    send_json_headers();
+    fputs("{\"path\":", g_resp);
+    json_write_string(g_resp, len ? requested_path : "/");
+    fprintf(g_resp, ",\"size\":%llu,\"usage\":%llu,\"files\":%llu,\"children\":%zu,\"built_at\":%lld,\"top\":[",
+            (unsigned long long)size, (unsigned long long)usage, (unsigned long long)files,
+            count, (long long)idx.hdr->built_at);
+    for (size_t i = 0; i < kept; i++) {
+        if (i > 0) {
+            fputc(',', g_resp);
+        }
+        fputs("{\"name\":", g_resp);
+        json_write_string(g_resp, disk_index_name(&idx, best[i]));
+        fprintf(g_resp, ",\"is_dir\":%s,\"size\":%llu,\"usage\":%llu,\"files\":%u}",
+                (best[i]->flags & DISK_INDEX_DIR) ? "true" : "false",
+                (unsigned long long)best[i]->size, (unsigned long long)best[i]->usage, best[i]->files);
+    }
+    fputs("]}\n", g_resp);
+    disk_index_close(&idx);
 }
-// 获取照片列表
-void photos_list_get(const char *path, const char *body) {
-    (void)path; (void)body;
-
-    // 认证
-    char *token = get_token_from_cookie();
-    if (!token || !is_valid_token(token)) {
-        free(token);
-        send_error_401("Unauthorized");
+// 查询后台磁盘任务进度
+void disk_job_get_handler(const struct request_ctx *ctx) {
+    struct disk_job job;
+    if (disk_job_get(route_param(ctx->path), &job) != 0) {
+        send_error_404("Job not found");
         return;
     }
-    free(token);
+    send_json_object_response(disk_job_to_json(&job));
+}
+// 解析 from/to 时间参数 支持 Unix 秒数与 YYYY-MM-DD[THH:MM[:SS]]
+// 结果与索引一致为不带时区的本地时间秒数 只给日期时 to 取当天最后一秒
+// 返回 1 表示未提供 -1 表示格式错误且已发送 400
+static int parse_taken_param(const struct request_ctx *ctx, const char *key, int end_of_day, int64_t *out) {
+    char value[32];
+    struct tm tm;
+    char *end = NULL;
+    int n = 0;
+
+    if (parse_query_string(ctx->query, key, value, sizeof(value)) != 0 || value[0] == '\0') {
+        return 1;
+    }
+    memset(&tm, 0, sizeof(tm));
+    long long secs = strtoll(value, &end, 10);
+    if (end && *end == '\0') {
+        time_t t = (time_t)secs;
+        localtime_r(&t, &tm);
+        *out = (int64_t)timegm(&tm);
+        return 0;
+    }
+    if (sscanf(value, "%4d-%2d-%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &n) == 3
+        && tm.tm_mon >= 1 && tm.tm_mon <= 12 && tm.tm_mday >= 1 && tm.tm_mday <= 31) {
+        int date_only = value[n] == '\0';
+        if (!date_only && sscanf(value + n, "%*[T ]%2d:%2d:%2d", &tm.tm_hour, &tm.tm_min, &tm.tm_sec) < 2) {
+            send_error_400(end_of_day ? "Invalid 'to' parameter" : "Invalid 'from' parameter");
+            return -1;
+        }
+        if (date_only && end_of_day) {
+            tm.tm_hour = 23;
+            tm.tm_min = 59;
+            tm.tm_sec = 59;
+        }
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        *out = (int64_t)timegm(&tm);
+        return 0;
+    }
+    send_error_400(end_of_day ? "Invalid 'to' parameter" : "Invalid 'from' parameter");
+    return -1;
+}
 
-    // 复用已有的函数
-    char *json = photos_build_list_json();
-    photos_send_json_response(json);
-    free(json);
+struct photo_name_sort {
+    const photo_index_t *idx;
+    int descending;
+};
+
+// 按名字比较索引条目
+static int photo_name_cmp(const void *a, const void *b, void *arg) {
+    const struct photo_name_sort *s = arg;
+    int r = strcmp(photo_index_name(s->idx, *(const struct photo_index_entry *const *)a),
+                   photo_index_name(s->idx, *(const struct photo_index_entry *const *)b));
+    return s->descending ? -r : r;
 }
-// 获取单张照片
-void photos_photo_get(const char *path, const char *body) {
-    (void)path; (void)body;
 
-    // 认证
-    char *token = get_token_from_cookie();
-    if (!token || !is_valid_token(token)) {
-        free(token);
-        send_error_401("Unauthorized");
+// 获取照片列表 答复全部取自照片索引
+// from/to 按拍摄时间二分定位区间 q 在区间内匹配文件名与备注 默认按拍摄时间倒序分页
+void photos_list_get(const struct request_ctx *ctx) {
+    char value[32];
+    char q[128] = {0};
+    long offset;
+    long limit;
+    int64_t from = INT64_MIN;
+    int64_t to = INT64_MAX;
+    int by_name = 0;
+    int descending = 1;
+
+    if (parse_page_params(ctx, &offset, &limit) != 0) {
+        return;
+    }
+    if (parse_query_string(ctx->query, "sort", value, sizeof(value)) == 0) {
+        if (strcmp(value, "name") == 0) {
+            by_name = 1;
+        } else if (strcmp(value, "date") != 0) {
+            send_error_400("Invalid 'sort' parameter");
+            return;
+        }
+    }
+    if (parse_query_string(ctx->query, "order", value, sizeof(value)) == 0) {
+        if (strcmp(value, "asc") == 0) {
+            descending = 0;
+        } else if (strcmp(value, "desc") != 0) {
+            send_error_400("Invalid 'order' parameter");
+            return;
+        }
+    }
+    if (parse_taken_param(ctx, "from", 0, &from) < 0 || parse_taken_param(ctx, "to", 1, &to) < 0) {
+        return;
+    }
+    parse_query_string(ctx->query, "q", q, sizeof(q));
+
+    photo_index_t idx;
+    if (photos_open_index(&idx) != 0) {
+        send_error_500("Failed to read photos directory");
         return;
     }
-    free(token);
 
-    // 从 QUERY_STRING 获取 name 参数
-    const char *qs = getenv("QUERY_STRING");
-    if (!qs || !strstr(qs, "name=")) {
-        send_error_400("Missing 'name' parameter");
+    // 先按时间区间取出候选 再按关键字过滤
+    size_t first;
+    size_t last;
+    size_t total = 0;
+    photo_index_range(&idx, from, to, &first, &last);
+    const struct photo_index_entry **hits = malloc(sizeof(*hits) * (last > first ? last - first : 1));
+    if (!hits) {
+        photo_index_close(&idx);
+        send_error_500("Out of memory");
         return;
     }
+    for (size_t i = first; i < last; i++) {
+        const struct photo_index_entry *e = &idx.entries[descending && !by_name ? last - 1 - (i - first) : i];
+        if (q[0] && !strcasestr(photo_index_name(&idx, e), q) && !strcasestr(photo_index_note(&idx, e), q)) {
+            continue;
+        }
+        hits[total++] = e;
+    }
+    if (by_name) {
+        struct photo_name_sort s = { &idx, descending };
+        qsort_r(hits, total, sizeof(*hits), photo_name_cmp, &s);
+    }
+
+    size_t begin = (size_t)offset < total ? (size_t)offset : total;
+    size_t end = total - begin > (size_t)limit ? begin + (size_t)limit : total;
 
+    send_json_headers();
+    fprintf(g_resp, "{\"total\":%zu,\"offset\":%ld,\"limit\":%ld,\"sort\":\"%s\",\"order\":\"%s\",\"next_offset\":",
+            total, offset, limit, by_name ? "name" : "date", descending ? "desc" : "asc");
+    if (end < total) {
+        fprintf(g_resp, "%zu", end);
+    } else {
+        fputs("null", g_resp);
+    }
+    fputs(",\"photos\":[", g_resp);
+    for (size_t i = begin; i < end; i++) {
+        const struct photo_index_entry *e = hits[i];
+        time_t taken = (time_t)e->taken;
+        struct tm tm;
+        char taken_str[32];
+
+        gmtime_r(&taken, &tm);
+        strftime(taken_str, sizeof(taken_str), "%Y-%m-%dT%H:%M:%S", &tm);
+        if (i > begin) {
+            fputc(',', g_resp);
+        }
+        fputs("{\"name\":", g_resp);
+        json_write_string(g_resp, photo_index_name(&idx, e));
+        fprintf(g_resp, ",\"size\":%llu,\"mtime\":%lld,\"mtime_ns\":%lld,\"taken\":\"%s\",\"taken_source\":\"%s\","
+                "\"width\":%u,\"height\":%u,\"has_note\":%s",
+                (unsigned long long)e->size, (long long)(e->mtime_ns / 1000000000LL), (long long)e->mtime_ns,
+                taken_str, e->flags & PHOTO_INDEX_EXIF_TIME ? "exif" : "mtime",
+                e->width, e->height, e->note_mtime_ns ? "true" : "false");
+        if (e->note_len) {
+            fputs(",\"note\":", g_resp);
+            json_write_stringn(g_resp, photo_index_note(&idx, e), e->note_len);
+        }
+        fputs("}", g_resp);
+    }
+    fputs("]}\n", g_resp);
+    free(hits);
+    photo_index_close(&idx);
+}
+// 报告照片目录中内容重复的照片 不做修改
+void photos_dedupe_get(const struct request_ctx *ctx) {
+    (void)ctx;
+    send_photo_dedupe_report(0);
+}
+// 获取单张照片 size=small|medium 时返回缓存的缩略图
+void photos_photo_get(const struct request_ctx *ctx) {
     char filename[256] = {0};
-    sscanf(qs, "name=%255[^&\r\n]", filename);
-    url_decode(filename, filename);
+    char size_name[16] = {0};
+    char version[32] = {0};
+
+    if (parse_query_string(ctx->query, "name", filename, sizeof(filename)) != 0 || filename[0] == '\0') {
+        send_error_400("Missing 'name' parameter");
+        return;
+    }
+    if (!photos_is_safe_filename(filename)) {
+        send_error_400("Invalid filename");
+        return;
+    }
 
     // 构建完整路径
     char filepath[512];
@@ -524,6 +1095,24 @@ void photos_photo_get(const char *path, const char *body) {
         return;
     }
 
+    // 缩略图按修改时间与大小命名 带 v 参数的地址内容不会变 可长期缓存
+    if (parse_query_string(ctx->query, "size", size_name, sizeof(size_name)) == 0) {
+        enum thumb_size size;
+        char thumbpath[MAX_PATH];
+
+        if (thumb_parse_size(size_name, &size) != 0) {
+            send_error_400("Invalid size");
+            return;
+        }
+        parse_query_string(ctx->query, "v", version, sizeof(version));
+        if (thumb_get(filepath, filename, size, thumbpath, sizeof(thumbpath)) == 0) {
+            serve_file(ctx, thumbpath, "image/jpeg", "inline", filename,
+                       version[0] ? "private, max-age=31536000, immutable" : "private, max-age=86400");
+            return;
+        }
+        // 格式不支持或解码失败时回退到原图
+    }
+
     // 确定 MIME 类型（和 disk_download_get 一致）
     const char *mime = "application/octet-stream";
     const char *ext = strrchr(filename, '.');
@@ -537,40 +1126,13 @@ void photos_photo_get(const char *path, const char *body) {
         else if (strcasecmp(ext, "svg") == 0) mime = "image/svg+xml";
     }
 
-    // 打开并发送文件
-    FILE *fp = fopen(filepath, "rb");
-    if (!fp) {
-        send_error_500("Cannot open photo");
-        return;
-    }
-
-    printf("Content-Type: %s\r\n", mime);
-    printf("Content-Length: %ld\r\n", (long)st.st_size);
-    printf("Content-Disposition: inline; filename=\"%s\"\r\n", filename);
-    printf("\r\n");
-
-    char buf[8192];
-    size_t n;
-    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
-        fwrite(buf, 1, n, stdout);
-    }
-    fclose(fp);
+    // 发送文件（支持 Range）
+    serve_file(ctx, filepath, mime, "inline", filename, "private, max-age=3600");
 }
 // 获取照片备注
-void photo_note_get(const char *path, const char *body) {
-    (void)path; (void)body;
-
-    // 认证
-    char *token = get_token_from_cookie();
-    if (!token || !is_valid_token(token)) {
-        free(token);
-        send_error_401("Unauthorized");
-        return;
-    }
-    free(token);
-
+void photo_note_get(const struct request_ctx *ctx) {
     // 获取查询字符串
-    const char *qs = getenv("QUERY_STRING");
+    const char *qs = ctx->query;
     if (!qs || !strstr(qs, "name=")) {
         send_error_400("Missing 'name' parameter");
         return;
@@ -595,49 +1157,48 @@ void photo_note_get(const char *path, const char *body) {
     FILE *fp = fopen(notepath, "r");
     if (!fp) {
         // 文件不存在则返回空内容
-        printf("Content-Type: text/plain\r\n\r\n");
+        fprintf(g_resp, "Content-Type: text/plain\r\n\r\n");
         return;
     }
 
     // 返回文件内容（确保 UTF-8 兼容）
-    printf("Content-Type: text/plain; charset=utf-8\r\n\r\n");
+    fprintf(g_resp, "Content-Type: text/plain; charset=utf-8\r\n\r\n");
 
     char buf[1024];
     size_t n;
     while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
-        fwrite(buf, 1, n, stdout);
+        fwrite(buf, 1, n, g_resp);
     }
     fclose(fp);
 }
 // 获取家庭成员
-void family_members_get(const char *path, const char *body) {
-    (void)path; (void)body;
+void family_members_get(const struct request_ctx *ctx) {
+    (void)ctx;
 
     json_object *root = load_family_data();
     send_json_headers();
     if (!root) {
-        printf("{\"error\":\"Internal error\"}\n");
+        fprintf(g_resp, "{\"error\":\"Internal error\"}\n");
         return;
     }
     json_object *resp = json_object_new_object();
     json_object_object_add(resp, "members",
         json_object_get(json_object_object_get(root, "members")));
-    printf("%s\n", json_object_to_json_string_ext(resp, JSON_C_TO_STRING_PLAIN));
+    fprintf(g_resp, "%s\n", json_object_to_json_string_ext(resp, JSON_C_TO_STRING_PLAIN));
     json_object_put(resp);
     json_object_put(root);
 }
 // 获取我的任务
-void family_my_tasks_get(const char *path, const char *body) {
+void family_my_tasks_get(const struct request_ctx *ctx) {
     size_t i;
     size_t j;
-    (void)path;
-    (void)body;
+    (void)ctx;
 
     send_json_headers();
 
     json_object *root = load_family_data();
     if (!root) {
-        printf("[]\n");
+        fprintf(g_resp, "[]\n");
         return;
     }
 
@@ -686,61 +1247,25 @@ void family_my_tasks_get(const char *path, const char *body) {
         }
     }
 
-    printf("%s\n", json_object_to_json_string_ext(result, JSON_C_TO_STRING_PLAIN));
+    fprintf(g_resp, "%s\n", json_object_to_json_string_ext(result, JSON_C_TO_STRING_PLAIN));
 
     json_object_put(result);
     json_object_put(root);
 }
-// 获取灯状态
-void control_light_get(const char *path, const char *body) {
-    (void)path;
-    (void)body;
-    int state = get_light_state();  // 从本地状态获取
-    printf("Content-Type: application/json\r\n\r\n");
-    printf("{\"state\": %d}", state);
-}
-
-// 获取风扇状态
-void control_fan_get(const char *path, const char *body) {
-    (void)path;
-    (void)body;
-    int state = get_fan_state();
-    printf("Content-Type: application/json\r\n\r\n");
-    printf("{\"state\": %d}", state);
-}
-
-// 获取空调状态
-void control_aircon_get(const char *path, const char *body) {
-    (void)path;
-    (void)body;
-    int state = get_aircon_state(); // 从本地状态获取
-
-    printf("Content-Type: application/json\r\n\r\n");
-    printf("{\"state\": %d}", state);
-}
-
-// 获取洗衣机状态
-void control_washing_machine_get(const char *path, const char *body) {
-    (void)path;
-    (void)body;
-    int state = get_washing_state(); // 从本地状态获取
-
-    printf("Content-Type: application/json\r\n\r\n");
-    printf("{\"state\": %d}", state);
-}
-
-// 获取门状态
-void control_door_get(const char *path, const char *body) {
-    (void)path;
-    (void)body;
-    int state = get_door_state(); // 从本地状态获取
-
-    printf("Content-Type: application/json\r\n\r\n");
-    printf("{\"state\": %d}", state);
+// 获取设备状态
+void control_device_get(const struct request_ctx *ctx) {
+    const control_device_t *dev = find_control_device(route_param(ctx->path));
+    if (!dev) {
+        send_error_404("Unknown device");
+        return;
+    }
+    int state = dev->get_state();  // 从本地状态获取
+    fprintf(g_resp, "Content-Type: application/json\r\n\r\n");
+    fprintf(g_resp, "{\"state\": %d}", state);
 }
 // 获取修改密码信息
-void settings_change_password_get(const char *path, const char *body) {
-    (void)path; (void)body;
+void settings_change_password_get(const struct request_ctx *ctx) {
+    (void)ctx;
 
     char username[128] = {0};
     read_username(username, sizeof(username));
@@ -749,14 +1274,14 @@ void settings_change_password_get(const char *path, const char *body) {
     json_object_object_add(resp, "username", json_object_new_string(username));
 
     send_json_headers();
-    printf("%s\n", json_object_to_json_string_ext(resp, JSON_C_TO_STRING_PLAIN));
-    fflush(stdout);
+    fprintf(g_resp, "%s\n", json_object_to_json_string_ext(resp, JSON_C_TO_STRING_PLAIN));
+    fflush(g_resp);
 
     json_object_put(resp);
 }
 // 获取外网访问状态
-void settings_public_get(const char *path, const char *body) {
-    (void)path; (void)body;
+void settings_public_get(const struct request_ctx *ctx) {
+    (void)ctx;
 
     int enabled = is_ngrok_running();
 
@@ -764,14 +1289,14 @@ void settings_public_get(const char *path, const char *body) {
     json_object_object_add(resp, "enabled", json_object_new_boolean(enabled));
 
     send_json_headers();
-    printf("%s\n", json_object_to_json_string_ext(resp, JSON_C_TO_STRING_PLAIN));
-    fflush(stdout);
+    fprintf(g_resp, "%s\n", json_object_to_json_string_ext(resp, JSON_C_TO_STRING_PLAIN));
+    fflush(g_resp);
 
     json_object_put(resp);
 }
 // 获取WiFi状态
-void settings_wifi_get(const char *path, const char *body) {
-    (void)path; (void)body;
+void settings_wifi_get(const struct request_ctx *ctx) {
+    (void)ctx;
 
     json_object *root = json_object_new_object();
     char ssid[64] = {0};
@@ -811,132 +1336,63 @@ void settings_wifi_get(const char *path, const char *body) {
         json_object_object_add(root, "ssid", NULL);
     }
 
-    printf("Content-Type: application/json\r\n\r\n");
-    printf("%s\n", json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN));
+    fprintf(g_resp, "Content-Type: application/json\r\n\r\n");
+    fprintf(g_resp, "%s\n", json_object_to_json_string_ext(root, JSON_C_TO_STRING_PLAIN));
     json_object_put(root);
 }
 //check token
-// 检查认证
-void check_auth_get(const char *path, const char *body) {
-    (void)path;
-    (void)body;
-    // 从 Cookie 中提取 token
-    char *token = get_token_from_cookie();
-    
-    // 验证 token 是否有效（存在 + 未过期）
-    if (!token || !is_valid_token(token)) {
-        free(token); // 注意：get_token_from_cookie 返回 malloc 内存
-        
-        // 无效则返回 401
-        printf("Status: 401 Unauthorized\r\n");
-        printf("Content-Type: application/json\r\n\r\n");
-        printf("{\"error\":\"Unauthorized\"}\n");
+// 检查认证（路由策略已完成校验，能到达此处即为有效会话）
+void check_auth_get(const struct request_ctx *ctx) {
+    (void)ctx;
+    fprintf(g_resp, "Content-Type: application/json\r\n\r\n");
+    fprintf(g_resp, "{}\n");
+}
+// 查询分块上传进度
+void disk_upload_status_get(const struct request_ctx *ctx) {
+    upload_state_t st;
+    int rc = upload_load(route_param(ctx->path), &st);
+    if (rc != 0) {
+        send_upload_error(rc);
         return;
     }
-
-    // 有效则返回 200
-    free(token);
-    printf("Content-Type: application/json\r\n\r\n");
-    printf("{}\n");
+    send_json_object_response(upload_state_to_json(&st));
 }
 //==============================
 // PUT
 //==============================
-// 设置灯状态
-void control_light_put(const char *path, const char *body) {
-    (void)path;
-    int state = parse_state_from_json(body);
-    if (state == -1) {
-        printf("Status: 400 Bad Request\r\n\r\n");
+// 设置设备状态
+void control_device_put(const struct request_ctx *ctx) {
+    const control_device_t *dev = find_control_device(route_param(ctx->path));
+    if (!dev) {
+        send_error_404("Unknown device");
         return;
     }
-    const char* cmd = (state == 1) ? ZIGBEE_CMD_LIGHT_ON : ZIGBEE_CMD_LIGHT_OFF;
-    if (cgi_send_zigbee_cmd(cmd) == 0) {
-        printf("Status: 200 OK\r\nContent-Type: application/json\r\n\r\n{\"result\":\"success\"}");
-    } else {
-        printf("Status: 500 Internal Server Error\r\n\r\n");
-    }
-}
-
-// 设置空调状态
-void control_aircon_put(const char *path, const char *body) {
-    (void)path;
-    int state = parse_state_from_json(body);
+    int state = parse_state_from_json(ctx->body);
     if (state == -1) {
-        printf("Status: 400 Bad Request\r\n\r\n");
+        fprintf(g_resp, "Status: 400 Bad Request\r\n\r\n");
         return;
     }
-    const char* cmd = (state == 1) ? ZIGBEE_CMD_AIRCON_ON : ZIGBEE_CMD_AIRCON_OFF;
+    const char* cmd = (state == 1) ? dev->cmd_on : dev->cmd_off;
     if (cgi_send_zigbee_cmd(cmd) == 0) {
-        printf("Status: 200 OK\r\nContent-Type: application/json\r\n\r\n{\"result\":\"success\"}");
+        fprintf(g_resp, "Status: 200 OK\r\nContent-Type: application/json\r\n\r\n{\"result\":\"success\"}");
     } else {
-        printf("Status: 500 Internal Server Error\r\n\r\n");
-    }
-}
-
-// 设置洗衣机状态
-void control_washing_machine_put(const char *path, const char *body) {
-    (void)path;
-    int state = parse_state_from_json(body);
-    if (state == -1) {
-        printf("Status: 400 Bad Request\r\n\r\n");
-        return;
-    }
-    const char* cmd = (state == 1) ? ZIGBEE_CMD_WASHING_ON : ZIGBEE_CMD_WASHING_OFF;
-    if (cgi_send_zigbee_cmd(cmd) == 0) {
-        printf("Status: 200 OK\r\nContent-Type: application/json\r\n\r\n{\"result\":\"success\"}");
-    } else {
-        printf("Status: 500 Internal Server Error\r\n\r\n");
-    }
-}
-
-// 设置风扇状态
-void control_fan_put(const char *path, const char *body) {
-    (void)path;
-    int state = parse_state_from_json(body);
-    if (state == -1) {
-        printf("Status: 400 Bad Request\r\n\r\n");
-        return;
-    }
-    const char* cmd = (state == 1) ? ZIGBEE_CMD_FAN_ON : ZIGBEE_CMD_FAN_OFF;
-    if (cgi_send_zigbee_cmd(cmd) == 0) {
-        printf("Status: 200 OK\r\nContent-Type: application/json\r\n\r\n{\"result\":\"success\"}");
-    } else {
-        printf("Status: 500 Internal Server Error\r\n\r\n");
-    }
-}
-
-// 设置门状态
-void control_door_put(const char *path, const char *body) {
-    (void)path;
-    int state = parse_state_from_json(body);
-    if (state == -1) {
-        printf("Status: 400 Bad Request\r\n\r\n");
-        return;
-    }
-    const char* cmd = (state == 1) ? ZIGBEE_CMD_DOOR_OPEN : ZIGBEE_CMD_DOOR_CLOSE;
-    if (cgi_send_zigbee_cmd(cmd) == 0) {
-        printf("Status: 200 OK\r\nContent-Type: application/json\r\n\r\n{\"result\":\"success\"}");
-    } else {
-        printf("Status: 500 Internal Server Error\r\n\r\n");
+        fprintf(g_resp, "Status: 500 Internal Server Error\r\n\r\n");
     }
 }
 // 设置外网访问
-void settings_public_put(const char *path, const char *body) {
-    (void)path;
-
-    if (!body || body[0] == '\0') {
+void settings_public_put(const struct request_ctx *ctx) {
+    if (!ctx->body || ctx->body[0] == '\0') {
         send_json_headers();
-        printf("{\"error\":\"Empty request body\"}\n");
-        fflush(stdout);
+        fprintf(g_resp, "{\"error\":\"Empty request body\"}\n");
+        fflush(g_resp);
         return;
     }
 
-    struct json_object *jobj = json_tokener_parse(body);
+    struct json_object *jobj = json_tokener_parse(ctx->body);
     if (!jobj) {
         send_json_headers();
-        printf("{\"error\":\"Invalid JSON\"}\n");
-        fflush(stdout);
+        fprintf(g_resp, "{\"error\":\"Invalid JSON\"}\n");
+        fflush(g_resp);
         return;
     }
 
@@ -959,8 +1415,8 @@ void settings_public_put(const char *path, const char *body) {
     fprintf(stderr, "DEBUG: system() returned %d, WEXITSTATUS=%d\n", ret, WEXITSTATUS(ret));
     fflush(stderr);
     if (ret == -1 || WEXITSTATUS(ret) != 0) {
-        printf("Content-Type: application/json\r\n\r\n{\"error\":\"Tunnel control failed\"}\n");
-        fflush(stdout);
+        fprintf(g_resp, "Content-Type: application/json\r\n\r\n{\"error\":\"Tunnel control failed\"}\n");
+        fflush(g_resp);
         return;
     }
 
@@ -988,19 +1444,17 @@ void settings_public_put(const char *path, const char *body) {
     }
 
     send_json_headers();
-    printf("%s\n", json_object_to_json_string_ext(resp, JSON_C_TO_STRING_PLAIN));
-    fflush(stdout);
+    fprintf(g_resp, "%s\n", json_object_to_json_string_ext(resp, JSON_C_TO_STRING_PLAIN));
+    fflush(g_resp);
 
     json_object_put(resp);
 }
 // 设置WiFi
-void settings_wifi_put(const char *path, const char *body) {
-    (void)path;
-
-    json_object *req = json_tokener_parse(body);
+void settings_wifi_put(const struct request_ctx *ctx) {
+    json_object *req = json_tokener_parse(ctx->body);
     if (!req) {
-        printf("Content-Type: application/json\r\n\r\n");
-        printf("{\"status\":\"error\",\"message\":\"Invalid JSON\"}\n");
+        fprintf(g_resp, "Content-Type: application/json\r\n\r\n");
+        fprintf(g_resp, "{\"status\":\"error\",\"message\":\"Invalid JSON\"}\n");
         return;
     }
 
@@ -1105,24 +1559,45 @@ void settings_wifi_put(const char *path, const char *body) {
     }
 
 output:
-    printf("Content-Type: application/json\r\n\r\n");
-    printf("%s\n", json_object_to_json_string_ext(resp, JSON_C_TO_STRING_PLAIN));
+    fprintf(g_resp, "Content-Type: application/json\r\n\r\n");
+    fprintf(g_resp, "%s\n", json_object_to_json_string_ext(resp, JSON_C_TO_STRING_PLAIN));
     json_object_put(req);
     json_object_put(resp);
 }
+// 写入一个上传分块，偏移由 offset 参数给出，请求体为原始字节
+void disk_upload_chunk_put(const struct request_ctx *ctx) {
+    char offset_str[32] = {0};
+    if (parse_query_string(ctx->query, "offset", offset_str, sizeof(offset_str)) != 0) {
+        send_error_400("Missing 'offset' parameter");
+        return;
+    }
+    char *end = NULL;
+    long long offset = strtoll(offset_str, &end, 10);
+    if (!end || *end != '\0' || offset < 0) {
+        send_error_400("Invalid 'offset' parameter");
+        return;
+    }
+
+    upload_state_t st;
+    int rc = upload_write_chunk(route_param(ctx->path), offset, ctx->content_length, g_req_fd, &st);
+    if (rc != 0) {
+        send_upload_error(rc);
+        return;
+    }
+    send_json_object_response(upload_state_to_json(&st));
+}
 //==============================
 // POST
 //==============================
 // 登录
-void login_post(const char *path, const char *body) {
-    (void)path;
-    if (!body) {
+void login_post(const struct request_ctx *ctx) {
+    if (!ctx->body) {
         send_error_400("Missing request body");
         return;
     }
 
     json_tokener *tok = json_tokener_new();
-    json_object *input = json_tokener_parse_ex(tok, body, -1);
+    json_object *input = json_tokener_parse_ex(tok, ctx->body, -1);
     enum json_tokener_error jerr = json_tokener_get_error(tok);
     json_tokener_free(tok);
 
@@ -1166,22 +1641,22 @@ void login_post(const char *path, const char *body) {
     json_object *resp = json_object_new_object();
 
     if (auth_success) {
-        char token[33];
+        char token[TOKEN_LEN + 1];
         generate_token(token, sizeof(token));
 
-        if (!add_token(token)) {
+        if (!add_token(token, stored_user)) {
             json_object_object_add(resp, "success", json_object_new_boolean(0));
             json_object_object_add(resp, "message", json_object_new_string("服务器内部错误"));
             
-            printf("Content-Type: application/json\r\n\r\n");
-            printf("%s\n", json_object_to_json_string_ext(resp, JSON_C_TO_STRING_PLAIN));
+            fprintf(g_resp, "Content-Type: application/json\r\n\r\n");
+            fprintf(g_resp, "%s\n", json_object_to_json_string_ext(resp, JSON_C_TO_STRING_PLAIN));
             
             json_object_put(input);
             json_object_put(resp);
             return;
         }
 
-        printf("Set-Cookie: token=%s; Path=/; HttpOnly; SameSite=Strict\r\n", token);
+        fprintf(g_resp, "Set-Cookie: token=%s; Path=/; HttpOnly; SameSite=Strict\r\n", token);
         json_object_object_add(resp, "success", json_object_new_boolean(1));
         json_object_object_add(resp, "message", json_object_new_string("登录成功"));
     } else {
@@ -1189,33 +1664,17 @@ void login_post(const char *path, const char *body) {
         json_object_object_add(resp, "message", json_object_new_string("用户名或密码错误"));
     }
 
-    printf("Content-Type: application/json\r\n\r\n");
-    printf("%s\n", json_object_to_json_string_ext(resp, JSON_C_TO_STRING_PLAIN));
+    fprintf(g_resp, "Content-Type: application/json\r\n\r\n");
+    fprintf(g_resp, "%s\n", json_object_to_json_string_ext(resp, JSON_C_TO_STRING_PLAIN));
 
     json_object_put(input);
     json_object_put(resp);
 }
 
 // 上传文件
-void disk_upload_post(const char *path, const char *body) {
-    (void)path;
-    (void)body;
-
-    // 验证 token
-    char *token = get_token_from_cookie();
-    if (!token || !is_valid_token(token)) {
-        free(token);
-        send_error_401("Unauthorized");
-        return;
-    }
-    free(token);
-
+void disk_upload_post(const struct request_ctx *ctx) {
     // 从 QUERY_STRING 获取 target_path
-    const char *query = getenv("QUERY_STRING");
-    if (!query) {
-        send_error_400("Missing query string");
-        return;
-    }
+    const char *query = ctx->query;
 
     char qcopy[1024];
     strncpy(qcopy, query, sizeof(qcopy) - 1);
@@ -1249,55 +1708,29 @@ void disk_upload_post(const char *path, const char *body) {
     }
 
     // 获取 Content-Length 和 Content-Type
-    const char *content_length_str = getenv("CONTENT_LENGTH");
-    const char *content_type = getenv("CONTENT_TYPE");
-    if (!content_length_str || !content_type) {
+    const char *content_type = ctx->content_type;
+    if (ctx->content_length <= 0 || !content_type) {
         send_error_400("Missing headers");
         return;
     }
 
-    long content_length = atol(content_length_str);
-    if (content_length <= 0 || content_length > 100 * 1024 * 1024) {
+    // 流式写盘，内存占用与文件大小无关，仅受 Content-Length 表示范围限制
+    long content_length = ctx->content_length;
+    if (content_length <= 0) {
         send_error_400("File too large");
         return;
     }
 
-    const char *boundary_start = strstr(content_type, "boundary=");
-    if (!boundary_start) {
-        send_error_400("No boundary in Content-Type");
-        return;
-    }
-
-    boundary_start += 9;
     char boundary[256];
-    const char *end = strchr(boundary_start, ';');
-    size_t b_len = end ? (size_t)(end - boundary_start) : strlen(boundary_start);
-    if (b_len >= sizeof(boundary)) {
-        send_error_400("Boundary too long");
-        return;
-    }
-    strncpy(boundary, boundary_start, b_len);
-    boundary[b_len] = '\0';
-
-    // 读取整个请求体
-    char *full_body = malloc(content_length + 1);
-    if (!full_body) {
-        send_error_500("Out of memory");
-        return;
-    }
-    
-    if (read(0, full_body, content_length) != content_length) {
-        free(full_body);
-        send_error_500("Read request body failed");
+    int b_rc = multipart_boundary(content_type, boundary, sizeof(boundary));
+    if (b_rc != 0) {
+        send_error_400(b_rc == -1 ? "No boundary in Content-Type" : "Invalid boundary");
         return;
     }
-   
-    full_body[content_length] = '\0';
 
     // 构建目标目录路径
     const char *disk_root = get_disk_root();
     if (!disk_root) {
-        free(full_body);
         send_error_500("Disk root not configured");
         return;
     }
@@ -1309,9 +1742,8 @@ void disk_upload_post(const char *path, const char *body) {
         snprintf(save_dir, sizeof(save_dir), "%s%s", disk_root, target_path);
     }
 
-    // 解析 multipart 并保存
-    int result = parse_multipart_and_save(full_body, content_length, boundary, save_dir);
-    free(full_body);
+    // 边读边解析 multipart 并写盘
+    int result = multipart_stream_save(g_req_fd, content_length, boundary, save_dir, NULL);
 
     if (result == -1) {
         send_error_400("Malformed multipart data");
@@ -1325,16 +1757,14 @@ void disk_upload_post(const char *path, const char *body) {
 }
 
 // 创建目录
-void disk_mkdir_post(const char *path, const char *body) {
-    (void)path;
-
+void disk_mkdir_post(const struct request_ctx *ctx) {
     char input_name_raw[256] = {0};
     char input_path_raw[1024] = {0};
     char input_name[256] = {0};
     char input_path[1024] = {0};
 
     // 提取 name
-    const char *name_start = strstr(body, "name=");
+    const char *name_start = strstr(ctx->body, "name=");
     if (!name_start) {
         send_error_400("Missing 'name'");
         return;
@@ -1348,7 +1778,7 @@ void disk_mkdir_post(const char *path, const char *body) {
     }
 
     // 提取 path
-    const char *path_start = strstr(body, "path=");
+    const char *path_start = strstr(ctx->body, "path=");
     if (path_start) {
         path_start += 5;
         const char *path_end = strchr(path_start, '&');
@@ -1431,14 +1861,12 @@ void disk_mkdir_post(const char *path, const char *body) {
 }
 
 // 重命名
-void disk_rename_post(const char *path, const char *body) {
-    (void)path; // 实际路径从 body 中解析
-
+void disk_rename_post(const struct request_ctx *ctx) {
     char req_path[1024] = {0};
     char old_name[512] = {0};
     char new_name[512] = {0};
 
-    if (!parse_rename_json(body, req_path, old_name, new_name)) {
+    if (!parse_rename_json(ctx->body, req_path, old_name, new_name)) {
         send_error_400("Invalid JSON");
         return;
     }
@@ -1489,109 +1917,76 @@ void disk_rename_post(const char *path, const char *body) {
         send_error_500("System rename() failed");
     }
 }
-void photos_upload(const char *path, const char *body) {
-    (void)path;
-    (void)body;
-
+void photos_upload(const struct request_ctx *ctx) {
     // 获取 Content-Length
-    const char *content_length_str = getenv("CONTENT_LENGTH");
-    const char *content_type = getenv("CONTENT_TYPE");
-    if (!content_length_str || !content_type) {
+    const char *content_type = ctx->content_type;
+    if (ctx->content_length <= 0 || !content_type) {
         send_error_400("Missing Content-Length or Content-Type");
         return;
     }
 
-    long content_length = atol(content_length_str);
-    if (content_length <= 0 || content_length > 20 * 1024 * 1024) { // 限制 20MB
-        send_error_400("File too large");
+    long content_length = ctx->content_length;
+    if (content_length <= 0 || content_length > PHOTOS_UPLOAD_MAX) {
+        send_error_400("Upload too large");
         return;
     }
 
     // 提取 boundary
-    const char *boundary_start = strstr(content_type, "boundary=");
-    if (!boundary_start) {
-        send_error_400("No boundary in Content-Type");
-        return;
-    }
-    boundary_start += 9;
-
     char boundary[256];
-    size_t b_len;
-    if (*boundary_start == '"') {
-        boundary_start++;
-        const char *end_quote = strchr(boundary_start, '"');
-        b_len = end_quote ? (size_t)(end_quote - boundary_start) : strlen(boundary_start);
-    } else {
-        const char *end_semi = strchr(boundary_start, ';');
-        b_len = end_semi ? (size_t)(end_semi - boundary_start) : strlen(boundary_start);
-    }
-
-    if (b_len == 0 || b_len >= sizeof(boundary)) {
-        send_error_400("Invalid boundary");
+    int b_rc = multipart_boundary(content_type, boundary, sizeof(boundary));
+    if (b_rc != 0) {
+        send_error_400(b_rc == -1 ? "No boundary in Content-Type" : "Invalid boundary");
         return;
     }
-    strncpy(boundary, boundary_start, b_len);
-    boundary[b_len] = '\0';
 
-    //读取完整请求体
-    char *full_body = malloc(content_length + 1);
-    if (!full_body) {
-        send_error_500("Out of memory");
-        return;
-    }
+    // 逐项记录结果 每存完一张就生成网格小图 全部写完后只刷一次盘
+    // 内容与已有照片相同的不落地 结果中给出已有文件名
+    struct photo_batch batch = { json_object_new_array(), 0, 0, 0, { 0 } };
+    struct multipart_handler handler = { photos_is_safe_filename, photo_find_duplicate, photo_upload_item, &batch };
+    photo_hashes_load(&batch.hashes);
+    int result = multipart_stream_save(g_req_fd, content_length, boundary, PHOTOS_DIR, &handler);
 
-    ssize_t total = 0;
-    ssize_t n;
-    while (total < content_length) {
-        n = read(STDIN_FILENO, full_body + total, content_length - total);
-        if (n <= 0) break;
-        total += n;
+    photo_hashes_commit(&batch.hashes);
+    photo_hashes_free(&batch.hashes);
+    if (batch.ok > 0) {
+        photos_refresh_index();
     }
-
-    if (total != content_length) {
-        free(full_body);
-        send_error_500("Read request body failed");
+    if (result == -1 && batch.ok + batch.failed + batch.duplicates == 0) {
+        json_object_put(batch.results);
+        send_error_400("Malformed multipart data");
         return;
     }
-    full_body[content_length] = '\0';
-
-    //设置保存目录
-    const char *photos_dir = "/media/sdcard/photos";
-    // 复用 multipart 解析函数
-    int result = parse_multipart_and_save(full_body, content_length, boundary, photos_dir);
-    free(full_body);
-
-    // 返回结果
-    if (result == -1) {
-        send_error_400("Malformed multipart data");
-    } else if (result == -2) {
-        send_error_400("Unsafe filename");
-    } else if (result == -3) {
-        send_error_500("Failed to write file");
-    } else {
-        json_success("Photo uploaded successfully");
+    json_object *obj = json_object_new_object();
+    json_object_object_add(obj, "saved", json_object_new_int(batch.ok));
+    json_object_object_add(obj, "duplicates", json_object_new_int(batch.duplicates));
+    json_object_object_add(obj, "failed", json_object_new_int(batch.failed));
+    json_object_object_add(obj, "results", batch.results);
+    if (batch.ok + batch.duplicates == 0) {
+        // 一张都没存下时按首个错误给出状态码
+        if (result == -3) {
+            fprintf(g_resp, "Status: 500 Internal Server Error\r\n");
+            json_object_object_add(obj, "error", json_object_new_string("Failed to write file"));
+        } else {
+            fprintf(g_resp, "Status: 400 Bad Request\r\n");
+            json_object_object_add(obj, "error", json_object_new_string(result == -1 ? "Malformed multipart data" : "No photo saved"));
+        }
     }
+    send_json_object_response(obj);
+}
+// 把已有的重复照片改为指向同一份数据的硬链接
+void photos_dedupe_post(const struct request_ctx *ctx) {
+    (void)ctx;
+    send_photo_dedupe_report(1);
 }
 // 保存照片备注
-void photo_note_post(const char *path, const char *body) {
-    (void)path;
-
-    if (!body || body[0] == '\0') {
+void photo_note_post(const struct request_ctx *ctx) {
+    if (!ctx->body || ctx->body[0] == '\0') {
         send_error_400("Empty request body");
         return;
     }
 
-    // 验证 token
-    char *token = get_token_from_cookie();
-    if (!token || !is_valid_token(token)) {
-        free(token);
-        send_error_401("Unauthorized");
-        return;
-    }
-    free(token);
-
     // 先解析 JSON 字符串
-    struct json_object *jobj = json_tokener_parse(body);
+    struct json_object *jobj = json_tokener_parse(ctx->body);
     if (!jobj) {
         send_error_400("Invalid JSON format");
         return;
@@ -1629,24 +2024,21 @@ void photo_note_post(const char *path, const char *body) {
     char notepath[512];
     snprintf(notepath, sizeof(notepath), "%s/%s.txt", PHOTOS_DIR, decoded_filename);
 
-    FILE *fp = fopen(notepath, "w");
-    if (!fp) {
-        send_error_500("Cannot open note file for writing");
+    // 原子替换 照片索引线程不会读到写了一半的备注
+    if (atomic_write_file(notepath, note, strlen(note), 0644, 0) != 0) {
+        send_error_500("Cannot write note file");
         return;
     }
-    fputs(note, fp);
-    fclose(fp);
+    photos_refresh_index();
 
     json_success("Note saved");
 }
 // 添加家庭成员
-void family_members_post(const char *path, const char *body) {
-    (void)path;
-
-    json_object *req = json_tokener_parse(body);
+void family_members_post(const struct request_ctx *ctx) {
+    json_object *req = json_tokener_parse(ctx->body);
     send_json_headers();
     if (!req) {
-        printf("{\"error\":\"Invalid JSON\"}\n");
+        fprintf(g_resp, "{\"error\":\"Invalid JSON\"}\n");
         return;
     }
     const char *name = json_object_get_string(json_object_object_get(req, "name"));
@@ -1654,13 +2046,13 @@ void family_members_post(const char *path, const char *body) {
     const char *birthday = json_object_get_string(json_object_object_get(req, "birthday"));
     if (!name || !wechat_id || !birthday) {
         json_object_put(req);
-        printf("{\"error\":\"Missing name/wechat_id/birthday\"}\n");
+        fprintf(g_resp, "{\"error\":\"Missing name/wechat_id/birthday\"}\n");
         return;
     }
     json_object *root = load_family_data();
     if (!root) {
         json_object_put(req);
-        printf("{\"error\":\"Failed to load data\"}\n");
+        fprintf(g_resp, "{\"error\":\"Failed to load data\"}\n");
         return;
     }
     json_object *members = json_object_object_get(root, "members");
@@ -1677,7 +2069,7 @@ void family_members_post(const char *path, const char *body) {
     if (exists) {
         json_object_put(req);
         json_object_put(root);
-        printf("{\"error\":\"Member already exists\"}\n");
+        fprintf(g_resp, "{\"error\":\"Member already exists\"}\n");
         return;
     }
     json_object *new_member = json_object_new_object();
@@ -1689,22 +2081,20 @@ void family_members_post(const char *path, const char *body) {
     if (save_family_data(root) != 0) {
         json_object_put(req);
         json_object_put(root);
-        printf("{\"error\":\"Failed to save\"}\n");
+        fprintf(g_resp, "{\"error\":\"Failed to save\"}\n");
         return;
     }
     json_object_put(req);
     json_object_put(root);
-    printf("{\"status\":\"success\"}\n");
+    fprintf(g_resp, "{\"status\":\"success\"}\n");
 }
 // 添加任务
-void family_task_post(const char *path, const char *body) {
-    (void)path;
-
+void family_task_post(const struct request_ctx *ctx) {
     send_json_headers();
 
-    json_object *req = json_tokener_parse(body);
+    json_object *req = json_tokener_parse(ctx->body);
     if (!req) {
-        printf("{\"error\":\"Invalid JSON\"}\n");
+        fprintf(g_resp, "{\"error\":\"Invalid JSON\"}\n");
         return;
     }
 
@@ -1714,14 +2104,14 @@ void family_task_post(const char *path, const char *body) {
 
     if (!target || !title || !due_date) {
         json_object_put(req);
-        printf("{\"error\":\"Missing target/title/due_date\"}\n");
+        fprintf(g_resp, "{\"error\":\"Missing target/title/due_date\"}\n");
         return;
     }
 
     json_object *root = load_family_data();
     if (!root) {
         json_object_put(req);
-        printf("{\"error\":\"Failed to load data\"}\n");
+        fprintf(g_resp, "{\"error\":\"Failed to load data\"}\n");
         return;
     }
 
@@ -1741,7 +2131,7 @@ void family_task_post(const char *path, const char *body) {
     if (!target_member) {
         json_object_put(req);
         json_object_put(root);
-        printf("{\"error\":\"Target member not found\"}\n");
+        fprintf(g_resp, "{\"error\":\"Target member not found\"}\n");
         return;
     }
 
@@ -1761,30 +2151,28 @@ void family_task_post(const char *path, const char *body) {
     if (save_family_data(root) != 0) {
         json_object_put(req);
         json_object_put(root);
-        printf("{\"error\":\"Failed to save task\"}\n");
+        fprintf(g_resp, "{\"error\":\"Failed to save task\"}\n");
         return;
     }
 
     json_object_put(req);
     json_object_put(root);
-    printf("{\"status\":\"success\"}\n");
+    fprintf(g_resp, "{\"status\":\"success\"}\n");
 }
 // 修改密码
-void settings_change_password_post(const char *path, const char *body) {
-    (void)path;
-
-    if (!body || body[0] == '\0') {
+void settings_change_password_post(const struct request_ctx *ctx) {
+    if (!ctx->body || ctx->body[0] == '\0') {
         send_json_headers();
-        printf("{\"error\":\"Empty request body\"}\n");
-        fflush(stdout);
+        fprintf(g_resp, "{\"error\":\"Empty request body\"}\n");
+        fflush(g_resp);
         return;
     }
 
-    struct json_object *jobj = json_tokener_parse(body);
+    struct json_object *jobj = json_tokener_parse(ctx->body);
     if (!jobj) {
         send_json_headers();
-        printf("{\"error\":\"Invalid JSON\"}\n");
-        fflush(stdout);
+        fprintf(g_resp, "{\"error\":\"Invalid JSON\"}\n");
+        fflush(g_resp);
         return;
     }
 
@@ -1798,47 +2186,125 @@ void settings_change_password_post(const char *path, const char *body) {
 
     if (!ok || username[0] == '\0') {
         send_json_headers();
-        printf("{\"error\":\"Username required\"}\n");
-        fflush(stdout);
+        fprintf(g_resp, "{\"error\":\"Username required\"}\n");
+        fflush(g_resp);
         return;
     }
 
     if (write_login_file(username, password) != 0) {
         send_json_headers();
-        printf("{\"error\":\"Failed to save\"}\n");
-        fflush(stdout);
+        fprintf(g_resp, "{\"error\":\"Failed to save\"}\n");
+        fflush(g_resp);
         return;
     }
 
     send_json_headers();
-    printf("{\"status\":\"ok\"}\n");
-    fflush(stdout);
+    fprintf(g_resp, "{\"status\":\"ok\"}\n");
+    fflush(g_resp);
+}
+// 创建分块上传会话
+void disk_upload_init_post(const struct request_ctx *ctx) {
+    char path[512] = {0};
+    char name[MAX_FILENAME] = {0};
+
+    json_object *req = ctx->body ? json_tokener_parse(ctx->body) : NULL;
+    json_object *size_obj = NULL;
+    if (!req ||
+        extract_json_string(req, "path", path, sizeof(path)) != 0 ||
+        extract_json_string(req, "name", name, sizeof(name)) != 0 ||
+        !json_object_object_get_ex(req, "size", &size_obj) ||
+        !json_object_is_type(size_obj, json_type_int)) {
+        if (req) json_object_put(req);
+        send_error_400("Expected JSON {path, name, size}");
+        return;
+    }
+    long long size = json_object_get_int64(size_obj);
+    json_object_put(req);
+
+    upload_state_t st;
+    int rc = upload_init(path, name, size, &st);
+    if (rc != 0) {
+        send_upload_error(rc);
+        return;
+    }
+    send_json_object_response(upload_state_to_json(&st));
+}
+// 创建后台磁盘任务 请求体 {op, from, to} op 为 delete、move 或 copy
+void disk_jobs_post(const struct request_ctx *ctx) {
+    char op_name[16] = {0};
+    char from[512] = {0};
+    char to[512] = {0};
+    enum disk_job_op op;
+
+    json_object *req = ctx->body ? json_tokener_parse(ctx->body) : NULL;
+    if (!req ||
+        extract_json_string(req, "op", op_name, sizeof(op_name)) != 0 ||
+        extract_json_string(req, "from", from, sizeof(from)) != 0) {
+        if (req) json_object_put(req);
+        send_error_400("Expected JSON {op, from, to}");
+        return;
+    }
+    extract_json_string(req, "to", to, sizeof(to));
+    json_object_put(req);
+
+    if (strcmp(op_name, "delete") == 0) {
+        op = DISK_JOB_DELETE;
+    } else if (strcmp(op_name, "move") == 0) {
+        op = DISK_JOB_MOVE;
+    } else if (strcmp(op_name, "copy") == 0) {
+        op = DISK_JOB_COPY;
+    } else {
+        send_error_400("Unknown op");
+        return;
+    }
+    if (!is_safe_relative_path(from) || strspn(from, "/") == strlen(from)) {
+        send_error_403("Invalid path");
+        return;
+    }
+    if (op != DISK_JOB_DELETE && (!to[0] || !is_safe_relative_path(to) || strspn(to, "/") == strlen(to))) {
+        send_error_403("Invalid destination");
+        return;
+    }
+    submit_disk_job(op, from, op == DISK_JOB_DELETE ? NULL : to);
+}
+// 校验并完成分块上传，可附带 sha256 校验和
+void disk_upload_finalize_post(const struct request_ctx *ctx) {
+    char expected[SHA256_DIGEST_SIZE * 2 + 1] = {0};
+    char actual[SHA256_DIGEST_SIZE * 2 + 1] = {0};
+
+    if (ctx->body && ctx->body[0]) {
+        json_object *req = json_tokener_parse(ctx->body);
+        if (!req) {
+            send_error_400("Invalid JSON");
+            return;
+        }
+        extract_json_string(req, "sha256", expected, sizeof(expected));
+        json_object_put(req);
+    }
+
+    int rc = upload_finalize(route_param(ctx->path), expected, actual);
+    if (rc != 0) {
+        send_upload_error(rc);
+        return;
+    }
+    json_object *root = json_object_new_object();
+    json_object_object_add(root, "message", json_object_new_string("File uploaded successfully"));
+    json_object_object_add(root, "sha256", json_object_new_string(actual));
+    send_json_object_response(root);
 }
 //==============================
 // DELETE
 //==============================
 // 删除照片
-void disk_delete_handler(const char *path, const char *body) {
-    (void)path;
-    (void)body;
-    char *token = get_token_from_cookie();
-    if (!token || !is_valid_token(token)) {
-        free(token);
-        send_error_401("Unauthorized");
-        return;
-    }
-    free(token);
-
+// 删除文件或目录 目录交给守护进程后台删除并返回任务 ID
+void disk_delete_handler(const struct request_ctx *ctx) {
     char requested_path[512] = "";
-    const char *qs = getenv("QUERY_STRING");
-    if (!qs || !strstr(qs, "path=")) {
+    if (parse_query_string(ctx->query, "path", requested_path, sizeof(requested_path)) != 0) {
         send_error_400("Missing 'path' parameter");
         return;
     }
-    sscanf(qs, "path=%511[^&\r\n]", requested_path);
-    url_decode(requested_path, requested_path);
 
-    if (!is_safe_relative_path(requested_path)) {
+    if (!is_safe_relative_path(requested_path) || strspn(requested_path, "/") == strlen(requested_path)) {
         send_error_403("Invalid path");
         return;
     }
@@ -1846,34 +2312,97 @@ void disk_delete_handler(const char *path, const char *body) {
     char real_path[1024];
     snprintf(real_path, sizeof(real_path), "%s%s", get_disk_root(), requested_path);
 
-    if (delete_path_recursive(real_path) != 0) {
-        send_error_500("Delete failed");
+    struct stat st;
+    if (lstat(real_path, &st) != 0) {
+        send_error_404("File not found");
         return;
     }
-
-    struct json_object *root = json_object_new_object();
-    json_object_object_add(root, "message", json_object_new_string("Deleted successfully"));
-    send_json_object_response(root);
+    if (!S_ISDIR(st.st_mode)) {
+        if (unlink(real_path) != 0) {
+            send_error_500("Delete failed");
+            return;
+        }
+        json_success("Deleted successfully");
+        return;
+    }
+    submit_disk_job(DISK_JOB_DELETE, requested_path, NULL);
 }
-void photos_delete(const char *path, const char *body) {
-    (void)path;
-
-    if (!body || strlen(body) == 0) {
-        photos_send_json_response("{\"error\":\"Request body is empty\"}");
+void photos_delete(const struct request_ctx *ctx) {
+    if (!ctx->body || strlen(ctx->body) == 0) {
+        send_error_400("Request body is empty");
         return;
     }
 
-    char *filename = photos_extract_filename_from_json(body);
-    if (!filename) {
-        photos_send_json_response("{\"error\":\"Invalid JSON: missing or invalid 'filename' field\"}");
+    // 兼容单个 filename 与批量 filenames 数组
+    json_object *root = json_tokener_parse(ctx->body);
+    json_object *names = NULL;
+    json_object *single = NULL;
+    if (!root || !json_object_is_type(root, json_type_object)) {
+        if (root) {
+            json_object_put(root);
+        }
+        send_error_400("Invalid JSON");
         return;
     }
-
-    if (photos_delete_photo_file(filename)) {
-        photos_send_json_response("{\"code\":\"200\",\"msg\":\"Photo deleted successfully\"}");
+    if (json_object_object_get_ex(root, "filenames", &names)) {
+        if (!json_object_is_type(names, json_type_array) || json_object_array_length(names) == 0
+            || json_object_array_length(names) > PHOTOS_DELETE_MAX) {
+            json_object_put(root);
+            send_error_400("'filenames' must be a non-empty array");
+            return;
+        }
+    } else if (json_object_object_get_ex(root, "filename", &single) && json_object_is_type(single, json_type_string)) {
+        names = json_object_new_array();
+        json_object_array_add(names, json_object_get(single));
+        json_object_object_add(root, "filenames", names);
     } else {
-        photos_send_json_response("{\"error\":\"Failed to delete photo (file not found or unsafe name)\"}");
+        json_object_put(root);
+        send_error_400("Missing 'filename' or 'filenames'");
+        return;
+    }
+
+    struct photo_batch batch = { json_object_new_array(), 0, 0, 0, { 0 } };
+    size_t n = json_object_array_length(names);
+    photo_hashes_load(&batch.hashes);
+    for (size_t i = 0; i < n; i++) {
+        json_object *item = json_object_array_get_idx(names, i);
+        const char *name = json_object_is_type(item, json_type_string) ? json_object_get_string(item) : "";
+        const char *error = NULL;
+
+        if (!photos_is_safe_filename(name)) {
+            error = "Unsafe filename";
+        } else if (!photos_delete_photo_file(name)) {
+            error = "Photo not found";
+        } else {
+            photo_hashes_remove(&batch.hashes, name);
+        }
+        photo_batch_add(&batch, name, error);
     }
+    photo_hashes_commit(&batch.hashes);
+    photo_hashes_free(&batch.hashes);
+    // 删除完后只对目录做一次 fsync
+    if (batch.ok > 0) {
+        photos_sync_dir();
+        photos_refresh_index();
+    }
+    json_object_put(root);
 
-    free(filename); // 由 strdup 分配
+    json_object *obj = json_object_new_object();
+    json_object_object_add(obj, "deleted", json_object_new_int(batch.ok));
+    json_object_object_add(obj, "failed", json_object_new_int(batch.failed));
+    json_object_object_add(obj, "results", batch.results);
+    if (batch.ok == 0) {
+        fprintf(g_resp, "Status: 404 Not Found\r\n");
+        json_object_object_add(obj, "error", json_object_new_string("No photo deleted"));
+    }
+    send_json_object_response(obj);
+}
+// 放弃分块上传
+void disk_upload_abort_delete(const struct request_ctx *ctx) {
+    int rc = upload_abort(route_param(ctx->path));
+    if (rc != 0) {
+        send_upload_error(rc);
+        return;
+    }
+    json_success("Upload aborted");
 }
@@ -0,0 +1,421 @@
+/**********************************************************************
+ * @file multipart.c
+ * @brief multipart/form-data 流式解析实现
+ *
+ * 本文件实现按分隔符增量解析 multipart 请求体的状态机
+ * 文件部分边读边写入目标目录 内存占用与上传大小无关
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ *
+ * @note
+ * - 分隔符查找使用 Boyer-Moore-Horspool 固定缓冲区内滑动
+ * - 文件先写入目标目录下的临时文件 完整接收后 rename 为正式文件名
+ * - 返回值沿用旧接口：0 成功 -1 格式错误 -2 文件名不安全 -3 写入失败
+ * - 单个文件失败不中断整个请求 逐项经回调报告 返回首个失败的错误码
+ * - 每个文件关闭前只发起回写 全部接收后对所在文件系统做一次 syncfs
+ * - 设置了查重回调时边接收边计算 XXH64 重复的文件不落地
+ * - boundary 参数由 multipart_boundary 统一解析 支持带引号的写法
+ **********************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "multipart.h"
+#include "util.h"
+#include "xxhash.h"
+
+enum mp_state{
+    MP_PREAMBLE=0,
+    MP_DELIM_TAIL,
+    MP_HEADERS,
+    MP_BODY
+};
+
+struct mp_reader{
+    int fd;
+    long remaining;
+    size_t start;
+    size_t end;
+    unsigned char buf[MULTIPART_BUF_SIZE];
+};
+
+struct mp_search{
+    const unsigned char*pat;
+    size_t len;
+    size_t skip[256];
+};
+
+struct mp_file{
+    int fd;
+    long size;
+    int hashing;
+    xxh64_state_t hash;
+    char tmp_path[MAX_PATH];
+    char final_path[MAX_PATH];
+    char existing[MAX_FILENAME];
+};
+
+static struct mp_reader g_reader;
+
+// 构建 Horspool 跳转表
+static void mp_search_init(struct mp_search*s,const unsigned char*pat,size_t len){
+    size_t i;
+
+    s->pat=pat;
+    s->len=len;
+    for(i=0;i<256;i++){
+        s->skip[i]=len;
+    }
+    for(i=0;i+1<len;i++){
+        s->skip[pat[i]]=len-1-i;
+    }
+}
+
+// 在缓冲区中查找分隔符 未找到返回 -1
+static long mp_search_find(const struct mp_search*s,const unsigned char*hay,size_t n){
+    size_t pos=0;
+    size_t last=s->len-1;
+
+    while(pos+s->len<=n){
+        unsigned char c=hay[pos+last];
+        if(c==s->pat[last]&&memcmp(hay+pos,s->pat,last)==0){
+            return (long)pos;
+        }
+        pos+=s->skip[c];
+    }
+    return -1;
+}
+
+// 把未消费数据移到缓冲区头部并继续读取 返回读到的字节数
+static ssize_t mp_fill(struct mp_reader*r){
+    size_t want;
+    ssize_t n;
+
+    if(r->start>0){
+        memmove(r->buf,r->buf+r->start,r->end-r->start);
+        r->end-=r->start;
+        r->start=0;
+    }
+    if(r->remaining<=0||r->end==sizeof(r->buf)){
+        return -1;
+    }
+    want=sizeof(r->buf)-r->end;
+    if((long)want>r->remaining){
+        want=(size_t)r->remaining;
+    }
+    do{
+        n=read(r->fd,r->buf+r->end,want);
+    }while(n<0&&errno==EINTR);
+    if(n<=0){
+        return -1;
+    }
+    r->end+=(size_t)n;
+    r->remaining-=n;
+    return n;
+}
+
+// 写满指定字节数
+static int mp_write(struct mp_file*f,const unsigned char*data,size_t len){
+    ssize_t n;
+
+    f->size+=(long)len;
+    if(f->hashing){
+        xxh64_update(&f->hash,data,len);
+    }
+    while(len>0){
+        n=write(f->fd,data,len);
+        if(n<0&&errno==EINTR)continue;
+        if(n<=0)return -1;
+        data+=n;
+        len-=(size_t)n;
+    }
+    return 0;
+}
+
+// 解析部分头 取得文件名 返回 1 为文件部分 0 为普通字段 -2 文件名不安全
+static int mp_parse_headers(const unsigned char*p,size_t len,char*filename,size_t size){
+    char line[1024];
+    const unsigned char*end=p+len;
+    const unsigned char*eol;
+    size_t n;
+
+    filename[0]='\0';
+    while(p<end){
+        eol=memmem(p,(size_t)(end-p),"\r\n",2);
+        if(!eol)eol=end;
+        n=(size_t)(eol-p);
+        if(n>=sizeof(line))n=sizeof(line)-1;
+        memcpy(line,p,n);
+        line[n]='\0';
+        if(strncasecmp(line,"Content-Disposition:",20)==0&&strstr(line,"filename=")){
+            if(!extract_filename_from_header(line,filename,size)){
+                return 0;
+            }
+            return is_safe_filename(filename)?1:-2;
+        }
+        p=eol+2;
+    }
+    return 0;
+}
+
+// 在目标目录创建临时文件
+static int mp_open_file(struct mp_file*f,const char*target_dir,const char*filename,int hashing){
+    if((size_t)snprintf(f->final_path,sizeof(f->final_path),"%s/%s",target_dir,filename)>=sizeof(f->final_path)||
+       (size_t)snprintf(f->tmp_path,sizeof(f->tmp_path),"%s/.upload-XXXXXX",target_dir)>=sizeof(f->tmp_path)){
+        return -1;
+    }
+    f->fd=mkstemp(f->tmp_path);
+    if(f->fd<0){
+        return -1;
+    }
+    fchmod(f->fd,0644);
+    f->size=0;
+    f->hashing=hashing;
+    if(hashing){
+        xxh64_init(&f->hash,0);
+    }
+    return 0;
+}
+
+// 丢弃未完成的临时文件
+static void mp_abort_file(struct mp_file*f){
+    if(f->fd>=0){
+        close(f->fd);
+        unlink(f->tmp_path);
+        f->fd=-1;
+    }
+}
+
+// 关闭并原子替换为正式文件 数据只提交回写 由调用方最后统一落盘
+// 内容与已有文件重复时丢弃临时文件 返回 1
+static int mp_finish_file(struct mp_file*f,const struct multipart_handler*h){
+    int fd=f->fd;
+
+    f->fd=-1;
+    f->existing[0]='\0';
+    if(f->size==0){
+        close(fd);
+        unlink(f->tmp_path);
+        return -1;
+    }
+    if(f->hashing&&h->find_duplicate(f->tmp_path,xxh64_digest(&f->hash),f->size,
+                                     f->existing,sizeof(f->existing),h->arg)==1){
+        close(fd);
+        unlink(f->tmp_path);
+        return 1;
+    }
+    sync_file_range(fd,0,0,SYNC_FILE_RANGE_WRITE);
+    if(close(fd)!=0){
+        unlink(f->tmp_path);
+        return -3;
+    }
+    if(rename(f->tmp_path,f->final_path)!=0){
+        unlink(f->tmp_path);
+        return -3;
+    }
+    return 0;
+}
+
+// 报告单个文件的处理结果 f 为空表示文件没有开始写入
+static void mp_report(const struct multipart_handler*h,const char*filename,const struct mp_file*f,int result,int*first_error){
+    struct multipart_item item;
+
+    if(result<0&&*first_error==0){
+        *first_error=result;
+    }
+    if(h&&h->on_item){
+        memset(&item,0,sizeof(item));
+        item.filename=filename;
+        item.result=result;
+        if(f){
+            item.path=result==0?f->final_path:NULL;
+            item.existing=result==1?f->existing:NULL;
+            item.size=f->size;
+            item.hash=f->hashing?xxh64_digest(&f->hash):0;
+        }
+        h->on_item(&item,h->arg);
+    }
+}
+
+// 有文件落地时统一刷盘 一次 syncfs 覆盖全部文件数据与目录项
+static void mp_sync_dir(const char*target_dir){
+    int dfd=open(target_dir,O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+
+    if(dfd>=0){
+        syncfs(dfd);
+        close(dfd);
+    }
+}
+
+// 从 Content-Type 取出 boundary 去掉引号 返回 0 成功 -1 缺少 boundary -2 为空或过长
+int multipart_boundary(const char*content_type,char*boundary,size_t size){
+    const char*p;
+    const char*end;
+    size_t len;
+
+    p=content_type?strstr(content_type,"boundary="):NULL;
+    if(!p){
+        return -1;
+    }
+    p+=9;
+    if(*p=='"'){
+        p++;
+        end=strchr(p,'"');
+        len=end?(size_t)(end-p):strlen(p);
+    }else{
+        len=strcspn(p,"; \t");
+    }
+    if(len==0||len>=size){
+        return -2;
+    }
+    memcpy(boundary,p,len);
+    boundary[len]='\0';
+    return 0;
+}
+
+// 从 fd 流式读取 multipart 请求体 并把其中的文件部分保存到目标目录
+int multipart_stream_save(int fd,long content_length,const char*boundary,const char*target_dir,
+                          const struct multipart_handler*h){
+    struct mp_reader*r=&g_reader;
+    struct mp_search search;
+    struct mp_file file;
+    unsigned char delim[300];
+    char filename[MAX_FILENAME];
+    enum mp_state state=MP_PREAMBLE;
+    struct stat st;
+    size_t dlen;
+    size_t avail;
+    size_t keep;
+    unsigned char*p;
+    const unsigned char*hit;
+    long pos;
+    int saved=0;
+    int items=0;
+    int first_error=0;
+    int rc;
+
+    if(fd<0||content_length<=0||!boundary||!*boundary||!target_dir){
+        return -1;
+    }
+    if(strlen(boundary)>sizeof(delim)-5){
+        return -1;
+    }
+    if(stat(target_dir,&st)!=0||!S_ISDIR(st.st_mode)){
+        return -3;
+    }
+
+    // 分隔符为 CRLF--boundary 首个分隔符前补一个 CRLF 统一处理
+    dlen=(size_t)snprintf((char*)delim,sizeof(delim),"\r\n--%s",boundary);
+    mp_search_init(&search,delim,dlen);
+    r->fd=fd;
+    r->remaining=content_length;
+    r->buf[0]='\r';
+    r->buf[1]='\n';
+    r->start=0;
+    r->end=2;
+    file.fd=-1;
+
+    for(;;){
+        p=r->buf+r->start;
+        avail=r->end-r->start;
+        switch(state){
+            case MP_PREAMBLE:
+            case MP_BODY:
+                pos=mp_search_find(&search,p,avail);
+                if(pos>=0){
+                    if(file.fd>=0){
+                        if(mp_write(&file,p,(size_t)pos)!=0){
+                            mp_abort_file(&file);
+                            mp_report(h,filename,NULL,-3,&first_error);
+                        }else{
+                            rc=mp_finish_file(&file,h);
+                            if(rc==0){
+                                saved++;
+                            }
+                            mp_report(h,filename,&file,rc,&first_error);
+                        }
+                    }
+                    r->start+=(size_t)pos+dlen;
+                    state=MP_DELIM_TAIL;
+                    continue;
+                }
+                // 尾部可能是被截断的分隔符 保留到下次读取
+                keep=avail<dlen-1?avail:dlen-1;
+                if(file.fd>=0&&mp_write(&file,p,avail-keep)!=0){
+                    // 写盘失败后丢弃该文件剩余部分 继续处理后续文件
+                    mp_abort_file(&file);
+                    mp_report(h,filename,NULL,-3,&first_error);
+                }
+                r->start+=avail-keep;
+                break;
+            case MP_DELIM_TAIL:
+                if(avail<2){
+                    break;
+                }
+                if(p[0]=='-'&&p[1]=='-'){
+                    if(saved>0){
+                        mp_sync_dir(target_dir);
+                    }
+                    if(items==0){
+                        return -1;
+                    }
+                    return first_error;
+                }
+                hit=memmem(p,avail,"\r\n",2);
+                if(!hit){
+                    if(avail>256){
+                        rc=-1;
+                        goto fail;
+                    }
+                    break;
+                }
+                r->start+=(size_t)(hit-p)+2;
+                state=MP_HEADERS;
+                continue;
+            case MP_HEADERS:
+                hit=memmem(p,avail,"\r\n\r\n",4);
+                if(!hit){
+                    if(avail>=MULTIPART_HEADER_MAX){
+                        rc=-1;
+                        goto fail;
+                    }
+                    break;
+                }
+                rc=mp_parse_headers(p,(size_t)(hit-p),filename,sizeof(filename));
+                if(rc!=0){
+                    items++;
+                }
+                if(rc==1&&h&&h->accept&&!h->accept(filename)){
+                    rc=-2;
+                }
+                if(rc<0){
+                    // 不安全或不接受的文件只跳过该部分
+                    mp_report(h,filename,NULL,rc,&first_error);
+                }else if(rc==1&&mp_open_file(&file,target_dir,filename,h&&h->find_duplicate)!=0){
+                    mp_report(h,filename,NULL,-3,&first_error);
+                }
+                r->start+=(size_t)(hit-p)+4;
+                state=MP_BODY;
+                continue;
+        }
+        if(mp_fill(r)<=0){
+            // 请求体在结束分隔符之前就结束了
+            rc=-1;
+            goto fail;
+        }
+    }
+
+fail:
+    mp_abort_file(&file);
+    if(saved>0){
+        mp_sync_dir(target_dir);
+    }
+    return rc;
+}
@@ -0,0 +1,672 @@
+/**********************************************************************
+ * @file photo_dedupe.c
+ * @brief 照片内容去重实现
+ *
+ * 本文件维护照片目录下的内容哈希索引 上传时据此发现重复照片
+ * 并提供一次性扫描 报告已有的重复照片或把它们改为硬链接
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ *
+ * @note
+ * - 索引为 PHOTO_HASHES_FILE 文本文件 每行 "哈希 大小 修改时间 文件名"
+ * - 哈希用 XXH64 只作为候选 判定重复前总是逐字节比较文件内容
+ * - 只有大小相同的文件才可能重复 大小唯一的文件不必计算哈希
+ *   上传时按照片索引找出同大小的文件 缺哈希的当场补算并写回索引
+ * - 照片索引每个请求只映射一次 不检查新鲜度也不重建
+ *   上传过程中目录修改时间不断变化 索引稍旧只会漏掉一次去重
+ * - 索引原地改写并以 flock 互斥 提交时与磁盘上最新内容合并
+ *   条目过期只会漏掉一次去重 不会误判
+ **********************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "define.h"
+#include "photo_dedupe.h"
+#include "photos.h"
+#include "thumb.h"
+#include "xxhash.h"
+
+#define DEDUPE_BUF_SIZE 65536
+
+struct scan_file{
+    char*name;
+    long long size;
+    long long mtime_ns;
+    dev_t dev;
+    ino_t ino;
+    uint64_t hash;
+    int hashed;
+};
+
+static unsigned char g_buf_a[DEDUPE_BUF_SIZE];
+static unsigned char g_buf_b[DEDUPE_BUF_SIZE];
+
+// 读满缓冲区 返回读到的字节数 出错返回 -1
+static ssize_t read_full(int fd,unsigned char*buf,size_t len){
+    size_t got=0;
+    ssize_t n;
+
+    while(got<len){
+        n=read(fd,buf+got,len-got);
+        if(n<0&&errno==EINTR)continue;
+        if(n<0)return -1;
+        if(n==0)break;
+        got+=(size_t)n;
+    }
+    return (ssize_t)got;
+}
+
+// 计算文件内容的 XXH64
+int photo_hash_file(const char*path,uint64_t*hash){
+    xxh64_state_t st;
+    ssize_t n;
+    int fd=open(path,O_RDONLY|O_CLOEXEC);
+
+    if(fd<0){
+        return -1;
+    }
+    posix_fadvise(fd,0,0,POSIX_FADV_SEQUENTIAL);
+    xxh64_init(&st,0);
+    while((n=read_full(fd,g_buf_a,sizeof(g_buf_a)))>0){
+        xxh64_update(&st,g_buf_a,(size_t)n);
+    }
+    close(fd);
+    if(n<0){
+        return -1;
+    }
+    *hash=xxh64_digest(&st);
+    return 0;
+}
+
+// 逐字节比较两个文件 相同返回 1
+static int files_equal(const char*a,const char*b){
+    int fa=open(a,O_RDONLY|O_CLOEXEC);
+    int fb=open(b,O_RDONLY|O_CLOEXEC);
+    ssize_t na;
+    ssize_t nb;
+    int equal=0;
+
+    if(fa>=0&&fb>=0){
+        for(;;){
+            na=read_full(fa,g_buf_a,sizeof(g_buf_a));
+            nb=read_full(fb,g_buf_b,sizeof(g_buf_b));
+            if(na<0||na!=nb||memcmp(g_buf_a,g_buf_b,(size_t)na)!=0){
+                break;
+            }
+            if(na==0){
+                equal=1;
+                break;
+            }
+        }
+    }
+    if(fa>=0)close(fa);
+    if(fb>=0)close(fb);
+    return equal;
+}
+
+// 按文件名查找条目
+static long hashes_find_name(const photo_hashes_t*h,const char*name){
+    size_t i;
+
+    for(i=0;i<h->count;i++){
+        if(strcmp(h->items[i].name,name)==0){
+            return (long)i;
+        }
+    }
+    return -1;
+}
+
+// 追加条目 name 的所有权转交给列表
+static int hashes_append(photo_hashes_t*h,char*name,uint64_t hash,long long size,long long mtime_ns){
+    struct photo_hash*p;
+
+    if(h->count==h->cap){
+        size_t cap=h->cap?h->cap*2:64;
+        p=realloc(h->items,cap*sizeof(*p));
+        if(!p){
+            return -1;
+        }
+        h->items=p;
+        h->cap=cap;
+    }
+    p=&h->items[h->count++];
+    p->hash=hash;
+    p->size=size;
+    p->mtime_ns=mtime_ns;
+    p->name=name;
+    return 0;
+}
+
+// 删除第 i 项 顺序无关 用末项填位
+static void hashes_drop(photo_hashes_t*h,size_t i){
+    free(h->items[i].name);
+    h->items[i]=h->items[--h->count];
+}
+
+// 记录本次改动过的文件名
+static void hashes_touch(photo_hashes_t*h,const char*name){
+    char**p;
+
+    if(h->touched_count==h->touched_cap){
+        size_t cap=h->touched_cap?h->touched_cap*2:16;
+        p=realloc(h->touched,cap*sizeof(*p));
+        if(!p){
+            return;
+        }
+        h->touched=p;
+        h->touched_cap=cap;
+    }
+    h->touched[h->touched_count]=strdup(name);
+    if(h->touched[h->touched_count]){
+        h->touched_count++;
+    }
+}
+
+// 解析索引文本 格式不对的行直接跳过
+static void hashes_parse(photo_hashes_t*h,char*text){
+    char*line;
+    char*save=NULL;
+    unsigned long long hash;
+    long long size;
+    long long mtime_ns;
+    int off;
+    char*name;
+
+    for(line=strtok_r(text,"\n",&save);line;line=strtok_r(NULL,"\n",&save)){
+        off=0;
+        if(sscanf(line,"%16llx %lld %lld %n",&hash,&size,&mtime_ns,&off)!=3||off==0){
+            continue;
+        }
+        if(!photos_is_safe_filename(line+off)){
+            continue;
+        }
+        name=strdup(line+off);
+        if(!name||hashes_append(h,name,(uint64_t)hash,size,mtime_ns)!=0){
+            free(name);
+        }
+    }
+}
+
+// 从已打开的索引文件读入全部条目
+static int hashes_read_fd(photo_hashes_t*h,int fd){
+    struct stat st;
+    char*text;
+    ssize_t n;
+
+    if(fstat(fd,&st)!=0){
+        return -1;
+    }
+    if(st.st_size==0){
+        return 0;
+    }
+    text=malloc((size_t)st.st_size+1);
+    if(!text){
+        return -1;
+    }
+    n=pread(fd,text,(size_t)st.st_size,0);
+    if(n<0){
+        free(text);
+        return -1;
+    }
+    text[n]='\0';
+    hashes_parse(h,text);
+    free(text);
+    return 0;
+}
+
+// 载入索引快照 文件不存在时为空索引
+int photo_hashes_load(photo_hashes_t*h){
+    int fd;
+    int rc;
+
+    memset(h,0,sizeof(*h));
+    fd=open(PHOTO_HASHES_FILE,O_RDONLY|O_CLOEXEC);
+    if(fd<0){
+        return errno==ENOENT?0:-1;
+    }
+    flock(fd,LOCK_SH);
+    rc=hashes_read_fd(h,fd);
+    close(fd);
+    return rc;
+}
+
+// 登记或更新一项
+void photo_hashes_put(photo_hashes_t*h,const char*name,uint64_t hash,long long size,long long mtime_ns){
+    long i=hashes_find_name(h,name);
+    char*copy;
+
+    if(i>=0){
+        h->items[i].hash=hash;
+        h->items[i].size=size;
+        h->items[i].mtime_ns=mtime_ns;
+    }else{
+        copy=strdup(name);
+        if(!copy||hashes_append(h,copy,hash,size,mtime_ns)!=0){
+            free(copy);
+            return;
+        }
+    }
+    hashes_touch(h,name);
+}
+
+// 删除一项
+void photo_hashes_remove(photo_hashes_t*h,const char*name){
+    long i;
+
+    // name 可能就是条目自身的字符串 先记下再删
+    hashes_touch(h,name);
+    i=hashes_find_name(h,name);
+    if(i>=0){
+        hashes_drop(h,(size_t)i);
+    }
+}
+
+// 取照片的哈希 索引中没有或已过期时现算并登记
+static int hashes_get(photo_hashes_t*h,const char*name,const char*path,long long size,long long mtime_ns,uint64_t*hash){
+    long i=hashes_find_name(h,name);
+
+    if(i>=0&&h->items[i].size==size&&h->items[i].mtime_ns==mtime_ns){
+        *hash=h->items[i].hash;
+        return 0;
+    }
+    if(photo_hash_file(path,hash)!=0){
+        return -1;
+    }
+    photo_hashes_put(h,name,*hash,size,mtime_ns);
+    return 0;
+}
+
+// 判断候选是否与 path 内容相同 候选已不存在时从索引中去掉
+static int hashes_check(photo_hashes_t*h,size_t i,long long size,const char*path){
+    char full[MAX_PATH];
+    struct stat st;
+
+    snprintf(full,sizeof(full),"%s/%s",PHOTOS_DIR,h->items[i].name);
+    if(stat(full,&st)!=0||!S_ISREG(st.st_mode)){
+        photo_hashes_remove(h,h->items[i].name);
+        return -1;
+    }
+    if((long long)st.st_size!=size){
+        return 0;
+    }
+    return files_equal(path,full);
+}
+
+// 查找与 path 内容相同的已有照片 返回其文件名 没有返回 NULL
+const char*photo_hashes_find_dup(photo_hashes_t*h,uint64_t hash,long long size,const char*path){
+    const photo_index_t*idx=&h->photos;
+    const struct photo_index_entry*e;
+    const char*name;
+    char full[MAX_PATH];
+    uint64_t other;
+    size_t i;
+    long j;
+    int rc;
+
+    // 先查索引中已有的哈希 包括本次请求里刚存下的照片
+    for(i=0;i<h->count;){
+        if(h->items[i].hash!=hash||h->items[i].size!=size){
+            i++;
+            continue;
+        }
+        rc=hashes_check(h,i,size,path);
+        if(rc==1){
+            return h->items[i].name;
+        }
+        if(rc==0){
+            i++;
+        }
+    }
+    // 再找照片索引里同大小但还没有哈希的文件
+    if(h->index_state==0){
+        h->index_state=photo_index_open(&h->photos,PHOTO_INDEX_FILE)==0?1:-1;
+    }
+    if(h->index_state!=1){
+        return NULL;
+    }
+    for(i=0;i<idx->hdr->count;i++){
+        e=&idx->entries[i];
+        if((long long)e->size!=size){
+            continue;
+        }
+        name=photo_index_name(idx,e);
+        j=hashes_find_name(h,name);
+        if(j>=0&&h->items[j].size==size&&h->items[j].mtime_ns==e->mtime_ns){
+            continue;
+        }
+        snprintf(full,sizeof(full),"%s/%s",PHOTOS_DIR,name);
+        if(hashes_get(h,name,full,size,e->mtime_ns,&other)!=0||other!=hash){
+            continue;
+        }
+        if(files_equal(path,full)){
+            j=hashes_find_name(h,name);
+            return j>=0?h->items[j].name:NULL;
+        }
+    }
+    return NULL;
+}
+
+static int cmp_str(const void*a,const void*b){
+    return strcmp(*(char*const*)a,*(char*const*)b);
+}
+
+static int cmp_hash_name(const void*a,const void*b){
+    return strcmp(((const struct photo_hash*)a)->name,((const struct photo_hash*)b)->name);
+}
+
+// 是否在已排序的改动列表里
+static int hashes_touched(const photo_hashes_t*h,const char*name){
+    return bsearch(&name,h->touched,h->touched_count,sizeof(char*),cmp_str)!=NULL;
+}
+
+// 把改动合并到磁盘上的最新索引并原地写回
+int photo_hashes_commit(photo_hashes_t*h){
+    photo_hashes_t disk;
+    char*text=NULL;
+    size_t len=0;
+    FILE*mem;
+    size_t i;
+    int fd;
+    int rc=-1;
+
+    if(h->touched_count==0&&!h->replace_all){
+        return 0;
+    }
+    fd=open(PHOTO_HASHES_FILE,O_RDWR|O_CREAT|O_CLOEXEC,0644);
+    if(fd<0){
+        return -1;
+    }
+    flock(fd,LOCK_EX);
+    memset(&disk,0,sizeof(disk));
+    if(!h->replace_all){
+        // 其他请求写入的条目保留 本次改动过的文件名以本次为准
+        qsort(h->touched,h->touched_count,sizeof(char*),cmp_str);
+        hashes_read_fd(&disk,fd);
+        for(i=0;i<disk.count;){
+            if(hashes_touched(h,disk.items[i].name)){
+                hashes_drop(&disk,i);
+            }else{
+                i++;
+            }
+        }
+        for(i=0;i<h->count;i++){
+            if(hashes_touched(h,h->items[i].name)){
+                char*copy=strdup(h->items[i].name);
+                if(!copy||hashes_append(&disk,copy,h->items[i].hash,h->items[i].size,h->items[i].mtime_ns)!=0){
+                    free(copy);
+                }
+            }
+        }
+    }
+    mem=open_memstream(&text,&len);
+    if(mem){
+        const photo_hashes_t*src=h->replace_all?h:&disk;
+        qsort(src->items,src->count,sizeof(struct photo_hash),cmp_hash_name);
+        for(i=0;i<src->count;i++){
+            fprintf(mem,"%016llx %lld %lld %s\n",(unsigned long long)src->items[i].hash,
+                    src->items[i].size,src->items[i].mtime_ns,src->items[i].name);
+        }
+        if(fclose(mem)==0&&
+           (len==0||pwrite(fd,text,len,0)==(ssize_t)len)&&
+           ftruncate(fd,(off_t)len)==0){
+            rc=0;
+        }
+        free(text);
+    }
+    close(fd);
+    for(i=0;i<disk.count;i++){
+        free(disk.items[i].name);
+    }
+    free(disk.items);
+    for(i=0;i<h->touched_count;i++){
+        free(h->touched[i]);
+    }
+    h->touched_count=0;
+    h->replace_all=0;
+    return rc;
+}
+
+// 释放快照
+void photo_hashes_free(photo_hashes_t*h){
+    size_t i;
+
+    for(i=0;i<h->count;i++){
+        free(h->items[i].name);
+    }
+    for(i=0;i<h->touched_count;i++){
+        free(h->touched[i]);
+    }
+    free(h->items);
+    free(h->touched);
+    if(h->index_state==1){
+        photo_index_close(&h->photos);
+    }
+    memset(h,0,sizeof(*h));
+}
+
+static int cmp_scan_size(const void*a,const void*b){
+    const struct scan_file*x=a;
+    const struct scan_file*y=b;
+
+    return (x->size>y->size)-(x->size<y->size);
+}
+
+// 同组内按哈希排序 同内容时最早的文件排前面作为保留对象
+static int cmp_scan_hash(const void*a,const void*b){
+    const struct scan_file*x=a;
+    const struct scan_file*y=b;
+
+    if(x->hashed!=y->hashed)return y->hashed-x->hashed;
+    if(x->size!=y->size)return (x->size>y->size)-(x->size<y->size);
+    if(x->hash!=y->hash)return (x->hash>y->hash)-(x->hash<y->hash);
+    if(x->mtime_ns!=y->mtime_ns)return (x->mtime_ns>y->mtime_ns)-(x->mtime_ns<y->mtime_ns);
+    return strcmp(x->name,y->name);
+}
+
+// 列出照片目录中的照片
+static struct scan_file*scan_list(size_t*count){
+    DIR*dir=opendir(PHOTOS_DIR);
+    struct dirent*de;
+    struct scan_file*files=NULL;
+    struct scan_file*p;
+    struct stat st;
+    size_t n=0;
+    size_t cap=0;
+
+    *count=0;
+    if(!dir){
+        return NULL;
+    }
+    while((de=readdir(dir))!=NULL){
+        if(!photos_is_safe_filename(de->d_name)||
+           fstatat(dirfd(dir),de->d_name,&st,AT_SYMLINK_NOFOLLOW)!=0||!S_ISREG(st.st_mode)){
+            continue;
+        }
+        if(n==cap){
+            cap=cap?cap*2:256;
+            p=realloc(files,cap*sizeof(*p));
+            if(!p){
+                break;
+            }
+            files=p;
+        }
+        p=&files[n];
+        memset(p,0,sizeof(*p));
+        p->name=strdup(de->d_name);
+        if(!p->name){
+            break;
+        }
+        p->size=(long long)st.st_size;
+        p->mtime_ns=(long long)st.st_mtim.tv_sec*1000000000LL+st.st_mtim.tv_nsec;
+        p->dev=st.st_dev;
+        p->ino=st.st_ino;
+        n++;
+    }
+    closedir(dir);
+    *count=n;
+    return files;
+}
+
+// 把重复文件原子替换为保留文件的硬链接
+static int scan_link(const char*keep,const char*dup){
+    char keep_path[MAX_PATH];
+    char dup_path[MAX_PATH];
+    char tmp[MAX_PATH];
+
+    snprintf(keep_path,sizeof(keep_path),"%s/%s",PHOTOS_DIR,keep);
+    snprintf(dup_path,sizeof(dup_path),"%s/%s",PHOTOS_DIR,dup);
+    snprintf(tmp,sizeof(tmp),"%s/.dedupe-%ld",PHOTOS_DIR,(long)getpid());
+    unlink(tmp);
+    if(link(keep_path,tmp)!=0){
+        return -1;
+    }
+    if(rename(tmp,dup_path)!=0){
+        unlink(tmp);
+        return -1;
+    }
+    // 重复文件已变成保留文件 它的旧小图按修改时间失效 直接清掉
+    thumb_remove_all(dup);
+    return 0;
+}
+
+// 向组内追加一个重复文件
+static int group_add(struct photo_dup_group*g,const char*name){
+    char**p=realloc(g->dups,(g->dup_count+1)*sizeof(*p));
+
+    if(!p){
+        return -1;
+    }
+    g->dups=p;
+    g->dups[g->dup_count]=strdup(name);
+    if(!g->dups[g->dup_count]){
+        return -1;
+    }
+    g->dup_count++;
+    return 0;
+}
+
+// 扫描照片目录中的重复照片 do_link 非 0 时改为硬链接 同时重建哈希索引
+int photo_dedupe_scan(int do_link,struct photo_dedupe_report*rep){
+    photo_hashes_t h;
+    struct scan_file*files;
+    struct photo_dup_group*g;
+    char path[MAX_PATH];
+    char keep_path[MAX_PATH];
+    size_t n;
+    size_t i;
+    size_t j;
+    size_t k;
+
+    memset(rep,0,sizeof(*rep));
+    if(photo_hashes_load(&h)!=0){
+        return -1;
+    }
+    files=scan_list(&n);
+    rep->scanned=n;
+
+    // 只有大小相同的文件需要哈希 其余沿用索引中仍有效的哈希
+    qsort(files,n,sizeof(*files),cmp_scan_size);
+    for(i=0;i<n;i=j){
+        for(j=i+1;j<n&&files[j].size==files[i].size;j++);
+        for(k=i;k<j;k++){
+            long e=hashes_find_name(&h,files[k].name);
+            if(e>=0&&h.items[e].size==files[k].size&&h.items[e].mtime_ns==files[k].mtime_ns){
+                files[k].hash=h.items[e].hash;
+                files[k].hashed=1;
+            }else if(j-i>1){
+                snprintf(path,sizeof(path),"%s/%s",PHOTOS_DIR,files[k].name);
+                if(photo_hash_file(path,&files[k].hash)==0){
+                    files[k].hashed=1;
+                    rep->hashed++;
+                }
+            }
+        }
+    }
+
+    qsort(files,n,sizeof(*files),cmp_scan_hash);
+    for(i=0;i<n&&files[i].hashed;i=j){
+        for(j=i+1;j<n&&files[j].hashed&&files[j].size==files[i].size&&files[j].hash==files[i].hash;j++);
+        if(j-i<2){
+            continue;
+        }
+        g=NULL;
+        snprintf(keep_path,sizeof(keep_path),"%s/%s",PHOTOS_DIR,files[i].name);
+        for(k=i+1;k<j;k++){
+            // 已是同一个 inode 的不算重复 哈希碰撞的不同内容也跳过
+            if(files[k].dev==files[i].dev&&files[k].ino==files[i].ino){
+                continue;
+            }
+            snprintf(path,sizeof(path),"%s/%s",PHOTOS_DIR,files[k].name);
+            if(!files_equal(keep_path,path)){
+                continue;
+            }
+            if(!g){
+                g=realloc(rep->groups,(rep->group_count+1)*sizeof(*g));
+                if(!g){
+                    break;
+                }
+                rep->groups=g;
+                g=&rep->groups[rep->group_count++];
+                memset(g,0,sizeof(*g));
+                g->keep=strdup(files[i].name);
+                g->size=files[i].size;
+            }
+            if(group_add(g,files[k].name)!=0){
+                break;
+            }
+            g->wasted+=files[k].size;
+            rep->wasted+=files[k].size;
+            if(do_link){
+                if(scan_link(files[i].name,files[k].name)==0){
+                    files[k].mtime_ns=files[i].mtime_ns;
+                    rep->linked++;
+                    rep->reclaimed+=files[k].size;
+                }else{
+                    rep->link_failed++;
+                }
+            }
+        }
+    }
+
+    // 以本次扫描结果整体替换哈希索引 去掉已不存在的文件
+    for(i=0;i<h.count;i++){
+        free(h.items[i].name);
+    }
+    h.count=0;
+    for(i=0;i<n;i++){
+        if(files[i].hashed&&hashes_append(&h,files[i].name,files[i].hash,files[i].size,files[i].mtime_ns)==0){
+            files[i].name=NULL;
+        }
+        free(files[i].name);
+    }
+    free(files);
+    h.replace_all=1;
+    photo_hashes_commit(&h);
+    photo_hashes_free(&h);
+    return 0;
+}
+
+// 释放扫描报告
+void photo_dedupe_report_free(struct photo_dedupe_report*rep){
+    size_t i;
+    size_t k;
+
+    for(i=0;i<rep->group_count;i++){
+        for(k=0;k<rep->groups[i].dup_count;k++){
+            free(rep->groups[i].dups[k]);
+        }
+        free(rep->groups[i].dups);
+        free(rep->groups[i].keep);
+    }
+    free(rep->groups);
+    memset(rep,0,sizeof(*rep));
+}
@@ -11,12 +11,18 @@
  *
  * @note
  * - 路由表只做路径匹配与函数指针绑定
+ * - 路径含 {参数} 的路由按前缀匹配最后一段 处理函数用 route_param 取参数
+ * - 进程启动时为路由表求一个无冲突的哈希种子 之后每次查找 O(1)
+ * - 每条路由声明认证策略 未声明的默认需要登录
  **********************************************************************/
 #include <stdio.h>
 #include <string.h>
 #include "routes.h"
 #include "function.h"
 
+#define ROUTE_HASH_SIZE 256
+#define ROUTE_SEED_TRIES 65536
+
 struct route routes[] = {
     {
         .path = "/check-auth",
@@ -24,7 +30,8 @@ struct route routes[] = {
     },
     {
         .path="/login",
-        .post= login_post
+        .post= login_post,
+        .auth = ROUTE_AUTH_NONE
     },
     {
         .path = "/weather",
@@ -34,6 +41,10 @@ struct route routes[] = {
         .path = "/temperature",
         .get = temperature_get
     },
+    {
+        .path = "/temperature/history",
+        .get = temperature_history_get
+    },
     {
         .path = "/picture",
         .get = picture_get
@@ -46,6 +57,17 @@ struct route routes[] = {
         .path = "/disk/upload",
         .post = disk_upload_post
     },
+    {
+        .path = "/disk/upload/init",
+        .post = disk_upload_init_post
+    },
+    {
+        .path = "/disk/upload/{id}",
+        .get = disk_upload_status_get,
+        .put = disk_upload_chunk_put,
+        .post = disk_upload_finalize_post,
+        .delete = disk_upload_abort_delete
+    },
     {
         .path = "/disk/delete",
         .delete = disk_delete_handler
@@ -54,6 +76,22 @@ struct route routes[] = {
         .path = "/disk/list",
         .get = disk_list_get
     },
+    {
+        .path = "/disk/search",
+        .get = disk_search_get
+    },
+    {
+        .path = "/disk/usage",
+        .get = disk_usage_get
+    },
+    {
+        .path = "/disk/jobs",
+        .post = disk_jobs_post
+    },
+    {
+        .path = "/disk/jobs/{id}",
+        .get = disk_job_get_handler
+    },
     {
         .path = "/disk/mkdir",
         .post = disk_mkdir_post
@@ -76,6 +114,11 @@ struct route routes[] = {
         .post = photos_upload,
         .delete = photos_delete
     },
+    {
+        .path = "/photos/dedupe",
+        .get = photos_dedupe_get,
+        .post = photos_dedupe_post
+    },
     {
         .path = "/photo",
         .get = photos_photo_get
@@ -99,29 +142,9 @@ struct route routes[] = {
         .get = family_my_tasks_get
     },
     {
-        .path = "/control/light",
-        .get = control_light_get,
-        .put = control_light_put,
-    },
-    {
-        .path = "/control/aircon",
-        .get = control_aircon_get,
-        .put = control_aircon_put,
-    },
-    {
-        .path = "/control/washing_machine",
-        .get = control_washing_machine_get,
-        .put = control_washing_machine_put,
-    },
-    {
-        .path = "/control/fan",
-        .get = control_fan_get,
-        .put = control_fan_put,
-    },
-    {
-        .path = "/control/door",
-        .get = control_door_get,
-        .put = control_door_put,
+        .path = "/control/{device}",
+        .get = control_device_get,
+        .put = control_device_put,
     },
     {
         .path = "/settings/change-password",
@@ -138,5 +161,168 @@ struct route routes[] = {
         .get = settings_wifi_get,
         .put = settings_wifi_put
     },
-    { NULL, NULL, NULL, NULL, NULL, NULL }
+    { NULL, NULL, NULL, NULL, NULL, NULL, ROUTE_AUTH_REQUIRED }
 };
+
+static short g_route_slots[ROUTE_HASH_SIZE];
+static unsigned int g_route_seed=0;
+// 0 未初始化 1 完美哈希 -1 回退为线性扫描
+static int g_route_state=0;
+
+// 带种子的 FNV-1a 哈希
+static unsigned int route_hash(unsigned int seed,const char*s,size_t len){
+    unsigned int h;
+    size_t i;
+
+    h=2166136261u^seed;
+    for(i=0;i<len;i++){
+        h^=(unsigned char)s[i];
+        h*=16777619u;
+    }
+    h^=h>>15;
+    h*=0x2c1b3c6du;
+    h^=h>>12;
+    return h;
+}
+
+// 路由键长度 参数路由只取 '{' 之前的前缀
+static size_t route_key_len(const char*path){
+    const char*brace;
+
+    brace=strchr(path,'{');
+    return brace?(size_t)(brace-path):strlen(path);
+}
+
+// 尝试用给定种子把所有路由键放进不冲突的槽位
+static int try_route_seed(unsigned int seed){
+    int i;
+    unsigned int slot;
+
+    memset(g_route_slots,0xff,sizeof(g_route_slots));
+    for(i=0;routes[i].path;i++){
+        slot=route_hash(seed,routes[i].path,route_key_len(routes[i].path))&(ROUTE_HASH_SIZE-1);
+        if(g_route_slots[slot]>=0){
+            return 0;
+        }
+        g_route_slots[slot]=(short)i;
+    }
+    return 1;
+}
+
+// 构建路由哈希表
+int routes_init(void){
+    unsigned int seed;
+    int n;
+
+    for(n=0;routes[n].path;n++){
+    }
+    if(n*2<=ROUTE_HASH_SIZE){
+        for(seed=0;seed<ROUTE_SEED_TRIES;seed++){
+            if(try_route_seed(seed)){
+                g_route_seed=seed;
+                g_route_state=1;
+                return 0;
+            }
+        }
+    }
+    fprintf(stderr,"routes: no perfect hash seed for %d routes, using linear scan\n",n);
+    g_route_state=-1;
+    return -1;
+}
+
+// 按路由键查找 is_param 指定匹配普通路由还是参数路由
+static const struct route*find_route_key(const char*key,size_t len,int is_param){
+    const struct route*r;
+    short idx;
+    int i;
+
+    if(g_route_state>0){
+        idx=g_route_slots[route_hash(g_route_seed,key,len)&(ROUTE_HASH_SIZE-1)];
+        if(idx<0){
+            return NULL;
+        }
+        r=&routes[idx];
+        if(strncmp(r->path,key,len)==0&&r->path[len]==(is_param?'{':'\0')){
+            return r;
+        }
+        return NULL;
+    }
+    for(i=0;routes[i].path;i++){
+        r=&routes[i];
+        if(strncmp(r->path,key,len)==0&&r->path[len]==(is_param?'{':'\0')){
+            return r;
+        }
+    }
+    return NULL;
+}
+
+// 查找路径对应的路由
+const struct route*route_lookup(const char*path){
+    const struct route*r;
+    const char*slash;
+    size_t len;
+
+    if(!path){
+        return NULL;
+    }
+    if(g_route_state==0){
+        routes_init();
+    }
+    len=strlen(path);
+    r=find_route_key(path,len,0);
+    if(r){
+        return r;
+    }
+    // 精确匹配失败时把最后一段当作参数
+    slash=strrchr(path,'/');
+    if(!slash||slash[1]=='\0'){
+        return NULL;
+    }
+    return find_route_key(path,(size_t)(slash-path)+1,1);
+}
+
+// 取路由中对应方法的处理函数
+route_handler_t route_get_handler(const struct route*r,enum http_method method){
+    if(!r){
+        return NULL;
+    }
+    switch(method){
+        case HTTP_GET:return r->get;
+        case HTTP_POST:return r->post;
+        case HTTP_PUT:return r->put;
+        case HTTP_PATCH:return r->patch;
+        case HTTP_DELETE:return r->delete;
+        default:return NULL;
+    }
+}
+
+// 请求方法字符串转枚举
+enum http_method http_method_from_string(const char*method){
+    if(!method){
+        return HTTP_METHOD_UNKNOWN;
+    }
+    switch(method[0]){
+        case 'G':
+            return strcmp(method,"GET")==0?HTTP_GET:HTTP_METHOD_UNKNOWN;
+        case 'P':
+            if(strcmp(method,"POST")==0)return HTTP_POST;
+            if(strcmp(method,"PUT")==0)return HTTP_PUT;
+            if(strcmp(method,"PATCH")==0)return HTTP_PATCH;
+            return HTTP_METHOD_UNKNOWN;
+        case 'D':
+            return strcmp(method,"DELETE")==0?HTTP_DELETE:HTTP_METHOD_UNKNOWN;
+        default:
+            return HTTP_METHOD_UNKNOWN;
+    }
+}
+
+// 取参数路由的参数 即路径最后一段
+const char*route_param(const char*path){
+    const char*slash;
+
+    if(!path){
+        return "";
+    }
+    slash=strrchr(path,'/');
+    return slash?slash+1:path;
+}
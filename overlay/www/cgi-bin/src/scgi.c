@@ -0,0 +1,229 @@
+/**********************************************************************
+ * @file scgi.c
+ * @brief SCGI 常驻服务循环实现
+ *
+ * 本文件实现 SCGI 请求头解析与连接接收循环
+ * 使 main.cgi 由 lighttpd 拉起后常驻复用 免去每个请求的 fork+exec
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ *
+ * @note
+ * - lighttpd 通过 bin-path 拉起时监听套接字位于 fd 0
+ * - 请求头导入环境变量 处理函数仍可通过 getenv 读取
+ * - 响应与 CGI 格式一致 直接写回连接无需分帧
+ **********************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "scgi.h"
+#include "common.h"
+
+#define SCGI_MAX_HEADER 65536
+#define SCGI_MAX_ENV 64
+#define SCGI_READ_TIMEOUT_SEC 30
+#define SCGI_OUT_BUF_SIZE 65536
+
+static char*g_env_keys[SCGI_MAX_ENV];
+static int g_env_count=0;
+
+// 判断 fd 是否为监听套接字
+int scgi_is_listen_socket(int fd){
+    int val;
+    socklen_t len;
+
+    val=0;
+    len=sizeof(val);
+    if(getsockopt(fd,SOL_SOCKET,SO_ACCEPTCONN,&val,&len)!=0){
+        return 0;
+    }
+    return val!=0;
+}
+
+// 读满指定字节数
+static int read_full(int fd,char*buf,size_t len){
+    size_t got;
+    ssize_t n;
+
+    got=0;
+    while(got<len){
+        n=read(fd,buf+got,len-got);
+        if(n<0&&errno==EINTR){
+            continue;
+        }
+        if(n<=0){
+            return -1;
+        }
+        got+=(size_t)n;
+    }
+    return 0;
+}
+
+// 读取 netstring 长度前缀
+static long read_netstring_len(int fd){
+    char c;
+    long len;
+    int digits;
+
+    len=0;
+    digits=0;
+    while(1){
+        if(read_full(fd,&c,1)!=0){
+            return -1;
+        }
+        if(c==':'){
+            break;
+        }
+        if(c<'0'||c>'9'||++digits>7){
+            return -1;
+        }
+        len=len*10+(c-'0');
+    }
+    if(digits==0||len<=0||len>SCGI_MAX_HEADER){
+        return -1;
+    }
+    return len;
+}
+
+// 清除上一请求导入的环境变量
+static void reset_request_env(void){
+    int i;
+
+    for(i=0;i<g_env_count;i++){
+        unsetenv(g_env_keys[i]);
+        free(g_env_keys[i]);
+    }
+    g_env_count=0;
+}
+
+// 将 SCGI 请求头导入环境变量
+static int import_headers(const char*buf,long len){
+    const char*p;
+    const char*end;
+    const char*val;
+    const char*next;
+    char*key;
+
+    p=buf;
+    end=buf+len;
+    while(p<end){
+        val=memchr(p,'\0',(size_t)(end-p));
+        if(!val||val+1>=end){
+            return -1;
+        }
+        val++;
+        next=memchr(val,'\0',(size_t)(end-val));
+        if(!next){
+            return -1;
+        }
+        if(*p&&g_env_count<SCGI_MAX_ENV){
+            key=strdup(p);
+            if(key&&setenv(key,val,1)==0){
+                g_env_keys[g_env_count++]=key;
+            }else{
+                free(key);
+            }
+        }
+        p=next+1;
+    }
+    return 0;
+}
+
+// 读取并导入一个请求的头部
+static int read_request_headers(int conn){
+    long len;
+    char*buf;
+    char comma;
+    int ret;
+
+    len=read_netstring_len(conn);
+    if(len<0){
+        return -1;
+    }
+    buf=malloc((size_t)len);
+    if(!buf){
+        return -1;
+    }
+    ret=-1;
+    if(read_full(conn,buf,(size_t)len)==0&&
+        read_full(conn,&comma,1)==0&&comma==','){
+        ret=import_headers(buf,len);
+    }
+    free(buf);
+    return ret;
+}
+
+// 发完响应后读掉处理函数未读的请求体 避免带未读数据关闭触发 RST 丢弃响应
+static void drain_request_body(int conn){
+    char buf[4096];
+    ssize_t n;
+
+    shutdown(conn,SHUT_WR);
+    while((n=read(conn,buf,sizeof(buf)))!=0){
+        if(n<0&&errno!=EINTR){
+            break;
+        }
+    }
+}
+
+// 接收连接并逐个处理请求
+int scgi_serve(int listen_fd,scgi_request_fn handle){
+    static char out_buf[SCGI_OUT_BUF_SIZE];
+    int conn;
+    struct timeval tv;
+    FILE*out;
+
+    if(!handle){
+        return EXIT_FAILURE;
+    }
+    // 客户端提前断开时不让进程被 SIGPIPE 杀死
+    signal(SIGPIPE,SIG_IGN);
+
+    while(1){
+        conn=accept4(listen_fd,NULL,NULL,SOCK_CLOEXEC);
+        if(conn<0){
+            if(errno==EINTR||errno==ECONNABORTED){
+                continue;
+            }
+            perror("accept");
+            return EXIT_FAILURE;
+        }
+
+        tv.tv_sec=SCGI_READ_TIMEOUT_SEC;
+        tv.tv_usec=0;
+        setsockopt(conn,SOL_SOCKET,SO_RCVTIMEO,&tv,sizeof(tv));
+
+        if(read_request_headers(conn)!=0){
+            reset_request_env();
+            close(conn);
+            continue;
+        }
+
+        out=fdopen(conn,"w");
+        if(!out){
+            reset_request_env();
+            close(conn);
+            continue;
+        }
+        setvbuf(out,out_buf,_IOFBF,sizeof(out_buf));
+
+        g_resp=out;
+        g_req_fd=conn;
+        handle();
+        fflush(out);
+        drain_request_body(conn);
+        fclose(out);
+
+        g_resp=stdout;
+        g_req_fd=STDIN_FILENO;
+        reset_request_env();
+    }
+    return EXIT_SUCCESS;
+}
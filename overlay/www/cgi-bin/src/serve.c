@@ -0,0 +1,374 @@
+/**********************************************************************
+ * @file serve.c
+ * @brief 文件下发实现
+ *
+ * 本文件实现带 Range 支持的文件响应输出
+ * 供网盘下载与照片查看等处理函数共用
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ *
+ * @note
+ * - 支持单段与多段 Range 多段时以 multipart/byteranges 返回 206
+ * - 输出为套接字时（SCGI 常驻模式）用 sendfile 零拷贝发送
+ * - 其他情况用对齐的大缓冲区 read/write 发送
+ * - 校验器由 inode、大小与纳秒级修改时间生成 命中条件请求时不打开文件
+ **********************************************************************/
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include "serve.h"
+#include "error.h"
+#include "common.h"
+
+#define SERVE_BOUNDARY "YYHOME_BYTERANGES"
+
+struct byte_range{
+    off_t start;
+    off_t end;
+};
+
+static unsigned char*g_serve_buf=NULL;
+
+// 由 stat 结果生成 ETag 与 Last-Modified
+void cache_validator_init(struct cache_validator*v,const struct stat*st){
+    struct tm tm;
+
+    snprintf(v->etag,sizeof(v->etag),"\"%llx-%llx-%llx\"",
+        (unsigned long long)st->st_ino,(unsigned long long)st->st_size,
+        (unsigned long long)st->st_mtim.tv_sec*1000000000ULL+(unsigned long long)st->st_mtim.tv_nsec);
+    v->mtime=st->st_mtime;
+    gmtime_r(&v->mtime,&tm);
+    strftime(v->last_modified,sizeof(v->last_modified),"%a, %d %b %Y %H:%M:%S GMT",&tm);
+}
+
+// 由共享内存分区的版本号与更新时间生成校验器
+void cache_validator_init_version(struct cache_validator*v,uint64_t version,time_t mtime){
+    struct tm tm;
+
+    snprintf(v->etag,sizeof(v->etag),"\"v%llx-%llx\"",(unsigned long long)version,(unsigned long long)mtime);
+    v->mtime=mtime;
+    gmtime_r(&v->mtime,&tm);
+    strftime(v->last_modified,sizeof(v->last_modified),"%a, %d %b %Y %H:%M:%S GMT",&tm);
+}
+
+// 在 If-None-Match 列表中查找 ETag（弱比较）
+static int etag_list_matches(const char*list,const char*etag){
+    size_t len=strlen(etag);
+    const char*p=list;
+
+    while(*p){
+        while(*p==' '||*p=='\t'||*p==',')p++;
+        if(*p=='*')return 1;
+        if(strncmp(p,"W/",2)==0)p+=2;
+        if(strncmp(p,etag,len)==0&&(p[len]=='\0'||p[len]==','||p[len]==' '||p[len]=='\t')){
+            return 1;
+        }
+        while(*p&&*p!=',')p++;
+    }
+    return 0;
+}
+
+// 解析 HTTP 日期 失败返回 -1
+static time_t parse_http_date(const char*s){
+    struct tm tm;
+    const char*end;
+
+    memset(&tm,0,sizeof(tm));
+    end=strptime(s,"%a, %d %b %Y %H:%M:%S GMT",&tm);
+    if(!end){
+        return (time_t)-1;
+    }
+    return timegm(&tm);
+}
+
+// 判断请求的缓存副本是否仍有效
+int request_not_modified(const struct request_ctx*ctx,const struct cache_validator*v){
+    time_t since;
+
+    if(!ctx||!v){
+        return 0;
+    }
+    // 同时携带两者时以 If-None-Match 为准
+    if(ctx->if_none_match){
+        return etag_list_matches(ctx->if_none_match,v->etag);
+    }
+    if(ctx->if_modified_since){
+        since=parse_http_date(ctx->if_modified_since);
+        return since!=(time_t)-1&&v->mtime<=since;
+    }
+    return 0;
+}
+
+// 输出校验器与缓存策略头
+void send_validator_headers(const struct cache_validator*v,const char*cache_control){
+    fprintf(g_resp,"ETag: %s\r\n",v->etag);
+    fprintf(g_resp,"Last-Modified: %s\r\n",v->last_modified);
+    if(cache_control){
+        fprintf(g_resp,"Cache-Control: %s\r\n",cache_control);
+    }
+}
+
+// 输出 304 响应
+void send_not_modified(const struct cache_validator*v,const char*cache_control){
+    fprintf(g_resp,"Status: 304 Not Modified\r\n");
+    send_validator_headers(v,cache_control);
+    fprintf(g_resp,"\r\n");
+    fflush(g_resp);
+}
+
+// If-Range 与当前版本一致时 Range 才生效
+static int if_range_matches(const char*if_range,const struct cache_validator*v){
+    if(!if_range){
+        return 1;
+    }
+    if(if_range[0]=='"'){
+        return strcmp(if_range,v->etag)==0;
+    }
+    return strcmp(if_range,v->last_modified)==0;
+}
+
+// 解析 Range 头 返回段数 -1 表示忽略 Range 0 表示无可满足的段
+static int parse_ranges(const char*spec,off_t size,struct byte_range*out,int max){
+    const char*p;
+    int n=0;
+
+    if(!spec||strncmp(spec,"bytes=",6)!=0){
+        return -1;
+    }
+    p=spec+6;
+    while(*p){
+        off_t start=-1;
+        off_t end=-1;
+        char*next;
+
+        while(*p==' '||*p=='\t')p++;
+        if(*p=='-'){
+            // 后缀形式 -N 表示最后 N 字节
+            long long suffix=strtoll(p+1,&next,10);
+            if(next==p+1||suffix<0)return -1;
+            if(suffix>0&&size>0){
+                start=suffix>=size?0:size-suffix;
+                end=size-1;
+            }
+        }else{
+            long long a=strtoll(p,&next,10);
+            if(next==p||a<0||*next!='-')return -1;
+            p=next+1;
+            if(*p>='0'&&*p<='9'){
+                long long b=strtoll(p,&next,10);
+                if(b<a)return -1;
+                end=b>=size?size-1:b;
+            }else{
+                next=(char*)p;
+                end=size-1;
+            }
+            start=a;
+            if(start>=size){
+                start=-1;
+            }
+        }
+        p=next;
+        while(*p==' '||*p=='\t')p++;
+        if(*p==','){
+            p++;
+        }else if(*p){
+            return -1;
+        }
+        if(start<0){
+            continue;
+        }
+        if(n>=max){
+            return -1;
+        }
+        out[n].start=start;
+        out[n].end=end;
+        n++;
+    }
+    return n;
+}
+
+// 按起点排序并合并重叠或相邻的段
+static int merge_ranges(struct byte_range*r,int n){
+    int i;
+    int j;
+    int m;
+
+    for(i=1;i<n;i++){
+        struct byte_range key=r[i];
+        for(j=i-1;j>=0&&r[j].start>key.start;j--){
+            r[j+1]=r[j];
+        }
+        r[j+1]=key;
+    }
+    m=0;
+    for(i=1;i<n;i++){
+        if(r[i].start<=r[m].end+1){
+            if(r[i].end>r[m].end)r[m].end=r[i].end;
+        }else{
+            r[++m]=r[i];
+        }
+    }
+    return n>0?m+1:0;
+}
+
+// 写满指定字节数
+static int write_full(int fd,const unsigned char*buf,size_t len){
+    ssize_t n;
+
+    while(len>0){
+        n=write(fd,buf,len);
+        if(n<0&&errno==EINTR)continue;
+        if(n<=0)return -1;
+        buf+=n;
+        len-=(size_t)n;
+    }
+    return 0;
+}
+
+// 发送文件中的一段 先冲刷已缓冲的响应头
+static int send_range(int in_fd,off_t offset,off_t len,int zero_copy){
+    int out_fd;
+    ssize_t n;
+
+    fflush(g_resp);
+    out_fd=fileno(g_resp);
+    if(zero_copy){
+        while(len>0){
+            n=sendfile(out_fd,in_fd,&offset,len>0x40000000?0x40000000:(size_t)len);
+            if(n<0&&errno==EINTR)continue;
+            if(n<0&&(errno==EINVAL||errno==ENOSYS)&&len>0){
+                // 文件系统不支持时退回缓冲区拷贝
+                break;
+            }
+            if(n<=0)return -1;
+            len-=n;
+        }
+        if(len==0)return 0;
+    }
+    if(!g_serve_buf&&posix_memalign((void**)&g_serve_buf,4096,SERVE_BUF_SIZE)!=0){
+        g_serve_buf=NULL;
+        return -1;
+    }
+    while(len>0){
+        n=pread(in_fd,g_serve_buf,len>SERVE_BUF_SIZE?SERVE_BUF_SIZE:(size_t)len,offset);
+        if(n<0&&errno==EINTR)continue;
+        if(n<=0)return -1;
+        if(write_full(out_fd,g_serve_buf,(size_t)n)!=0)return -1;
+        offset+=n;
+        len-=n;
+    }
+    return 0;
+}
+
+// 多段响应中每段的分隔头
+static int part_header(char*buf,size_t size,const char*mime,const struct byte_range*r,off_t total){
+    return snprintf(buf,size,"\r\n--" SERVE_BOUNDARY "\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+        mime,(long long)r->start,(long long)r->end,(long long)total);
+}
+
+// 发送文件 支持 Range 请求 成功返回 0
+int serve_file(const struct request_ctx*ctx,const char*path,const char*mime,const char*disposition,const char*filename,const char*cache_control){
+    struct byte_range ranges[SERVE_MAX_RANGES];
+    struct cache_validator v;
+    struct stat st;
+    struct stat out_st;
+    char head[512];
+    int zero_copy;
+    int count=-1;
+    int fd;
+    int i;
+    int rc=0;
+
+    // 条件请求命中时不打开文件
+    if(stat(path,&st)!=0||!S_ISREG(st.st_mode)){
+        send_error_404("File not found");
+        return -1;
+    }
+    cache_validator_init(&v,&st);
+    if(request_not_modified(ctx,&v)){
+        send_not_modified(&v,cache_control);
+        return 0;
+    }
+
+    fd=open(path,O_RDONLY|O_CLOEXEC);
+    if(fd<0){
+        send_error_404("File not found");
+        return -1;
+    }
+    if(fstat(fd,&st)!=0||!S_ISREG(st.st_mode)){
+        close(fd);
+        send_error_404("File not found");
+        return -1;
+    }
+
+    // 以打开后的 inode 为准 防止 stat 与 open 之间文件被替换
+    cache_validator_init(&v,&st);
+    if(ctx&&ctx->range&&if_range_matches(ctx->if_range,&v)){
+        count=parse_ranges(ctx->range,st.st_size,ranges,SERVE_MAX_RANGES);
+        if(count==0){
+            close(fd);
+            fprintf(g_resp,"Status: 416 Range Not Satisfiable\r\n");
+            fprintf(g_resp,"Content-Range: bytes */%lld\r\n",(long long)st.st_size);
+            fprintf(g_resp,"Content-Length: 0\r\n\r\n");
+            fflush(g_resp);
+            return 0;
+        }
+        if(count>0){
+            count=merge_ranges(ranges,count);
+        }
+    }
+
+    zero_copy=fstat(fileno(g_resp),&out_st)==0&&S_ISSOCK(out_st.st_mode);
+
+    if(count>0){
+        fprintf(g_resp,"Status: 206 Partial Content\r\n");
+    }
+    fprintf(g_resp,"Accept-Ranges: bytes\r\n");
+    send_validator_headers(&v,cache_control);
+    if(filename){
+        fprintf(g_resp,"Content-Disposition: %s; filename=\"%s\"\r\n",disposition?disposition:"inline",filename);
+    }
+
+    if(count<0){
+        fprintf(g_resp,"Content-Type: %s\r\n",mime);
+        fprintf(g_resp,"Content-Length: %lld\r\n\r\n",(long long)st.st_size);
+        rc=send_range(fd,0,st.st_size,zero_copy);
+    }else if(count==1){
+        fprintf(g_resp,"Content-Type: %s\r\n",mime);
+        fprintf(g_resp,"Content-Range: bytes %lld-%lld/%lld\r\n",
+            (long long)ranges[0].start,(long long)ranges[0].end,(long long)st.st_size);
+        fprintf(g_resp,"Content-Length: %lld\r\n\r\n",(long long)(ranges[0].end-ranges[0].start+1));
+        rc=send_range(fd,ranges[0].start,ranges[0].end-ranges[0].start+1,zero_copy);
+    }else{
+        // 先算出整体长度 lighttpd 才能直接透传而不必分块
+        long long total=(long long)strlen("\r\n--" SERVE_BOUNDARY "--\r\n");
+        for(i=0;i<count;i++){
+            total+=part_header(head,sizeof(head),mime,&ranges[i],st.st_size);
+            total+=(long long)(ranges[i].end-ranges[i].start+1);
+        }
+        fprintf(g_resp,"Content-Type: multipart/byteranges; boundary=" SERVE_BOUNDARY "\r\n");
+        fprintf(g_resp,"Content-Length: %lld\r\n\r\n",total);
+        for(i=0;i<count&&rc==0;i++){
+            part_header(head,sizeof(head),mime,&ranges[i],st.st_size);
+            fputs(head,g_resp);
+            rc=send_range(fd,ranges[i].start,ranges[i].end-ranges[i].start+1,zero_copy);
+        }
+        if(rc==0){
+            fputs("\r\n--" SERVE_BOUNDARY "--\r\n",g_resp);
+        }
+    }
+    close(fd);
+    fflush(g_resp);
+    return rc;
+}
@@ -20,6 +20,7 @@
 #include <signal.h>
 #include <json-c/json.h>
 #include "settings.h"
+#include "atomic_file.h"
 
 // 从行中提取指定键的值
 void extract_value(const char*line,const char*key,char*out,size_t out_size){
@@ -63,15 +64,17 @@ void json_escape(const char*src,char*dst,size_t dst_size){
 
 // 写入账号信息文件
 int write_login_file(const char*username,const char*password){
-    FILE*f;
+    struct atomic_file af;
 
-    f=fopen(LOGIN_FILE,"w");
-    if(!f){
+    // 原子替换 写入中途断电也不会丢失账号
+    if(!atomic_file_open(&af,LOGIN_FILE,0600,ATOMIC_FILE_SYNC_DIR)){
         return -1;
     }
-    fprintf(f,"username:%s\npassword:%s\n",username,password);
-    fclose(f);
-    return 0;
+    if(fprintf(af.fp,"username:%s\npassword:%s\n",username,password)<0){
+        atomic_file_abort(&af);
+        return -1;
+    }
+    return atomic_file_commit(&af);
 }
 
 // 读取用户名
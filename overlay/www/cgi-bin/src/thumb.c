@@ -0,0 +1,555 @@
+/**********************************************************************
+ * @file thumb.c
+ * @brief 照片缩略图生成与缓存实现
+ *
+ * 本文件解码 JPEG/PNG 照片 按固定边长等比缩小后编码为 JPEG
+ * 缓存在照片目录下的 .thumbs 中 供相册网格加载小图
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ *
+ * @note
+ * - JPEG 先用解码器自带的 1/2、1/4、1/8 DCT 缩放 再做面积平均 逐行解码不缓存整图
+ * - 面积平均为可分离的定点运算 垂直方向是对整行的连续乘加 便于编译器向量化
+ * - 缓存文件名由照片名哈希、纳秒修改时间与文件大小组成 照片变化后自动失效
+ * - 按 EXIF 方向标记旋转 缩略图本身不带 EXIF
+ **********************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <jpeglib.h>
+#include <png.h>
+#include "thumb.h"
+#include "photo_index.h"
+#include "define.h"
+
+// 可分离面积平均缩放器 水平方向查权重表 垂直方向按源行逐行累加
+struct thumb_scaler{
+    int src_w;
+    int src_h;
+    int dst_w;
+    int dst_h;
+    int x_stride;
+    int*x_first;
+    int*x_count;
+    uint32_t*x_weight;
+    uint8_t*src_row;
+    uint8_t*row;
+    uint32_t*acc;
+    uint8_t*out;
+    int src_y;
+    int dst_y;
+};
+
+struct thumb_jpeg_err{
+    struct jpeg_error_mgr pub;
+    jmp_buf jmp;
+};
+
+// libjpeg 出错时跳回调用处
+static void thumb_jpeg_error_exit(j_common_ptr cinfo){
+    struct thumb_jpeg_err*err=(struct thumb_jpeg_err*)cinfo->err;
+
+    longjmp(err->jmp,1);
+}
+
+// 目标尺寸 最长边不超过 edge 且不放大
+static void thumb_fit(int w,int h,int edge,int*dw,int*dh){
+    int longest=w>h?w:h;
+
+    if(longest<=edge){
+        *dw=w;
+        *dh=h;
+        return;
+    }
+    *dw=(int)(((long long)w*edge+longest/2)/longest);
+    *dh=(int)(((long long)h*edge+longest/2)/longest);
+    if(*dw<1)*dw=1;
+    if(*dh<1)*dh=1;
+}
+
+// 释放缩放器缓冲
+static void scaler_free(struct thumb_scaler*s){
+    free(s->x_first);
+    free(s->x_count);
+    free(s->x_weight);
+    free(s->src_row);
+    free(s->row);
+    free(s->acc);
+    free(s->out);
+    memset(s,0,sizeof(*s));
+}
+
+// 建立水平权重表并分配行缓冲 权重为 16.16 定点 每个目标像素之和为 65536
+static int scaler_init(struct thumb_scaler*s,int src_w,int src_h,int dst_w,int dst_h){
+    double scale=(double)src_w/dst_w;
+    int x;
+    int i;
+
+    memset(s,0,sizeof(*s));
+    s->src_w=src_w;
+    s->src_h=src_h;
+    s->dst_w=dst_w;
+    s->dst_h=dst_h;
+    s->x_stride=(int)scale+2;
+    s->x_first=malloc(sizeof(int)*(size_t)dst_w);
+    s->x_count=malloc(sizeof(int)*(size_t)dst_w);
+    s->x_weight=malloc(sizeof(uint32_t)*(size_t)dst_w*(size_t)s->x_stride);
+    s->src_row=malloc((size_t)src_w*3);
+    s->row=malloc((size_t)dst_w*3);
+    s->acc=calloc((size_t)dst_w*3,sizeof(uint32_t));
+    s->out=malloc((size_t)dst_w*(size_t)dst_h*3);
+    if(!s->x_first||!s->x_count||!s->x_weight||!s->src_row||!s->row||!s->acc||!s->out){
+        scaler_free(s);
+        return -1;
+    }
+    for(x=0;x<dst_w;x++){
+        double lo=x*scale;
+        double hi=(x+1)*scale;
+        int first=(int)lo;
+        int last=(int)hi;
+        uint32_t*w=s->x_weight+(size_t)x*(size_t)s->x_stride;
+        uint32_t sum=0;
+        int big=0;
+
+        if(last>=src_w||(double)last>=hi){
+            last--;
+        }
+        if(last<first){
+            last=first;
+        }
+        s->x_first[x]=first;
+        s->x_count[x]=last-first+1;
+        for(i=0;i<s->x_count[x];i++){
+            double a=first+i>lo?first+i:lo;
+            double b=first+i+1<hi?first+i+1:hi;
+            w[i]=(uint32_t)((b-a)/scale*65536.0+0.5);
+            sum+=w[i];
+            if(w[i]>w[big]){
+                big=i;
+            }
+        }
+        // 舍入误差补到权重最大的像素上
+        w[big]+=65536-sum;
+    }
+    return 0;
+}
+
+// 输出一行累加结果
+static void scaler_emit(struct thumb_scaler*s){
+    uint8_t*dst=s->out+(size_t)s->dst_y*(size_t)s->dst_w*3;
+    int n=s->dst_w*3;
+    int i;
+
+    for(i=0;i<n;i++){
+        uint32_t v=(s->acc[i]+32768)>>16;
+        dst[i]=(uint8_t)(v>255?255:v);
+        s->acc[i]=0;
+    }
+    s->dst_y++;
+}
+
+// 送入一行 RGB 源像素
+static void scaler_push(struct thumb_scaler*s,const uint8_t*src){
+    long long start=(long long)s->src_y*s->dst_h;
+    long long end=start+s->dst_h;
+    long long boundary;
+    uint32_t w1;
+    uint32_t w2=0;
+    int n=s->dst_w*3;
+    int x;
+    int i;
+
+    for(x=0;x<s->dst_w;x++){
+        const uint8_t*p=src+(size_t)s->x_first[x]*3;
+        const uint32_t*w=s->x_weight+(size_t)x*(size_t)s->x_stride;
+        uint32_t r=0;
+        uint32_t g=0;
+        uint32_t b=0;
+
+        for(i=0;i<s->x_count[x];i++){
+            r+=w[i]*p[i*3];
+            g+=w[i]*p[i*3+1];
+            b+=w[i]*p[i*3+2];
+        }
+        s->row[x*3]=(uint8_t)((r+32768)>>16);
+        s->row[x*3+1]=(uint8_t)((g+32768)>>16);
+        s->row[x*3+2]=(uint8_t)((b+32768)>>16);
+    }
+
+    // 源行在目标坐标中最多跨两行 按重叠长度分配权重
+    boundary=(long long)(s->dst_y+1)*s->src_h;
+    if(end<=boundary){
+        w1=(uint32_t)(((long long)s->dst_h<<16)/s->src_h);
+    }else{
+        w1=(uint32_t)(((boundary-start)<<16)/s->src_h);
+        w2=(uint32_t)(((end-boundary)<<16)/s->src_h);
+    }
+    for(i=0;i<n;i++){
+        s->acc[i]+=w1*s->row[i];
+    }
+    if(end>=boundary&&s->dst_y<s->dst_h){
+        scaler_emit(s);
+    }
+    if(w2&&s->dst_y<s->dst_h){
+        for(i=0;i<n;i++){
+            s->acc[i]+=w2*s->row[i];
+        }
+    }
+    s->src_y++;
+    if(s->src_y==s->src_h&&s->dst_y<s->dst_h){
+        scaler_emit(s);
+    }
+}
+
+// 取第一个 EXIF 段中的方向标记
+static int exif_orientation(j_decompress_ptr cinfo){
+    jpeg_saved_marker_ptr m;
+
+    for(m=cinfo->marker_list;m;m=m->next){
+        if(m->marker==JPEG_APP0+1&&m->data_length>=6&&memcmp(m->data,"Exif\0\0",6)==0){
+            return photo_exif_orientation(m->data,m->data_length);
+        }
+    }
+    return 1;
+}
+
+// 解码 JPEG 并缩放 先用 DCT 缩放减少解码量
+static int decode_jpeg(const char*path,int edge,struct thumb_scaler*s,int*orientation){
+    struct jpeg_decompress_struct cinfo;
+    struct thumb_jpeg_err err;
+    FILE*fp;
+    int dw;
+    int dh;
+    int longest;
+    unsigned int denom;
+    JSAMPROW row;
+
+    // 读文件头出错时 setjmp 分支也会走到 scaler_free
+    memset(s,0,sizeof(*s));
+    fp=fopen(path,"rb");
+    if(!fp){
+        return -3;
+    }
+    cinfo.err=jpeg_std_error(&err.pub);
+    err.pub.error_exit=thumb_jpeg_error_exit;
+    if(setjmp(err.jmp)){
+        jpeg_destroy_decompress(&cinfo);
+        fclose(fp);
+        scaler_free(s);
+        return -2;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo,fp);
+    jpeg_save_markers(&cinfo,JPEG_APP0+1,0xffff);
+    jpeg_read_header(&cinfo,TRUE);
+    if((long)cinfo.image_width*(long)cinfo.image_height>THUMB_MAX_PIXELS){
+        jpeg_destroy_decompress(&cinfo);
+        fclose(fp);
+        return -2;
+    }
+    *orientation=exif_orientation(&cinfo);
+    longest=(int)(cinfo.image_width>cinfo.image_height?cinfo.image_width:cinfo.image_height);
+    for(denom=8;denom>1&&longest/(int)denom<edge;denom/=2){
+    }
+    cinfo.scale_num=1;
+    cinfo.scale_denom=denom;
+    cinfo.out_color_space=JCS_RGB;
+    cinfo.dct_method=JDCT_IFAST;
+    jpeg_start_decompress(&cinfo);
+    thumb_fit((int)cinfo.output_width,(int)cinfo.output_height,edge,&dw,&dh);
+    if(scaler_init(s,(int)cinfo.output_width,(int)cinfo.output_height,dw,dh)!=0){
+        jpeg_destroy_decompress(&cinfo);
+        fclose(fp);
+        return -3;
+    }
+    row=s->src_row;
+    while(cinfo.output_scanline<cinfo.output_height){
+        jpeg_read_scanlines(&cinfo,&row,1);
+        scaler_push(s,s->src_row);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    fclose(fp);
+    return 0;
+}
+
+// 解码 PNG 并缩放 透明部分合成到白底
+static int decode_png(const char*path,int edge,struct thumb_scaler*s){
+    png_image img;
+    png_color bg={255,255,255};
+    uint8_t*buf;
+    int dw;
+    int dh;
+    unsigned int y;
+
+    memset(&img,0,sizeof(img));
+    img.version=PNG_IMAGE_VERSION;
+    if(!png_image_begin_read_from_file(&img,path)){
+        return -2;
+    }
+    if((long)img.width*(long)img.height>THUMB_MAX_PIXELS){
+        png_image_free(&img);
+        return -2;
+    }
+    img.format=PNG_FORMAT_RGB;
+    buf=malloc(PNG_IMAGE_SIZE(img));
+    if(!buf){
+        png_image_free(&img);
+        return -3;
+    }
+    if(!png_image_finish_read(&img,&bg,buf,0,NULL)){
+        free(buf);
+        return -2;
+    }
+    thumb_fit((int)img.width,(int)img.height,edge,&dw,&dh);
+    if(scaler_init(s,(int)img.width,(int)img.height,dw,dh)!=0){
+        free(buf);
+        return -3;
+    }
+    for(y=0;y<img.height;y++){
+        scaler_push(s,buf+(size_t)y*img.width*3);
+    }
+    free(buf);
+    return 0;
+}
+
+// 按 EXIF 方向变换像素 返回新缓冲 方向 5 至 8 交换宽高
+static uint8_t*apply_orientation(const uint8_t*src,int w,int h,int orientation,int*ow,int*oh){
+    int swap=orientation>=5;
+    int nw=swap?h:w;
+    int nh=swap?w:h;
+    uint8_t*dst;
+    int x;
+    int y;
+
+    dst=malloc((size_t)w*(size_t)h*3);
+    if(!dst){
+        return NULL;
+    }
+    for(y=0;y<h;y++){
+        for(x=0;x<w;x++){
+            int dx;
+            int dy;
+            switch(orientation){
+                case 2:dx=w-1-x;dy=y;break;
+                case 3:dx=w-1-x;dy=h-1-y;break;
+                case 4:dx=x;dy=h-1-y;break;
+                case 5:dx=y;dy=x;break;
+                case 6:dx=h-1-y;dy=x;break;
+                case 7:dx=h-1-y;dy=w-1-x;break;
+                case 8:dx=y;dy=w-1-x;break;
+                default:dx=x;dy=y;break;
+            }
+            memcpy(dst+((size_t)dy*(size_t)nw+(size_t)dx)*3,src+((size_t)y*(size_t)w+(size_t)x)*3,3);
+        }
+    }
+    *ow=nw;
+    *oh=nh;
+    return dst;
+}
+
+// 编码 JPEG 到临时文件后改名为缓存文件
+static int write_jpeg(const char*path,const uint8_t*rgb,int w,int h){
+    struct jpeg_compress_struct cinfo;
+    struct thumb_jpeg_err err;
+    char tmp[MAX_PATH];
+    FILE*fp;
+    JSAMPROW row;
+    int fd;
+
+    snprintf(tmp,sizeof(tmp),"%s/.tmp-XXXXXX",THUMB_DIR);
+    fd=mkstemp(tmp);
+    if(fd<0){
+        return -3;
+    }
+    fchmod(fd,0644);
+    fp=fdopen(fd,"wb");
+    if(!fp){
+        close(fd);
+        unlink(tmp);
+        return -3;
+    }
+    cinfo.err=jpeg_std_error(&err.pub);
+    err.pub.error_exit=thumb_jpeg_error_exit;
+    if(setjmp(err.jmp)){
+        jpeg_destroy_compress(&cinfo);
+        fclose(fp);
+        unlink(tmp);
+        return -3;
+    }
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo,fp);
+    cinfo.image_width=(JDIMENSION)w;
+    cinfo.image_height=(JDIMENSION)h;
+    cinfo.input_components=3;
+    cinfo.in_color_space=JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo,THUMB_QUALITY,TRUE);
+    cinfo.optimize_coding=TRUE;
+    jpeg_start_compress(&cinfo,TRUE);
+    while(cinfo.next_scanline<cinfo.image_height){
+        row=(JSAMPROW)(rgb+(size_t)cinfo.next_scanline*(size_t)w*3);
+        jpeg_write_scanlines(&cinfo,&row,1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    if(fclose(fp)!=0||rename(tmp,path)!=0){
+        unlink(tmp);
+        return -3;
+    }
+    return 0;
+}
+
+// 照片名的 FNV-1a 64 位哈希
+static uint64_t name_hash(const char*name){
+    uint64_t h=1469598103934665603ULL;
+
+    while(*name){
+        h^=(unsigned char)*name++;
+        h*=1099511628211ULL;
+    }
+    return h;
+}
+
+// 删除缓存目录中同一照片的缩略图 keep 非空时保留该文件 edge 为 0 时不限尺寸
+static void remove_cached(const char*name,int edge,const char*keep){
+    char prefix[24];
+    char suffix[24];
+    struct dirent*ent;
+    DIR*dir;
+    size_t plen;
+    size_t slen;
+
+    snprintf(prefix,sizeof(prefix),"%016llx-",(unsigned long long)name_hash(name));
+    snprintf(suffix,sizeof(suffix),"-%d.jpg",edge);
+    plen=strlen(prefix);
+    slen=strlen(suffix);
+    dir=opendir(THUMB_DIR);
+    if(!dir){
+        return;
+    }
+    while((ent=readdir(dir))!=NULL){
+        size_t len=strlen(ent->d_name);
+        if(strncmp(ent->d_name,prefix,plen)!=0){
+            continue;
+        }
+        if(edge&&(len<slen||strcmp(ent->d_name+len-slen,suffix)!=0)){
+            continue;
+        }
+        if(keep&&strcmp(ent->d_name,keep)==0){
+            continue;
+        }
+        unlinkat(dirfd(dir),ent->d_name,0);
+    }
+    closedir(dir);
+}
+
+// 解析 size 参数
+int thumb_parse_size(const char*name,enum thumb_size*out){
+    if(strcmp(name,"small")==0){
+        *out=THUMB_SIZE_SMALL;
+        return 0;
+    }
+    if(strcmp(name,"medium")==0){
+        *out=THUMB_SIZE_MEDIUM;
+        return 0;
+    }
+    return -1;
+}
+
+// 取缩略图路径 缓存不存在时生成
+// 返回 0 成功 -1 格式不支持（调用方应回退原图） -2 解码失败 -3 读写失败
+int thumb_get(const char*photo_path,const char*name,enum thumb_size size,char*out,size_t out_size){
+    struct thumb_scaler s;
+    struct stat st;
+    unsigned char magic[8];
+    uint8_t*rotated;
+    const char*base;
+    int edge=size==THUMB_SIZE_MEDIUM?THUMB_MEDIUM_EDGE:THUMB_SMALL_EDGE;
+    int orientation=1;
+    int is_png;
+    int w;
+    int h;
+    int rc;
+    int fd;
+
+    if(stat(photo_path,&st)!=0||!S_ISREG(st.st_mode)){
+        return -3;
+    }
+    if((size_t)snprintf(out,out_size,"%s/%016llx-%llx-%llx-%d.jpg",THUMB_DIR,
+                        (unsigned long long)name_hash(name),
+                        (unsigned long long)st.st_mtim.tv_sec*1000000000ULL+(unsigned long long)st.st_mtim.tv_nsec,
+                        (unsigned long long)st.st_size,edge)>=out_size){
+        return -3;
+    }
+    if(access(out,R_OK)==0){
+        return 0;
+    }
+
+    fd=open(photo_path,O_RDONLY|O_CLOEXEC);
+    if(fd<0){
+        return -3;
+    }
+    rc=(int)read(fd,magic,sizeof(magic));
+    close(fd);
+    if(rc>=3&&magic[0]==0xff&&magic[1]==0xd8&&magic[2]==0xff){
+        is_png=0;
+    }else if(rc==8&&memcmp(magic,"\x89PNG\r\n\x1a\n",8)==0){
+        is_png=1;
+    }else{
+        return -1;
+    }
+
+    if(mkdir(THUMB_DIR,0755)!=0&&errno!=EEXIST){
+        return -3;
+    }
+    // 清零后 scaler_free 只释放 scaler_init 实际分配的缓冲
+    memset(&s,0,sizeof(s));
+    rc=is_png?decode_png(photo_path,edge,&s):decode_jpeg(photo_path,edge,&s,&orientation);
+    if(rc!=0){
+        return rc;
+    }
+    w=s.dst_w;
+    h=s.dst_h;
+    if(orientation!=1){
+        rotated=apply_orientation(s.out,s.dst_w,s.dst_h,orientation,&w,&h);
+        if(!rotated){
+            scaler_free(&s);
+            return -3;
+        }
+        rc=write_jpeg(out,rotated,w,h);
+        free(rotated);
+    }else{
+        rc=write_jpeg(out,s.out,w,h);
+    }
+    scaler_free(&s);
+    if(rc!=0){
+        return rc;
+    }
+    base=strrchr(out,'/');
+    remove_cached(name,edge,base?base+1:out);
+    return 0;
+}
+
+// 删除照片的全部缩略图
+void thumb_remove_all(const char*name){
+    remove_cached(name,0,NULL);
+}
+
+// 上传完成后预先生成网格用的小图
+void thumb_on_upload(const char*path){
+    char out[MAX_PATH];
+    const char*name=strrchr(path,'/');
+
+    thumb_get(path,name?name+1:path,THUMB_SIZE_SMALL,out,sizeof(out));
+}
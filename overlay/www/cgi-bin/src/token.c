@@ -2,7 +2,7 @@
  * @file token.c
  * @brief 会话令牌管理实现
  *
- * 本文件实现令牌生成与校验及会话文件维护
+ * 本文件实现令牌生成与校验及会话维护
  * 供 CGI 认证流程校验请求合法性
  *
  * @author 杨翊
@@ -10,52 +10,102 @@
  * @version 1.0
  *
  * @note
- * - 会话采用文件形式存储并按时间过期清理
+ * - 令牌由 getrandom 随机数与到期时间组成 并附 HMAC-SHA256 签名
+ * - 签名密钥存于共享内存会话表头 清空会话时轮换
+ * - 签名与校验规则在 session_token 中实现 与 environment 守护进程共用
+ * - 会话存于共享内存会话表 校验成功即滑动续期
+ * - 过期会话由 environment 守护进程定期清扫
  **********************************************************************/
-#define _POSIX_C_SOURCE 199309L
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <time.h>
 #include <unistd.h>
-#include <sys/stat.h>
-#include <dirent.h>
-#include <limits.h>
+#include <sys/random.h>
 #include "token.h"
+#include "session_token.h"
+#include "session_store.h"
+
+#define TOKEN_POOL_SIZE 256
+
+// 随机数池 常驻进程内连续登录只需偶尔一次系统调用
+static unsigned char g_pool[TOKEN_POOL_SIZE];
+static size_t g_pool_pos=TOKEN_POOL_SIZE;
+static pid_t g_pool_pid=0;
+
+static const char hex_digits[]="0123456789abcdef";
+
+// 重新填满随机数池
+static int refill_pool(void){
+    size_t got=0;
+    ssize_t n;
+    int fd;
+
+    while(got<sizeof(g_pool)){
+        n=getrandom(g_pool+got,sizeof(g_pool)-got,0);
+        if(n<0){
+            if(errno==EINTR)continue;
+            break;
+        }
+        got+=(size_t)n;
+    }
+    if(got<sizeof(g_pool)){
+        // 内核不支持 getrandom 时退回 /dev/urandom
+        fd=open("/dev/urandom",O_RDONLY|O_CLOEXEC);
+        if(fd<0){
+            return -1;
+        }
+        while(got<sizeof(g_pool)){
+            n=read(fd,g_pool+got,sizeof(g_pool)-got);
+            if(n<=0)break;
+            got+=(size_t)n;
+        }
+        close(fd);
+        if(got<sizeof(g_pool)){
+            return -1;
+        }
+    }
+    g_pool_pos=0;
+    return 0;
+}
 
-#ifndef CLOCK_REALTIME
-#define USE_FALLBACK_TIME 1
-#else
-#define USE_FALLBACK_TIME 0
-#endif
+// 从随机数池取字节 取出部分随即清零
+static int pool_random(unsigned char*out,size_t len){
+    pid_t pid=getpid();
 
-// 确保会话目录存在
-static void ensure_session_dir(void){
-    mkdir(SESSION_DIR,0755);
-    chmod(SESSION_DIR,0777);
+    if(len>sizeof(g_pool)){
+        return -1;
+    }
+    // fork 出的子进程不能沿用父进程的池
+    if(pid!=g_pool_pid){
+        g_pool_pid=pid;
+        g_pool_pos=sizeof(g_pool);
+    }
+    if(g_pool_pos+len>sizeof(g_pool)&&refill_pool()!=0){
+        return -1;
+    }
+    memcpy(out,g_pool+g_pool_pos,len);
+    memset(g_pool+g_pool_pos,0,len);
+    g_pool_pos+=len;
+    return 0;
 }
 
-// 计算混合哈希
-static unsigned long mix_hash(unsigned long a,unsigned long b,unsigned long c){
-    unsigned long hash;
+// 字节转十六进制
+static void to_hex(const unsigned char*in,size_t len,char*out){
+    size_t i;
 
-    hash=5381;
-    hash=((hash<<5)+hash)^a;
-    hash=((hash<<5)+hash)^b;
-    hash=((hash<<5)+hash)^c;
-    return hash;
+    for(i=0;i<len;i++){
+        out[i*2]=hex_digits[in[i]>>4];
+        out[i*2+1]=hex_digits[in[i]&0x0F];
+    }
 }
 
-// 生成令牌字符串
+// 生成签名令牌 不分配内存
 void generate_token(char*token,size_t len){
-    static unsigned int counter=0;
-    unsigned long seed1;
-    unsigned long seed2;
-    unsigned long seed3;
-    unsigned long h1;
-    unsigned long h2;
+    unsigned char nonce[TOKEN_NONCE_HEX/2];
+    unsigned long expires;
 
     if(!token||len<(size_t)TOKEN_LEN+1){
         if(token){
@@ -63,149 +113,70 @@ void generate_token(char*token,size_t len){
         }
         return;
     }
-
-    counter++;
-    seed1=0;
-    seed2=0;
-    seed3=0;
-
-#if USE_FALLBACK_TIME
-    {
-        time_t t;
-        t=time(NULL);
-        seed1=(unsigned long)t;
-        seed2=(unsigned long)getpid();
-        seed3=(unsigned long)counter;
+    token[0]='\0';
+    if(pool_random(nonce,sizeof(nonce))!=0){
+        return;
     }
-#else
-    {
-        struct timespec ts;
-        if(clock_gettime(CLOCK_REALTIME,&ts)==0){
-            seed1=(unsigned long)ts.tv_sec;
-            seed2=(unsigned long)ts.tv_nsec;
-            seed3=((unsigned long)getpid()<<16)|(counter&0xFFFF);
-        }else{
-            time_t t;
-            t=time(NULL);
-            seed1=(unsigned long)t;
-            seed2=(unsigned long)getpid();
-            seed3=(unsigned long)counter;
-        }
+    to_hex(nonce,sizeof(nonce),token);
+    expires=(unsigned long)(time(NULL)+TOKEN_MAX_AGE)&0xFFFFFFFFUL;
+    snprintf(token+TOKEN_NONCE_HEX,TOKEN_EXPIRY_HEX+1,"%08lx",expires);
+    if(session_token_tag(token,token+TOKEN_SIGNED_HEX)!=0){
+        token[0]='\0';
+        return;
     }
-#endif
-
-    h1=mix_hash(seed1,seed2,seed3);
-    h2=mix_hash(seed2,seed3,seed1);
-
-    snprintf(token,(size_t)TOKEN_LEN+1,"%08lx%08lx%08lx%08lx",
-        h1&0xFFFFFFFFUL,
-        (h1>>32)&0xFFFFFFFFUL,
-        h2&0xFFFFFFFFUL,
-        (h2>>32)&0xFFFFFFFFUL);
     token[TOKEN_LEN]='\0';
 }
 
-// 保存令牌
-int add_token(const char*token){
-    char path[256];
-    FILE*f;
-
+// 保存令牌及其所属用户
+int add_token(const char*token,const char*user){
     if(!token||strlen(token)!=(size_t)TOKEN_LEN){
         return 0;
     }
-    ensure_session_dir();
-    snprintf(path,sizeof(path),"%s/%s",SESSION_DIR,token);
-    f=fopen(path,"w");
-    if(!f){
-        return 0;
-    }
-    fprintf(f,"%ld",(long)time(NULL));
-    fclose(f);
-    chmod(path,0644);
-    return 1;
+    return session_store_add(token,user,EXPIRE_SECONDS);
 }
 
-// 校验令牌
-int is_valid_token(const char*token){
-    char path[256];
-    FILE*f;
-    long saved_time;
-    time_t now;
-
-    if(!token||strlen(token)!=(size_t)TOKEN_LEN){
-        return 0;
-    }
-    snprintf(path,sizeof(path),"%s/%s",SESSION_DIR,token);
-    f=fopen(path,"r");
-    if(!f){
-        return 0;
-    }
-    if(fscanf(f,"%ld",&saved_time)!=1){
-        fclose(f);
-        unlink(path);
-        return 0;
-    }
-    fclose(f);
-    now=time(NULL);
-    if((long)(now-saved_time)>EXPIRE_SECONDS){
-        unlink(path);
+// 校验令牌 user 非空时带回所属用户名
+int is_valid_token(const char*token,char*user,size_t user_size){
+    // 伪造或过期的令牌在签名校验阶段即被拒绝 不必锁会话表
+    if(!session_token_verify(token)){
         return 0;
     }
-    return 1;
+    // 会话表负责空闲超时与注销
+    return session_store_touch(token,EXPIRE_SECONDS,user,user_size);
 }
 
-// 从 Cookie 获取令牌
-char*get_token_from_cookie(void){
-    char*cookie;
-    char*p;
-    char*end;
-    int len;
-    char*out;
-
-    cookie=getenv("HTTP_COOKIE");
-    if(!cookie){
-        return NULL;
+// 从 Cookie 字符串提取令牌 成功返回 0
+int get_token_from_cookie(const char*cookie,char*token,size_t size){
+    const char*p;
+    const char*end;
+    size_t len;
+
+    if(!cookie||!token||size<(size_t)TOKEN_LEN+1){
+        return -1;
+    }
+    p=cookie;
+    while((p=strstr(p,"token="))!=NULL){
+        // 只认独立的 token= 键 避免匹配 xtoken=
+        if(p==cookie||p[-1]==' '||p[-1]==';'){
+            break;
+        }
+        p+=6;
     }
-    p=strstr(cookie,"token=");
     if(!p){
-        return NULL;
+        return -1;
     }
     p+=6;
     end=strchr(p,';');
-    len=end?(int)(end-p):(int)strlen(p);
-    if(len!=TOKEN_LEN){
-        return NULL;
-    }
-    out=malloc((size_t)TOKEN_LEN+1);
-    if(!out){
-        return NULL;
+    len=end?(size_t)(end-p):strlen(p);
+    if(len!=(size_t)TOKEN_LEN){
+        return -1;
     }
-    strncpy(out,p,(size_t)len);
-    out[len]='\0';
-    return out;
+    memcpy(token,p,len);
+    token[len]='\0';
+    return 0;
 }
 
 // 清理所有令牌
 void clear_all_tokens(void){
-    DIR*dir;
-    struct dirent*entry;
-    char path[PATH_MAX];
-    int n;
-
-    dir=opendir(SESSION_DIR);
-    if(!dir){
-        return;
-    }
-    while((entry=readdir(dir))!=NULL){
-        if(strcmp(entry->d_name,".")==0||strcmp(entry->d_name,"..")==0){
-            continue;
-        }
-        n=snprintf(path,sizeof(path),"%s/%s",SESSION_DIR,entry->d_name);
-        if(n<0||(size_t)n>=sizeof(path)){
-            continue;
-        }
-        unlink(path);
-    }
-    closedir(dir);
-    rmdir(SESSION_DIR);
+    session_store_clear();
 }
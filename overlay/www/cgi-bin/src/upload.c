@@ -0,0 +1,486 @@
+/**********************************************************************
+ * @file upload.c
+ * @brief 网盘分块续传实现
+ *
+ * 本文件实现 初始化 → 按偏移写入分块 → 校验并完成 的上传流程
+ * 大文件可并行分块上传 断线后查询已收区间继续传输
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ *
+ * @note
+ * - 数据写入 DISK_ROOT/.uploads/<id>.part 稀疏文件 与目标同盘 完成时 rename
+ * - 已收区间记录在 <id>.meta 旁路文件 读改写时持 flock 排他锁
+ * - 分块落盘 fdatasync 后才记入区间 掉电后续传不会跳过未落盘数据
+ * - 返回值：0 成功 -1 参数错误 -2 会话不存在 -3 读写失败 -4 数据不完整 -5 校验和不符
+ **********************************************************************/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <json-c/json.h>
+#include "upload.h"
+#include "util.h"
+#include "error.h"
+
+#define UPLOAD_IO_SIZE 65536
+
+static unsigned char g_io_buf[UPLOAD_IO_SIZE];
+
+// 校验会话 ID 只允许十六进制
+static int valid_id(const char*id){
+    int i;
+
+    if(!id){
+        return 0;
+    }
+    for(i=0;i<UPLOAD_ID_LEN;i++){
+        if(!((id[i]>='0'&&id[i]<='9')||(id[i]>='a'&&id[i]<='f'))){
+            return 0;
+        }
+    }
+    return id[UPLOAD_ID_LEN]=='\0';
+}
+
+// 拼接会话文件路径
+static void upload_file_path(char*out,size_t size,const char*id,const char*ext){
+    snprintf(out,size,"%s/%s.%s",UPLOAD_DIR,id,ext);
+}
+
+// 解析旁路文件内容
+static int parse_meta(const char*text,upload_state_t*st){
+    const char*line=text;
+    char key[16];
+    char val[512];
+    long long a;
+    long long b;
+
+    st->range_count=0;
+    st->size=-1;
+    st->path[0]='\0';
+    st->name[0]='\0';
+    while(*line){
+        const char*eol=strchr(line,'\n');
+        size_t len=eol?(size_t)(eol-line):strlen(line);
+        if(len<sizeof(val)&&sscanf(line,"%15[^=]=%511[^\n]",key,val)==2){
+            if(strcmp(key,"path")==0){
+                snprintf(st->path,sizeof(st->path),"%s",val);
+            }else if(strcmp(key,"name")==0){
+                snprintf(st->name,sizeof(st->name),"%s",val);
+            }else if(strcmp(key,"size")==0){
+                st->size=atoll(val);
+            }else if(strcmp(key,"range")==0&&st->range_count<UPLOAD_MAX_RANGES&&
+                     sscanf(val,"%lld-%lld",&a,&b)==2&&a>=0&&b>a){
+                st->ranges[st->range_count][0]=a;
+                st->ranges[st->range_count][1]=b;
+                st->range_count++;
+            }
+        }
+        if(!eol)break;
+        line=eol+1;
+    }
+    return (st->size>=0&&st->path[0]&&st->name[0])?0:-1;
+}
+
+// 从已加锁的旁路文件读取会话
+static int read_meta_fd(int fd,upload_state_t*st){
+    static char text[UPLOAD_MAX_RANGES*48+2048];
+    ssize_t n;
+
+    n=pread(fd,text,sizeof(text)-1,0);
+    if(n<=0){
+        return -1;
+    }
+    text[n]='\0';
+    return parse_meta(text,st);
+}
+
+// 覆盖写入旁路文件
+static int write_meta_fd(int fd,const upload_state_t*st){
+    static char text[UPLOAD_MAX_RANGES*48+2048];
+    size_t len;
+    ssize_t n;
+    int i;
+
+    len=(size_t)snprintf(text,sizeof(text),"path=%s\nname=%s\nsize=%lld\n",st->path,st->name,st->size);
+    for(i=0;i<st->range_count&&len<sizeof(text);i++){
+        len+=(size_t)snprintf(text+len,sizeof(text)-len,"range=%lld-%lld\n",st->ranges[i][0],st->ranges[i][1]);
+    }
+    if(len>=sizeof(text)||ftruncate(fd,0)!=0){
+        return -1;
+    }
+    n=pwrite(fd,text,len,0);
+    return n==(ssize_t)len?0:-1;
+}
+
+// 记入新区间并与相邻区间合并 区间为左闭右开
+static int add_range(upload_state_t*st,long long start,long long end){
+    long long merged[UPLOAD_MAX_RANGES+1][2];
+    int n=0;
+    int inserted=0;
+    int i;
+
+    for(i=0;i<st->range_count;i++){
+        long long a=st->ranges[i][0];
+        long long b=st->ranges[i][1];
+        if(b<start){
+            merged[n][0]=a;merged[n][1]=b;n++;
+        }else if(a>end){
+            if(!inserted){
+                merged[n][0]=start;merged[n][1]=end;n++;
+                inserted=1;
+            }
+            merged[n][0]=a;merged[n][1]=b;n++;
+        }else{
+            if(a<start)start=a;
+            if(b>end)end=b;
+        }
+    }
+    if(!inserted){
+        merged[n][0]=start;merged[n][1]=end;n++;
+    }
+    if(n>UPLOAD_MAX_RANGES){
+        return -1;
+    }
+    memcpy(st->ranges,merged,sizeof(merged[0])*(size_t)n);
+    st->range_count=n;
+    return 0;
+}
+
+// 清理长期未更新的上传会话
+static void remove_stale_uploads(void){
+    DIR*dir;
+    struct dirent*de;
+    struct stat sb;
+    time_t now=time(NULL);
+
+    dir=opendir(UPLOAD_DIR);
+    if(!dir){
+        return;
+    }
+    while((de=readdir(dir))!=NULL){
+        if(de->d_name[0]=='.'){
+            continue;
+        }
+        if(fstatat(dirfd(dir),de->d_name,&sb,AT_SYMLINK_NOFOLLOW)==0&&
+           S_ISREG(sb.st_mode)&&now-sb.st_mtime>UPLOAD_STALE_SECONDS){
+            unlinkat(dirfd(dir),de->d_name,0);
+        }
+    }
+    closedir(dir);
+}
+
+// 已收字节数
+long long upload_received_bytes(const upload_state_t*st){
+    long long total=0;
+    int i;
+
+    for(i=0;i<st->range_count;i++){
+        total+=st->ranges[i][1]-st->ranges[i][0];
+    }
+    return total;
+}
+
+// 创建上传会话 预分配稀疏文件
+int upload_init(const char*path,const char*name,long long size,upload_state_t*st){
+    unsigned char rnd[UPLOAD_ID_LEN/2];
+    char meta_path[MAX_PATH];
+    char part_path[MAX_PATH];
+    char dir_path[MAX_PATH];
+    struct stat sb;
+    int meta_fd;
+    int part_fd;
+    int i;
+
+    if(!path||!name||size<0||!is_safe_relative_path(path)||path[0]!='/'||!is_safe_filename(name)){
+        return -1;
+    }
+    snprintf(dir_path,sizeof(dir_path),"%s%s",DISK_ROOT,path);
+    if(stat(dir_path,&sb)!=0||!S_ISDIR(sb.st_mode)){
+        return -1;
+    }
+    if(mkdir(UPLOAD_DIR,0755)!=0&&errno!=EEXIST){
+        return -3;
+    }
+    remove_stale_uploads();
+
+    if(getrandom(rnd,sizeof(rnd),0)!=(ssize_t)sizeof(rnd)){
+        return -3;
+    }
+    for(i=0;i<(int)sizeof(rnd);i++){
+        snprintf(st->id+i*2,3,"%02x",rnd[i]);
+    }
+    snprintf(st->path,sizeof(st->path),"%s",path);
+    snprintf(st->name,sizeof(st->name),"%s",name);
+    st->size=size;
+    st->range_count=0;
+
+    upload_file_path(part_path,sizeof(part_path),st->id,"part");
+    upload_file_path(meta_path,sizeof(meta_path),st->id,"meta");
+    part_fd=open(part_path,O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC,0644);
+    if(part_fd<0){
+        return -3;
+    }
+    // 只设长度不分配块 未写入的部分为空洞
+    if(ftruncate(part_fd,(off_t)size)!=0){
+        close(part_fd);
+        unlink(part_path);
+        return -3;
+    }
+    close(part_fd);
+    meta_fd=open(meta_path,O_RDWR|O_CREAT|O_EXCL|O_CLOEXEC,0644);
+    if(meta_fd<0||write_meta_fd(meta_fd,st)!=0){
+        if(meta_fd>=0)close(meta_fd);
+        unlink(meta_path);
+        unlink(part_path);
+        return -3;
+    }
+    close(meta_fd);
+    return 0;
+}
+
+// 读取上传会话状态
+int upload_load(const char*id,upload_state_t*st){
+    char meta_path[MAX_PATH];
+    int fd;
+    int rc;
+
+    if(!valid_id(id)){
+        return -1;
+    }
+    upload_file_path(meta_path,sizeof(meta_path),id,"meta");
+    fd=open(meta_path,O_RDONLY|O_CLOEXEC);
+    if(fd<0){
+        return -2;
+    }
+    flock(fd,LOCK_SH);
+    rc=read_meta_fd(fd,st);
+    flock(fd,LOCK_UN);
+    close(fd);
+    if(rc!=0){
+        return -3;
+    }
+    snprintf(st->id,sizeof(st->id),"%s",id);
+    return 0;
+}
+
+// 从 in_fd 读取 length 字节写入 offset 处并记录区间
+int upload_write_chunk(const char*id,long long offset,long length,int in_fd,upload_state_t*st){
+    char meta_path[MAX_PATH];
+    char part_path[MAX_PATH];
+    long long pos;
+    long left;
+    ssize_t n;
+    ssize_t w;
+    ssize_t done;
+    int part_fd;
+    int meta_fd;
+    int rc;
+
+    rc=upload_load(id,st);
+    if(rc!=0){
+        return rc;
+    }
+    // 偏移由客户端给出 用减法比较 避免 offset+length 溢出
+    if(offset<0||length<=0||length>UPLOAD_CHUNK_MAX||offset>st->size-length){
+        return -1;
+    }
+    upload_file_path(part_path,sizeof(part_path),id,"part");
+    part_fd=open(part_path,O_WRONLY|O_CLOEXEC);
+    if(part_fd<0){
+        return -2;
+    }
+
+    // 不同分块写入互不重叠的偏移 无需加锁
+    pos=offset;
+    left=length;
+    while(left>0){
+        n=read(in_fd,g_io_buf,left>UPLOAD_IO_SIZE?UPLOAD_IO_SIZE:(size_t)left);
+        if(n<0&&errno==EINTR)continue;
+        if(n<=0){
+            close(part_fd);
+            return -4;
+        }
+        left-=n;
+        done=0;
+        while(done<n){
+            w=pwrite(part_fd,g_io_buf+done,(size_t)(n-done),(off_t)pos);
+            if(w<0&&errno==EINTR)continue;
+            if(w<=0){
+                close(part_fd);
+                return -3;
+            }
+            pos+=w;
+            done+=w;
+        }
+    }
+    if(fdatasync(part_fd)!=0){
+        close(part_fd);
+        return -3;
+    }
+    close(part_fd);
+
+    upload_file_path(meta_path,sizeof(meta_path),id,"meta");
+    meta_fd=open(meta_path,O_RDWR|O_CLOEXEC);
+    if(meta_fd<0){
+        return -2;
+    }
+    flock(meta_fd,LOCK_EX);
+    rc=read_meta_fd(meta_fd,st);
+    if(rc==0){
+        rc=add_range(st,offset,offset+length);
+        if(rc==0){
+            rc=write_meta_fd(meta_fd,st)==0?0:-3;
+        }else{
+            rc=-1;
+        }
+    }else{
+        rc=-3;
+    }
+    flock(meta_fd,LOCK_UN);
+    close(meta_fd);
+    snprintf(st->id,sizeof(st->id),"%s",id);
+    return rc;
+}
+
+// 校验完整性与 SHA-256 后移动到目标目录
+int upload_finalize(const char*id,const char*sha256_hex,char out_hex[SHA256_DIGEST_SIZE*2+1]){
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    char meta_path[MAX_PATH];
+    char part_path[MAX_PATH];
+    char final_path[MAX_PATH*2];
+    upload_state_t st;
+    sha256_ctx_t sha;
+    off_t pos=0;
+    ssize_t n;
+    int meta_fd;
+    int part_fd;
+    int rc=0;
+    int i;
+
+    if(!valid_id(id)){
+        return -1;
+    }
+    upload_file_path(meta_path,sizeof(meta_path),id,"meta");
+    upload_file_path(part_path,sizeof(part_path),id,"part");
+    meta_fd=open(meta_path,O_RDWR|O_CLOEXEC);
+    if(meta_fd<0){
+        return -2;
+    }
+    // 持锁完成全部检查与移动 防止并发完成同一会话
+    flock(meta_fd,LOCK_EX);
+    if(read_meta_fd(meta_fd,&st)!=0){
+        rc=-3;
+        goto out;
+    }
+    if(st.size>0&&(st.range_count!=1||st.ranges[0][0]!=0||st.ranges[0][1]!=st.size)){
+        rc=-4;
+        goto out;
+    }
+
+    part_fd=open(part_path,O_RDONLY|O_CLOEXEC);
+    if(part_fd<0){
+        rc=-2;
+        goto out;
+    }
+    sha256_init(&sha);
+    while((n=pread(part_fd,g_io_buf,sizeof(g_io_buf),pos))>0){
+        sha256_update(&sha,g_io_buf,(size_t)n);
+        pos+=n;
+    }
+    close(part_fd);
+    if(n<0||pos!=(off_t)st.size){
+        rc=-3;
+        goto out;
+    }
+    sha256_final(&sha,digest);
+    for(i=0;i<SHA256_DIGEST_SIZE;i++){
+        snprintf(out_hex+i*2,3,"%02x",digest[i]);
+    }
+    if(sha256_hex&&sha256_hex[0]&&strcasecmp(sha256_hex,out_hex)!=0){
+        rc=-5;
+        goto out;
+    }
+
+    if(strcmp(st.path,"/")==0){
+        snprintf(final_path,sizeof(final_path),"%s/%s",DISK_ROOT,st.name);
+    }else{
+        snprintf(final_path,sizeof(final_path),"%s%s/%s",DISK_ROOT,st.path,st.name);
+    }
+    if(rename(part_path,final_path)!=0){
+        rc=-3;
+        goto out;
+    }
+    unlink(meta_path);
+
+out:
+    flock(meta_fd,LOCK_UN);
+    close(meta_fd);
+    return rc;
+}
+
+// 放弃上传会话
+int upload_abort(const char*id){
+    char meta_path[MAX_PATH];
+    char part_path[MAX_PATH];
+    int fd;
+
+    if(!valid_id(id)){
+        return -1;
+    }
+    upload_file_path(meta_path,sizeof(meta_path),id,"meta");
+    upload_file_path(part_path,sizeof(part_path),id,"part");
+    fd=open(meta_path,O_RDWR|O_CLOEXEC);
+    if(fd<0){
+        return -2;
+    }
+    flock(fd,LOCK_EX);
+    unlink(part_path);
+    unlink(meta_path);
+    flock(fd,LOCK_UN);
+    close(fd);
+    return 0;
+}
+
+// 会话状态转 JSON
+json_object*upload_state_to_json(const upload_state_t*st){
+    json_object*root=json_object_new_object();
+    json_object*ranges=json_object_new_array();
+    int i;
+
+    for(i=0;i<st->range_count;i++){
+        json_object*r=json_object_new_array();
+        json_object_array_add(r,json_object_new_int64(st->ranges[i][0]));
+        json_object_array_add(r,json_object_new_int64(st->ranges[i][1]));
+        json_object_array_add(ranges,r);
+    }
+    json_object_object_add(root,"id",json_object_new_string(st->id));
+    json_object_object_add(root,"path",json_object_new_string(st->path));
+    json_object_object_add(root,"name",json_object_new_string(st->name));
+    json_object_object_add(root,"size",json_object_new_int64(st->size));
+    json_object_object_add(root,"received",json_object_new_int64(upload_received_bytes(st)));
+    json_object_object_add(root,"chunk_size",json_object_new_int64(UPLOAD_CHUNK_SIZE));
+    json_object_object_add(root,"ranges",ranges);
+    return root;
+}
+
+// 按返回码输出错误响应
+void send_upload_error(int rc){
+    switch(rc){
+        case -1:send_error_400("Invalid upload request");break;
+        case -2:send_error_404("Upload not found");break;
+        case -4:_send_json_error(409,"Conflict","Upload incomplete");break;
+        case -5:_send_json_error(422,"Unprocessable Entity","Checksum mismatch");break;
+        default:send_error_500("Upload I/O failed");break;
+    }
+}
@@ -2,7 +2,7 @@
  * @file util.c
  * @brief CGI 通用工具函数实现
  *
- * 本文件实现 multipart 解析与路径校验等通用工具
+ * 本文件实现文件名解析与路径校验等通用工具
  * 供多个 CGI 处理函数复用以减少重复代码
  *
  * @author 杨翊
@@ -65,108 +65,6 @@ static void url_decode_to(const char*src,char*dst,size_t dst_size){
     *o='\0';
 }
 
-// 解析 multipart 并保存文件到目标目录
-int parse_multipart_and_save(const char*body,long content_length,const char*boundary,const char*target_dir){
-    char full_boundary[300];
-    const char*current;
-    const char*headers_end;
-    int is_file_part;
-    const char*line_start;
-    const char*line_end;
-    size_t len;
-    char filename[MAX_FILENAME];
-    char header_line[1024];
-    const char*data_start;
-    const char*next_boundary;
-    size_t data_len;
-    char final_path[MAX_PATH];
-    struct stat st;
-    FILE*fp;
-
-    if(!body||!boundary||!target_dir){
-        return -1;
-    }
-
-    filename[0]='\0';
-    snprintf(full_boundary,sizeof(full_boundary),"--%s",boundary);
-
-    current=body;
-    while((current=strstr(current,full_boundary))!=NULL){
-        current+=strlen(full_boundary);
-        if(strncmp(current,"--",2)==0){
-            break;
-        }
-        headers_end=strstr(current,"\r\n\r\n");
-        if(!headers_end){
-            current+=1;
-            continue;
-        }
-
-        is_file_part=0;
-        line_start=current;
-        filename[0]='\0';
-        while(line_start<headers_end){
-            line_end=strstr(line_start,"\r\n");
-            if(!line_end||line_end>headers_end){
-                break;
-            }
-            len=(size_t)(line_end-line_start);
-            if(len>=sizeof(header_line)){
-                len=sizeof(header_line)-1;
-            }
-            strncpy(header_line,line_start,len);
-            header_line[len]='\0';
-
-            if(strncasecmp(header_line,"Content-Disposition:",20)==0){
-                if(strstr(header_line,"filename=")!=NULL){
-                    if(extract_filename_from_header(header_line,filename,sizeof(filename))){
-                        if(!is_safe_filename(filename)){
-                            return -2;
-                        }
-                        is_file_part=1;
-                    }
-                    break;
-                }
-            }
-            line_start=line_end+2;
-        }
-
-        if(!is_file_part){
-            current=headers_end+4;
-            continue;
-        }
-
-        data_start=headers_end+4;
-        next_boundary=strstr(data_start,full_boundary);
-        if(!next_boundary){
-            next_boundary=body+content_length;
-        }
-        data_len=(size_t)(next_boundary-data_start);
-        if(data_len==0){
-            return -1;
-        }
-
-        if(stat(target_dir,&st)!=0||!S_ISDIR(st.st_mode)){
-            return -3;
-        }
-
-        snprintf(final_path,sizeof(final_path),"%s/%s",target_dir,filename);
-        fp=fopen(final_path,"wb");
-        if(!fp){
-            return -3;
-        }
-        if(fwrite(data_start,1,data_len,fp)!=data_len){
-            fclose(fp);
-            unlink(final_path);
-            return -3;
-        }
-        fclose(fp);
-        return 0;
-    }
-
-    return -1;
-}
-
 // 确保目录可写
 int make_parent_writable(const char*dirpath){
     struct stat st;
@@ -0,0 +1,157 @@
+/**********************************************************************
+ * @file xxhash.c
+ * @brief XXH64 非加密哈希实现
+ *
+ * 本文件实现 XXH64 的流式计算 用于上传照片时边接收边计算内容哈希
+ * 输出与官方 xxHash 的 XXH64 一致
+ *
+ * @author 杨翊
+ * @date 2026-10-17
+ * @version 1.0
+ *
+ * @note
+ * - 主循环为四路独立累加 每次处理 32 字节 无跨路依赖 便于流水执行
+ * - 哈希只用于查找候选 判定重复前仍逐字节比较文件内容
+ **********************************************************************/
+#include <string.h>
+#include "xxhash.h"
+
+#define P1 11400714785074694791ULL
+#define P2 14029467366897019727ULL
+#define P3 1609587929392839161ULL
+#define P4 9650029242287828579ULL
+#define P5 2870177450012600261ULL
+
+// 循环左移
+static inline uint64_t rotl64(uint64_t x,int r){
+    return (x<<r)|(x>>(64-r));
+}
+
+// 小端读取
+static inline uint64_t read64(const unsigned char*p){
+    uint64_t v;
+
+    memcpy(&v,p,8);
+#if __BYTE_ORDER__==__ORDER_BIG_ENDIAN__
+    v=__builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char*p){
+    uint32_t v;
+
+    memcpy(&v,p,4);
+#if __BYTE_ORDER__==__ORDER_BIG_ENDIAN__
+    v=__builtin_bswap32(v);
+#endif
+    return v;
+}
+
+// 单路累加
+static inline uint64_t xxh_round(uint64_t acc,uint64_t input){
+    acc+=input*P2;
+    acc=rotl64(acc,31);
+    return acc*P1;
+}
+
+// 合并一路累加值
+static inline uint64_t xxh_merge(uint64_t acc,uint64_t val){
+    acc^=xxh_round(0,val);
+    return acc*P1+P4;
+}
+
+// 处理若干个 32 字节块 返回处理到的位置
+static const unsigned char*xxh_stripes(uint64_t v[4],const unsigned char*p,const unsigned char*limit){
+    uint64_t v1=v[0];
+    uint64_t v2=v[1];
+    uint64_t v3=v[2];
+    uint64_t v4=v[3];
+
+    while(p+32<=limit){
+        v1=xxh_round(v1,read64(p));
+        v2=xxh_round(v2,read64(p+8));
+        v3=xxh_round(v3,read64(p+16));
+        v4=xxh_round(v4,read64(p+24));
+        p+=32;
+    }
+    v[0]=v1;
+    v[1]=v2;
+    v[2]=v3;
+    v[3]=v4;
+    return p;
+}
+
+// 初始化
+void xxh64_init(xxh64_state_t*s,uint64_t seed){
+    memset(s,0,sizeof(*s));
+    s->v[0]=seed+P1+P2;
+    s->v[1]=seed+P2;
+    s->v[2]=seed;
+    s->v[3]=seed-P1;
+}
+
+// 追加数据
+void xxh64_update(xxh64_state_t*s,const void*data,size_t len){
+    const unsigned char*p=data;
+    const unsigned char*end=p+len;
+
+    s->total_len+=len;
+    if(s->memsize+len<32){
+        memcpy(s->mem+s->memsize,p,len);
+        s->memsize+=len;
+        return;
+    }
+    if(s->memsize){
+        size_t fill=32-s->memsize;
+        memcpy(s->mem+s->memsize,p,fill);
+        xxh_stripes(s->v,s->mem,s->mem+32);
+        p+=fill;
+        s->memsize=0;
+    }
+    p=xxh_stripes(s->v,p,end);
+    if(p<end){
+        memcpy(s->mem,p,(size_t)(end-p));
+        s->memsize=(size_t)(end-p);
+    }
+}
+
+// 取最终哈希值 不改变状态
+uint64_t xxh64_digest(const xxh64_state_t*s){
+    const unsigned char*p=s->mem;
+    const unsigned char*end=p+s->memsize;
+    uint64_t h;
+
+    if(s->total_len>=32){
+        h=rotl64(s->v[0],1)+rotl64(s->v[1],7)+rotl64(s->v[2],12)+rotl64(s->v[3],18);
+        h=xxh_merge(h,s->v[0]);
+        h=xxh_merge(h,s->v[1]);
+        h=xxh_merge(h,s->v[2]);
+        h=xxh_merge(h,s->v[3]);
+    }else{
+        // 不足一个块时 v[2] 仍为种子
+        h=s->v[2]+P5;
+    }
+    h+=s->total_len;
+    while(p+8<=end){
+        h^=xxh_round(0,read64(p));
+        h=rotl64(h,27)*P1+P4;
+        p+=8;
+    }
+    if(p+4<=end){
+        h^=(uint64_t)read32(p)*P1;
+        h=rotl64(h,23)*P2+P3;
+        p+=4;
+    }
+    while(p<end){
+        h^=(uint64_t)(*p)*P5;
+        h=rotl64(h,11)*P1;
+        p++;
+    }
+    h^=h>>33;
+    h*=P2;
+    h^=h>>29;
+    h*=P3;
+    h^=h>>32;
+    return h;
+}
@@ -21,4 +21,10 @@ if [ -f "$SDK_UBUNTU_DIR/mk-rootfs.sh" ]; then
     echo "已更新 mk-rootfs.sh"
 fi
 
+#同步 build-assets.sh
+if [ -f "$SDK_UBUNTU_DIR/build-assets.sh" ]; then
+    cp "$SDK_UBUNTU_DIR/build-assets.sh" "$MYGIT_DIR/"
+    echo "已更新 build-assets.sh"
+fi
+
 echo "同步完成！现在可以 git add / commit / push"